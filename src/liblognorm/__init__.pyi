@@ -1,4 +1,4 @@
-from typing import Any, Dict, Optional
+from typing import Any, Dict, Iterable, List, Literal, Optional, Tuple, Union
 
 # --- Module-Level Functions ---
 
@@ -35,6 +35,14 @@ class ParserError(Error):
     ...
 
 
+class PrefilterError(ParserError):
+    """
+    Raised when the prefilter installed with Lognorm.prefilter() rejects
+    a message before parsing, because it contains none of the literals.
+    """
+    ...
+
+
 class RuleError(Error):
     """
     Raised when a rule is malformed or exceeds internal size limits.
@@ -56,7 +64,22 @@ class Lognorm:
         add_exec_path: bool = False,
         add_original_message: bool = False,
         add_rule: bool = False,
-        add_rule_location: bool = False
+        add_rule_location: bool = False,
+        syslog_header: bool = False,
+        input_format: Literal["plain", "docker", "cri"] = "plain",
+        unescape_control: bool = False,
+        strip_ansi: bool = False,
+        strip_pri: bool = False,
+        lstrip: bool = False,
+        errors: Literal["strict", "replace", "surrogateescape", "latin1"] = "strict",
+        intern: Union[None, Literal["auto"], Iterable[str]] = None,
+        intern_limit: int = 1024,
+        filter: Union[None, str, "Filter"] = None,
+        mapping: Optional[Dict[str, Optional[str]]] = None,
+        constants: Optional[Dict[str, Any]] = None,
+        max_length: int = 0,
+        oversize: Literal["truncate", "reject"] = "truncate",
+        batch_budget: float = 0.0
     ) -> None:
         """
         Initializes a new liblognorm context, optionally configuring its behavior.
@@ -69,12 +92,221 @@ class Lognorm:
             add_original_message: Always add the original message to the output.
             add_rule: Add the rule that matched to the output.
             add_rule_location: Add rule location (file, lineno) to metadata.
+            syslog_header: Split the RFC 3164 / RFC 5424 header (including
+                           octet-counted framing) off natively, normalize
+                           only the MSG part, and merge the header fields
+                           `pri`, `facility`, `severity`, `version`,
+                           `timestamp`, `hostname`, `app_name`, `procid`,
+                           `msgid` and `structured_data` into the result.
+                           Fields extracted by the rulebase take precedence.
+            input_format: Container log framing to unwrap natively before
+                          parsing: "docker" (json-file records) or "cri"
+                          (containerd / CRI-O lines). The inner payload is
+                          normalized and `time`, `stream` and, for split
+                          lines, `partial` are added to the result. Lines
+                          in another format are normalized unchanged.
+            unescape_control: Decode rsyslog's "#ooo" control-character
+                              escapes ("#011" becomes TAB). Only codes
+                              below 0x20 and DEL (#177) are decoded.
+            strip_ansi: Remove ANSI color and cursor escape sequences.
+            strip_pri: Remove a leading "<PRI>".
+            lstrip: Remove leading whitespace.
+            errors: What to do with bytes input (including lines read by a
+                    Follower) that is not valid UTF-8: "strict" raises
+                    UnicodeDecodeError, "replace" substitutes U+FFFD for
+                    each offending byte, "surrogateescape" parses the raw
+                    bytes and decodes field values with surrogateescape,
+                    and "latin1" transcodes the whole message from
+                    Latin-1. Valid input is never copied.
+            intern: Share one str object between repeated values of
+                    low-cardinality fields (host, program, action, ...).
+                    Either the field names to intern, or "auto" to intern
+                    short values of any field until it exceeds
+                    `intern_limit` distinct values.
+            intern_limit: Maximum number of distinct values cached per
+                          field. Named fields stop caching new values once
+                          full; "auto" stops interning that field.
+            filter: A Filter, or expression text to compile into one.
+                    Events it rejects are discarded before they are
+                    converted: normalize() and normalize_record() return
+                    None, normalize_into() returns False, and Multiline
+                    and Follower report None like an unmatched line.
+            mapping: Renames applied while events are converted, as
+                     {field: target}. A dotted target ("source.ip") moves
+                     the value into nested dicts; a target of None drops
+                     the field. Only top-level fields are mapped, and
+                     normalize_record() ignores the mapping.
+            constants: Values added to every event, as {target: value},
+                       with dotted targets nesting like in `mapping`.
+                       The same objects are shared by all events.
+            max_length: Longest message, in bytes, handed to liblognorm
+                        (0: no limit). With `input_format`, the limit
+                        applies to the unwrapped payload. The check runs
+                        before preprocessing and parsing.
+            oversize: What to do with longer messages: "truncate" parses
+                      their first `max_length` bytes (cut at a character
+                      boundary), "reject" raises ParserError without
+                      parsing; Follower, Multiline and Aggregator treat
+                      rejected lines as unmatched.
+            batch_budget: Seconds a batch call may spend normalizing
+                          before it stops early (0: no limit). Checked
+                          between lines, so a single slow line still runs
+                          to the end. Follower.read() returns a shorter
+                          batch and leaves the remaining lines for the
+                          next read; Aggregator.feed_many() and
+                          Rollup.feed_many() keep the rest of their input
+                          as a backlog that the next feed_many() or
+                          flush() continues.
 
         Raises:
             MemoryError: On failure to initialize the context.
+            ValueError: If `input_format`, `errors`, `oversize` or a str
+                        `intern` is not a known value, `intern_limit` is
+                        not positive, `max_length` or `batch_budget` is
+                        negative, `filter` is not a valid expression, or a
+                        mapping target is empty.
+            TypeError: If `mapping` or `constants` is not a dict of str,
+                       or `intern` holds a name that is not a str.
+        """
+        ...
+
+    def enrich(
+        self,
+        table: Union["CidrTable", "KVTable"],
+        fields: Union[str, Iterable[str]],
+        prefix: Optional[str] = None
+    ) -> None:
+        """
+        Annotates fields with the attributes of a lookup table.
+
+        For every listed top-level field, the non-empty attributes found
+        for its value are added to the event as "<prefix><column>". A
+        CidrTable matches the most specific prefix holding an IP address;
+        a KVTable matches the value's text exactly (numbers are looked up
+        by their decimal text). Calls accumulate, so several tables can be
+        attached. A table that is re-initialized later is skipped while it
+        is not loaded or its columns differ from those seen here.
+
+        Args:
+            table: The table to look values up in. It is read-only and
+                   can be shared between contexts and threads.
+            fields: The field name(s) to look up, as produced by the
+                    rulebase (before any `mapping`).
+            prefix: Prefix of the added keys. Defaults to "<field>_", so
+                    a "zone" column on field "src" becomes "src_zone".
+        """
+        ...
+
+    def prefilter(
+        self,
+        literals: Optional[Iterable[str]] = None,
+        *,
+        min_length: int = 3
+    ) -> Tuple[str, ...]:
+        """
+        Rejects lines that contain none of a set of literals before they
+        reach liblognorm, using an Aho-Corasick automaton.
+
+        normalize(), normalize_into() and normalize_record() raise
+        PrefilterError, a subclass of ParserError, for rejected lines, so
+        they can be routed apart from lines that match no rule; the batch
+        APIs treat them as unmatched and counters() counts them as
+        "prefiltered". The check runs on the text the rules see, i.e.
+        after container unwrapping, preprocessing and syslog header
+        removal.
+
+        Args:
+            literals: The literals to look for. By default, one literal is
+                      derived for every loaded rule: the longest constant
+                      text of the rule or of its prefix= line. A derived
+                      prefilter is rebuilt when more rules are loaded, and
+                      it is removed if a new rule has no usable literal.
+            min_length: The shortest literal a derived rule may contribute.
+
+        Returns:
+            The literals in use.
+
+        Raises:
+            ValueError: If a rule has no literal of `min_length` bytes, or
+                        there are no literals at all.
+        """
+        ...
+
+    def clear_prefilter(self) -> None:
+        """Removes the prefilter."""
+        ...
+
+    def redact(
+        self,
+        fields: Union[str, Iterable[str]],
+        action: Literal["hash", "truncate", "mask"],
+        *,
+        key: Optional[bytes] = None,
+        v4_prefix: int = 24,
+        v6_prefix: int = 48,
+        keep_start: int = 0,
+        keep_end: int = 0,
+        keep_after: Optional[str] = None,
+        mask: str = "*"
+    ) -> None:
+        """
+        Rewrites fields holding personal data right after parsing, before
+        filters, sketches, aggregators or conversion see them.
+
+        Rules apply to scalar values, in the order they were added. Numbers
+        are rewritten from their decimal text and become strings.
+
+        Args:
+            fields: The field name(s) as produced by the rulebase; dotted
+                    names address nested fields.
+            action: "hash" replaces the value by its keyed SipHash-2-4 as
+                    16 hex digits, so equal values stay joinable without
+                    being readable. "truncate" zeroes the host part of an
+                    IP address; other values become None. "mask" replaces
+                    characters by `mask`.
+            key: The 16-byte secret key, required for "hash".
+            v4_prefix: Bits kept of IPv4 (and IPv4-mapped) addresses.
+            v6_prefix: Bits kept of IPv6 addresses.
+            keep_start: Characters left readable at the start ("mask").
+            keep_end: Characters left readable at the end ("mask"). If
+                      `keep_start` and `keep_end` would leave nothing
+                      masked, the whole value is masked.
+            keep_after: Leave the text from the last occurrence of this
+                        literal on readable, e.g. "@" for e-mail domains.
+            mask: The ASCII character that replaces masked characters.
+
+        Raises:
+            ValueError: If an option is invalid for `action`.
+        """
+        ...
+
+    def attach(self, sketch: Union["TopK", "HyperLogLog"], field: str) -> None:
+        """
+        Feeds the value of `field` from every accepted event to `sketch`.
+
+        The sketch is updated in C while lines are normalized by any API
+        of this context (including Aggregator, Multiline and Follower),
+        after the filter and before conversion. Events without the field,
+        or where it is an object or array, are skipped. Numbers are fed as
+        their decimal text. A sketch can be attached to several fields and
+        contexts.
+
+        Args:
+            sketch: The sketch to update.
+            field: The field name as produced by the rulebase; dotted
+                   names address nested fields.
+
+        Raises:
+            TypeError: If `sketch` is not a TopK or HyperLogLog.
+            ValueError: If `sketch` was never successfully initialized, or
+                        `field` is empty.
         """
         ...
 
+    def detach(self, sketch: Union["TopK", "HyperLogLog"]) -> bool:
+        """Stops feeding `sketch`; returns False if it was not attached."""
+        ...
+
     def load(self, path: str) -> None:
         """
         Loads normalization rules from a file or a directory of files.
@@ -108,7 +340,202 @@ class Lognorm:
         """
         ...
 
-    def normalize(self, log: str, strip: bool = True) -> Optional[Dict[str, Any]]:
+    def rules(self) -> List[Dict[str, Any]]:
+        """
+        Describes every rule loaded so far, in rulebase order.
+
+        Returns:
+            One dict per rule with the keys "origin" (file path or
+            "<string>"), "line", "tags" (tuple of str), "prefix" (the
+            prefix= text in effect, or ""), "sample" (the rule text after
+            the tags) and "fields", a tuple of (name, type) pairs for the
+            top-level fields of prefix and rule, where type is the
+            liblognorm parser name such as "word" or "ipv4".
+        """
+        ...
+
+    def fields(self) -> Dict[str, Tuple[str, ...]]:
+        """
+        Maps every top-level field the loaded rules can produce to the
+        parser types it is extracted with, in order of first appearance.
+        A name with more than one type is parsed differently by different
+        rules.
+        """
+        ...
+
+    def dag_estimate(self) -> Dict[str, int]:
+        """
+        Estimates the size of the parse DAG liblognorm builds from the
+        loaded rules.
+
+        Rules are merged on common prefixes of literal characters and
+        field descriptions, as liblognorm does; the byte figure assumes
+        a fixed cost per node plus the rule text and is only a rough
+        guide for comparing rulebases.
+
+        Returns:
+            A dict with the keys "rules", "nodes" and "bytes".
+        """
+        ...
+
+    def profile(self, enabled: bool = True) -> None:
+        """
+        Turns per-rule profiling on or off.
+
+        While on, the time every ln_normalize() call takes is charged to
+        the rule that matched, taken from the rule location metadata.
+        Lines that match no rule are charged to an unattributed entry.
+        Data collected so far is kept when profiling is turned off.
+
+        Raises:
+            ValueError: If the context was not created with
+                        add_rule_location=True.
+        """
+        ...
+
+    def profile_report(
+        self,
+        n: Optional[int] = None,
+        *,
+        reset: bool = False
+    ) -> List[Dict[str, Any]]:
+        """
+        Returns the profile collected so far, most expensive rule first.
+
+        Args:
+            n: Return at most this many entries (default: all).
+            reset: Clear the collected data afterwards.
+
+        Returns:
+            One dict per rule with the keys "origin" and "line" (the rule
+            location, both None for lines no rule matched), "count",
+            "seconds" (total), "mean" and "max".
+        """
+        ...
+
+    def profile_rulebase(
+        self,
+        corpus: Iterable[Union[str, bytes]],
+        *,
+        repeat: int = 1
+    ) -> List[Dict[str, Any]]:
+        """
+        Profiles the loaded rules against a corpus of sample lines.
+
+        Clears the collected profile, normalizes every line `repeat`
+        times and returns profile_report(). Lines that fail to decode
+        under the encoding policy are skipped; filters, mapping and
+        sketches are not applied.
+
+        Raises:
+            ValueError: If the context was not created with
+                        add_rule_location=True.
+        """
+        ...
+
+    def slowlog(
+        self,
+        threshold: Optional[float],
+        *,
+        capacity: int = 128,
+        max_bytes: int = 4096
+    ) -> None:
+        """
+        Keeps the lines that take longer than `threshold` seconds to
+        normalize and convert, for later inspection with drain_slowlog().
+
+        The check covers every normalize API and the Follower and
+        Aggregator classes. Lines that match no rule are checked as well.
+
+        Args:
+            threshold: Seconds of parse plus conversion time; None turns
+                       the slow-line log off and discards its entries.
+            capacity: Number of lines kept; the oldest is overwritten when
+                      the log is full.
+            max_bytes: Bytes of each line that are copied.
+
+        Raises:
+            ValueError: If an argument is out of range.
+        """
+        ...
+
+    def drain_slowlog(self) -> Tuple[List[Dict[str, Any]], int]:
+        """
+        Removes and returns the lines kept by the slow-line log, oldest
+        first.
+
+        Returns:
+            A tuple of the entries and the number of entries overwritten
+            since the last drain. Each entry is a dict with the keys
+            "line" (up to max_bytes of the input), "length" (of the whole
+            line), "rule" (the matched rule as "file:line" with
+            add_rule_location, else its mockup with add_rule, else None),
+            "time" (wall clock time of the call), "parse", "convert" and
+            "total" (seconds).
+        """
+        ...
+
+    def trace(
+        self,
+        every: int = 0,
+        *,
+        slow: Optional[float] = None,
+        capacity: int = 16,
+        max_bytes: int = 65536
+    ) -> None:
+        """
+        Captures liblognorm's debug output for selected lines, showing how
+        they were matched against (and backtracked through) the parse DAG.
+
+        Debug output is only enabled for the lines being traced, so the
+        other lines are parsed at full speed. Calling trace() with neither
+        `every` nor `slow` turns tracing off.
+
+        Args:
+            every: Trace one line in `every` (0: no sampling).
+            slow: Parse lines that took longer than this many seconds
+                  a second time, with debug output on.
+            capacity: Number of traces kept; the oldest are dropped.
+            max_bytes: Debug output kept per trace; the rest is cut off.
+
+        Raises:
+            ValueError: If an argument is out of range.
+        """
+        ...
+
+    def drain_traces(self) -> List[Dict[str, Any]]:
+        """
+        Removes and returns the captured traces, oldest first.
+
+        Returns:
+            One dict per traced line with the keys "line" (the text given
+            to liblognorm, after preprocessing and header removal),
+            "reason" ("sampled" or "slow"), "result" (the ln_normalize()
+            result code), "seconds" (the untraced parse time for slow
+            lines, the traced one for sampled lines), "trace" (a tuple of
+            debug messages) and "truncated".
+        """
+        ...
+
+    def counters(self, *, reset: bool = False) -> Dict[str, int]:
+        """
+        Returns the number of messages truncated ("truncated") or rejected
+        ("rejected") by `max_length`, rejected by the prefilter
+        ("prefiltered"), and batch calls cut short by `batch_budget`
+        ("over_budget").
+
+        Args:
+            reset: Set the counters back to zero afterwards.
+        """
+        ...
+
+    def normalize(
+        self,
+        log: Union[str, bytes],
+        strip: bool = True,
+        values: Literal["str", "bytes"] = "str",
+        filter: Union[None, str, "Filter"] = None
+    ) -> Optional[Dict[str, Any]]:
         """
         Normalizes a log message string against the loaded rulebase.
 
@@ -117,18 +544,801 @@ class Lognorm:
         not match any rule, it returns None.
 
         Args:
-            log: The unstructured log message string to normalize.
+            log: The unstructured log message to normalize. Bytes-like
+                 input is handled according to the context's `errors`
+                 policy.
             strip: If True (default), trailing whitespace and newlines are
                    removed from the log string before processing.
+            values: "bytes" returns string field values as the raw UTF-8
+                    bytes produced by liblognorm, skipping the decode into
+                    str. Keys are always str.
+            filter: A Filter (or expression text, compiled on every call)
+                    to apply instead of the context's filter.
 
         Returns:
             A dictionary containing the normalized event fields, or None if
-            the message did not match any rule.
+            the message was empty or the event was rejected by the filter.
 
         Raises:
             ParserError: If the message is invalid or causes a parser error.
             RuleError: If a rule-related limit is exceeded.
             MemoryError: If memory allocation fails during normalization.
+            UnicodeDecodeError: If bytes input is not valid UTF-8 and the
+                                `errors` policy is "strict".
             Error: For other generic processing errors.
         """
         ...
+
+
+    def normalize_into(
+        self,
+        log: Union[str, bytes],
+        target: Dict[str, Any],
+        strip: bool = True,
+        values: Literal["str", "bytes"] = "str",
+        reuse: bool = False,
+        filter: Union[None, str, "Filter"] = None
+    ) -> bool:
+        """
+        Normalizes a log message into a caller-owned dictionary.
+
+        Behaves like normalize(), but instead of allocating a new dict per
+        call it clears and refills `target`, which suits loops that handle
+        one event at a time and discard it.
+
+        Args:
+            log: The unstructured log message to normalize.
+            target: The dict to fill. Its previous contents are replaced.
+            strip: As in normalize().
+            values: As in normalize().
+            reuse: Also refill nested dicts already present in `target` in
+                   place instead of allocating new ones. Only use this if
+                   no references to nested dicts of the previous event are
+                   kept.
+            filter: As in normalize().
+
+        Returns:
+            True if `target` holds a new event, False if the message was
+            empty or the event was rejected by the filter (`target` is
+            then empty as well).
+
+        Raises:
+            The same exceptions as normalize(). `target` is left in an
+            unspecified state when an exception is raised.
+        """
+        ...
+
+    def record_type(self, fields: Optional[Iterable[str]] = None) -> type:
+        """
+        Builds the compact record type returned by normalize_record().
+
+        The type is a struct sequence named `liblognorm.Event` with one
+        slot per field, supporting both attribute and tuple access. Its
+        field names are available as the `_fields` class attribute.
+
+        Args:
+            fields: The field names to give slots to. If None (default),
+                    they are derived from the top-level fields of the
+                    loaded rules, including prefixes and the members of
+                    "alternative" parsers.
+
+        Returns:
+            The new record type, which also becomes the context's type for
+            normalize_record().
+
+        Raises:
+            ValueError: If no fields are given or derived, or a name
+                        repeats.
+        """
+        ...
+
+    def normalize_record(
+        self,
+        log: Union[str, bytes],
+        strip: bool = True,
+        values: Literal["str", "bytes"] = "str",
+        filter: Union[None, str, "Filter"] = None
+    ) -> Optional[Any]:
+        """
+        Normalizes a log message into an instance of the record type.
+
+        Needs far less memory per event than the dict returned by
+        normalize(), which matters when millions of events are buffered.
+        If record_type() has not been called, the type is derived from
+        the loaded rules on first use (and derived again after further
+        rules are loaded).
+
+        Fields the message did not produce are None. Top-level fields
+        without a slot, such as those added by `add_rule` or the syslog
+        header, are dropped.
+
+        Args:
+            log: As in normalize().
+            strip: As in normalize().
+            values: As in normalize().
+            filter: As in normalize().
+
+        Returns:
+            An Event record, or None if the message was empty or the
+            event was rejected by the filter.
+
+        Raises:
+            The same exceptions as normalize(), and ValueError if the
+            record type has to be derived and the rules define no fields.
+        """
+        ...
+
+class Filter:
+    """
+    A compiled predicate evaluated on normalized events before they are
+    converted to Python objects.
+
+    Expressions compare fields with literals and combine the results:
+
+    - `field == "v"`, `!=`, `<`, `<=`, `>`, `>=` against a quoted string
+      or a number. Number literals compare numerically, also with fields
+      the rulebase captured as numeric strings; string literals compare
+      the field's text byte-wise.
+    - `field ^= "prefix"` tests for a string prefix.
+    - `field in ("a", "b")` and `field not in (...)` test set membership.
+    - A bare `field` tests that the field is present and not null.
+    - `and`, `or`, `not` and parentheses combine predicates.
+
+    Dotted names (`user.name`) address nested fields. A missing field fails
+    every test except `!=` and `not ...`.
+    """
+
+    def __init__(self, expr: str) -> None:
+        """
+        Compiles `expr`.
+
+        Raises:
+            ValueError: If the expression is not valid.
+        """
+        ...
+
+class CidrTable:
+    """
+    A read-only table mapping IP prefixes to attributes, for enriching
+    events with Lognorm.enrich().
+
+    Lookups return the attributes of the most specific prefix holding an
+    address. IPv4-mapped IPv6 addresses are looked up as IPv4.
+    """
+
+    def __init__(self, path: str) -> None:
+        """
+        Loads a table from a CSV file or from a file written by save().
+
+        The CSV needs a header line such as "cidr,zone,owner" followed by
+        one "prefix,attribute,..." line per prefix. Prefixes are IPv4 or
+        IPv6 networks (host bits are ignored) or single addresses. Fields
+        may be double-quoted. Blank lines and lines starting with '#' are
+        skipped. When a prefix repeats, the later line wins.
+
+        Files written by save() are mmapped instead of parsed, so they
+        load in constant time and share their pages between processes.
+
+        Raises:
+            OSError: If the file cannot be read.
+            ValueError: If the file is malformed.
+        """
+        ...
+
+    @property
+    def columns(self) -> Tuple[str, ...]:
+        """The attribute column names."""
+        ...
+
+    def __len__(self) -> int:
+        """The number of address ranges after flattening nested prefixes."""
+        ...
+
+    def lookup(self, ip: str) -> Optional[Dict[str, str]]:
+        """
+        Returns the non-empty attributes of the most specific prefix
+        holding `ip`, or None if no prefix matches or `ip` is not an
+        address.
+        """
+        ...
+
+    def save(self, path: str) -> None:
+        """
+        Writes the compiled table to `path` (atomically, via a temporary
+        file). The file uses native byte order and is meant to be loaded
+        on the same architecture.
+
+        Raises:
+            OSError: If the file cannot be written.
+        """
+        ...
+
+class KVTable:
+    """
+    A key/value table that is mmapped from a file written by build(), for
+    enriching events with Lognorm.enrich().
+
+    The file is mapped read-only and shared, so forked workers use the
+    same page-cache pages. When the file at the table's path is replaced
+    (for example by another build() to the same path, which renames the
+    new file into place), the table switches to the new file at its next
+    check.
+    """
+
+    def __init__(self, path: str, *, check_interval: float = 1.0) -> None:
+        """
+        Maps the table file at `path`.
+
+        Args:
+            path: A file written by KVTable.build().
+            check_interval: Minimum number of seconds between the checks
+                            that lookups make for a replaced file; 0
+                            disables them (see reload()). A replacement
+                            file with different columns is ignored.
+
+        Raises:
+            OSError: If the file cannot be opened.
+            ValueError: If the file is not a valid table.
+        """
+        ...
+
+    @staticmethod
+    def build(source: str, path: str) -> None:
+        """
+        Compiles a CSV file into a table file.
+
+        The CSV needs a header line such as "key,name,dept" followed by
+        one "key,attribute,..." line per key. Fields may be double-quoted.
+        Blank lines and lines starting with '#' are skipped. When a key
+        repeats, the later line wins. `path` is replaced atomically. The
+        file uses native byte order.
+
+        Raises:
+            OSError: If a file cannot be read or written.
+            ValueError: If the CSV is malformed.
+        """
+        ...
+
+    @property
+    def columns(self) -> Tuple[str, ...]:
+        """The attribute column names."""
+        ...
+
+    def __len__(self) -> int:
+        """The number of keys."""
+        ...
+
+    def lookup(self, key: str) -> Optional[Dict[str, str]]:
+        """Returns the non-empty attributes of `key`, or None."""
+        ...
+
+    def reload(self) -> bool:
+        """
+        Switches to the file currently at the table's path if it was
+        replaced.
+
+        Returns:
+            True if the table now uses a new file.
+
+        Raises:
+            OSError: If the file cannot be opened.
+            ValueError: If the new file is invalid or its columns differ.
+        """
+        ...
+
+class Aggregator:
+    """
+    Counts normalized lines per group (e.g. per host, program and action)
+    and keeps sums and minimum/maximum values of numeric fields.
+
+    Lines are normalized through a Lognorm context and folded into a hash
+    table in C; no Python object is created per line. Rows are produced
+    only by flush() and expire().
+    """
+
+    def __init__(
+        self,
+        ctx: Lognorm,
+        by: Iterable[str] = (),
+        *,
+        sum: Iterable[str] = (),
+        min: Iterable[str] = (),
+        max: Iterable[str] = (),
+        window: Optional[float] = None,
+        filter: Union[Filter, str, None] = None,
+        strip: bool = True
+    ) -> None:
+        """
+        Creates an aggregator normalizing lines through `ctx`.
+
+        Args:
+            ctx: The context used to normalize every line.
+            by: Fields whose values form the group key. Dotted names
+                address nested fields. With no fields, all lines fall
+                into a single group.
+            sum: Numeric fields to add up, reported as "<field>_sum".
+            min: Numeric fields reported as "<field>_min".
+            max: Numeric fields reported as "<field>_max".
+            window: Length in seconds of the wall-clock windows groups are
+                    split into; rows then carry the window start time as
+                    "window", and expire() returns the windows that ended.
+            filter: Count only matching events instead of applying the
+                    context's filter.
+            strip: Remove trailing whitespace from each line before parsing.
+
+        Raises:
+            TypeError: If a field list is not a sequence of str.
+            ValueError: If a field name is empty, `window` is not positive
+                        or `filter` does not compile.
+        """
+        ...
+
+    @property
+    def lines(self) -> int:
+        """The number of non-empty lines fed so far."""
+        ...
+
+    @property
+    def unmatched(self) -> int:
+        """The number of lines that matched no rule."""
+        ...
+
+    @property
+    def backlog(self) -> bool:
+        """
+        Whether input of feed_many() is left over because the context's
+        batch_budget ran out.
+        """
+        ...
+
+    def __len__(self) -> int:
+        """The number of groups currently held."""
+        ...
+
+    def feed(self, line: Union[str, bytes]) -> bool:
+        """
+        Normalizes one line and folds it into its group.
+
+        Returns:
+            True if the line was counted; False if it was empty, matched
+            no rule or was rejected by the filter.
+
+        Raises:
+            Error: On normalization errors other than a non-matching line.
+        """
+        ...
+
+    def feed_many(self, lines: Union[str, bytes, Iterable[Union[str, bytes]]]) -> int:
+        """
+        Feeds each line of an iterable, or of a newline-separated str or
+        bytes buffer, and returns how many were counted.
+
+        When the context's batch_budget runs out, the rest of the input
+        is kept as a backlog (see `backlog`) and worked through, in
+        order, before the input of the next call; feed_many(()) only
+        continues the backlog. flush() finishes it regardless of the
+        budget.
+        """
+        ...
+
+    def flush(self) -> List[Dict[str, Any]]:
+        """
+        Returns one row per group and resets all groups.
+
+        A row holds the `by` fields (str, or None when missing), "count",
+        and the requested statistics. Sums of fields that never held a
+        number are 0; minimum and maximum are then None. Statistics over
+        integers only are int, otherwise float.
+        """
+        ...
+
+    def expire(self) -> List[Dict[str, Any]]:
+        """
+        Returns and resets the rows of the windows that have ended; always
+        empty without a `window`.
+        """
+        ...
+
+class Rollup:
+    """
+    Counts normalized lines per fixed window of event time and group, like
+    Aggregator but keyed on a timestamp taken from each event.
+
+    The watermark trails the newest event time seen by `lateness`
+    seconds. A window is closed once the watermark passes its end.
+    expire() returns the closed windows, and events that still fall into
+    them are dropped and counted as late.
+    """
+
+    def __init__(
+        self,
+        ctx: Lognorm,
+        time_field: str,
+        window: float,
+        by: Iterable[str] = (),
+        *,
+        sum: Iterable[str] = (),
+        min: Iterable[str] = (),
+        max: Iterable[str] = (),
+        lateness: float = 0.0,
+        filter: Union[Filter, str, None] = None,
+        strip: bool = True
+    ) -> None:
+        """
+        Creates a rollup normalizing lines through `ctx`.
+
+        Args:
+            ctx: The context used to normalize every line.
+            time_field: The field holding the event time, either as a
+                        number of seconds since the epoch or as an ISO 8601
+                        or RFC 3164 timestamp ("2024-05-01T12:00:00.5+02:00",
+                        "May  1 12:00:00"). Times without a zone are UTC.
+                        RFC 3164 times get the current year, or the previous
+                        one if they would otherwise lie in the future.
+            window: Length of the windows in seconds. Windows are aligned
+                    to the epoch.
+            by, sum, min, max: Group key and statistics, as for Aggregator.
+            lateness: Seconds by which events may arrive out of order
+                      before they count as late.
+            filter: Count only matching events instead of applying the
+                    context's filter.
+            strip: Remove trailing whitespace from each line before parsing.
+
+        Raises:
+            ValueError: If `window` is not positive, `lateness` is
+                        negative, or a field name is empty.
+        """
+        ...
+
+    @property
+    def watermark(self) -> Optional[float]:
+        """
+        The event time up to which windows are complete, or None before
+        the first timed event.
+        """
+        ...
+
+    @property
+    def lines(self) -> int:
+        """The number of non-empty lines fed so far."""
+        ...
+
+    @property
+    def unmatched(self) -> int:
+        """The number of lines that matched no rule."""
+        ...
+
+    @property
+    def backlog(self) -> bool:
+        """
+        Whether input of feed_many() is left over because the context's
+        batch_budget ran out.
+        """
+        ...
+
+    @property
+    def late(self) -> int:
+        """The number of events dropped because their window had closed."""
+        ...
+
+    @property
+    def untimed(self) -> int:
+        """The number of events without a usable timestamp; they are dropped."""
+        ...
+
+    def __len__(self) -> int:
+        """The number of (window, group) rows currently held."""
+        ...
+
+    def feed(self, line: Union[str, bytes]) -> bool:
+        """
+        Normalizes one line and counts it in its window.
+
+        Returns:
+            True if the line was counted.
+
+        Raises:
+            Error: On normalization errors other than a non-matching line.
+        """
+        ...
+
+    def feed_many(self, lines: Union[str, bytes, Iterable[Union[str, bytes]]]) -> int:
+        """
+        Feeds each line of an iterable, or of a newline-separated str or
+        bytes buffer, and returns how many were counted.
+
+        When the context's batch_budget runs out, the rest of the input
+        is kept as a backlog (see `backlog`) and worked through, in
+        order, before the input of the next call; feed_many(()) only
+        continues the backlog. flush() finishes it regardless of the
+        budget.
+        """
+        ...
+
+    def expire(self) -> List[Dict[str, Any]]:
+        """
+        Returns and resets the rows of the closed windows. Rows are shaped
+        as for Aggregator and carry the window start as "window".
+        """
+        ...
+
+    def flush(self) -> List[Dict[str, Any]]:
+        """Returns and resets all rows, including those of open windows."""
+        ...
+
+class TopK:
+    """
+    Tracks the most frequent values of a stream in bounded memory, using
+    the Space-Saving algorithm.
+
+    The sketch keeps `capacity` counters. A value that is not tracked
+    takes over the counter with the lowest count and inherits that count
+    as its error bound. Every value occurring more than
+    total / capacity times is guaranteed to be tracked.
+    """
+
+    def __init__(self, k: int, *, capacity: Optional[int] = None) -> None:
+        """
+        Creates an empty sketch.
+
+        Args:
+            k: The number of values top() reports by default.
+            capacity: The number of counters; defaults to 10 * k. More
+                      counters give tighter counts for rarer values.
+
+        Raises:
+            ValueError: If `k` is not positive or `capacity` < `k`.
+        """
+        ...
+
+    @property
+    def k(self) -> int:
+        """The number of values reported by top()."""
+        ...
+
+    @property
+    def total(self) -> int:
+        """The sum of all counts added."""
+        ...
+
+    @property
+    def dropped(self) -> int:
+        """
+        The number of values from attached Lognorm contexts that could
+        not be counted because memory ran out.
+        """
+        ...
+
+    def __len__(self) -> int:
+        """The number of values currently tracked."""
+        ...
+
+    def add(self, value: Union[str, bytes], count: int = 1) -> None:
+        """Counts `count` occurrences of `value`."""
+        ...
+
+    def top(self, n: Optional[int] = None) -> List[Tuple[str, int, int]]:
+        """
+        Returns up to `n` (default `k`) values, most frequent first.
+
+        Each item is ``(value, count, error)``. The true number of
+        occurrences lies between ``count - error`` and ``count``.
+        """
+        ...
+
+    def clear(self) -> None:
+        """Forgets all counts."""
+        ...
+
+class HyperLogLog:
+    """
+    Estimates the number of distinct values in a stream (unique IPs,
+    users, URLs, ...) in fixed memory.
+
+    Sketches of the same precision can be merged, e.g. per-worker sketches
+    in a central process, and serialized with to_bytes(). The standard
+    error of count() is about 1.04 / sqrt(2 ** precision), i.e. 0.8% at
+    the default precision of 14 (16 KiB).
+    """
+
+    def __init__(self, precision: int = 14) -> None:
+        """
+        Creates an empty sketch with 2 ** `precision` registers.
+
+        Raises:
+            ValueError: If `precision` is not between 4 and 18.
+        """
+        ...
+
+    @classmethod
+    def from_bytes(cls, data: bytes) -> "HyperLogLog":
+        """
+        Restores a sketch serialized by to_bytes().
+
+        Raises:
+            ValueError: If `data` is not a serialized sketch.
+        """
+        ...
+
+    @property
+    def precision(self) -> int:
+        """The log2 of the number of registers."""
+        ...
+
+    def add(self, value: Union[str, bytes]) -> None:
+        """Adds a value to the set."""
+        ...
+
+    def count(self) -> int:
+        """Returns the estimated number of distinct values added."""
+        ...
+
+    def merge(self, other: "HyperLogLog") -> None:
+        """
+        Adds all values of `other` to this sketch.
+
+        Raises:
+            ValueError: If the precisions differ.
+        """
+        ...
+
+    def clear(self) -> None:
+        """Forgets all values."""
+        ...
+
+    def to_bytes(self) -> bytes:
+        """
+        Serializes the sketch. Hashes do not depend on the process, so
+        sketches from different hosts merge correctly.
+        """
+        ...
+
+class Multiline:
+    """
+    Joins physical lines into multi-line records (e.g. Java stack traces)
+    and normalizes each record as a single message.
+
+    A line opens a new record when it starts with the `start` literal or,
+    with `timestamp` enabled, with an ISO 8601 or RFC 3164 timestamp. Any
+    other line is appended to the pending record with a newline separator.
+    """
+
+    def __init__(
+        self,
+        ctx: Lognorm,
+        *,
+        start: Optional[str] = None,
+        timestamp: bool = False,
+        max_lines: int = 500,
+        max_bytes: int = 65536,
+        timeout: float = 1.0,
+        strip: bool = True,
+        values: Literal["str", "bytes"] = "str"
+    ) -> None:
+        """
+        Creates a joiner normalizing records through `ctx`.
+
+        Args:
+            ctx: The context used to normalize joined records.
+            start: Literal prefix of the first line of a record.
+            timestamp: Treat lines starting with a timestamp (optionally
+                       inside '[') as the first line of a record.
+            max_lines: Emit a record once it holds this many lines.
+            max_bytes: Emit a record before it would grow past this size.
+            timeout: Seconds a pending record waits for continuation lines
+                     before expire() (or a Follower) emits it.
+            strip: Remove trailing whitespace from each physical line.
+            values: Type of string field values, as in Lognorm.normalize().
+
+        Raises:
+            ValueError: If neither `start` nor `timestamp` is given.
+        """
+        ...
+
+    def feed(self, data: str) -> List[Optional[Dict[str, Any]]]:
+        """
+        Feeds one or more newline-separated lines and returns the events of
+        the records they completed. The last record stays pending.
+        """
+        ...
+
+    def flush(self) -> List[Optional[Dict[str, Any]]]:
+        """Emits the pending record, if any."""
+        ...
+
+    def expire(self) -> List[Optional[Dict[str, Any]]]:
+        """Emits the pending record if it has waited longer than `timeout`."""
+        ...
+
+
+class Follower:
+    """
+    Follows one or more log files like ``tail -F`` and normalizes new lines
+    through a Lognorm context.
+
+    Files are watched with inotify, so an idle follower sleeps without
+    consuming CPU. Rotation (rename and re-create) is detected and the old
+    file is drained before switching to the new one; truncation restarts
+    reading at offset 0. Byte offsets can be persisted to a checkpoint file
+    so a restarted follower resumes exactly where the last commit left off.
+    """
+
+    def __init__(
+        self,
+        ctx: Lognorm,
+        paths: Union[str, Iterable[str]],
+        *,
+        checkpoint: Optional[str] = None,
+        batch_size: int = 1024,
+        strip: bool = True,
+        from_beginning: bool = False,
+        multiline: Optional[Multiline] = None,
+        values: Literal["str", "bytes"] = "str"
+    ) -> None:
+        """
+        Starts following the given files.
+
+        Args:
+            ctx: The context used to normalize every line.
+            paths: A path or an iterable of paths. Files that do not exist
+                   yet are picked up once they are created.
+            checkpoint: Path of the offsets file. Offsets stored there take
+                        precedence over `from_beginning`.
+            batch_size: Maximum number of lines returned by one read().
+            strip: Remove trailing whitespace from each line before parsing.
+            from_beginning: Read existing files from the start instead of
+                            only following data appended from now on.
+            multiline: Join continuation lines using the settings of this
+                       Multiline; each file keeps its own pending record.
+                       The settings are copied, so re-initializing the
+                       Multiline later does not affect the Follower. It must
+                       have been created with the same `ctx`.
+                       Checkpoints point at the start of a pending record.
+            values: Type of string field values, as in Lognorm.normalize().
+
+        Raises:
+            ValueError: If `multiline` was created with another Lognorm.
+            OSError: If a file, its directory or the checkpoint cannot be read.
+        """
+        ...
+
+    def read(self, timeout: Optional[float] = None) -> List[Tuple[str, Optional[Dict[str, Any]]]]:
+        """
+        Returns the next batch of normalized lines, waiting for new data.
+
+        Each item is a ``(path, event)`` tuple; `event` is None for lines
+        that matched no rule. Empty lines are skipped.
+
+        Args:
+            timeout: Seconds to wait for new lines; None waits forever.
+                     An empty list is returned when the timeout expires.
+
+        Raises:
+            OSError: If reading a followed file fails.
+            Error: On normalization errors other than a non-matching line.
+                   The failed batch is not consumed.
+        """
+        ...
+
+    def commit(self) -> None:
+        """
+        Atomically writes the offsets of all lines returned so far to the
+        checkpoint file.
+
+        Raises:
+            ValueError: If the follower was created without a checkpoint.
+            OSError: If the checkpoint cannot be written.
+        """
+        ...
+
+    def offsets(self) -> Dict[str, int]:
+        """Returns the byte offset of the next unread line for each file."""
+        ...
+
+    def fileno(self) -> int:
+        """Returns the inotify descriptor, readable when files changed."""
+        ...
+
+    def close(self) -> None:
+        """Stops following and releases all file descriptors."""
+        ...
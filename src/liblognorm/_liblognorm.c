@@ -6,6 +6,16 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
 
 
 #define MODULE_NAME "liblognorm"
@@ -14,24 +24,206 @@
 #define MODULE_DOCSTRING "Log normalization library."
 #define TYPE_DOCSTRING   "liblognorm context"
 
+#define FOLLOWER_TYPE_NAME "Follower"
+#define FOLLOWER_DOCSTRING "tail -F style file follower feeding a liblognorm context"
+
+#define MULTILINE_TYPE_NAME "Multiline"
+#define MULTILINE_DOCSTRING "joins continuation lines into records before normalization"
+
+#define FILTER_TYPE_NAME "Filter"
+#define FILTER_DOCSTRING "compiled predicate evaluated on normalized events"
+
+#define CIDR_TYPE_NAME "CidrTable"
+#define CIDR_DOCSTRING "read-only IP prefix table for enriching normalized events"
+
+#define KV_TYPE_NAME "KVTable"
+#define KV_DOCSTRING "mmapped key/value table for enriching normalized events"
+
+#define AGGREGATOR_TYPE_NAME "Aggregator"
+#define AGGREGATOR_DOCSTRING "group-by counters over normalized lines, kept in C"
+
+#define ROLLUP_TYPE_NAME "Rollup"
+#define ROLLUP_DOCSTRING "event-time windowed counters with watermark flushing"
+
+#define TOPK_TYPE_NAME "TopK"
+#define TOPK_DOCSTRING "bounded-memory heavy hitters (Space-Saving)"
+
+#define HLL_TYPE_NAME "HyperLogLog"
+#define HLL_DOCSTRING "mergeable distinct-count sketch"
+
 // Exception types
 static PyObject *LognormError;          // Base exception
 static PyObject *LognormMemoryError;
 static PyObject *LognormConfigError;
 static PyObject *LognormParserError;
 static PyObject *LognormRuleError;
+static PyObject *LognormPrefilterError;
 
 static PyObject* liblognorm_version(PyObject *self, PyObject *args)
 {
   return Py_BuildValue("s", ln_version());
 }
 
+// Framing of the lines handed to normalize()
+enum {
+    INPUT_PLAIN = 0,
+    INPUT_DOCKER,            // Docker json-file records
+    INPUT_CRI,               // CRI (containerd, CRI-O) log lines
+};
+
+// Transforms applied to each message before parsing
+enum {
+    PRE_UNESCAPE   = 0x01,   // decode rsyslog "#ooo" control-character escapes
+    PRE_STRIP_ANSI = 0x02,   // drop ANSI color / cursor sequences
+    PRE_STRIP_PRI  = 0x04,   // drop a leading "<PRI>"
+    PRE_LSTRIP     = 0x08,   // drop leading whitespace
+};
+
+// Handling of bytes input that is not valid UTF-8
+enum {
+    ENC_STRICT = 0,          // raise UnicodeDecodeError
+    ENC_REPLACE,             // replace offending bytes by U+FFFD
+    ENC_SURROGATEESCAPE,     // parse the raw bytes, decode values with surrogateescape
+    ENC_LATIN1,              // transcode the whole message from Latin-1
+};
+
+// Open-addressing map from byte strings to arbitrary values
+typedef struct {
+    uint64_t hash;
+    char *key;               // owned copy, NULL for an empty slot
+    size_t len;
+    void *value;
+} strmap_entry;
+
+typedef struct {
+    strmap_entry *slots;
+    size_t cap;              // power of two
+    size_t count;
+} strmap;
+
+// A sketch (TopK, ...) fed with one field of every accepted event
+typedef struct {
+    PyObject *sketch;
+    char *path;              // compiled field name, see path_compile()
+    size_t depth;
+} sketch_attachment;
+
+// Rewrites applied by redact()
+enum {
+    REDACT_HASH = 0,         // keyed SipHash-2-4, as 16 hex digits
+    REDACT_TRUNCATE,         // IP address cut to its network prefix
+    REDACT_MASK,             // characters replaced by a mask character
+};
+
+typedef struct {
+    char *path;              // compiled field name, see path_compile()
+    size_t depth;
+    int action;              // REDACT_*
+    uint64_t key[2];         // SipHash key
+    int v4_prefix;           // prefix bits kept by REDACT_TRUNCATE
+    int v6_prefix;
+    Py_ssize_t keep_start;   // code points left unmasked by REDACT_MASK
+    Py_ssize_t keep_end;
+    char *keep_after;        // REDACT_MASK keeps the text from its last occurrence, or NULL
+    char mask;
+} redact_rule;
+
+// Time spent in ln_normalize() for one rule, see profile()
+typedef struct {
+    const char *origin;      // rule file, pointing into the profile key; NULL
+    long line;               // for lines without a rule location
+    Py_ssize_t count;
+    double seconds;
+    double max;
+} rule_cost;
+
+// The line ctx_normalize() handed to the slow-log check, see slowlog()
+typedef struct {
+    const char *msg;         // input line, NULL when no check is pending
+    size_t len;
+    double started;          // monotonic time ctx_normalize() was entered
+    double parsed;           // ... and ln_normalize() returned
+} slow_call;
+
+// What ctx_normalize() does with a message longer than max_length
+enum {
+    OVERSIZE_TRUNCATE = 0,   // parse its first max_length bytes
+    OVERSIZE_REJECT,         // fail without parsing
+};
+
+// Interning of string values
+enum {
+    INTERN_OFF = 0,
+    INTERN_FIELDS,           // only the fields named by the caller
+    INTERN_AUTO,             // any field whose values turn out to repeat
+};
+
+// Growable buffer for messages rewritten on the way to ln_normalize()
+typedef struct {
+    char *ptr;
+    size_t cap;
+} scratch_buf;
+
 typedef struct {
     PyObject_HEAD
     ln_ctx lognorm_context;
     char last_error[512];
+    int syslog_header;       // split the syslog header off before ln_normalize()
+    int input_format;        // INPUT_* container log framing to unwrap
+    unsigned int preprocess; // PRE_* transforms
+    int encoding_errors;     // ENC_* policy for bytes input
+    scratch_buf transcoded;  // bytes input fixed up by the encoding policy
+    scratch_buf scratch;     // rewritten messages (unescaped payloads, ...)
+    int intern_mode;         // INTERN_* mode
+    size_t intern_limit;     // distinct values cached per field
+    strmap intern_fields;    // field name -> intern_field
+    PyObject *rule_sources;  // list of (origin, bytes) for every loaded rulebase
+    PyObject *record_type;   // structseq type built by record_type(), or NULL
+    strmap record_slots;     // field name -> slot index + 1 in record_type
+    int record_derived;      // record_type was derived from the rules
+    PyObject *filter;        // Filter applied to every event, or NULL
+    strmap field_map;        // source field -> target path tuple, None to drop
+    PyObject *constants;     // list of (target path, value) added to events
+    PyObject *enrichments;   // list of (CidrTable/KVTable, field, output keys), or NULL
+    sketch_attachment *sketches; // sketches attached with attach()
+    size_t nsketches;
+    redact_rule *redactions; // rules added with redact(), applied in order
+    size_t nredactions;
+    struct prefilter_dfa *prefilter; // literals a line must contain, or NULL
+    PyObject *prefilter_literals;    // tuple of bytes compiled into prefilter
+    int prefilter_derived;   // prefilter follows the loaded rules
+    Py_ssize_t prefilter_min_length;
+    int rule_location;       // events carry metadata.rule.location
+    int profiling;           // profile() is on
+    strmap profile;          // "file\0line" -> rule_cost
+    rule_cost unattributed;  // lines without a rule location
+    struct slowlog *slowlog; // ring of slow lines, or NULL when off
+    slow_call pending;       // line of the call in progress
+    struct tracer *tracer;   // parse traces requested with trace(), or NULL
+    size_t max_length;       // longest message parsed, 0 = no limit
+    int oversize;            // OVERSIZE_* policy
+    double batch_budget;     // seconds per batch call, 0 = no limit
+    Py_ssize_t truncated;    // counters reported by counters()
+    Py_ssize_t oversized;
+    Py_ssize_t prefiltered;
+    Py_ssize_t over_budget;
 } ObjectInstance;
 
+// Python type produced for string values
+enum {
+    VALUES_STR = 0,
+    VALUES_BYTES,            // raw UTF-8 bytes, skipping the decode
+};
+
+// Settings for one json_object -> Python conversion
+typedef struct {
+    ObjectInstance *ctx;
+    const char *errors;      // error handler for decoding string values
+    int values;              // VALUES_* mode
+} conv_state;
+
+static PyTypeObject TypeObject;
+
 static
 void py_err_callback(void *cookie, const char *msg, size_t lenMsg)
 {
@@ -43,6 +235,20 @@ void py_err_callback(void *cookie, const char *msg, size_t lenMsg)
     self->last_error[len] = '\0';
 }
 
+static int intern_add_field(ObjectInstance *self, const char *name, size_t len);
+static void intern_clear(ObjectInstance *self);
+static void strmap_clear(strmap *m, void (*free_value)(void *));
+static PyObject* filter_from_arg(PyObject *arg);
+static int mapping_init(ObjectInstance *self, PyObject *mapping, PyObject *constants);
+static void mapping_free_value(void *value);
+static void sketches_clear(ObjectInstance *self);
+static void redactions_clear(ObjectInstance *self);
+static void prefilter_clear(ObjectInstance *self);
+static void prefilter_rules_changed(ObjectInstance *self);
+static void profile_clear(ObjectInstance *self);
+static void slowlog_free(struct slowlog *log);
+static void tracer_free(struct tracer *t);
+
 static int
 obj_init(ObjectInstance *self, PyObject *args, PyObject *kwargs)
 {
@@ -53,6 +259,21 @@ obj_init(ObjectInstance *self, PyObject *args, PyObject *kwargs)
         "add_original_message",
         "add_rule",
         "add_rule_location",
+        "syslog_header",
+        "input_format",
+        "unescape_control",
+        "strip_ansi",
+        "strip_pri",
+        "lstrip",
+        "errors",
+        "intern",
+        "intern_limit",
+        "filter",
+        "mapping",
+        "constants",
+        "max_length",
+        "oversize",
+        "batch_budget",
         NULL
     };
 
@@ -63,13 +284,32 @@ obj_init(ObjectInstance *self, PyObject *args, PyObject *kwargs)
     PyObject *add_original_message = NULL;
     PyObject *add_rule = NULL;
     PyObject *add_rule_location = NULL;
+    PyObject *syslog_header = NULL;
+    const char *input_format = NULL;
+    PyObject *unescape_control = NULL;
+    PyObject *strip_ansi = NULL;
+    PyObject *strip_pri = NULL;
+    PyObject *lstrip = NULL;
+    const char *errors = NULL;
+    PyObject *intern = NULL;
+    Py_ssize_t intern_limit = 1024;
+    PyObject *filter = NULL;
+    PyObject *mapping = NULL;
+    PyObject *constants = NULL;
+    Py_ssize_t max_length = 0;
+    const char *oversize = NULL;
+    double batch_budget = 0;
 
-    // The format string "O|OOOOO" means the first argument is optional,
-    // and the rest are keyword-only. We will actually check for no positional args.
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOOOO", kwlist,
+    // All arguments are optional; positional ones are rejected below.
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OOOOOOzOOOOzOnOOOnzd", kwlist,
                                      &allow_regex, &add_exec_path,
                                      &add_original_message, &add_rule,
-                                     &add_rule_location)) {
+                                     &add_rule_location, &syslog_header,
+                                     &input_format, &unescape_control,
+                                     &strip_ansi, &strip_pri, &lstrip,
+                                     &errors, &intern, &intern_limit, &filter,
+                                     &mapping, &constants, &max_length, &oversize,
+                                     &batch_budget)) {
         return -1; // Error is already set by PyArg_ParseTupleAndKeywords
     }
 
@@ -79,6 +319,62 @@ obj_init(ObjectInstance *self, PyObject *args, PyObject *kwargs)
         return -1;
     }
 
+    int format = INPUT_PLAIN;
+    if (input_format == NULL || strcmp(input_format, "plain") == 0) {
+        format = INPUT_PLAIN;
+    } else if (strcmp(input_format, "docker") == 0) {
+        format = INPUT_DOCKER;
+    } else if (strcmp(input_format, "cri") == 0) {
+        format = INPUT_CRI;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Unknown input_format: %s", input_format);
+        return -1;
+    }
+
+    int encoding_errors = ENC_STRICT;
+    if (errors == NULL || strcmp(errors, "strict") == 0) {
+        encoding_errors = ENC_STRICT;
+    } else if (strcmp(errors, "replace") == 0) {
+        encoding_errors = ENC_REPLACE;
+    } else if (strcmp(errors, "surrogateescape") == 0) {
+        encoding_errors = ENC_SURROGATEESCAPE;
+    } else if (strcmp(errors, "latin1") == 0) {
+        encoding_errors = ENC_LATIN1;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Unknown errors policy: %s", errors);
+        return -1;
+    }
+
+    if (intern_limit < 1) {
+        PyErr_SetString(PyExc_ValueError, "intern_limit must be positive");
+        return -1;
+    }
+
+    int oversize_policy = OVERSIZE_TRUNCATE;
+    if (oversize == NULL || strcmp(oversize, "truncate") == 0) {
+        oversize_policy = OVERSIZE_TRUNCATE;
+    } else if (strcmp(oversize, "reject") == 0) {
+        oversize_policy = OVERSIZE_REJECT;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Unknown oversize policy: %s", oversize);
+        return -1;
+    }
+    if (max_length < 0 || !(batch_budget >= 0)) {
+        PyErr_SetString(PyExc_ValueError, "max_length and batch_budget must not be negative");
+        return -1;
+    }
+
+    self->filter = filter_from_arg(filter);
+    if (self->filter == NULL && PyErr_Occurred())
+        return -1;
+
+    if (mapping_init(self, mapping, constants) != 0)
+        return -1;
+
+    self->rule_sources = PyList_New(0);
+    if (self->rule_sources == NULL)
+        return -1;
+
     // Initialize the liblognorm context
     self->lognorm_context = ln_initCtx();
     if (self->lognorm_context == NULL) {
@@ -106,6 +402,7 @@ obj_init(ObjectInstance *self, PyObject *args, PyObject *kwargs)
     }
     if (add_rule_location && PyObject_IsTrue(add_rule_location)) {
         opts |= LN_CTXOPT_ADD_RULE_LOCATION;
+        self->rule_location = 1;
     }
 
     // If any options were set, apply them
@@ -113,6 +410,63 @@ obj_init(ObjectInstance *self, PyObject *args, PyObject *kwargs)
         ln_setCtxOpts(self->lognorm_context, opts);
     }
 
+    // Binding-side stages of the normalize path
+    self->syslog_header = syslog_header && PyObject_IsTrue(syslog_header);
+    self->input_format = format;
+    self->encoding_errors = encoding_errors;
+    self->max_length = (size_t)max_length;
+    self->oversize = oversize_policy;
+    self->batch_budget = batch_budget;
+
+    self->intern_mode = INTERN_OFF;
+    self->intern_limit = (size_t)intern_limit;
+    if (intern != NULL && intern != Py_None) {
+        if (PyUnicode_Check(intern) && PyUnicode_CompareWithASCIIString(intern, "auto") == 0) {
+            self->intern_mode = INTERN_AUTO;
+        } else if (PyUnicode_Check(intern)) {
+            // a lone field name would otherwise be split into characters
+            PyErr_SetString(PyExc_ValueError, "intern must be 'auto' or a sequence of field names");
+            return -1;
+        } else {
+            PyObject *names = PySequence_Fast(intern, "intern must be 'auto' or a sequence of field names");
+            if (names == NULL)
+                return -1;
+            for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(names); i++) {
+                Py_ssize_t len;
+                PyObject *item = PySequence_Fast_GET_ITEM(names, i);
+                const char *name = PyUnicode_Check(item) ? PyUnicode_AsUTF8AndSize(item, &len) : NULL;
+                if (name == NULL) {
+                    Py_DECREF(names);
+                    if (!PyErr_Occurred())
+                        PyErr_SetString(PyExc_TypeError, "intern field names must be str");
+                    return -1;
+                }
+                if (intern_add_field(self, name, (size_t)len) != 0) {
+                    Py_DECREF(names);
+                    PyErr_NoMemory();
+                    return -1;
+                }
+            }
+            Py_DECREF(names);
+            self->intern_mode = self->intern_fields.count > 0 ? INTERN_FIELDS : INTERN_OFF;
+        }
+    }
+
+    unsigned int pre = 0;
+    if (unescape_control && PyObject_IsTrue(unescape_control)) {
+        pre |= PRE_UNESCAPE;
+    }
+    if (strip_ansi && PyObject_IsTrue(strip_ansi)) {
+        pre |= PRE_STRIP_ANSI;
+    }
+    if (strip_pri && PyObject_IsTrue(strip_pri)) {
+        pre |= PRE_STRIP_PRI;
+    }
+    if (lstrip && PyObject_IsTrue(lstrip)) {
+        pre |= PRE_LSTRIP;
+    }
+    self->preprocess = pre;
+
     return 0; // Success
 }
 
@@ -123,11 +477,92 @@ void obj_dealloc(ObjectInstance *self)
         ln_exitCtx(self->lognorm_context);
         memset(self->last_error, 0, sizeof(self->last_error));
     }
+    free(self->scratch.ptr);
+    free(self->transcoded.ptr);
+    intern_clear(self);
+    strmap_clear(&self->record_slots, NULL);
+    Py_XDECREF(self->record_type);
+    Py_XDECREF(self->rule_sources);
+    Py_XDECREF(self->filter);
+    strmap_clear(&self->field_map, mapping_free_value);
+    Py_XDECREF(self->constants);
+    Py_XDECREF(self->enrichments);
+    sketches_clear(self);
+    redactions_clear(self);
+    prefilter_clear(self);
+    profile_clear(self);
+    slowlog_free(self->slowlog);
+    tracer_free(self->tracer);
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 
-static PyObject* convert_object(json_object *obj);
+static PyObject* convert_object(json_object *obj, const conv_state *cv);
+static PyObject* convert_event(json_object *obj, const conv_state *cv);
+
+// Keep the text of every loaded rulebase so that the field schema can be
+// derived from it later (ln_ctx offers no way to walk the parse DAG).
+static int
+remember_rules(ObjectInstance *self, const char *origin, const char *text, size_t len)
+{
+    PyObject *entry = Py_BuildValue("(sy#)", origin, text, (Py_ssize_t)len);
+    if (entry == NULL)
+        return -1;
+    int rc = PyList_Append(self->rule_sources, entry);
+    Py_DECREF(entry);
+
+    // a record type derived from the old rules lacks the new fields
+    if (self->record_derived) {
+        Py_CLEAR(self->record_type);
+        strmap_clear(&self->record_slots, NULL);
+        self->record_derived = 0;
+    }
+    if (rc == 0)
+        prefilter_rules_changed(self);
+    return rc;
+}
+
+static int
+remember_rule_file(ObjectInstance *self, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return -1;
+    }
+
+    char *text = NULL;
+    size_t len = 0, cap = 0;
+    for (;;) {
+        if (len == cap) {
+            size_t ncap = cap ? cap * 2 : 8192;
+            char *p = realloc(text, ncap);
+            if (p == NULL) {
+                free(text);
+                fclose(fp);
+                PyErr_NoMemory();
+                return -1;
+            }
+            text = p;
+            cap = ncap;
+        }
+        size_t n = fread(text + len, 1, cap - len, fp);
+        if (n == 0)
+            break;
+        len += n;
+    }
+    int failed = ferror(fp);
+    fclose(fp);
+    if (failed) {
+        free(text);
+        PyErr_Format(PyExc_OSError, "Cannot read rulebase file: %s", path);
+        return -1;
+    }
+
+    int rc = remember_rules(self, path, text, len);
+    free(text);
+    return rc;
+}
 
 static PyObject* liblognorm_load(ObjectInstance *self, PyObject *args)
 {
@@ -148,6 +583,8 @@ static PyObject* liblognorm_load(ObjectInstance *self, PyObject *args)
             PyErr_Format(PyExc_RuntimeError, "Failed to load rulebase file: %s", path);
             return NULL;
         }
+        if (remember_rule_file(self, path) != 0)
+            return NULL;
         Py_RETURN_NONE;
     }
 
@@ -173,6 +610,10 @@ static PyObject* liblognorm_load(ObjectInstance *self, PyObject *args)
                 PyErr_Format(PyExc_RuntimeError, "Failed to load rulebase file: %s", filepath);
                 return NULL;
             }
+            if (remember_rule_file(self, filepath) != 0) {
+                closedir(dir);
+                return NULL;
+            }
         }
         closedir(dir);
         Py_RETURN_NONE;
@@ -203,197 +644,8937 @@ liblognorm_load_from_string(ObjectInstance *self, PyObject *args)
         return NULL;
     }
 
+    if (remember_rules(self, "<string>", rules, strlen(rules)) != 0)
+        return NULL;
+
     Py_RETURN_NONE;
 }
 
-// result = lognorm.normalize(log = "...", strip = True)
-static
-PyObject* normalize(ObjectInstance *self, PyObject *args, PyObject *kwargs)
-{
-  char *log_entry;
-  Py_ssize_t log_entry_length;
-  PyObject *strip = NULL;
+//----------------------------------------------------------------------------
+// syslog header pre-parsing (RFC 3164 / RFC 5424, octet-counted framing)
+//----------------------------------------------------------------------------
 
-  static char *kwlist[] = {"log", "strip", NULL};
+typedef struct {
+    const char *ptr;
+    size_t len;
+} span;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|O", kwlist,
-                                   &log_entry, &log_entry_length, &strip))
-    return NULL;
+typedef struct {
+    int pri;                 // -1 when the message carries no PRI
+    int version;             // 0 for RFC 3164
+    span timestamp;
+    span hostname;
+    span app_name;           // APP-NAME, or the RFC 3164 tag
+    span procid;
+    span msgid;
+    span structured_data;
+    span msg;
+} syslog_header;
 
-  if (log_entry_length == 0) {
-    Py_INCREF(Py_None);
-    return Py_None;
-  }
+static int
+is_digits(const char *s, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if (s[i] < '0' || s[i] > '9')
+            return 0;
+    return 1;
+}
 
-  if (strip != NULL && PyObject_IsTrue(strip)) {
-    while (log_entry_length > 0 &&
-           (log_entry[log_entry_length - 1] == '\n' ||
-            log_entry[log_entry_length - 1] == '\r' ||
-            log_entry[log_entry_length - 1] == '\t' ||
-            log_entry[log_entry_length - 1] == ' '))
-      log_entry_length--;
-  }
+// Length of a leading "YYYY-MM-DD[T ]hh:mm:ss[.frac][zone]" or
+// "Mmm dd hh:mm:ss" timestamp, 0 if the text does not start with one.
+static size_t
+timestamp_len(const char *s, size_t len)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
 
-  self->last_error[0] = '\0';
-  struct json_object *log = NULL;
-  int norm_result = ln_normalize(self->lognorm_context, log_entry,
-                                 (size_t)log_entry_length, &log);
+    if (len >= 19 && is_digits(s, 4) && s[4] == '-' && is_digits(s + 5, 2) &&
+        s[7] == '-' && is_digits(s + 8, 2) && (s[10] == 'T' || s[10] == ' ') &&
+        is_digits(s + 11, 2) && s[13] == ':' && is_digits(s + 14, 2) &&
+        s[16] == ':' && is_digits(s + 17, 2)) {
+        size_t n = 19;
+        while (n < len && (is_digits(s + n, 1) || s[n] == '.' || s[n] == ':' ||
+                           s[n] == '+' || s[n] == '-' || s[n] == 'Z'))
+            n++;
+        return n;
+    }
+    if (len >= 15 && s[3] == ' ' && (s[4] == ' ' || is_digits(s + 4, 1)) &&
+        is_digits(s + 5, 1) && s[6] == ' ' && is_digits(s + 7, 2) &&
+        s[9] == ':' && is_digits(s + 10, 2) && s[12] == ':' && is_digits(s + 13, 2)) {
+        for (size_t m = 0; m < sizeof(months) - 1; m += 3)
+            if (memcmp(s, months + m, 3) == 0)
+                return 15;
+    }
+    return 0;
+}
 
-  if (norm_result != 0 || log == NULL) {
-    switch (norm_result) {
-        case LN_NOMEM:
-            PyErr_SetString(LognormMemoryError, "Out of memory");
-            return NULL;
-        case LN_BADCONFIG:
-            PyErr_SetString(LognormConfigError, "Invalid rulebase configuration");
-            return NULL;
-        case LN_BADPARSERSTATE:
-            PyErr_SetString(LognormParserError, "Invalid parser state");
-            return NULL;
-        case LN_WRONGPARSER:
-            PyErr_SetString(LognormParserError, "No matching parser or invalid message");
-            return NULL;
-        case LN_RB_LINE_TOO_LONG:
-        case LN_OVER_SIZE_LIMIT:
-            PyErr_SetString(LognormRuleError, "Rulebase line too long or over size limit");
-            return NULL;
-        default:
-            if (self->last_error[0] != '\0')
-                PyErr_SetString(LognormError, self->last_error);
-            else
-                PyErr_SetString(LognormError, "Unknown normalization error");
-            return NULL;
-      }
-  }
+static int
+digits_value(const char *s, size_t n)
+{
+    int v = 0;
+    for (size_t i = 0; i < n; i++)
+        v = v * 10 + (s[i] - '0');
+    return v;
+}
 
+// Days since 1970-01-01 of a proleptic Gregorian date.
+static int64_t
+days_from_civil(int64_t y, int m, int d)
+{
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
 
-  PyObject *result = convert_object(log);
+// Seconds since the epoch of a timestamp that timestamp_len() accepts
+// and that spans all of `s`.  Times without a zone are UTC.  RFC 3164
+// times carry no year; they are placed in the year of `now`, or the one
+// before if that would put them more than a day in the future.
+static int
+timestamp_value(const char *s, size_t len, double now, double *out)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
 
-  /* NOTE:
-   * In liblognorm >= 2.x, ln_normalize() may free or reuse
-   * the JSON internally; calling json_object_put(log) can segfault.
-   * So we remove the unconditional free to avoid double-free.
-   */
-  // json_object_put(log);
+    if (timestamp_len(s, len) != len || len == 0)
+        return 0;
 
-  return result;
-}
+    if (s[3] == ' ') {
+        int month = 1;
+        while (memcmp(s, months + 3 * (month - 1), 3) != 0)
+            month++;
+        int day = s[4] == ' ' ? s[5] - '0' : digits_value(s + 4, 2);
+        double secs = digits_value(s + 7, 2) * 3600 + digits_value(s + 10, 2) * 60 +
+                      digits_value(s + 13, 2);
+        time_t t = (time_t)now;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        int64_t year = tm.tm_year + 1900;
+        *out = (double)days_from_civil(year, month, day) * 86400 + secs;
+        if (*out > now + 86400)
+            *out = (double)days_from_civil(year - 1, month, day) * 86400 + secs;
+        return day >= 1;
+    }
 
-//----------------------------------------------------------------------------
-// data conversion: json-c/libfastjson -> Python
-//----------------------------------------------------------------------------
+    int month = digits_value(s + 5, 2);
+    int day = digits_value(s + 8, 2);
+    int hour = digits_value(s + 11, 2);
+    int minute = digits_value(s + 14, 2);
+    int second = digits_value(s + 17, 2);
+    if (month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 ||
+        second > 60)
+        return 0;
 
-static PyObject* convert_scalar(json_object *obj);
-static PyObject* convert_list(json_object *obj);
-static PyObject* convert_hash(json_object *obj);
+    double value = (double)days_from_civil(digits_value(s, 4), month, day) * 86400 +
+                   hour * 3600 + minute * 60 + second;
+    size_t n = 19;
+    if (n < len && s[n] == '.') {
+        double scale = 0.1;
+        size_t start = ++n;
+        for (; n < len && is_digits(s + n, 1); n++, scale /= 10)
+            value += (s[n] - '0') * scale;
+        if (n == start)
+            return 0;
+    }
+    if (n < len && s[n] == 'Z') {
+        n++;
+    } else if (n < len && (s[n] == '+' || s[n] == '-')) {
+        int sign = s[n] == '+' ? 1 : -1;
+        const char *z = s + n + 1;
+        size_t zlen = len - n - 1;
+        int offset;
+        if (zlen == 2 && is_digits(z, 2))
+            offset = digits_value(z, 2) * 60;
+        else if (zlen == 4 && is_digits(z, 4))
+            offset = digits_value(z, 2) * 60 + digits_value(z + 2, 2);
+        else if (zlen == 5 && z[2] == ':' && is_digits(z, 2) && is_digits(z + 3, 2))
+            offset = digits_value(z, 2) * 60 + digits_value(z + 3, 2);
+        else
+            return 0;
+        value -= sign * offset * 60;
+        n = len;
+    }
+    *out = value;
+    return n == len;
+}
 
-static
-PyObject* convert_object(json_object *obj)
+// Next space-delimited header field; RFC 5424 NILVALUE ("-") yields an empty span.
+static span
+next_header_field(const char **p, const char *end)
 {
-  if (obj == NULL) {
-    Py_INCREF(Py_None);
-    return Py_None;
-  }
-
-  switch (json_object_get_type(obj)) {
-    case json_type_null:
-    case json_type_boolean:
-    case json_type_double:
-    case json_type_int:
-    case json_type_string:
-      return convert_scalar(obj);
-    case json_type_object:
-      return convert_hash(obj);
-    case json_type_array:
-      return convert_list(obj);
-    default:
-      Py_INCREF(Py_None);
-      return Py_None;
-  }
+    span field = { *p, 0 };
+    while (*p < end && **p != ' ')
+        (*p)++;
+    field.len = (size_t)(*p - field.ptr);
+    if (*p < end)
+        (*p)++;
+    if (field.len == 1 && field.ptr[0] == '-')
+        field.len = 0;
+    return field;
 }
 
-static
-PyObject* convert_scalar(json_object *obj)
+static void
+parse_rfc5424(const char *p, const char *end, syslog_header *h)
 {
-  if (obj == NULL) {
-    Py_INCREF(Py_None);
-    return Py_None;
-  }
+    h->timestamp = next_header_field(&p, end);
+    h->hostname = next_header_field(&p, end);
+    h->app_name = next_header_field(&p, end);
+    h->procid = next_header_field(&p, end);
+    h->msgid = next_header_field(&p, end);
 
-  switch (json_object_get_type(obj)) {
-    case json_type_null:
-      Py_INCREF(Py_None);
-      return Py_None;
-    case json_type_boolean:
-      if (json_object_get_boolean(obj)) {
-        Py_INCREF(Py_True);
-        return Py_True;
-      } else {
-        Py_INCREF(Py_False);
-        return Py_False;
-      }
-    case json_type_double:
-      return Py_BuildValue("d", json_object_get_double(obj));
-    case json_type_int:
-      return Py_BuildValue("l", json_object_get_int64(obj));
-    case json_type_string:
-      return Py_BuildValue("s", json_object_get_string(obj));
-    default:
-      Py_INCREF(Py_None);
-      return Py_None;
-  }
+    if (p < end && *p == '[') {
+        const char *sd = p;
+        while (p < end && *p == '[') {
+            int quoted = 0;
+            for (p++; p < end; p++) {
+                if (quoted && *p == '\\' && p + 1 < end)
+                    p++;
+                else if (*p == '"')
+                    quoted = !quoted;
+                else if (!quoted && *p == ']')
+                    break;
+            }
+            if (p < end)
+                p++;
+        }
+        h->structured_data.ptr = sd;
+        h->structured_data.len = (size_t)(p - sd);
+        if (p < end && *p == ' ')
+            p++;
+    } else {
+        next_header_field(&p, end);
+    }
+
+    if (end - p >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+        p += 3;   // BOM announcing a UTF-8 MSG
+    h->msg.ptr = p;
+    h->msg.len = (size_t)(end - p);
 }
 
-static
-PyObject* convert_list(json_object *obj)
+static void
+parse_rfc3164(const char *p, const char *end, syslog_header *h)
 {
-  if (obj == NULL) {
-    Py_INCREF(Py_None);
-    return Py_None;
-  }
+    size_t ts = timestamp_len(p, (size_t)(end - p));
+    if (ts > 0) {
+        h->timestamp.ptr = p;
+        h->timestamp.len = ts;
+        p += ts;
+        while (p < end && *p == ' ')
+            p++;
+    }
 
-  PyObject *result = PyList_New(0);
-  int array_length = json_object_array_length(obj);
-  for (int i = 0; i < array_length; ++i) {
-    PyObject *item = convert_object(json_object_array_get_idx(obj, i));
-    PyList_Append(result, item);
-    Py_DECREF(item);
-  }
-  return result;
+    // HOSTNAME is often left out; a token ending in ':' or carrying a
+    // "[pid]" is the tag instead.
+    const char *tok = p;
+    while (p < end && *p != ' ' && *p != ':' && *p != '[')
+        p++;
+    if (p < end && *p == ' ' && p > tok) {
+        h->hostname.ptr = tok;
+        h->hostname.len = (size_t)(p - tok);
+        while (p < end && *p == ' ')
+            p++;
+        tok = p;
+        while (p < end && *p != ' ' && *p != ':' && *p != '[')
+            p++;
+    }
+
+    if (p < end && (*p == ':' || *p == '[')) {
+        h->app_name.ptr = tok;
+        h->app_name.len = (size_t)(p - tok);
+        if (*p == '[') {
+            const char *pid = ++p;
+            while (p < end && *p != ']')
+                p++;
+            h->procid.ptr = pid;
+            h->procid.len = (size_t)(p - pid);
+            if (p < end)
+                p++;
+        }
+        if (p < end && *p == ':')
+            p++;
+        if (p < end && *p == ' ')
+            p++;
+    } else {
+        p = tok;   // no tag: everything after the hostname is MSG
+    }
+
+    h->msg.ptr = p;
+    h->msg.len = (size_t)(end - p);
 }
 
-static
-PyObject* convert_hash(json_object *obj)
+// Split the syslog header off `msg`.  Returns 0 (and leaves MSG spanning
+// the whole input) when the input does not look like a syslog message.
+static int
+parse_syslog_header(const char *msg, size_t len, syslog_header *h)
 {
-  if (obj == NULL) {
-    Py_INCREF(Py_None);
-    return Py_None;
-  }
+    const char *p = msg;
+    const char *end = msg + len;
 
-  PyObject *result = PyDict_New();
-  struct json_object_iterator it = json_object_iter_begin(obj);
-  struct json_object_iterator itEnd = json_object_iter_end(obj);
+    memset(h, 0, sizeof(*h));
+    h->pri = -1;
+    h->msg.ptr = msg;
+    h->msg.len = len;
 
-  while (!json_object_iter_equal(&it, &itEnd)) {
-    PyObject *value = convert_object(json_object_iter_peek_value(&it));
-    PyDict_SetItemString(result, json_object_iter_peek_name(&it), value);
-    Py_DECREF(value);
-    json_object_iter_next(&it);
-  }
+    // octet-counted framing (RFC 6587): "MSG-LEN SP SYSLOG-MSG"
+    if (p < end && *p >= '1' && *p <= '9') {
+        const char *q = p;
+        size_t frame = 0;
+        while (q < end && is_digits(q, 1) && frame < len)
+            frame = frame * 10 + (size_t)(*q++ - '0');
+        if (q + 1 < end && q[0] == ' ' && q[1] == '<') {
+            p = q + 1;
+            if (frame < (size_t)(end - p))
+                end = p + frame;
+        }
+    }
 
-  return result;
+    if (p < end && *p == '<') {
+        const char *q = p + 1;
+        int pri = 0;
+        while (q < end && q - p <= 3 && is_digits(q, 1))
+            pri = pri * 10 + (*q++ - '0');
+        if (q == p + 1 || q >= end || *q != '>' || pri > 191)
+            return 0;
+        h->pri = pri;
+        p = q + 1;
+    }
+
+    if (end - p >= 2 && p[0] >= '1' && p[0] <= '9' && p[1] == ' ' && h->pri >= 0) {
+        h->version = p[0] - '0';
+        parse_rfc5424(p + 2, end, h);
+        return 1;
+    }
+
+    if (h->pri < 0 && timestamp_len(p, (size_t)(end - p)) == 0)
+        return 0;
+    parse_rfc3164(p, end, h);
+    return 1;
 }
 
-//----------------------------------------------------------------------------
-// Python module administrative stuff
-//----------------------------------------------------------------------------
+// Header fields never overwrite what the rulebase extracted from MSG.
+static void
+merge_header_string(struct json_object *json, const char *key, span value)
+{
+    struct json_object *existing;
+    if (value.len > 0 && !json_object_object_get_ex(json, key, &existing))
+        json_object_object_add(json, key, json_object_new_string_len(value.ptr, (int)value.len));
+}
 
-static PyMethodDef object_methods[] = {
-  {"normalize", (PyCFunction)normalize, METH_VARARGS | METH_KEYWORDS,
-    "parse log line to dict object"},
-  {"load", (PyCFunction)liblognorm_load, METH_VARARGS,
-    "Load a rulebase file or all rulebase files in a directory."},
-  {"load_from_string", (PyCFunction)liblognorm_load_from_string, METH_VARARGS,
+static void
+merge_header_int(struct json_object *json, const char *key, int value)
+{
+    struct json_object *existing;
+    if (!json_object_object_get_ex(json, key, &existing))
+        json_object_object_add(json, key, json_object_new_int(value));
+}
+
+static void
+merge_syslog_header(struct json_object *json, const syslog_header *h)
+{
+    if (json_object_get_type(json) != json_type_object)
+        return;
+    if (h->pri >= 0) {
+        merge_header_int(json, "pri", h->pri);
+        merge_header_int(json, "facility", h->pri >> 3);
+        merge_header_int(json, "severity", h->pri & 7);
+    }
+    if (h->version > 0)
+        merge_header_int(json, "version", h->version);
+    merge_header_string(json, "timestamp", h->timestamp);
+    merge_header_string(json, "hostname", h->hostname);
+    merge_header_string(json, "app_name", h->app_name);
+    merge_header_string(json, "procid", h->procid);
+    merge_header_string(json, "msgid", h->msgid);
+    merge_header_string(json, "structured_data", h->structured_data);
+}
+
+//----------------------------------------------------------------------------
+// encoding policy for bytes input
+//----------------------------------------------------------------------------
+
+static char*
+scratch_reserve(scratch_buf *buf, size_t size)
+{
+    if (size > buf->cap) {
+        char *ptr = realloc(buf->ptr, size);
+        if (ptr == NULL)
+            return NULL;
+        buf->ptr = ptr;
+        buf->cap = size;
+    }
+    return buf->ptr;
+}
+
+// Length of the valid UTF-8 sequence at `s`, 0 if it is invalid.
+static size_t
+utf8_sequence_len(const unsigned char *s, size_t avail)
+{
+    unsigned char c = s[0];
+    unsigned char lo = 0x80, hi = 0xBF;
+    size_t n;
+
+    if (c < 0x80)
+        return 1;
+    if (c >= 0xC2 && c <= 0xDF)
+        n = 2;
+    else if (c >= 0xE0 && c <= 0xEF) {
+        n = 3;
+        if (c == 0xE0)
+            lo = 0xA0;              // overlong
+        else if (c == 0xED)
+            hi = 0x9F;              // surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        n = 4;
+        if (c == 0xF0)
+            lo = 0x90;              // overlong
+        else if (c == 0xF4)
+            hi = 0x8F;              // above U+10FFFF
+    } else
+        return 0;
+
+    if (avail < n || s[1] < lo || s[1] > hi)
+        return 0;
+    for (size_t i = 2; i < n; i++)
+        if (s[i] < 0x80 || s[i] > 0xBF)
+            return 0;
+    return n;
+}
+
+// Offset of the first byte that is not valid UTF-8, `len` if there is none.
+// Pure ASCII is skipped eight bytes at a time.
+static size_t
+utf8_valid_prefix(const char *msg, size_t len)
+{
+    const unsigned char *s = (const unsigned char *)msg;
+    size_t i = 0;
+
+    while (i < len) {
+        if (len - i >= 8) {
+            uint64_t word;
+            memcpy(&word, s + i, sizeof(word));
+            if ((word & 0x8080808080808080ULL) == 0) {
+                i += 8;
+                continue;
+            }
+        }
+        size_t n = utf8_sequence_len(s + i, len - i);
+        if (n == 0)
+            return i;
+        i += n;
+    }
+    return len;
+}
+
+// Replace every byte that is not part of valid UTF-8 by U+FFFD.
+static size_t
+utf8_replace_invalid(const char *msg, size_t len, size_t valid, char *out)
+{
+    const unsigned char *s = (const unsigned char *)msg;
+    size_t n = valid;
+
+    memcpy(out, msg, valid);
+    for (size_t i = valid; i < len; ) {
+        size_t seq = utf8_sequence_len(s + i, len - i);
+        if (seq == 0) {
+            memcpy(out + n, "\xEF\xBF\xBD", 3);
+            n += 3;
+            i++;
+        } else {
+            memcpy(out + n, msg + i, seq);
+            n += seq;
+            i += seq;
+        }
+    }
+    return n;
+}
+
+static size_t
+latin1_to_utf8(const char *msg, size_t len, char *out)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)msg[i];
+        if (c < 0x80) {
+            out[n++] = (char)c;
+        } else {
+            out[n++] = (char)(0xC0 | (c >> 6));
+            out[n++] = (char)(0x80 | (c & 0x3F));
+        }
+    }
+    return n;
+}
+
+// Make a bytes message acceptable to the rulebase according to the
+// context's ENC_* policy.  Valid UTF-8 (and therefore ASCII) input is
+// passed through untouched.  Returns -1 with a Python exception set.
+static int
+apply_encoding_policy(ObjectInstance *self, const char **msg, size_t *len)
+{
+    size_t valid = utf8_valid_prefix(*msg, *len);
+    if (valid == *len)
+        return 0;
+
+    char *out;
+    switch (self->encoding_errors) {
+        case ENC_SURROGATEESCAPE:
+            return 0;   // passed on as is, values are decoded with surrogateescape
+        case ENC_REPLACE:
+            if ((out = scratch_reserve(&self->transcoded, *len * 3 + 1)) == NULL)
+                break;
+            *len = utf8_replace_invalid(*msg, *len, valid, out);
+            *msg = out;
+            return 0;
+        case ENC_LATIN1:
+            if ((out = scratch_reserve(&self->transcoded, *len * 2 + 1)) == NULL)
+                break;
+            *len = latin1_to_utf8(*msg, *len, out);
+            *msg = out;
+            return 0;
+        default: {
+            PyObject *exc = PyUnicodeDecodeError_Create(
+                "utf-8", *msg, (Py_ssize_t)*len, (Py_ssize_t)valid,
+                (Py_ssize_t)valid + 1, "invalid utf-8 sequence");
+            if (exc != NULL) {
+                PyErr_SetObject(PyExc_UnicodeDecodeError, exc);
+                Py_DECREF(exc);
+            }
+            return -1;
+        }
+    }
+    PyErr_NoMemory();
+    return -1;
+}
+
+//----------------------------------------------------------------------------
+// container log unwrapping (Docker json-file, CRI)
+//----------------------------------------------------------------------------
+
+typedef struct {
+    span time;
+    span stream;
+    int partial;             // the runtime split a long line; more follows
+} container_meta;
+
+static int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+static int
+parse_hex4(const char *p, const char *end, unsigned *value)
+{
+    if (end - p < 4)
+        return -1;
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        int h = hex_value(p[i]);
+        if (h < 0)
+            return -1;
+        *value = (*value << 4) | (unsigned)h;
+    }
+    return 0;
+}
+
+static size_t
+put_utf8(char *out, unsigned cp)
+{
+    if (cp < 0x80) {
+        out[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        out[0] = (char)(0xC0 | (cp >> 6));
+        out[1] = (char)(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        out[0] = (char)(0xE0 | (cp >> 12));
+        out[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (cp >> 18));
+    out[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Decode the body of a JSON string into the scratch buffer.  Unescaped
+// output is never longer than its escaped input.
+static int
+json_unescape(ObjectInstance *self, span raw, span *out)
+{
+    char *buf = scratch_reserve(&self->scratch, raw.len + 1);
+    if (buf == NULL)
+        return -1;
+
+    const char *p = raw.ptr;
+    const char *end = raw.ptr + raw.len;
+    size_t n = 0;
+    while (p < end) {
+        const char *bs = memchr(p, '\\', (size_t)(end - p));
+        size_t run = bs ? (size_t)(bs - p) : (size_t)(end - p);
+        memcpy(buf + n, p, run);
+        n += run;
+        p += run;
+        if (p >= end || ++p >= end)
+            break;
+
+        unsigned cp, lo;
+        switch (*p++) {
+            case 'n': buf[n++] = '\n'; break;
+            case 't': buf[n++] = '\t'; break;
+            case 'r': buf[n++] = '\r'; break;
+            case 'b': buf[n++] = '\b'; break;
+            case 'f': buf[n++] = '\f'; break;
+            case 'u':
+                if (parse_hex4(p, end, &cp) != 0)
+                    return -1;
+                p += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 && end - p >= 6 && p[0] == '\\' &&
+                    p[1] == 'u' && parse_hex4(p + 2, end, &lo) == 0 &&
+                    lo >= 0xDC00 && lo < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    p += 6;
+                }
+                n += put_utf8(buf + n, cp);
+                break;
+            default:   // \" \\ \/
+                buf[n++] = p[-1];
+                break;
+        }
+    }
+    out->ptr = buf;
+    out->len = n;
+    return 0;
+}
+
+// Skip a JSON value that is not a string (attrs objects, numbers, ...).
+static const char*
+json_skip_value(const char *p, const char *end)
+{
+    int depth = 0;
+    int quoted = 0;
+    for (; p < end; p++) {
+        if (quoted) {
+            if (*p == '\\')
+                p++;
+            else if (*p == '"')
+                quoted = 0;
+        } else if (*p == '"') {
+            quoted = 1;
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+        } else if (*p == '}' || *p == ']') {
+            if (depth-- == 0)
+                return p;
+        } else if (*p == ',' && depth == 0) {
+            return p;
+        }
+    }
+    return p;
+}
+
+// {"log":"...\n","stream":"stdout","time":"..."}; the payload is only
+// copied when it contains escapes.
+static int
+unwrap_docker(ObjectInstance *self, const char **msg, size_t *len, container_meta *meta)
+{
+    const char *p = *msg;
+    const char *end = *msg + *len;
+    span log = { NULL, 0 };
+    int log_escaped = 0;
+
+    while (p < end && *p == ' ')
+        p++;
+    if (p >= end || *p++ != '{')
+        return 0;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ','))
+            p++;
+        if (p >= end || *p != '"')
+            break;
+        const char *key = ++p;
+        while (p < end && *p != '"')
+            p++;
+        size_t key_len = (size_t)(p - key);
+        for (p++; p < end && (*p == ' ' || *p == ':'); p++)
+            ;
+        if (p >= end)
+            break;
+
+        if (*p != '"') {
+            p = json_skip_value(p, end);
+            continue;
+        }
+        span value = { ++p, 0 };
+        int escaped = 0;
+        while (p < end && *p != '"') {
+            if (*p == '\\') {
+                escaped = 1;
+                p++;
+            }
+            p++;
+        }
+        if (p >= end)
+            return 0;
+        value.len = (size_t)(p - value.ptr);
+        p++;
+
+        if (key_len == 3 && memcmp(key, "log", 3) == 0) {
+            log = value;
+            log_escaped = escaped;
+        } else if (key_len == 6 && memcmp(key, "stream", 6) == 0) {
+            meta->stream = value;
+        } else if (key_len == 4 && memcmp(key, "time", 4) == 0) {
+            meta->time = value;
+        }
+    }
+
+    if (log.ptr == NULL)
+        return 0;
+    if (log_escaped && json_unescape(self, log, &log) != 0)
+        return 0;
+    // json-file ends complete lines with "\n"; chunks of a split line do not
+    if (log.len > 0 && log.ptr[log.len - 1] == '\n')
+        log.len--;
+    else
+        meta->partial = 1;
+    *msg = log.ptr;
+    *len = log.len;
+    return 1;
+}
+
+// "<time> <stream> <P|F> <log>"
+static int
+unwrap_cri(const char **msg, size_t *len, container_meta *meta)
+{
+    const char *p = *msg;
+    const char *end = *msg + *len;
+
+    meta->time = next_header_field(&p, end);
+    meta->stream = next_header_field(&p, end);
+    span tag = next_header_field(&p, end);
+    if (meta->time.len == 0 || meta->stream.len == 0 || tag.len == 0 ||
+        (tag.ptr[0] != 'P' && tag.ptr[0] != 'F'))
+        return 0;
+    meta->partial = tag.ptr[0] == 'P';
+    *msg = p;
+    *len = (size_t)(end - p);
+    return 1;
+}
+
+// Replace `msg` by the payload of a container log record.  Lines in some
+// other format are left alone and normalized as they are.
+static int
+unwrap_container(ObjectInstance *self, const char **msg, size_t *len, container_meta *meta)
+{
+    memset(meta, 0, sizeof(*meta));
+    switch (self->input_format) {
+        case INPUT_DOCKER:
+            return unwrap_docker(self, msg, len, meta);
+        case INPUT_CRI:
+            return unwrap_cri(msg, len, meta);
+        default:
+            return 0;
+    }
+}
+
+static void
+merge_container_meta(struct json_object *json, const container_meta *meta)
+{
+    struct json_object *existing;
+
+    if (json_object_get_type(json) != json_type_object)
+        return;
+    merge_header_string(json, "time", meta->time);
+    merge_header_string(json, "stream", meta->stream);
+    if (meta->partial && !json_object_object_get_ex(json, "partial", &existing))
+        json_object_object_add(json, "partial", json_object_new_boolean(1));
+}
+
+//----------------------------------------------------------------------------
+// event filters (predicates evaluated on the json_object before conversion)
+//----------------------------------------------------------------------------
+
+enum {
+    FLT_AND = 0,
+    FLT_OR,
+    FLT_NOT,
+    FLT_EXISTS,              // bare field path
+    FLT_EQ,
+    FLT_NE,
+    FLT_LT,
+    FLT_LE,
+    FLT_GT,
+    FLT_GE,
+    FLT_PREFIX,              // ^=
+    FLT_IN,
+};
+
+typedef struct {
+    char *str;               // literal text (the digits for numbers)
+    size_t len;
+    int is_num;
+    double num;
+} flt_value;
+
+typedef struct flt_node {
+    int op;                  // FLT_*
+    struct flt_node *a, *b;  // operands of and/or/not
+    char *path;              // NUL-separated path components
+    size_t depth;
+    flt_value *values;       // one literal, several for "in"
+    size_t nvalues;
+} flt_node;
+
+typedef struct {
+    PyObject_HEAD
+    flt_node *root;
+    PyObject *expr;          // source text, for repr()
+} FilterInstance;
+
+static PyTypeObject FilterType;
+
+static void
+flt_free(flt_node *n)
+{
+    if (n == NULL)
+        return;
+    flt_free(n->a);
+    flt_free(n->b);
+    for (size_t i = 0; i < n->nvalues; i++)
+        free(n->values[i].str);
+    free(n->values);
+    free(n->path);
+    free(n);
+}
+
+// Dotted field name -> malloc()ed NUL-separated components, for
+// path_lookup(); NULL when out of memory.
+static char*
+path_compile(const char *name, size_t len, size_t *depth)
+{
+    char *path = malloc(len + 1);
+    if (path == NULL)
+        return NULL;
+    memcpy(path, name, len);
+    path[len] = '\0';
+    *depth = 1;
+    for (size_t i = 0; i < len; i++) {
+        if (path[i] == '.') {
+            path[i] = '\0';
+            (*depth)++;
+        }
+    }
+    return path;
+}
+
+// Member of `event` at a compiled path; NULL if missing or null.
+static json_object*
+path_lookup(json_object *event, const char *path, size_t depth)
+{
+    json_object *obj = event;
+    for (size_t i = 0; i < depth; i++) {
+        if (json_object_get_type(obj) != json_type_object ||
+            !json_object_object_get_ex(obj, path, &obj))
+            return NULL;
+        path += strlen(path) + 1;
+    }
+    return json_object_get_type(obj) == json_type_null ? NULL : obj;
+}
+
+// Object holding the last component of a compiled path, which is
+// returned in `*last`; NULL if an intermediate object is missing.
+static json_object*
+path_parent(json_object *event, const char *path, size_t depth, const char **last)
+{
+    json_object *obj = event;
+    for (size_t i = 0; i + 1 < depth; i++) {
+        if (json_object_get_type(obj) != json_type_object ||
+            !json_object_object_get_ex(obj, path, &obj))
+            return NULL;
+        path += strlen(path) + 1;
+    }
+    *last = path;
+    return json_object_get_type(obj) == json_type_object ? obj : NULL;
+}
+
+// Recursive-descent compiler state
+typedef struct {
+    const char *start;
+    const char *p;
+    const char *error;       // static message, NULL while parsing succeeds
+} flt_parser;
+
+static flt_node*
+flt_fail(flt_parser *ps, const char *msg)
+{
+    if (ps->error == NULL)
+        ps->error = msg;
+    return NULL;
+}
+
+static void
+flt_skip_space(flt_parser *ps)
+{
+    while (*ps->p == ' ' || *ps->p == '\t' || *ps->p == '\n' || *ps->p == '\r')
+        ps->p++;
+}
+
+static int
+flt_is_name_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+        c == '_' || c == '.' || c == '-' || c == '@' || c == '$' || c == '!' || c == ':';
+}
+
+static size_t
+flt_name_len(const char *p)
+{
+    size_t n = 0;
+    // '!' only belongs to a name when it is not the start of "!="
+    while (flt_is_name_char(p[n]) && !(p[n] == '!' && p[n + 1] == '='))
+        n++;
+    return n;
+}
+
+// Consume `word` if it is the next whole name.
+static int
+flt_keyword(flt_parser *ps, const char *word)
+{
+    size_t len = strlen(word);
+    flt_skip_space(ps);
+    if (strncmp(ps->p, word, len) != 0 || flt_name_len(ps->p) != len)
+        return 0;
+    ps->p += len;
+    return 1;
+}
+
+static int
+flt_punct(flt_parser *ps, const char *tok)
+{
+    size_t len = strlen(tok);
+    flt_skip_space(ps);
+    if (strncmp(ps->p, tok, len) != 0)
+        return 0;
+    ps->p += len;
+    return 1;
+}
+
+static flt_node*
+flt_new(flt_parser *ps, int op)
+{
+    flt_node *n = calloc(1, sizeof(flt_node));
+    if (n == NULL)
+        return flt_fail(ps, "out of memory");
+    n->op = op;
+    return n;
+}
+
+static int
+flt_parse_value(flt_parser *ps, flt_value *v)
+{
+    flt_skip_space(ps);
+    char quote = *ps->p;
+
+    if (quote == '"' || quote == '\'') {
+        const char *s = ++ps->p;
+        char *out = malloc(strlen(s) + 1);
+        size_t n = 0;
+        if (out == NULL) {
+            flt_fail(ps, "out of memory");
+            return -1;
+        }
+        while (*s != '\0' && *s != quote) {
+            if (*s == '\\' && s[1] != '\0') {
+                s++;
+                out[n++] = *s == 'n' ? '\n' : *s == 't' ? '\t' : *s;
+            } else {
+                out[n++] = *s;
+            }
+            s++;
+        }
+        if (*s != quote) {
+            free(out);
+            flt_fail(ps, "unterminated string");
+            return -1;
+        }
+        out[n] = '\0';
+        ps->p = s + 1;
+        v->str = out;
+        v->len = n;
+        v->is_num = 0;
+        return 0;
+    }
+
+    char *end;
+    double num = strtod(ps->p, &end);
+    if (end == ps->p || flt_is_name_char(*end)) {
+        flt_fail(ps, "expected a quoted string or a number");
+        return -1;
+    }
+    v->len = (size_t)(end - ps->p);
+    v->str = malloc(v->len + 1);
+    if (v->str == NULL) {
+        flt_fail(ps, "out of memory");
+        return -1;
+    }
+    memcpy(v->str, ps->p, v->len);
+    v->str[v->len] = '\0';
+    v->is_num = 1;
+    v->num = num;
+    ps->p = end;
+    return 0;
+}
+
+static int
+flt_add_value(flt_parser *ps, flt_node *n)
+{
+    flt_value *values = realloc(n->values, (n->nvalues + 1) * sizeof(flt_value));
+    if (values == NULL) {
+        flt_fail(ps, "out of memory");
+        return -1;
+    }
+    n->values = values;
+    if (flt_parse_value(ps, &values[n->nvalues]) != 0)
+        return -1;
+    n->nvalues++;
+    return 0;
+}
+
+static flt_node* flt_parse_or(flt_parser *ps);
+
+// comparison, membership test, bare path or parenthesized expression
+static flt_node*
+flt_parse_primary(flt_parser *ps)
+{
+    if (flt_punct(ps, "(")) {
+        flt_node *n = flt_parse_or(ps);
+        if (n != NULL && !flt_punct(ps, ")")) {
+            flt_free(n);
+            return flt_fail(ps, "expected ')'");
+        }
+        return n;
+    }
+
+    flt_skip_space(ps);
+    size_t len = flt_name_len(ps->p);
+    if (len == 0 || (len == 2 && memcmp(ps->p, "or", 2) == 0) ||
+        (len == 3 && memcmp(ps->p, "and", 3) == 0) || (len == 2 && memcmp(ps->p, "in", 2) == 0))
+        return flt_fail(ps, "expected a field name");
+
+    flt_node *n = flt_new(ps, FLT_EXISTS);
+    if (n == NULL)
+        return NULL;
+    n->path = path_compile(ps->p, len, &n->depth);
+    if (n->path == NULL) {
+        flt_free(n);
+        return flt_fail(ps, "out of memory");
+    }
+    ps->p += len;
+
+    static const struct { const char *tok; int op; } ops[] = {
+        {"==", FLT_EQ}, {"!=", FLT_NE}, {"<=", FLT_LE}, {">=", FLT_GE},
+        {"^=", FLT_PREFIX}, {"<", FLT_LT}, {">", FLT_GT},
+    };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (!flt_punct(ps, ops[i].tok))
+            continue;
+        n->op = ops[i].op;
+        if (flt_add_value(ps, n) != 0) {
+            flt_free(n);
+            return NULL;
+        }
+        if (n->op == FLT_PREFIX && n->values[0].is_num) {
+            flt_free(n);
+            return flt_fail(ps, "^= needs a string");
+        }
+        return n;
+    }
+
+    const char *save = ps->p;
+    int negate = flt_keyword(ps, "not");
+    if (flt_keyword(ps, "in")) {
+        n->op = FLT_IN;
+        if (!flt_punct(ps, "(")) {
+            flt_free(n);
+            return flt_fail(ps, "expected '(' after in");
+        }
+        do {
+            if (flt_add_value(ps, n) != 0) {
+                flt_free(n);
+                return NULL;
+            }
+        } while (flt_punct(ps, ","));
+        if (!flt_punct(ps, ")")) {
+            flt_free(n);
+            return flt_fail(ps, "expected ')'");
+        }
+        if (negate) {
+            flt_node *not = flt_new(ps, FLT_NOT);
+            if (not == NULL) {
+                flt_free(n);
+                return NULL;
+            }
+            not->a = n;
+            return not;
+        }
+        return n;
+    }
+    ps->p = save;
+    return n;
+}
+
+static flt_node*
+flt_parse_not(flt_parser *ps)
+{
+    if (!flt_keyword(ps, "not"))
+        return flt_parse_primary(ps);
+    flt_node *operand = flt_parse_not(ps);
+    if (operand == NULL)
+        return NULL;
+    flt_node *n = flt_new(ps, FLT_NOT);
+    if (n == NULL) {
+        flt_free(operand);
+        return NULL;
+    }
+    n->a = operand;
+    return n;
+}
+
+static flt_node*
+flt_parse_binary(flt_parser *ps, int op)
+{
+    const char *word = op == FLT_OR ? "or" : "and";
+    flt_node *left = op == FLT_OR ? flt_parse_binary(ps, FLT_AND) : flt_parse_not(ps);
+
+    while (left != NULL && flt_keyword(ps, word)) {
+        flt_node *right = op == FLT_OR ? flt_parse_binary(ps, FLT_AND) : flt_parse_not(ps);
+        flt_node *n = right ? flt_new(ps, op) : NULL;
+        if (n == NULL) {
+            flt_free(left);
+            flt_free(right);
+            return NULL;
+        }
+        n->a = left;
+        n->b = right;
+        left = n;
+    }
+    return left;
+}
+
+static flt_node*
+flt_parse_or(flt_parser *ps)
+{
+    return flt_parse_binary(ps, FLT_OR);
+}
+
+// Compile `expr`; returns NULL with ValueError set on syntax errors.
+static flt_node*
+flt_compile(const char *expr)
+{
+    flt_parser ps = {expr, expr, NULL};
+    flt_node *root = flt_parse_or(&ps);
+
+    flt_skip_space(&ps);
+    if (root != NULL && *ps.p != '\0') {
+        flt_free(root);
+        root = flt_fail(&ps, "unexpected text");
+    }
+    if (root == NULL) {
+        if (ps.error != NULL && strcmp(ps.error, "out of memory") == 0)
+            PyErr_NoMemory();
+        else
+            PyErr_Format(PyExc_ValueError, "invalid filter at offset %zd: %s",
+                         (Py_ssize_t)(ps.p - ps.start), ps.error);
+    }
+    return root;
+}
+
+static json_object*
+flt_lookup(json_object *event, const flt_node *n)
+{
+    return path_lookup(event, n->path, n->depth);
+}
+
+// Numeric value of a field; numbers captured as strings count as well.
+static int
+flt_number(json_object *obj, double *out)
+{
+    switch (json_object_get_type(obj)) {
+        case json_type_int:
+            *out = (double)json_object_get_int64(obj);
+            return 1;
+        case json_type_double:
+            *out = json_object_get_double(obj);
+            return 1;
+        case json_type_boolean:
+            *out = json_object_get_boolean(obj) ? 1 : 0;
+            return 1;
+        case json_type_string: {
+            const char *s = json_object_get_string(obj);
+            char *end;
+            if (*s == '\0')
+                return 0;
+            *out = strtod(s, &end);
+            return *end == '\0';
+        }
+        default:
+            return 0;
+    }
+}
+
+// Text of a scalar field, NULL for objects and arrays.
+static const char*
+flt_text(json_object *obj, size_t *len)
+{
+    enum json_type type = json_object_get_type(obj);
+    if (type == json_type_object || type == json_type_array)
+        return NULL;
+    const char *s = json_object_get_string(obj);
+    *len = type == json_type_string ? (size_t)json_object_get_string_len(obj) : strlen(s);
+    return s;
+}
+
+// <0, 0, >0 like strcmp; 2 when the field cannot be compared to `v`.
+static int
+flt_compare(json_object *obj, const flt_value *v)
+{
+    if (v->is_num) {
+        double num;
+        if (!flt_number(obj, &num))
+            return 2;
+        return num < v->num ? -1 : num > v->num;
+    }
+
+    size_t len;
+    const char *s = flt_text(obj, &len);
+    if (s == NULL)
+        return 2;
+    int c = memcmp(s, v->str, len < v->len ? len : v->len);
+    if (c != 0)
+        return c < 0 ? -1 : 1;
+    return len < v->len ? -1 : len > v->len;
+}
+
+static int
+flt_match(const flt_node *n, json_object *event)
+{
+    switch (n->op) {
+        case FLT_AND:
+            return flt_match(n->a, event) && flt_match(n->b, event);
+        case FLT_OR:
+            return flt_match(n->a, event) || flt_match(n->b, event);
+        case FLT_NOT:
+            return !flt_match(n->a, event);
+        default:
+            break;
+    }
+
+    json_object *obj = flt_lookup(event, n);
+    if (obj == NULL)
+        return n->op == FLT_NE;
+
+    switch (n->op) {
+        case FLT_EXISTS:
+            return 1;
+        case FLT_EQ:
+            return flt_compare(obj, &n->values[0]) == 0;
+        case FLT_NE:
+            return flt_compare(obj, &n->values[0]) != 0;
+        case FLT_LT:
+            return flt_compare(obj, &n->values[0]) == -1;
+        case FLT_LE: {
+            int c = flt_compare(obj, &n->values[0]);
+            return c == -1 || c == 0;
+        }
+        case FLT_GT:
+            return flt_compare(obj, &n->values[0]) == 1;
+        case FLT_GE: {
+            int c = flt_compare(obj, &n->values[0]);
+            return c == 1 || c == 0;
+        }
+        case FLT_PREFIX: {
+            size_t len;
+            const char *s = flt_text(obj, &len);
+            return s != NULL && len >= n->values[0].len &&
+                memcmp(s, n->values[0].str, n->values[0].len) == 0;
+        }
+        case FLT_IN:
+            for (size_t i = 0; i < n->nvalues; i++) {
+                if (flt_compare(obj, &n->values[i]) == 0)
+                    return 1;
+            }
+            return 0;
+    }
+    return 0;
+}
+
+// Filter given as a Filter instance or as expression text; None -> NULL
+// without an exception.  Returns a new reference.
+static PyObject*
+filter_from_arg(PyObject *arg)
+{
+    if (arg == NULL || arg == Py_None)
+        return NULL;
+    if (PyObject_TypeCheck(arg, &FilterType)) {
+        Py_INCREF(arg);
+        return arg;
+    }
+    if (!PyUnicode_Check(arg)) {
+        PyErr_SetString(PyExc_TypeError, "filter must be a Filter or str");
+        return NULL;
+    }
+    return PyObject_CallFunctionObjArgs((PyObject *)&FilterType, arg, NULL);
+}
+
+// Whether `event` passes `filter` (a FilterInstance, or NULL for none).
+static int
+filter_accepts(PyObject *filter, json_object *event)
+{
+    return filter == NULL || flt_match(((FilterInstance *)filter)->root, event);
+}
+
+static int
+filter_init(FilterInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"expr", NULL};
+    PyObject *expr;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "U", kwlist, &expr))
+        return -1;
+    const char *text = PyUnicode_AsUTF8(expr);
+    if (text == NULL)
+        return -1;
+
+    flt_node *root = flt_compile(text);
+    if (root == NULL)
+        return -1;
+    flt_free(self->root);
+    self->root = root;
+    Py_INCREF(expr);
+    Py_XDECREF(self->expr);
+    self->expr = expr;
+    return 0;
+}
+
+static void
+filter_dealloc(FilterInstance *self)
+{
+    flt_free(self->root);
+    Py_XDECREF(self->expr);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject*
+filter_repr(FilterInstance *self)
+{
+    if (self->expr == NULL)
+        return PyUnicode_FromString(MODULE_NAME "." FILTER_TYPE_NAME "()");
+    return PyUnicode_FromFormat(MODULE_NAME "." FILTER_TYPE_NAME "(%R)", self->expr);
+}
+
+static PyTypeObject FilterType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." FILTER_TYPE_NAME,    /* tp_name */
+    sizeof(FilterInstance),              /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)filter_dealloc,          /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    (reprfunc)filter_repr,               /* tp_repr */
+    0,                                   /* tp_as_number */
+    0,                                   /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    FILTER_DOCSTRING,                    /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    0,                                   /* tp_methods */
+    0,                                   /* tp_members */
+    0,                                   /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)filter_init,               /* tp_init */
+    0,                                   /* tp_alloc */
+    PyType_GenericNew,                   /* tp_new */
+};
+
+//----------------------------------------------------------------------------
+// message preprocessing (rsyslog control-character escapes, ANSI, PRI)
+//----------------------------------------------------------------------------
+
+// Rewrite `msg` into the scratch buffer starting at `from`, the offset of
+// the first byte that changes.  All transforms shrink the message, so a
+// message already living in the scratch buffer is rewritten in place.
+static char*
+preprocess_target(ObjectInstance *self, const char *msg, size_t len, size_t from)
+{
+    int in_place = self->scratch.ptr != NULL && msg >= self->scratch.ptr &&
+        msg < self->scratch.ptr + self->scratch.cap;
+    char *dst = in_place ? self->scratch.ptr : scratch_reserve(&self->scratch, len + 1);
+    if (dst != NULL)
+        memmove(dst, msg, from);
+    return dst;
+}
+
+// rsyslog escapes control characters as '#' plus three octal digits
+// ("#011" for TAB).  Only codes below 0x20 and DEL are decoded, so text
+// such as "issue #123" is left alone.
+static int
+control_escape(const char *p, const char *end)
+{
+    if (end - p < 4 || p[0] != '#')
+        return -1;
+    if (p[1] == '0' && p[2] >= '0' && p[2] <= '3' && p[3] >= '0' && p[3] <= '7')
+        return ((p[2] - '0') << 3) | (p[3] - '0');
+    if (p[1] == '1' && p[2] == '7' && p[3] == '7')
+        return 0x7F;
+    return -1;
+}
+
+static int
+unescape_control_chars(ObjectInstance *self, const char **msg, size_t *len)
+{
+    const char *p = *msg;
+    const char *end = *msg + *len;
+
+    // fast path: memchr() (vectorized by libc) finds no escape at all
+    while ((p = memchr(p, '#', (size_t)(end - p))) != NULL && control_escape(p, end) < 0)
+        p++;
+    if (p == NULL)
+        return 0;
+
+    char *dst = preprocess_target(self, *msg, *len, (size_t)(p - *msg));
+    if (dst == NULL)
+        return -1;
+    size_t n = (size_t)(p - *msg);
+    while (p < end) {
+        int c = control_escape(p, end);
+        if (c >= 0) {
+            dst[n++] = (char)c;
+            p += 4;
+            continue;
+        }
+        const char *next = memchr(p + 1, '#', (size_t)(end - p - 1));
+        size_t run = next ? (size_t)(next - p) : (size_t)(end - p);
+        memmove(dst + n, p, run);
+        n += run;
+        p += run;
+    }
+    *msg = dst;
+    *len = n;
+    return 0;
+}
+
+// Length of the ANSI escape sequence at `p` (which points at ESC).
+static size_t
+ansi_sequence_len(const char *p, const char *end)
+{
+    const char *q = p + 1;
+
+    if (q >= end)
+        return 1;
+    if (*q == '[') {                          // CSI: params, intermediates, final byte
+        for (q++; q < end && (unsigned char)*q >= 0x20 && (unsigned char)*q <= 0x3F; q++)
+            ;
+        if (q < end && (unsigned char)*q >= 0x40 && (unsigned char)*q <= 0x7E)
+            q++;
+        return (size_t)(q - p);
+    }
+    if (*q == ']') {                          // OSC: terminated by BEL or ESC '\'
+        for (q++; q < end; q++) {
+            if (*q == '\a')
+                return (size_t)(q + 1 - p);
+            if (*q == '\x1b' && q + 1 < end && q[1] == '\\')
+                return (size_t)(q + 2 - p);
+        }
+        return (size_t)(end - p);
+    }
+    return 2;                                 // two-byte escape
+}
+
+static int
+strip_ansi_sequences(ObjectInstance *self, const char **msg, size_t *len)
+{
+    const char *end = *msg + *len;
+    const char *p = memchr(*msg, '\x1b', *len);
+    if (p == NULL)
+        return 0;
+
+    char *dst = preprocess_target(self, *msg, *len, (size_t)(p - *msg));
+    if (dst == NULL)
+        return -1;
+    size_t n = (size_t)(p - *msg);
+    while (p != NULL) {
+        p += ansi_sequence_len(p, end);
+        const char *next = p < end ? memchr(p, '\x1b', (size_t)(end - p)) : NULL;
+        size_t run = (size_t)((next ? next : end) - p);
+        memmove(dst + n, p, run);
+        n += run;
+        p = next;
+    }
+    *msg = dst;
+    *len = n;
+    return 0;
+}
+
+// Apply the context's PRE_* transforms; only rewrites the message when
+// there is something to change.
+static int
+preprocess_message(ObjectInstance *self, const char **msg, size_t *len)
+{
+    const char *p = *msg;
+    const char *end = *msg + *len;
+
+    if (self->preprocess & PRE_LSTRIP) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+    }
+    if ((self->preprocess & PRE_STRIP_PRI) && p < end && *p == '<') {
+        const char *q = p + 1;
+        while (q < end && q - p <= 3 && is_digits(q, 1))
+            q++;
+        if (q > p + 1 && q < end && *q == '>')
+            p = q + 1;
+    }
+    *msg = p;
+    *len = (size_t)(end - p);
+
+    // escapes first: rsyslog turns ESC into "#033"
+    if ((self->preprocess & PRE_UNESCAPE) && unescape_control_chars(self, msg, len) != 0)
+        return -1;
+    if ((self->preprocess & PRE_STRIP_ANSI) && strip_ansi_sequences(self, msg, len) != 0)
+        return -1;
+    return 0;
+}
+
+// Length of the message once trailing newlines and blanks are dropped.
+static size_t
+rstrip_len(const char *msg, size_t len)
+{
+    while (len > 0 &&
+           (msg[len - 1] == '\n' || msg[len - 1] == '\r' ||
+            msg[len - 1] == '\t' || msg[len - 1] == ' '))
+        len--;
+    return len;
+}
+
+static void redact_event(ObjectInstance *self, json_object *event);
+static int prefilter_match(const struct prefilter_dfa *dfa, const char *msg, size_t len);
+static void profile_record(ObjectInstance *self, json_object *event, double seconds);
+static void slowlog_check(ObjectInstance *self, json_object *event);
+static int traced_normalize(ObjectInstance *self, const char *msg, size_t len,
+                            struct json_object **json, double *traced);
+static double monotonic_now(void);
+
+// ctx_normalize() result: a Python exception has already been set
+#define NORMALIZE_PYERR  (-30000)
+// ctx_normalize() result: the message exceeds max_length
+#define NORMALIZE_OVERSIZE  (-30001)
+// ctx_normalize() result: the prefilter rejected the message unparsed
+#define NORMALIZE_PREFILTERED  (-30002)
+
+// Run ln_normalize() on one message; returns liblognorm's result code.
+// `raw` messages come from bytes and go through the encoding policy.
+// Container framing and the syslog header are stripped first, so only the
+// payload reaches the rulebase; their fields are merged in afterwards.
+static int
+ctx_normalize(ObjectInstance *self, const char *msg, size_t len, int raw,
+              struct json_object **json)
+{
+    *json = NULL;
+    self->pending.msg = NULL;
+    const char *input = msg;
+    size_t input_len = len;
+    double started = self->slowlog != NULL ? monotonic_now() : 0;
+
+    if (raw && apply_encoding_policy(self, &msg, &len) != 0)
+        return NORMALIZE_PYERR;
+
+    container_meta meta;
+    int has_meta = self->input_format != INPUT_PLAIN &&
+        unwrap_container(self, &msg, &len, &meta);
+
+    // the limit applies to the payload, so container framing stays intact
+    if (self->max_length > 0 && len > self->max_length) {
+        if (self->oversize == OVERSIZE_REJECT) {
+            self->oversized++;
+            return NORMALIZE_OVERSIZE;
+        }
+        // the message is UTF-8 by now; cut before a whole sequence
+        len = self->max_length;
+        while (len > 0 && ((unsigned char)msg[len] & 0xC0) == 0x80)
+            len--;
+        self->truncated++;
+    }
+
+    if (self->preprocess != 0 && preprocess_message(self, &msg, &len) != 0)
+        return LN_NOMEM;
+
+    syslog_header header;
+    int has_header = self->syslog_header && parse_syslog_header(msg, len, &header);
+
+    if (has_header) {
+        msg = header.msg.ptr;
+        len = header.msg.len;
+    }
+    if (self->prefilter != NULL && !prefilter_match(self->prefilter, msg, len)) {
+        self->prefiltered++;
+        return NORMALIZE_PREFILTERED;
+    }
+
+    self->last_error[0] = '\0';
+    double traced = 0;       // time spent re-running slow lines for a trace
+    double parse_started = self->profiling ? monotonic_now() : 0;
+    int norm_result = self->tracer != NULL
+        ? traced_normalize(self, msg, len, json, &traced)
+        : ln_normalize(self->lognorm_context, msg, len, json);
+    if (norm_result == NORMALIZE_PYERR)
+        return NORMALIZE_PYERR;
+    if (self->profiling)
+        profile_record(self, norm_result == 0 ? *json : NULL,
+                       monotonic_now() - parse_started - traced);
+
+    if (has_header && *json != NULL)
+        merge_syslog_header(*json, &header);
+    if (has_meta && *json != NULL)
+        merge_container_meta(*json, &meta);
+    if (self->nredactions > 0 && norm_result == 0 && *json != NULL)
+        redact_event(self, *json);
+
+    // a matched line is checked once its event has been converted
+    if (self->slowlog != NULL) {
+        self->pending = (slow_call){ input, input_len, started + traced, monotonic_now() };
+        if (norm_result != 0 || *json == NULL)
+            slowlog_check(self, NULL);
+    }
+    return norm_result;
+}
+
+// Translate a failed ln_normalize() result code into a Python exception.
+static PyObject*
+raise_normalize_error(ObjectInstance *self, int norm_result)
+{
+    switch (norm_result) {
+        case NORMALIZE_PYERR:
+            return NULL;
+        case NORMALIZE_OVERSIZE:
+            PyErr_SetString(LognormParserError, "Message longer than max_length");
+            return NULL;
+        case NORMALIZE_PREFILTERED:
+            PyErr_SetString(LognormPrefilterError, "Message contains no prefilter literal");
+            return NULL;
+        case LN_NOMEM:
+            PyErr_SetString(LognormMemoryError, "Out of memory");
+            return NULL;
+        case LN_BADCONFIG:
+            PyErr_SetString(LognormConfigError, "Invalid rulebase configuration");
+            return NULL;
+        case LN_BADPARSERSTATE:
+            PyErr_SetString(LognormParserError, "Invalid parser state");
+            return NULL;
+        case LN_WRONGPARSER:
+            PyErr_SetString(LognormParserError, "No matching parser or invalid message");
+            return NULL;
+        case LN_RB_LINE_TOO_LONG:
+        case LN_OVER_SIZE_LIMIT:
+            PyErr_SetString(LognormRuleError, "Rulebase line too long or over size limit");
+            return NULL;
+        default:
+            if (self->last_error[0] != '\0')
+                PyErr_SetString(LognormError, self->last_error);
+            else
+                PyErr_SetString(LognormError, "Unknown normalization error");
+            return NULL;
+    }
+}
+
+static void
+conv_init(conv_state *cv, ObjectInstance *self, int values)
+{
+    cv->ctx = self;
+    cv->errors = self->encoding_errors == ENC_SURROGATEESCAPE ? "surrogateescape" : NULL;
+    cv->values = values;
+}
+
+// Parse the `values=` argument of the normalize APIs.
+static int
+parse_values_mode(const char *values, int *mode)
+{
+    if (values == NULL || strcmp(values, "str") == 0) {
+        *mode = VALUES_STR;
+    } else if (strcmp(values, "bytes") == 0) {
+        *mode = VALUES_BYTES;
+    } else {
+        PyErr_Format(PyExc_ValueError, "values must be 'str' or 'bytes', not '%s'", values);
+        return -1;
+    }
+    return 0;
+}
+
+static void sketches_observe(ObjectInstance *self, json_object *event);
+
+// Whether an event passes `filter`; accepted events feed the attached
+// sketches.
+static int
+ctx_accepts(ObjectInstance *self, PyObject *filter, json_object *event)
+{
+    if (!filter_accepts(filter, event))
+        return 0;
+    if (self->nsketches > 0)
+        sketches_observe(self, event);
+    return 1;
+}
+
+// Whether a batch call that started at `started` has used up the
+// context's batch_budget; counts the call once when it has.
+static int
+batch_budget_spent(ObjectInstance *self, double started)
+{
+    if (self->batch_budget <= 0 || monotonic_now() - started < self->batch_budget)
+        return 0;
+    self->over_budget++;
+    return 1;
+}
+
+// Normalize one line on behalf of the batch-style APIs (Follower & co.).
+// Lines that match no rule or fail strict UTF-8 validation become None
+// instead of raising, so a single bad line cannot abort a whole batch.
+static PyObject*
+normalize_batch_line(ObjectInstance *self, const char *line, size_t len, int values)
+{
+    struct json_object *log = NULL;
+    int norm_result = ctx_normalize(self, line, len, 1, &log);
+
+    if (norm_result == NORMALIZE_PYERR && PyErr_ExceptionMatches(PyExc_UnicodeDecodeError)) {
+        PyErr_Clear();
+        norm_result = LN_WRONGPARSER;
+    }
+    if (norm_result == LN_WRONGPARSER || norm_result == NORMALIZE_OVERSIZE ||
+        norm_result == NORMALIZE_PREFILTERED) {
+        json_object_put(log);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    if (norm_result != 0 || log == NULL) {
+        json_object_put(log);
+        return raise_normalize_error(self, norm_result);
+    }
+    if (!ctx_accepts(self, self->filter, log)) {
+        slowlog_check(self, log);
+        json_object_put(log);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    conv_state cv;
+    conv_init(&cv, self, values);
+    PyObject *event = convert_event(log, &cv);
+    slowlog_check(self, log);
+    json_object_put(log);
+    return event;
+}
+
+// Borrow the bytes of a str (always valid UTF-8) or of a bytes-like
+// object; `*raw` tells which.  Release `view` with release_message().
+static int
+get_message(PyObject *obj, Py_buffer *view, const char **msg, Py_ssize_t *len, int *raw)
+{
+    view->obj = NULL;
+    if (PyUnicode_Check(obj)) {
+        *msg = PyUnicode_AsUTF8AndSize(obj, len);
+        *raw = 0;
+        return *msg != NULL ? 0 : -1;
+    }
+    if (PyObject_GetBuffer(obj, view, PyBUF_SIMPLE) != 0) {
+        view->obj = NULL;    // release_message() must stay a no-op
+        return -1;
+    }
+    *msg = view->buf;
+    *len = view->len;
+    *raw = 1;
+    return 0;
+}
+
+static void
+release_message(Py_buffer *view)
+{
+    if (view->obj != NULL)
+        PyBuffer_Release(view);
+}
+
+// Shared front half of normalize() and normalize_into(): returns 1 with
+// `*log` set, 0 for an empty message or an event rejected by the filter
+// (`filter_arg`, else the context's), -1 with an exception set.  The
+// message stays borrowed in `view` until the caller's release_message(),
+// after conversion, since the slow-line log may still copy it.  The event
+// tree is the caller's (liblognorm 2.x hands it over) and must be released
+// with json_object_put() on both 0 and 1; on -1 it is already released.
+static int
+normalize_message(ObjectInstance *self, PyObject *log_obj, PyObject *strip,
+                  PyObject *filter_arg, struct json_object **log, Py_buffer *view)
+{
+  PyObject *filter = NULL;
+  const char *log_entry;
+  Py_ssize_t log_entry_length;
+  int raw;
+
+  if (get_message(log_obj, view, &log_entry, &log_entry_length, &raw) != 0)
+    return -1;
+
+  if (log_entry_length == 0)
+    return 0;
+
+  if (strip != NULL && PyObject_IsTrue(strip))
+    log_entry_length = (Py_ssize_t)rstrip_len(log_entry, (size_t)log_entry_length);
+
+  int norm_result = ctx_normalize(self, log_entry, (size_t)log_entry_length, raw, log);
+
+  if (norm_result != 0 || *log == NULL) {
+    json_object_put(*log);
+    *log = NULL;
+    raise_normalize_error(self, norm_result);
+    return -1;
+  }
+
+  if (filter_arg != NULL && filter_arg != Py_None) {
+    filter = filter_from_arg(filter_arg);
+    if (filter == NULL) {
+      json_object_put(*log);
+      *log = NULL;
+      return -1;
+    }
+    int accepted = ctx_accepts(self, filter, *log);
+    Py_DECREF(filter);
+    if (!accepted)
+      slowlog_check(self, *log);
+    return accepted;
+  }
+  if (!ctx_accepts(self, self->filter, *log)) {
+    slowlog_check(self, *log);
+    return 0;
+  }
+  return 1;
+}
+
+// result = lognorm.normalize(log = "...", strip = True, values = "str",
+//                            filter = None)
+static
+PyObject* normalize(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+  PyObject *log_obj;
+  PyObject *strip = NULL;
+  const char *values = NULL;
+  PyObject *filter = NULL;
+  int values_mode;
+
+  static char *kwlist[] = {"log", "strip", "values", "filter", NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OzO", kwlist, &log_obj, &strip, &values,
+                                   &filter))
+    return NULL;
+
+  if (parse_values_mode(values, &values_mode) != 0)
+    return NULL;
+
+  struct json_object *log = NULL;
+  Py_buffer view;
+  int status = normalize_message(self, log_obj, strip, filter, &log, &view);
+  if (status <= 0) {
+    json_object_put(log);
+    release_message(&view);
+    if (status < 0)
+      return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  conv_state cv;
+  conv_init(&cv, self, values_mode);
+  PyObject *event = convert_event(log, &cv);
+  slowlog_check(self, log);
+  json_object_put(log);
+  release_message(&view);
+  return event;
+}
+
+static int fill_event(json_object *obj, PyObject *target, const conv_state *cv, int reuse);
+
+// matched = lognorm.normalize_into(log = "...", target = {}, strip = True,
+//                                  values = "str", reuse = False, filter = None)
+static
+PyObject* normalize_into(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+  PyObject *log_obj;
+  PyObject *target;
+  PyObject *strip = NULL;
+  const char *values = NULL;
+  int reuse = 0;
+  PyObject *filter = NULL;
+  int values_mode;
+
+  static char *kwlist[] = {"log", "target", "strip", "values", "reuse", "filter", NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO!|OzpO", kwlist, &log_obj,
+                                   &PyDict_Type, &target, &strip, &values, &reuse,
+                                   &filter))
+    return NULL;
+
+  if (parse_values_mode(values, &values_mode) != 0)
+    return NULL;
+
+  struct json_object *log = NULL;
+  Py_buffer view;
+  int status = normalize_message(self, log_obj, strip, filter, &log, &view);
+  if (status < 0) {
+    release_message(&view);
+    return NULL;
+  }
+
+  if (status == 0 || json_object_get_type(log) != json_type_object) {
+    slowlog_check(self, log);
+    json_object_put(log);
+    release_message(&view);
+    PyDict_Clear(target);
+    Py_RETURN_FALSE;
+  }
+
+  conv_state cv;
+  conv_init(&cv, self, values_mode);
+  if (!reuse)
+    PyDict_Clear(target);
+  int failed = fill_event(log, target, &cv, reuse);
+  slowlog_check(self, log);
+  json_object_put(log);
+  release_message(&view);
+  if (failed)
+    return NULL;
+  Py_RETURN_TRUE;
+}
+
+//----------------------------------------------------------------------------
+// string-keyed hash map used by the conversion stages
+//----------------------------------------------------------------------------
+
+// FNV-1a with a final avalanche step; stable across processes.
+static uint64_t
+hash_bytes(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static strmap_entry*
+strmap_find(const strmap *m, const char *key, size_t len, uint64_t hash)
+{
+    if (m->cap == 0)
+        return NULL;
+    for (size_t i = hash & (m->cap - 1); m->slots[i].key != NULL; i = (i + 1) & (m->cap - 1)) {
+        strmap_entry *e = &m->slots[i];
+        if (e->hash == hash && e->len == len && memcmp(e->key, key, len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static int
+strmap_grow(strmap *m)
+{
+    size_t cap = m->cap ? m->cap * 2 : 16;
+    strmap_entry *slots = calloc(cap, sizeof(strmap_entry));
+    if (slots == NULL)
+        return -1;
+    for (size_t i = 0; i < m->cap; i++) {
+        strmap_entry *e = &m->slots[i];
+        if (e->key == NULL)
+            continue;
+        size_t j = e->hash & (cap - 1);
+        while (slots[j].key != NULL)
+            j = (j + 1) & (cap - 1);
+        slots[j] = *e;
+    }
+    free(m->slots);
+    m->slots = slots;
+    m->cap = cap;
+    return 0;
+}
+
+// Find `key`, adding it with a NULL value when it is missing.
+static strmap_entry*
+strmap_insert(strmap *m, const char *key, size_t len, uint64_t hash)
+{
+    strmap_entry *e = strmap_find(m, key, len, hash);
+    if (e != NULL)
+        return e;
+    if ((m->count + 1) * 4 > m->cap * 3 && strmap_grow(m) != 0)
+        return NULL;
+
+    char *copy = malloc(len + 1);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+
+    size_t i = hash & (m->cap - 1);
+    while (m->slots[i].key != NULL)
+        i = (i + 1) & (m->cap - 1);
+    e = &m->slots[i];
+    e->hash = hash;
+    e->key = copy;
+    e->len = len;
+    e->value = NULL;
+    m->count++;
+    return e;
+}
+
+// Remove an entry found by strmap_find()/strmap_insert(), freeing its key.
+// Entries after it may move, so pointers to them become stale.
+static void
+strmap_remove(strmap *m, strmap_entry *e)
+{
+    size_t mask = m->cap - 1;
+    size_t hole = (size_t)(e - m->slots);
+    free(e->key);
+    for (size_t i = (hole + 1) & mask; m->slots[i].key != NULL; i = (i + 1) & mask) {
+        size_t home = m->slots[i].hash & mask;
+        // Move the entry back unless its home slot lies in (hole, i].
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            m->slots[hole] = m->slots[i];
+            hole = i;
+        }
+    }
+    m->slots[hole].key = NULL;
+    m->slots[hole].value = NULL;
+    m->count--;
+}
+
+static void
+strmap_clear(strmap *m, void (*free_value)(void *))
+{
+    for (size_t i = 0; i < m->cap; i++) {
+        if (m->slots[i].key == NULL)
+            continue;
+        if (free_value != NULL && m->slots[i].value != NULL)
+            free_value(m->slots[i].value);
+        free(m->slots[i].key);
+    }
+    free(m->slots);
+    memset(m, 0, sizeof(*m));
+}
+
+//----------------------------------------------------------------------------
+// interning of low-cardinality string values
+//----------------------------------------------------------------------------
+
+#define INTERN_AUTO_MAX_FIELDS  256   // field names tracked in "auto" mode
+#define INTERN_AUTO_MAX_LEN     64    // longer values are never interned in "auto" mode
+
+typedef struct {
+    strmap values;           // UTF-8 value -> shared str
+    int disabled;            // too many distinct values to be worth it
+} intern_field;
+
+static void
+intern_free_value(void *value)
+{
+    Py_DECREF((PyObject *)value);
+}
+
+static void
+intern_free_field(void *value)
+{
+    intern_field *field = value;
+    strmap_clear(&field->values, intern_free_value);
+    free(field);
+}
+
+static void
+intern_clear(ObjectInstance *self)
+{
+    strmap_clear(&self->intern_fields, intern_free_field);
+}
+
+// Pre-register the fields named in `intern=`.
+static int
+intern_add_field(ObjectInstance *self, const char *name, size_t len)
+{
+    strmap_entry *e = strmap_insert(&self->intern_fields, name, len, hash_bytes(name, len));
+    if (e == NULL)
+        return -1;
+    if (e->value == NULL && (e->value = calloc(1, sizeof(intern_field))) == NULL)
+        return -1;
+    return 0;
+}
+
+// Shared str for the value of `key`, or NULL (without an exception) when
+// the field is not interned.
+static PyObject*
+intern_lookup(ObjectInstance *self, const char *key, json_object *value, const char *errors)
+{
+    size_t key_len = strlen(key);
+    strmap_entry *fe = strmap_find(&self->intern_fields, key, key_len, hash_bytes(key, key_len));
+    const char *str = json_object_get_string(value);
+    size_t len = (size_t)json_object_get_string_len(value);
+
+    if (fe == NULL) {
+        if (self->intern_mode != INTERN_AUTO ||
+            self->intern_fields.count >= INTERN_AUTO_MAX_FIELDS ||
+            intern_add_field(self, key, key_len) != 0)
+            return NULL;
+        fe = strmap_find(&self->intern_fields, key, key_len, hash_bytes(key, key_len));
+    }
+    intern_field *field = fe->value;
+    if (field->disabled || (self->intern_mode == INTERN_AUTO && len > INTERN_AUTO_MAX_LEN))
+        return NULL;
+
+    uint64_t hash = hash_bytes(str, len);
+    strmap_entry *ve = strmap_find(&field->values, str, len, hash);
+    if (ve != NULL) {
+        Py_INCREF((PyObject *)ve->value);
+        return ve->value;
+    }
+
+    PyObject *result = PyUnicode_DecodeUTF8(str, (Py_ssize_t)len, errors);
+    if (result == NULL) {
+        PyErr_Clear();   // the regular conversion reports the error
+        return NULL;
+    }
+    if (field->values.count >= self->intern_limit) {
+        // "auto" gives up on high-cardinality fields; named fields just
+        // stop growing
+        if (self->intern_mode == INTERN_AUTO) {
+            strmap_clear(&field->values, intern_free_value);
+            field->disabled = 1;
+        }
+        return result;
+    }
+    if ((ve = strmap_insert(&field->values, str, len, hash)) != NULL) {
+        Py_INCREF(result);
+        ve->value = result;
+    }
+    return result;
+}
+
+//----------------------------------------------------------------------------
+// data conversion: json-c/libfastjson -> Python
+//----------------------------------------------------------------------------
+
+static PyObject* convert_scalar(json_object *obj, const conv_state *cv);
+static PyObject* convert_list(json_object *obj, const conv_state *cv);
+static PyObject* convert_hash(json_object *obj, const conv_state *cv);
+
+static
+PyObject* convert_object(json_object *obj, const conv_state *cv)
+{
+  if (obj == NULL) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  switch (json_object_get_type(obj)) {
+    case json_type_null:
+    case json_type_boolean:
+    case json_type_double:
+    case json_type_int:
+    case json_type_string:
+      return convert_scalar(obj, cv);
+    case json_type_object:
+      return convert_hash(obj, cv);
+    case json_type_array:
+      return convert_list(obj, cv);
+    default:
+      Py_INCREF(Py_None);
+      return Py_None;
+  }
+}
+
+static
+PyObject* convert_scalar(json_object *obj, const conv_state *cv)
+{
+  if (obj == NULL) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  switch (json_object_get_type(obj)) {
+    case json_type_null:
+      Py_INCREF(Py_None);
+      return Py_None;
+    case json_type_boolean:
+      if (json_object_get_boolean(obj)) {
+        Py_INCREF(Py_True);
+        return Py_True;
+      } else {
+        Py_INCREF(Py_False);
+        return Py_False;
+      }
+    case json_type_double:
+      return Py_BuildValue("d", json_object_get_double(obj));
+    case json_type_int:
+      return Py_BuildValue("l", json_object_get_int64(obj));
+    case json_type_string:
+      if (cv->values == VALUES_BYTES)
+        return PyBytes_FromStringAndSize(json_object_get_string(obj),
+                                         json_object_get_string_len(obj));
+      return PyUnicode_DecodeUTF8(json_object_get_string(obj),
+                                  json_object_get_string_len(obj), cv->errors);
+    default:
+      Py_INCREF(Py_None);
+      return Py_None;
+  }
+}
+
+static
+PyObject* convert_list(json_object *obj, const conv_state *cv)
+{
+  if (obj == NULL) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  int array_length = json_object_array_length(obj);
+  PyObject *result = PyList_New(array_length);
+  if (result == NULL)
+    return NULL;
+  for (int i = 0; i < array_length; ++i) {
+    PyObject *item = convert_object(json_object_array_get_idx(obj, i), cv);
+    if (item == NULL) {
+      Py_DECREF(result);
+      return NULL;
+    }
+    PyList_SET_ITEM(result, i, item);
+  }
+  return result;
+}
+
+// Python value of one object member, going through the intern table when
+// the context has one.
+static PyObject*
+convert_member(const char *key, json_object *item, const conv_state *cv)
+{
+  if (cv->ctx->intern_mode != INTERN_OFF && cv->values == VALUES_STR &&
+      json_object_get_type(item) == json_type_string) {
+    PyObject *value = intern_lookup(cv->ctx, key, item, cv->errors);
+    if (value != NULL)
+      return value;
+  }
+  return convert_object(item, cv);
+}
+
+// Store the members of `obj` in `target`.  With `reuse`, nested dicts
+// already present in `target` are refilled in place and keys missing from
+// `obj` are removed; otherwise `target` is expected to be empty.
+static
+int fill_hash(json_object *obj, PyObject *target, const conv_state *cv, int reuse)
+{
+  struct json_object_iterator it = json_object_iter_begin(obj);
+  struct json_object_iterator itEnd = json_object_iter_end(obj);
+  Py_ssize_t members = 0;
+
+  while (!json_object_iter_equal(&it, &itEnd)) {
+    const char *key = json_object_iter_peek_name(&it);
+    json_object *item = json_object_iter_peek_value(&it);
+    PyObject *existing;
+
+    members++;
+    if (reuse && json_object_get_type(item) == json_type_object &&
+        (existing = PyDict_GetItemString(target, key)) != NULL &&
+        PyDict_CheckExact(existing)) {
+      if (fill_hash(item, existing, cv, reuse) != 0)
+        return -1;
+      json_object_iter_next(&it);
+      continue;
+    }
+
+    PyObject *value = convert_member(key, item, cv);
+    if (value == NULL || PyDict_SetItemString(target, key, value) != 0) {
+      Py_XDECREF(value);
+      return -1;
+    }
+    Py_DECREF(value);
+    json_object_iter_next(&it);
+  }
+
+  if (!reuse || PyDict_Size(target) == members)
+    return 0;
+
+  // drop keys left over from the previous event
+  PyObject *stale = PyList_New(0);
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+  if (stale == NULL)
+    return -1;
+  while (PyDict_Next(target, &pos, &key, &value)) {
+    const char *name = PyUnicode_Check(key) ? PyUnicode_AsUTF8(key) : NULL;
+    json_object *found;
+    if (name == NULL || !json_object_object_get_ex(obj, name, &found)) {
+      PyErr_Clear();
+      if (PyList_Append(stale, key) != 0) {
+        Py_DECREF(stale);
+        return -1;
+      }
+    }
+  }
+  for (Py_ssize_t i = 0; i < PyList_GET_SIZE(stale); i++) {
+    if (PyDict_DelItem(target, PyList_GET_ITEM(stale, i)) != 0) {
+      Py_DECREF(stale);
+      return -1;
+    }
+  }
+  Py_DECREF(stale);
+  return 0;
+}
+
+static
+PyObject* convert_hash(json_object *obj, const conv_state *cv)
+{
+  if (obj == NULL) {
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  PyObject *result = PyDict_New();
+  if (result == NULL)
+    return NULL;
+  if (fill_hash(obj, result, cv, 0) != 0) {
+    Py_DECREF(result);
+    return NULL;
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------
+// lookup tables shared by the enrichment stages (CSV input, cell storage,
+// mmapped files)
+//----------------------------------------------------------------------------
+
+// Attribute rows of a table: NUL-terminated cell text in `blob`, indexed
+// by `cells` (row 0 holds the column names).  Identical rows are stored
+// once.
+typedef struct {
+    char *blob;
+    size_t blob_len, blob_cap;
+    uint32_t *cells;
+    size_t ncells, cells_cap;
+    strmap rows;             // joined row text -> row number
+    uint32_t ncols, nrows;
+} table_cells;
+
+// Append NUL-terminated text to the blob; returns its offset, or -1.
+static int64_t
+table_blob_add(table_cells *tc, const char *text, size_t len)
+{
+    if (tc->blob_len + len + 1 > UINT32_MAX)
+        return -1;
+    if (tc->blob_len + len + 1 > tc->blob_cap) {
+        size_t cap = tc->blob_cap ? tc->blob_cap : 4096;
+        while (cap < tc->blob_len + len + 1)
+            cap *= 2;
+        char *p = realloc(tc->blob, cap);
+        if (p == NULL)
+            return -1;
+        tc->blob = p;
+        tc->blob_cap = cap;
+    }
+    int64_t off = (int64_t)tc->blob_len;
+    memcpy(tc->blob + tc->blob_len, text, len);
+    tc->blob[tc->blob_len + len] = '\0';
+    tc->blob_len += len + 1;
+    return off;
+}
+
+// Append `n` NUL-separated cells starting at `text`.
+static int
+table_cells_add(table_cells *tc, const char *text, uint32_t n)
+{
+    if (tc->ncells + n > tc->cells_cap) {
+        size_t cap = tc->cells_cap ? tc->cells_cap : 256;
+        while (cap < tc->ncells + n)
+            cap *= 2;
+        uint32_t *c = realloc(tc->cells, cap * sizeof(uint32_t));
+        if (c == NULL)
+            return -1;
+        tc->cells = c;
+        tc->cells_cap = cap;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        size_t len = strlen(text);
+        int64_t off = table_blob_add(tc, text, len);
+        if (off < 0)
+            return -1;
+        tc->cells[tc->ncells++] = (uint32_t)off;
+        text += len + 1;
+    }
+    return 0;
+}
+
+// Row number of the `len` bytes of NUL-separated cells at `row`, adding
+// the row if it is new; 0 when out of memory.
+static uint32_t
+table_cells_row(table_cells *tc, const char *row, size_t len)
+{
+    strmap_entry *e = strmap_insert(&tc->rows, row, len, hash_bytes(row, len));
+    if (e == NULL)
+        return 0;
+    if (e->value == NULL) {
+        if (tc->nrows == UINT32_MAX - 1 || table_cells_add(tc, row, tc->ncols) != 0)
+            return 0;
+        e->value = (void *)(uintptr_t)++tc->nrows;
+    }
+    return (uint32_t)(uintptr_t)e->value;
+}
+
+static void
+table_cells_free(table_cells *tc)
+{
+    free(tc->blob);
+    free(tc->cells);
+    strmap_clear(&tc->rows, NULL);
+}
+
+// Split one CSV record (RFC 4180 quoting) into NUL-separated cells in
+// `out`; returns the number of cells, -1 on a quoting error.
+static long
+csv_split(const char *p, const char *end, scratch_buf *out, size_t *out_len)
+{
+    long cells = 1;
+    size_t n = 0;
+
+    if (scratch_reserve(out, (size_t)(end - p) + 1) == NULL)
+        return -1;
+    while (p < end) {
+        if (*p == '"') {
+            for (p++;; p++) {
+                if (p >= end)
+                    return -1;
+                if (*p == '"') {
+                    if (p + 1 < end && p[1] == '"') {
+                        p++;
+                    } else {
+                        p++;
+                        break;
+                    }
+                }
+                out->ptr[n++] = *p;
+            }
+            if (p < end && *p != ',')
+                return -1;
+            continue;
+        }
+        if (*p == ',') {
+            out->ptr[n++] = '\0';
+            cells++;
+        } else {
+            out->ptr[n++] = *p;
+        }
+        p++;
+    }
+    out->ptr[n] = '\0';
+    *out_len = n;
+    return cells;
+}
+
+// Called for every data line of a CSV table with its key (first column)
+// and attribute row; returns -1 with an exception set to stop.
+typedef int (*table_key_fn)(void *arg, const char *key, uint32_t row, long lineno);
+
+// Read a CSV table: a header line "<key>,<column>,..." followed by one
+// entry per line.  Blank lines and lines starting with '#' are skipped.
+// `what` names the table kind in error messages.
+static int
+read_csv_table(const char *text, size_t len, const char *what, table_cells *tc,
+               table_key_fn on_key, void *arg)
+{
+    scratch_buf cells = {NULL, 0};
+    const char *p = text, *end = text + len;
+    long lineno = 0;
+    int have_header = 0;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = eol ? eol : end;
+        const char *next = eol ? eol + 1 : end;
+        lineno++;
+        if (line_end > p && line_end[-1] == '\r')
+            line_end--;
+        if (line_end == p || *p == '#') {
+            p = next;
+            continue;
+        }
+
+        size_t row_len;
+        long n = csv_split(p, line_end, &cells, &row_len);
+        if (n < 0) {
+            if (!PyErr_Occurred())
+                PyErr_Format(PyExc_ValueError, "%s line %ld: bad quoting", what, lineno);
+            goto fail;
+        }
+
+        // cells after the first, still NUL-separated
+        size_t first_len = strlen(cells.ptr);
+        const char *rest = cells.ptr + first_len + 1;
+        size_t rest_len = n > 1 ? row_len - first_len - 1 : 0;
+
+        if (!have_header) {
+            if (n < 2) {
+                PyErr_Format(PyExc_ValueError, "%s header needs at least one attribute column", what);
+                goto fail;
+            }
+            tc->ncols = (uint32_t)(n - 1);
+            if (table_cells_add(tc, rest, tc->ncols) != 0)
+                goto nomem;
+            have_header = 1;
+        } else if (n - 1 != (long)tc->ncols) {
+            PyErr_Format(PyExc_ValueError, "%s line %ld: expected %ld columns, got %ld",
+                         what, lineno, (long)tc->ncols + 1, n);
+            goto fail;
+        } else {
+            uint32_t row = table_cells_row(tc, rest, rest_len);
+            if (row == 0)
+                goto nomem;
+            if (on_key(arg, cells.ptr, row, lineno) != 0)
+                goto fail;
+        }
+        p = next;
+    }
+
+    free(cells.ptr);
+    if (!have_header) {
+        PyErr_Format(PyExc_ValueError, "%s has no header line", what);
+        return -1;
+    }
+    return 0;
+
+nomem:
+    PyErr_NoMemory();
+fail:
+    free(cells.ptr);
+    return -1;
+}
+
+// Store the non-empty cells of `row` in `target` under `keys`.
+static int
+table_row_fill(const uint32_t *cells, const char *blob, uint32_t ncols, uint32_t row,
+               PyObject *keys, int values, PyObject *target)
+{
+    for (uint32_t c = 0; c < ncols; c++) {
+        const char *cell = blob + cells[(size_t)row * ncols + c];
+        size_t len = strlen(cell);
+        if (len == 0)
+            continue;
+        PyObject *value = values == VALUES_BYTES ?
+            PyBytes_FromStringAndSize(cell, (Py_ssize_t)len) :
+            PyUnicode_DecodeUTF8(cell, (Py_ssize_t)len, "replace");
+        if (value == NULL || PyDict_SetItem(target, PyTuple_GET_ITEM(keys, c), value) != 0) {
+            Py_XDECREF(value);
+            return -1;
+        }
+        Py_DECREF(value);
+    }
+    return 0;
+}
+
+// Column names (row 0) as a tuple of str.
+static PyObject*
+table_columns(const uint32_t *cells, const char *blob, uint32_t ncols)
+{
+    PyObject *columns = PyTuple_New(ncols);
+    for (uint32_t c = 0; columns != NULL && c < ncols; c++) {
+        const char *name = blob + cells[c];
+        PyObject *s = PyUnicode_DecodeUTF8(name, (Py_ssize_t)strlen(name), "replace");
+        if (s == NULL) {
+            Py_CLEAR(columns);
+            break;
+        }
+        PyTuple_SET_ITEM(columns, c, s);
+    }
+    return columns;
+}
+
+// mmap() a whole file read-only and shared, so that forked workers use the
+// same page-cache pages.  Returns NULL with errno set; an empty file maps
+// to a non-NULL pointer that must not be unmapped (`*size` is 0).
+static char*
+map_file(const char *path, size_t *size, struct stat *st)
+{
+    static char empty[1];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+    *size = (size_t)st->st_size;
+    if (*size == 0) {
+        close(fd);
+        return empty;
+    }
+    char *map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    errno = err;
+    return map == MAP_FAILED ? NULL : map;
+}
+
+static void
+unmap_file(char *map, size_t size)
+{
+    if (size > 0)
+        munmap(map, size);
+}
+
+// Replace `path` atomically with `size` bytes from `data`.  Returns -1
+// with OSError set.
+static int
+write_file_atomic(const char *path, const char *data, size_t size)
+{
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        PyErr_Format(PyExc_ValueError, "Path too long: %s", path);
+        return -1;
+    }
+
+    int ok;
+    Py_BEGIN_ALLOW_THREADS
+    FILE *fp = fopen(tmp, "wb");
+    ok = fp != NULL;
+    if (ok) {
+        ok = fwrite(data, 1, size, fp) == size;
+        ok = (fclose(fp) == 0) && ok;
+    }
+    ok = ok && rename(tmp, path) == 0;
+    Py_END_ALLOW_THREADS
+
+    if (!ok) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, tmp);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+// CIDR tables (longest-prefix match enrichment of IP fields)
+//----------------------------------------------------------------------------
+
+// The prefixes are flattened into sorted, disjoint ranges: entry i covers
+// [start[i], start[i + 1]) and names an attribute row (0 = no match), so
+// a lookup is one binary search over a flat array.  The in-memory layout
+// is exactly the file written by save(), which is mmapped when loaded:
+//
+//   cidr_header
+//   uint64_t v6_hi[n6], v6_lo[n6]       range starts, IPv6
+//   uint32_t v4_start[n4], v4_row[n4]   range starts and rows, IPv4
+//   uint32_t v6_row[n6]
+//   uint32_t cells[(nrows + 1) * ncols] blob offsets; row 0 holds the column names
+//   char blob[blob_size]                NUL-terminated cell text
+//
+// All integers are in native byte order.
+
+#define CIDR_MAGIC     "LNCIDR1"
+
+typedef struct {
+    char magic[8];
+    uint32_t ncols;          // attribute columns
+    uint32_t nrows;          // distinct attribute rows, excluding the names
+    uint64_t n4, n6;         // ranges in the IPv4 and IPv6 tables
+    uint64_t blob_size;
+} cidr_header;
+
+typedef struct {
+    PyObject_HEAD
+    char *base;              // header and tables
+    size_t size;
+    int mapped;              // base is an mmap() of a saved table
+    const cidr_header *hdr;
+    const uint64_t *v6_hi, *v6_lo;
+    const uint32_t *v4_start, *v4_row, *v6_row;
+    const uint32_t *cells;
+    const char *blob;
+    PyObject *columns;       // tuple of column names
+} CidrTableInstance;
+
+static PyTypeObject CidrTableType;
+
+typedef struct {
+    uint64_t hi, lo;
+} ip128;
+
+static int
+ip_cmp(ip128 a, ip128 b)
+{
+    if (a.hi != b.hi)
+        return a.hi < b.hi ? -1 : 1;
+    return a.lo < b.lo ? -1 : a.lo > b.lo;
+}
+
+static ip128
+ip_next(ip128 a)
+{
+    if (++a.lo == 0)
+        a.hi++;
+    return a;
+}
+
+static ip128
+ip_from_bytes(const unsigned char *b)
+{
+    ip128 ip = {0, 0};
+    for (int i = 0; i < 8; i++) {
+        ip.hi = (ip.hi << 8) | b[i];
+        ip.lo = (ip.lo << 8) | b[i + 8];
+    }
+    return ip;
+}
+
+// Parse an IPv4 or IPv6 address; IPv4-mapped IPv6 addresses count as IPv4.
+// Returns 4, 6, or 0 if `text` is not an address.
+static int
+ip_parse(const char *text, ip128 *ip)
+{
+    unsigned char b[16];
+    if (inet_pton(AF_INET, text, b) == 1) {
+        ip->hi = 0;
+        ip->lo = ((uint64_t)b[0] << 24) | ((uint64_t)b[1] << 16) | ((uint64_t)b[2] << 8) | b[3];
+        return 4;
+    }
+    if (inet_pton(AF_INET6, text, b) != 1)
+        return 0;
+    *ip = ip_from_bytes(b);
+    if (ip->hi == 0 && (ip->lo >> 32) == 0xffff) {
+        ip->lo &= 0xffffffffULL;
+        return 4;
+    }
+    return 6;
+}
+
+// Row (1-based) of the range holding `ip`, 0 if there is none.
+static uint32_t
+cidr_find(const CidrTableInstance *t, int family, ip128 ip)
+{
+    size_t lo = 0, hi = family == 4 ? (size_t)t->hdr->n4 : (size_t)t->hdr->n6;
+
+    // first range starting above ip
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int above = family == 4 ?
+            t->v4_start[mid] > ip.lo :
+            ip_cmp((ip128){t->v6_hi[mid], t->v6_lo[mid]}, ip) > 0;
+        if (above)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (lo == 0)
+        return 0;
+    return family == 4 ? t->v4_row[lo - 1] : t->v6_row[lo - 1];
+}
+
+static uint32_t
+cidr_lookup_text(const CidrTableInstance *t, const char *text)
+{
+    ip128 ip;
+    int family = ip_parse(text, &ip);
+    return family ? cidr_find(t, family, ip) : 0;
+}
+
+// Point the table accessors into `base`, checking that the layout fits in
+// `size` bytes.
+static int
+cidr_attach(CidrTableInstance *self, char *base, size_t size)
+{
+    const cidr_header *h = (const cidr_header *)base;
+    if (size < sizeof(cidr_header) || memcmp(h->magic, CIDR_MAGIC, 8) != 0) {
+        PyErr_SetString(PyExc_ValueError, "not a CIDR table file");
+        return -1;
+    }
+
+    uint64_t ncells = ((uint64_t)h->nrows + 1) * h->ncols;
+    uint64_t need = sizeof(cidr_header) + h->n6 * 20 + h->n4 * 8 + ncells * 4 + h->blob_size;
+    if (h->n4 > size || h->n6 > size || ncells > size || h->blob_size > size ||
+        need != size || h->blob_size == 0 || base[size - 1] != '\0') {
+        PyErr_SetString(PyExc_ValueError, "corrupt CIDR table file");
+        return -1;
+    }
+
+    char *p = base + sizeof(cidr_header);
+    self->v6_hi = (const uint64_t *)p;
+    p += h->n6 * 8;
+    self->v6_lo = (const uint64_t *)p;
+    p += h->n6 * 8;
+    self->v4_start = (const uint32_t *)p;
+    p += h->n4 * 4;
+    self->v4_row = (const uint32_t *)p;
+    p += h->n4 * 4;
+    self->v6_row = (const uint32_t *)p;
+    p += h->n6 * 4;
+    self->cells = (const uint32_t *)p;
+    p += ncells * 4;
+    self->blob = p;
+
+    for (uint64_t i = 0; i < ncells; i++) {
+        if (self->cells[i] >= h->blob_size) {
+            PyErr_SetString(PyExc_ValueError, "corrupt CIDR table file");
+            return -1;
+        }
+    }
+    for (uint64_t i = 0; i < h->n4; i++) {
+        if (self->v4_row[i] > h->nrows) {
+            PyErr_SetString(PyExc_ValueError, "corrupt CIDR table file");
+            return -1;
+        }
+    }
+    for (uint64_t i = 0; i < h->n6; i++) {
+        if (self->v6_row[i] > h->nrows) {
+            PyErr_SetString(PyExc_ValueError, "corrupt CIDR table file");
+            return -1;
+        }
+    }
+
+    self->columns = table_columns(self->cells, self->blob, h->ncols);
+    if (self->columns == NULL)
+        return -1;
+    self->base = base;
+    self->size = size;
+    self->hdr = h;
+    return 0;
+}
+
+// --- building a table from CSV ---
+
+typedef struct {
+    ip128 start, end;
+    uint32_t row;
+    uint32_t order;          // input position, later lines win ties
+    uint8_t bits;
+} cidr_prefix;
+
+typedef struct {
+    ip128 *start;
+    uint32_t *row;
+    size_t count, cap;
+} cidr_ranges;
+
+typedef struct {
+    cidr_prefix *v4, *v6;
+    size_t n4, n6, cap4, cap6;
+    table_cells tc;
+} cidr_builder;
+
+static int
+cidr_prefix_order(const void *a, const void *b)
+{
+    const cidr_prefix *x = a, *y = b;
+    int c = ip_cmp(x->start, y->start);
+    if (c != 0)
+        return c;
+    if (x->bits != y->bits)
+        return x->bits < y->bits ? -1 : 1;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int
+cidr_ranges_emit(cidr_ranges *r, ip128 start, uint32_t row)
+{
+    if (r->count > 0 && ip_cmp(r->start[r->count - 1], start) == 0) {
+        r->count--;          // a narrower prefix starts at the same address
+    }
+    if (r->count > 0 && r->row[r->count - 1] == row)
+        return 0;
+    if (r->count == 0 && row == 0)
+        return 0;
+    if (r->count == r->cap) {
+        size_t cap = r->cap ? r->cap * 2 : 1024;
+        ip128 *s = realloc(r->start, cap * sizeof(ip128));
+        if (s == NULL)
+            return -1;
+        r->start = s;
+        uint32_t *w = realloc(r->row, cap * sizeof(uint32_t));
+        if (w == NULL)
+            return -1;
+        r->row = w;
+        r->cap = cap;
+    }
+    r->start[r->count] = start;
+    r->row[r->count] = row;
+    r->count++;
+    return 0;
+}
+
+// Flatten nested prefixes (sorted by cidr_prefix_order) into disjoint
+// ranges where the most specific prefix wins.
+static int
+cidr_flatten(cidr_prefix *p, size_t n, ip128 max, cidr_ranges *out)
+{
+    cidr_prefix **stack = malloc((n ? n : 1) * sizeof(cidr_prefix *));
+    size_t sp = 0;
+    if (stack == NULL)
+        return -1;
+
+    for (size_t i = 0; i <= n; i++) {
+        // close the prefixes that end before the next one starts
+        while (sp > 0 && (i == n || ip_cmp(stack[sp - 1]->end, p[i].start) < 0)) {
+            cidr_prefix *top = stack[--sp];
+            if (ip_cmp(top->end, max) != 0 &&
+                cidr_ranges_emit(out, ip_next(top->end), sp ? stack[sp - 1]->row : 0) != 0)
+                goto fail;
+        }
+        if (i == n)
+            break;
+        if (cidr_ranges_emit(out, p[i].start, p[i].row) != 0)
+            goto fail;
+        stack[sp++] = &p[i];
+    }
+    free(stack);
+    return 0;
+
+fail:
+    free(stack);
+    return -1;
+}
+
+// Parse "addr[/bits]" into a prefix; returns 4, 6 or 0.
+static int
+cidr_parse_prefix(const char *text, cidr_prefix *out)
+{
+    char addr[INET6_ADDRSTRLEN];
+    const char *slash = strchr(text, '/');
+    size_t addr_len = slash ? (size_t)(slash - text) : strlen(text);
+    long bits = -1;
+    if (addr_len >= sizeof(addr))
+        return 0;
+    memcpy(addr, text, addr_len);
+    addr[addr_len] = '\0';
+    if (slash != NULL) {
+        char *end;
+        bits = strtol(slash + 1, &end, 10);
+        if (end == slash + 1 || *end != '\0')
+            return 0;
+    }
+
+    ip128 ip;
+    unsigned char b[16];
+    int family;
+    if (inet_pton(AF_INET, addr, b) == 1) {
+        family = 4;
+        ip.hi = 0;
+        ip.lo = ((uint64_t)b[0] << 24) | ((uint64_t)b[1] << 16) | ((uint64_t)b[2] << 8) | b[3];
+    } else if (inet_pton(AF_INET6, addr, b) == 1) {
+        family = 6;
+        ip = ip_from_bytes(b);
+    } else {
+        return 0;
+    }
+
+    int width = family == 4 ? 32 : 128;
+    if (bits < 0)
+        bits = width;
+    if (bits > width)
+        return 0;
+
+    // host bits of the 128-bit value that lie below the prefix
+    int host = width - (int)bits;
+    ip128 mask;
+    mask.lo = host >= 64 ? ~0ULL : host == 0 ? 0 : (1ULL << host) - 1;
+    mask.hi = host > 64 ? (host >= 128 ? ~0ULL : (1ULL << (host - 64)) - 1) : 0;
+    out->start.hi = ip.hi & ~mask.hi;
+    out->start.lo = ip.lo & ~mask.lo;
+    out->end.hi = out->start.hi | mask.hi;
+    out->end.lo = out->start.lo | mask.lo;
+    out->bits = (uint8_t)bits;
+    return family;
+}
+
+static int
+cidr_builder_add(cidr_builder *b, int family, const cidr_prefix *p)
+{
+    cidr_prefix **list = family == 4 ? &b->v4 : &b->v6;
+    size_t *n = family == 4 ? &b->n4 : &b->n6;
+    size_t *cap = family == 4 ? &b->cap4 : &b->cap6;
+    if (*n == *cap) {
+        size_t ncap = *cap ? *cap * 2 : 1024;
+        cidr_prefix *q = realloc(*list, ncap * sizeof(cidr_prefix));
+        if (q == NULL)
+            return -1;
+        *list = q;
+        *cap = ncap;
+    }
+    (*list)[(*n)++] = *p;
+    return 0;
+}
+
+static void
+cidr_builder_free(cidr_builder *b)
+{
+    free(b->v4);
+    free(b->v6);
+    table_cells_free(&b->tc);
+}
+
+static int
+cidr_add_line(void *arg, const char *key, uint32_t row, long lineno)
+{
+    cidr_builder *b = arg;
+    cidr_prefix prefix;
+    int family = cidr_parse_prefix(key, &prefix);
+    if (family == 0) {
+        PyErr_Format(PyExc_ValueError, "CIDR table line %ld: invalid prefix: %s", lineno, key);
+        return -1;
+    }
+    prefix.row = row;
+    prefix.order = (uint32_t)(b->n4 + b->n6);
+    if (cidr_builder_add(b, family, &prefix) != 0) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+// Lay out a table built from CSV exactly like a saved file.
+static int
+cidr_build(CidrTableInstance *self, const char *text, size_t len)
+{
+    cidr_builder b;
+    cidr_ranges r4 = {0}, r6 = {0};
+    memset(&b, 0, sizeof(b));
+
+    if (read_csv_table(text, len, "CIDR table", &b.tc, cidr_add_line, &b) != 0)
+        goto fail;
+
+    qsort(b.v4, b.n4, sizeof(cidr_prefix), cidr_prefix_order);
+    qsort(b.v6, b.n6, sizeof(cidr_prefix), cidr_prefix_order);
+    if (cidr_flatten(b.v4, b.n4, (ip128){0, 0xffffffffULL}, &r4) != 0 ||
+        cidr_flatten(b.v6, b.n6, (ip128){~0ULL, ~0ULL}, &r6) != 0) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    size_t size = sizeof(cidr_header) + r6.count * 20 + r4.count * 8 + b.tc.ncells * 4 + b.tc.blob_len;
+    char *base = malloc(size);
+    if (base == NULL) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    cidr_header *h = (cidr_header *)base;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CIDR_MAGIC, 8);
+    h->ncols = b.tc.ncols;
+    h->nrows = b.tc.nrows;
+    h->n4 = r4.count;
+    h->n6 = r6.count;
+    h->blob_size = b.tc.blob_len;
+
+    char *p = base + sizeof(cidr_header);
+    for (size_t i = 0; i < r6.count; i++)
+        ((uint64_t *)p)[i] = r6.start[i].hi;
+    p += r6.count * 8;
+    for (size_t i = 0; i < r6.count; i++)
+        ((uint64_t *)p)[i] = r6.start[i].lo;
+    p += r6.count * 8;
+    for (size_t i = 0; i < r4.count; i++)
+        ((uint32_t *)p)[i] = (uint32_t)r4.start[i].lo;
+    p += r4.count * 4;
+    memcpy(p, r4.row, r4.count * 4);
+    p += r4.count * 4;
+    memcpy(p, r6.row, r6.count * 4);
+    p += r6.count * 4;
+    memcpy(p, b.tc.cells, b.tc.ncells * 4);
+    p += b.tc.ncells * 4;
+    memcpy(p, b.tc.blob, b.tc.blob_len);
+
+    free(r4.start);
+    free(r4.row);
+    free(r6.start);
+    free(r6.row);
+    cidr_builder_free(&b);
+
+    if (cidr_attach(self, base, size) != 0) {
+        free(base);
+        return -1;
+    }
+    return 0;
+
+fail:
+    free(r4.start);
+    free(r4.row);
+    free(r6.start);
+    free(r6.row);
+    cidr_builder_free(&b);
+    return -1;
+}
+
+// --- CidrTable type ---
+
+static void
+cidr_release(CidrTableInstance *self)
+{
+    if (self->base != NULL) {
+        if (self->mapped)
+            unmap_file(self->base, self->size);
+        else
+            free(self->base);
+    }
+    self->base = NULL;
+    self->hdr = NULL;
+    Py_CLEAR(self->columns);
+}
+
+static int
+cidr_init(CidrTableInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"path", NULL};
+    PyObject *path_obj;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&", kwlist,
+                                     PyUnicode_FSConverter, &path_obj))
+        return -1;
+    const char *path = PyBytes_AS_STRING(path_obj);
+
+    cidr_release(self);
+
+    struct stat st;
+    size_t size;
+    char *map = map_file(path, &size, &st);
+    if (map == NULL) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        Py_DECREF(path_obj);
+        return -1;
+    }
+
+    int rc;
+    if (size >= sizeof(cidr_header) && memcmp(map, CIDR_MAGIC, 8) == 0) {
+        self->mapped = 1;
+        rc = cidr_attach(self, map, size);
+        if (rc != 0)
+            unmap_file(map, size);
+    } else {
+        self->mapped = 0;
+        rc = cidr_build(self, map, size);
+        unmap_file(map, size);
+    }
+    Py_DECREF(path_obj);
+    return rc;
+}
+
+static void
+cidr_dealloc(CidrTableInstance *self)
+{
+    cidr_release(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int
+cidr_check(CidrTableInstance *self)
+{
+    if (self->hdr == NULL) {
+        PyErr_SetString(PyExc_ValueError, "CidrTable is not loaded");
+        return -1;
+    }
+    return 0;
+}
+
+// attrs = table.lookup("10.1.2.3")
+static PyObject*
+cidr_lookup(CidrTableInstance *self, PyObject *args)
+{
+    const char *ip;
+    if (!PyArg_ParseTuple(args, "s", &ip) || cidr_check(self) != 0)
+        return NULL;
+
+    uint32_t row = cidr_lookup_text(self, ip);
+    if (row == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    PyObject *result = PyDict_New();
+    if (result != NULL && table_row_fill(self->cells, self->blob, self->hdr->ncols, row,
+                                         self->columns, VALUES_STR, result) != 0)
+        Py_CLEAR(result);
+    return result;
+}
+
+// table.save(path): write the compiled table for mmapped loading
+static PyObject*
+cidr_save(CidrTableInstance *self, PyObject *args)
+{
+    PyObject *path_obj;
+    if (!PyArg_ParseTuple(args, "O&", PyUnicode_FSConverter, &path_obj))
+        return NULL;
+    if (cidr_check(self) != 0) {
+        Py_DECREF(path_obj);
+        return NULL;
+    }
+
+    int rc = write_file_atomic(PyBytes_AS_STRING(path_obj), self->base, self->size);
+    Py_DECREF(path_obj);
+    if (rc != 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+cidr_get_columns(CidrTableInstance *self, void *closure)
+{
+    (void)closure;
+    if (cidr_check(self) != 0)
+        return NULL;
+    Py_INCREF(self->columns);
+    return self->columns;
+}
+
+static Py_ssize_t
+cidr_length(CidrTableInstance *self)
+{
+    if (self->hdr == NULL)
+        return 0;
+    return (Py_ssize_t)(self->hdr->n4 + self->hdr->n6);
+}
+
+static PyMethodDef cidr_methods[] = {
+    {"lookup", (PyCFunction)cidr_lookup, METH_VARARGS,
+        "Attributes of the most specific prefix holding an address, or None."},
+    {"save", (PyCFunction)cidr_save, METH_VARARGS,
+        "Write the compiled table to a file that loads by mmap."},
+    {NULL}
+};
+
+static PyGetSetDef cidr_getset[] = {
+    {"columns", (getter)cidr_get_columns, NULL, "attribute column names", NULL},
+    {NULL}
+};
+
+static PySequenceMethods cidr_as_sequence = {
+    (lenfunc)cidr_length,                /* sq_length */
+};
+
+static PyTypeObject CidrTableType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." CIDR_TYPE_NAME,      /* tp_name */
+    sizeof(CidrTableInstance),           /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)cidr_dealloc,            /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    0,                                   /* tp_repr */
+    0,                                   /* tp_as_number */
+    &cidr_as_sequence,                   /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    CIDR_DOCSTRING,                      /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    cidr_methods,                        /* tp_methods */
+    0,                                   /* tp_members */
+    cidr_getset,                         /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)cidr_init,                 /* tp_init */
+    0,                                   /* tp_alloc */
+    PyType_GenericNew,                   /* tp_new */
+};
+
+//----------------------------------------------------------------------------
+// key/value tables (mmapped, hash-indexed, swapped when the file changes)
+//----------------------------------------------------------------------------
+
+// File layout, written by KVTable.build() and only ever mmapped:
+//
+//   kv_header
+//   uint32_t slots[nslots]              key index + 1, 0 = empty (linear probing
+//                                       on hash_bytes(key))
+//   uint32_t key_off[nkeys], key_len[nkeys], key_row[nkeys]
+//   uint32_t cells[(nrows + 1) * ncols] blob offsets; row 0 holds the column names
+//   char blob[blob_size]                NUL-terminated keys and cell text
+//
+// All integers are in native byte order.
+
+#define KV_MAGIC "LNKVT01"
+
+typedef struct {
+    char magic[8];
+    uint32_t ncols;
+    uint32_t nrows;          // distinct attribute rows, excluding the names
+    uint64_t nkeys;
+    uint64_t nslots;         // power of two
+    uint64_t blob_size;
+} kv_header;
+
+// One mapping of a table file; replaced as a whole on reload.
+typedef struct {
+    char *base;
+    size_t size;
+    const kv_header *hdr;
+    const uint32_t *slots, *key_off, *key_len, *key_row, *cells;
+    const char *blob;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+} kv_map;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *path;          // file system path (bytes)
+    kv_map map;
+    PyObject *columns;       // tuple of column names
+    double check_interval;   // seconds between file checks, 0 = never
+    double next_check;
+} KVTableInstance;
+
+static PyTypeObject KVTableType;
+
+// Map and validate the table file at `path`.  Returns -1 with an exception
+// set.
+static int
+kv_map_open(const char *path, kv_map *m)
+{
+    struct stat st;
+    size_t size;
+    char *base = map_file(path, &size, &st);
+    if (base == NULL) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return -1;
+    }
+
+    const kv_header *h = (const kv_header *)base;
+    if (size < sizeof(kv_header) || memcmp(h->magic, KV_MAGIC, 8) != 0) {
+        unmap_file(base, size);
+        PyErr_Format(PyExc_ValueError, "not a KV table file: %s", path);
+        return -1;
+    }
+
+    uint64_t ncells = ((uint64_t)h->nrows + 1) * h->ncols;
+    if (h->nkeys > size || h->nslots > size || ncells > size || h->blob_size > size ||
+        (h->nslots & (h->nslots - 1)) != 0 || h->nslots <= h->nkeys ||
+        sizeof(kv_header) + h->nslots * 4 + h->nkeys * 12 + ncells * 4 + h->blob_size != size ||
+        h->blob_size == 0 || base[size - 1] != '\0')
+        goto corrupt;
+
+    char *p = base + sizeof(kv_header);
+    m->slots = (const uint32_t *)p;
+    p += h->nslots * 4;
+    m->key_off = (const uint32_t *)p;
+    p += h->nkeys * 4;
+    m->key_len = (const uint32_t *)p;
+    p += h->nkeys * 4;
+    m->key_row = (const uint32_t *)p;
+    p += h->nkeys * 4;
+    m->cells = (const uint32_t *)p;
+    p += ncells * 4;
+    m->blob = p;
+
+    // kv_find() probes until it meets an empty slot, so every key must
+    // take exactly one slot and leave the rest empty
+    uint64_t used = 0;
+    for (uint64_t i = 0; i < h->nslots; i++) {
+        if (m->slots[i] > h->nkeys)
+            goto corrupt;
+        used += m->slots[i] != 0;
+    }
+    if (used != h->nkeys)
+        goto corrupt;
+    for (uint64_t i = 0; i < h->nkeys; i++) {
+        if ((uint64_t)m->key_off[i] + m->key_len[i] >= h->blob_size || m->key_row[i] == 0 ||
+            m->key_row[i] > h->nrows)
+            goto corrupt;
+    }
+    for (uint64_t i = 0; i < ncells; i++) {
+        if (m->cells[i] >= h->blob_size)
+            goto corrupt;
+    }
+
+    m->base = base;
+    m->size = size;
+    m->hdr = h;
+    m->dev = st.st_dev;
+    m->ino = st.st_ino;
+    m->mtime = st.st_mtime;
+    return 0;
+
+corrupt:
+    unmap_file(base, size);
+    PyErr_Format(PyExc_ValueError, "corrupt KV table file: %s", path);
+    return -1;
+}
+
+static void
+kv_map_close(kv_map *m)
+{
+    if (m->base != NULL)
+        unmap_file(m->base, m->size);
+    memset(m, 0, sizeof(*m));
+}
+
+// Row of `key`, 0 if it is not in the table.
+static uint32_t
+kv_find(const kv_map *m, const char *key, size_t len)
+{
+    uint64_t mask = m->hdr->nslots - 1;
+    for (uint64_t i = hash_bytes(key, len) & mask;; i = (i + 1) & mask) {
+        uint32_t k = m->slots[i];
+        if (k == 0)
+            return 0;
+        k--;
+        if (m->key_len[k] == len && memcmp(m->blob + m->key_off[k], key, len) == 0)
+            return m->key_row[k];
+    }
+}
+
+// Switch to the file currently at the table's path if it was replaced.
+// Returns 1 when swapped, 0 when unchanged, -1 with an exception set.
+// Lookups run with the GIL held, so the old mapping can go right away.
+static int
+kv_reload(KVTableInstance *self)
+{
+    const char *path = PyBytes_AS_STRING(self->path);
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return -1;
+    }
+    if (st.st_dev == self->map.dev && st.st_ino == self->map.ino &&
+        st.st_mtime == self->map.mtime && (size_t)st.st_size == self->map.size)
+        return 0;
+
+    kv_map fresh;
+    if (kv_map_open(path, &fresh) != 0)
+        return -1;
+
+    // enrich() precomputed its output keys from the old columns
+    PyObject *columns = table_columns(fresh.cells, fresh.blob, fresh.hdr->ncols);
+    int same = columns ? PyObject_RichCompareBool(columns, self->columns, Py_EQ) : -1;
+    Py_XDECREF(columns);
+    if (same != 1) {
+        kv_map_close(&fresh);
+        if (same == 0)
+            PyErr_Format(PyExc_ValueError, "KV table columns changed: %s", path);
+        return -1;
+    }
+
+    kv_map_close(&self->map);
+    self->map = fresh;
+    return 1;
+}
+
+// Periodic replacement check done by lookups; failures keep the current
+// mapping.
+static void
+kv_maybe_reload(KVTableInstance *self)
+{
+    if (self->check_interval <= 0)
+        return;
+    double now = monotonic_now();
+    if (now < self->next_check)
+        return;
+    self->next_check = now + self->check_interval;
+
+    PyObject *type, *value, *tb;
+    PyErr_Fetch(&type, &value, &tb);
+    if (kv_reload(self) < 0)
+        PyErr_Clear();
+    PyErr_Restore(type, value, tb);
+}
+
+static uint32_t
+kv_lookup_text(KVTableInstance *self, const char *key, size_t len)
+{
+    kv_maybe_reload(self);
+    return kv_find(&self->map, key, len);
+}
+
+// --- building a table file from CSV ---
+
+typedef struct {
+    table_cells tc;
+    strmap keys;             // key -> index + 1
+    uint32_t *key_off, *key_row;
+    uint32_t *key_len;
+    size_t nkeys, cap;
+} kv_builder;
+
+static int
+kv_add_line(void *arg, const char *key, uint32_t row, long lineno)
+{
+    kv_builder *b = arg;
+    size_t len = strlen(key);
+    (void)lineno;
+
+    strmap_entry *e = strmap_insert(&b->keys, key, len, hash_bytes(key, len));
+    if (e == NULL)
+        goto nomem;
+    if (e->value != NULL) {             // later lines win
+        b->key_row[(uintptr_t)e->value - 1] = row;
+        return 0;
+    }
+    if (b->nkeys == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 1024;
+        uint32_t *off = realloc(b->key_off, cap * sizeof(uint32_t));
+        if (off == NULL)
+            goto nomem;
+        b->key_off = off;
+        uint32_t *rows = realloc(b->key_row, cap * sizeof(uint32_t));
+        if (rows == NULL)
+            goto nomem;
+        b->key_row = rows;
+        uint32_t *lens = realloc(b->key_len, cap * sizeof(uint32_t));
+        if (lens == NULL)
+            goto nomem;
+        b->key_len = lens;
+        b->cap = cap;
+    }
+    int64_t off = table_blob_add(&b->tc, key, len);
+    if (off < 0 || b->nkeys >= UINT32_MAX - 1)
+        goto nomem;
+    b->key_off[b->nkeys] = (uint32_t)off;
+    b->key_len[b->nkeys] = (uint32_t)len;
+    b->key_row[b->nkeys] = row;
+    e->value = (void *)(uintptr_t)++b->nkeys;
+    return 0;
+
+nomem:
+    PyErr_NoMemory();
+    return -1;
+}
+
+// KVTable.build(source, path)
+static PyObject*
+kv_build(PyObject *cls, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"source", "path", NULL};
+    PyObject *source_obj, *path_obj;
+    (void)cls;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&O&", kwlist,
+                                     PyUnicode_FSConverter, &source_obj,
+                                     PyUnicode_FSConverter, &path_obj))
+        return NULL;
+
+    PyObject *result = NULL;
+    kv_builder b;
+    char *base = NULL;
+    struct stat st;
+    size_t text_len;
+    memset(&b, 0, sizeof(b));
+
+    char *text = map_file(PyBytes_AS_STRING(source_obj), &text_len, &st);
+    if (text == NULL) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(source_obj));
+        goto done;
+    }
+    int rc = read_csv_table(text, text_len, "KV table", &b.tc, kv_add_line, &b);
+    unmap_file(text, text_len);
+    if (rc != 0)
+        goto done;
+
+    uint64_t nslots = 16;
+    while (nslots < (uint64_t)b.nkeys * 2)
+        nslots *= 2;
+    size_t size = sizeof(kv_header) + nslots * 4 + b.nkeys * 12 + b.tc.ncells * 4 + b.tc.blob_len;
+    base = calloc(1, size);
+    if (base == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    kv_header *h = (kv_header *)base;
+    memcpy(h->magic, KV_MAGIC, 8);
+    h->ncols = b.tc.ncols;
+    h->nrows = b.tc.nrows;
+    h->nkeys = b.nkeys;
+    h->nslots = nslots;
+    h->blob_size = b.tc.blob_len;
+
+    uint32_t *slots = (uint32_t *)(base + sizeof(kv_header));
+    char *p = (char *)(slots + nslots);
+    for (size_t k = 0; k < b.nkeys; k++) {
+        uint64_t i = hash_bytes(b.tc.blob + b.key_off[k], b.key_len[k]) & (nslots - 1);
+        while (slots[i] != 0)
+            i = (i + 1) & (nslots - 1);
+        slots[i] = (uint32_t)k + 1;
+    }
+    memcpy(p, b.key_off, b.nkeys * 4);
+    p += b.nkeys * 4;
+    memcpy(p, b.key_len, b.nkeys * 4);
+    p += b.nkeys * 4;
+    memcpy(p, b.key_row, b.nkeys * 4);
+    p += b.nkeys * 4;
+    memcpy(p, b.tc.cells, b.tc.ncells * 4);
+    p += b.tc.ncells * 4;
+    memcpy(p, b.tc.blob, b.tc.blob_len);
+
+    if (write_file_atomic(PyBytes_AS_STRING(path_obj), base, size) == 0) {
+        Py_INCREF(Py_None);
+        result = Py_None;
+    }
+
+done:
+    free(base);
+    free(b.key_off);
+    free(b.key_len);
+    free(b.key_row);
+    strmap_clear(&b.keys, NULL);
+    table_cells_free(&b.tc);
+    Py_DECREF(source_obj);
+    Py_DECREF(path_obj);
+    return result;
+}
+
+// --- KVTable type ---
+
+static int
+kv_init(KVTableInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"path", "check_interval", NULL};
+    PyObject *path_obj;
+    double check_interval = 1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|$d", kwlist,
+                                     PyUnicode_FSConverter, &path_obj, &check_interval))
+        return -1;
+
+    kv_map map;
+    if (kv_map_open(PyBytes_AS_STRING(path_obj), &map) != 0) {
+        Py_DECREF(path_obj);
+        return -1;
+    }
+    PyObject *columns = table_columns(map.cells, map.blob, map.hdr->ncols);
+    if (columns == NULL) {
+        kv_map_close(&map);
+        Py_DECREF(path_obj);
+        return -1;
+    }
+
+    kv_map_close(&self->map);
+    self->map = map;
+    Py_XDECREF(self->columns);
+    self->columns = columns;
+    Py_XDECREF(self->path);
+    self->path = path_obj;
+    self->check_interval = check_interval;
+    self->next_check = monotonic_now() + check_interval;
+    return 0;
+}
+
+static void
+kv_dealloc(KVTableInstance *self)
+{
+    kv_map_close(&self->map);
+    Py_XDECREF(self->columns);
+    Py_XDECREF(self->path);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int
+kv_check(KVTableInstance *self)
+{
+    if (self->map.hdr == NULL) {
+        PyErr_SetString(PyExc_ValueError, "KVTable is not loaded");
+        return -1;
+    }
+    return 0;
+}
+
+// attrs = table.lookup("key")
+static PyObject*
+kv_lookup(KVTableInstance *self, PyObject *args)
+{
+    const char *key;
+    Py_ssize_t len;
+    if (!PyArg_ParseTuple(args, "s#", &key, &len) || kv_check(self) != 0)
+        return NULL;
+
+    uint32_t row = kv_lookup_text(self, key, (size_t)len);
+    if (row == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    PyObject *result = PyDict_New();
+    if (result != NULL && table_row_fill(self->map.cells, self->map.blob, self->map.hdr->ncols,
+                                         row, self->columns, VALUES_STR, result) != 0)
+        Py_CLEAR(result);
+    return result;
+}
+
+// swapped = table.reload()
+static PyObject*
+kv_reload_method(KVTableInstance *self, PyObject *unused)
+{
+    (void)unused;
+    if (kv_check(self) != 0)
+        return NULL;
+    int rc = kv_reload(self);
+    if (rc < 0)
+        return NULL;
+    self->next_check = monotonic_now() + self->check_interval;
+    return PyBool_FromLong(rc);
+}
+
+static PyObject*
+kv_get_columns(KVTableInstance *self, void *closure)
+{
+    (void)closure;
+    if (kv_check(self) != 0)
+        return NULL;
+    Py_INCREF(self->columns);
+    return self->columns;
+}
+
+static Py_ssize_t
+kv_length(KVTableInstance *self)
+{
+    return self->map.hdr ? (Py_ssize_t)self->map.hdr->nkeys : 0;
+}
+
+static PyMethodDef kv_methods[] = {
+    {"build", (PyCFunction)kv_build, METH_VARARGS | METH_KEYWORDS | METH_STATIC,
+        "Compile a CSV file into a KV table file."},
+    {"lookup", (PyCFunction)kv_lookup, METH_VARARGS,
+        "Attributes stored for a key, or None."},
+    {"reload", (PyCFunction)kv_reload_method, METH_NOARGS,
+        "Switch to the file at the table's path if it was replaced."},
+    {NULL}
+};
+
+static PyGetSetDef kv_getset[] = {
+    {"columns", (getter)kv_get_columns, NULL, "attribute column names", NULL},
+    {NULL}
+};
+
+static PySequenceMethods kv_as_sequence = {
+    (lenfunc)kv_length,                  /* sq_length */
+};
+
+static PyTypeObject KVTableType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." KV_TYPE_NAME,        /* tp_name */
+    sizeof(KVTableInstance),             /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)kv_dealloc,              /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    0,                                   /* tp_repr */
+    0,                                   /* tp_as_number */
+    &kv_as_sequence,                     /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    KV_DOCSTRING,                        /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    kv_methods,                          /* tp_methods */
+    0,                                   /* tp_members */
+    kv_getset,                           /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)kv_init,                   /* tp_init */
+    0,                                   /* tp_alloc */
+    PyType_GenericNew,                   /* tp_new */
+};
+
+//----------------------------------------------------------------------------
+// enrichment stage (CidrTable / KVTable lookups during conversion)
+//----------------------------------------------------------------------------
+
+// lognorm.enrich(table, fields, prefix = None)
+static PyObject*
+liblognorm_enrich(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"table", "fields", "prefix", NULL};
+    PyObject *table, *fields, *columns;
+    const char *prefix = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|z", kwlist, &table, &fields, &prefix))
+        return NULL;
+    if (PyObject_TypeCheck(table, &CidrTableType)) {
+        if (cidr_check((CidrTableInstance *)table) != 0)
+            return NULL;
+        columns = ((CidrTableInstance *)table)->columns;
+    } else if (PyObject_TypeCheck(table, &KVTableType)) {
+        if (kv_check((KVTableInstance *)table) != 0)
+            return NULL;
+        columns = ((KVTableInstance *)table)->columns;
+    } else {
+        PyErr_SetString(PyExc_TypeError, "table must be a CidrTable or KVTable");
+        return NULL;
+    }
+
+    PyObject *names = PyUnicode_Check(fields) ? PyTuple_Pack(1, fields) : PySequence_Tuple(fields);
+    if (names == NULL)
+        return NULL;
+    if (self->enrichments == NULL && (self->enrichments = PyList_New(0)) == NULL) {
+        Py_DECREF(names);
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(names); i++) {
+        PyObject *field = PyTuple_GET_ITEM(names, i);
+        if (!PyUnicode_Check(field)) {
+            PyErr_SetString(PyExc_TypeError, "enrich fields must be str");
+            Py_DECREF(names);
+            return NULL;
+        }
+
+        // output keys "<prefix><column>", prefix defaulting to "<field>_"
+        PyObject *pfx = prefix ? PyUnicode_FromString(prefix) : PyUnicode_FromFormat("%U_", field);
+        PyObject *keys = pfx ? PyTuple_New(PyTuple_GET_SIZE(columns)) : NULL;
+        for (Py_ssize_t c = 0; keys != NULL && c < PyTuple_GET_SIZE(columns); c++) {
+            PyObject *key = PyUnicode_Concat(pfx, PyTuple_GET_ITEM(columns, c));
+            if (key == NULL) {
+                Py_CLEAR(keys);
+                break;
+            }
+            PyUnicode_InternInPlace(&key);
+            PyTuple_SET_ITEM(keys, c, key);
+        }
+        Py_XDECREF(pfx);
+
+        PyObject *entry = keys ? PyTuple_Pack(3, table, field, keys) : NULL;
+        Py_XDECREF(keys);
+        if (entry == NULL || PyList_Append(self->enrichments, entry) != 0) {
+            Py_XDECREF(entry);
+            Py_DECREF(names);
+            return NULL;
+        }
+        Py_DECREF(entry);
+    }
+    Py_DECREF(names);
+    Py_RETURN_NONE;
+}
+
+// Add the table attributes for every enriched field of `obj` to `target`.
+static int
+enrich_event(json_object *obj, PyObject *target, const conv_state *cv)
+{
+    PyObject *list = cv->ctx->enrichments;
+
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(list); i++) {
+        PyObject *entry = PyList_GET_ITEM(list, i);
+        PyObject *table = PyTuple_GET_ITEM(entry, 0);
+        const char *field = PyUnicode_AsUTF8(PyTuple_GET_ITEM(entry, 1));
+        PyObject *keys = PyTuple_GET_ITEM(entry, 2);
+        json_object *value;
+        size_t len;
+
+        if (field == NULL)
+            return -1;
+        if (!json_object_object_get_ex(obj, field, &value))
+            continue;
+        const char *text = flt_text(value, &len);
+        if (text == NULL)
+            continue;
+
+        if (Py_TYPE(table) == &CidrTableType) {
+            CidrTableInstance *t = (CidrTableInstance *)table;
+            // re-initialized since enrich(): unloaded, or other columns
+            if (t->hdr == NULL || t->hdr->ncols != (uint32_t)PyTuple_GET_SIZE(keys))
+                continue;
+            uint32_t row = cidr_lookup_text(t, text);
+            if (row != 0 && table_row_fill(t->cells, t->blob, t->hdr->ncols, row, keys,
+                                           cv->values, target) != 0)
+                return -1;
+        } else {
+            KVTableInstance *t = (KVTableInstance *)table;
+            if (t->map.hdr == NULL || t->map.hdr->ncols != (uint32_t)PyTuple_GET_SIZE(keys))
+                continue;
+            uint32_t row = kv_lookup_text(t, text, len);
+            if (row != 0 && table_row_fill(t->map.cells, t->map.blob, t->map.hdr->ncols, row,
+                                           keys, cv->values, target) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+// redaction of personal data right after parsing
+//----------------------------------------------------------------------------
+
+// SipHash-2-4 (Aumasson & Bernstein), a keyed 64-bit PRF.
+#define SIP_ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND(v0, v1, v2, v3)                                               \
+    do {                                                                        \
+        v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32);       \
+        v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2;                              \
+        v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0;                              \
+        v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32);       \
+    } while (0)
+
+static uint64_t
+load_le64(const unsigned char *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t
+siphash24(const uint64_t key[2], const char *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+    size_t blocks = len / 8;
+
+    for (size_t i = 0; i < blocks; i++, p += 8) {
+        uint64_t m = load_le64(p);
+        v3 ^= m;
+        SIP_ROUND(v0, v1, v2, v3);
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    uint64_t b = (uint64_t)len << 56;
+    for (size_t i = 0; i < len % 8; i++)
+        b |= (uint64_t)p[i] << (8 * i);
+    v3 ^= b;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; i++)
+        SIP_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// Zero the bits of `b` after the first `bits`.
+static void
+mask_prefix(unsigned char *b, size_t size, int bits)
+{
+    for (size_t i = 0; i < size; i++) {
+        int keep = bits - (int)(i * 8);
+        if (keep <= 0)
+            b[i] = 0;
+        else if (keep < 8)
+            b[i] &= (unsigned char)(0xff << (8 - keep));
+    }
+}
+
+// Address text truncated to its network prefix; json null when `text` is
+// not an address.  IPv4-mapped IPv6 addresses keep `v4_prefix` bits of
+// the IPv4 part.
+static json_object*
+redact_truncate(const redact_rule *r, const char *text)
+{
+    unsigned char b[16];
+    char out[INET6_ADDRSTRLEN];
+    static const unsigned char mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+    if (inet_pton(AF_INET, text, b) == 1) {
+        mask_prefix(b, 4, r->v4_prefix);
+        inet_ntop(AF_INET, b, out, sizeof(out));
+    } else if (inet_pton(AF_INET6, text, b) == 1) {
+        if (memcmp(b, mapped, sizeof(mapped)) == 0)
+            mask_prefix(b + 12, 4, r->v4_prefix);
+        else
+            mask_prefix(b, 16, r->v6_prefix);
+        inet_ntop(AF_INET6, b, out, sizeof(out));
+    } else {
+        return NULL;
+    }
+    return json_object_new_string(out);
+}
+
+// Code points of UTF-8 text (continuation bytes are not counted).
+static size_t
+utf8_length(const char *s, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+        n += ((unsigned char)s[i] & 0xc0) != 0x80;
+    return n;
+}
+
+// Byte offset of code point `n`.
+static size_t
+utf8_offset(const char *s, size_t len, size_t n)
+{
+    size_t i = 0;
+    for (; i < len; i++) {
+        if (((unsigned char)s[i] & 0xc0) != 0x80 && n-- == 0)
+            break;
+    }
+    return i;
+}
+
+// `text` with every code point replaced by the mask character, except the
+// first keep_start and last keep_end ones and the part from the last
+// `keep_after` on.  When the kept parts would cover everything before
+// `keep_after`, all of it is masked.
+static json_object*
+redact_mask(const redact_rule *r, const char *text, size_t len)
+{
+    size_t cut = len;
+    if (r->keep_after != NULL) {
+        size_t n = strlen(r->keep_after);
+        for (size_t i = len >= n ? len - n + 1 : 0; i-- > 0;) {
+            if (memcmp(text + i, r->keep_after, n) == 0) {
+                cut = i;
+                break;
+            }
+        }
+    }
+
+    size_t chars = utf8_length(text, cut);
+    size_t keep_start = (size_t)r->keep_start;
+    size_t keep_end = (size_t)r->keep_end;
+    if (keep_start + keep_end >= chars)
+        keep_start = keep_end = 0;
+    size_t head = utf8_offset(text, cut, keep_start);
+    size_t tail = utf8_offset(text, cut, chars - keep_end);
+    size_t masked = chars - keep_start - keep_end;
+
+    char *out = malloc(head + masked + (len - tail) + 1);
+    if (out == NULL)
+        return NULL;
+    memcpy(out, text, head);
+    memset(out + head, r->mask, masked);
+    memcpy(out + head + masked, text + tail, len - tail);
+    json_object *value = json_object_new_string_len(out, (int)(head + masked + len - tail));
+    free(out);
+    return value;
+}
+
+// Apply the redact() rules to a freshly parsed event.  A field whose
+// replacement cannot be allocated is removed rather than left readable.
+static void
+redact_event(ObjectInstance *self, json_object *event)
+{
+    for (size_t i = 0; i < self->nredactions; i++) {
+        const redact_rule *r = &self->redactions[i];
+        const char *key;
+        json_object *parent = path_parent(event, r->path, r->depth, &key);
+        json_object *value;
+        size_t len;
+
+        if (parent == NULL || !json_object_object_get_ex(parent, key, &value))
+            continue;
+        if (json_object_get_type(value) == json_type_null)
+            continue;
+        const char *text = flt_text(value, &len);
+        if (text == NULL)
+            continue;
+
+        json_object *redacted;
+        if (r->action == REDACT_HASH) {
+            char digest[17];
+            snprintf(digest, sizeof(digest), "%016llx",
+                     (unsigned long long)siphash24(r->key, text, len));
+            redacted = json_object_new_string(digest);
+        } else if (r->action == REDACT_TRUNCATE) {
+            redacted = redact_truncate(r, text);
+            if (redacted == NULL) {
+                json_object_object_add(parent, key, NULL);
+                continue;
+            }
+        } else {
+            redacted = redact_mask(r, text, len);
+        }
+        if (redacted == NULL)
+            json_object_object_del(parent, key);
+        else
+            json_object_object_add(parent, key, redacted);
+    }
+}
+
+static void
+redactions_clear(ObjectInstance *self)
+{
+    for (size_t i = 0; i < self->nredactions; i++) {
+        free(self->redactions[i].path);
+        free(self->redactions[i].keep_after);
+    }
+    PyMem_Free(self->redactions);
+    self->redactions = NULL;
+    self->nredactions = 0;
+}
+
+// lognorm.redact(fields, action, key = None, v4_prefix = 24, v6_prefix = 48,
+//                keep_start = 0, keep_end = 0, keep_after = None, mask = "*")
+static PyObject*
+liblognorm_redact(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {
+        "fields", "action", "key", "v4_prefix", "v6_prefix", "keep_start", "keep_end",
+        "keep_after", "mask", NULL
+    };
+    PyObject *fields;
+    const char *action;
+    Py_buffer key = {NULL, NULL};
+    redact_rule rule;
+    const char *keep_after = NULL;
+    const char *mask = "*";
+
+    memset(&rule, 0, sizeof(rule));
+    rule.v4_prefix = 24;
+    rule.v6_prefix = 48;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Os|$y*iinnzs", kwlist, &fields, &action,
+                                     &key, &rule.v4_prefix, &rule.v6_prefix, &rule.keep_start,
+                                     &rule.keep_end, &keep_after, &mask))
+        return NULL;
+
+    if (strcmp(action, "hash") == 0) {
+        rule.action = REDACT_HASH;
+        if (key.buf == NULL || key.len != 16) {
+            PyErr_SetString(PyExc_ValueError, "hash needs a 16-byte key");
+            goto error;
+        }
+        rule.key[0] = load_le64(key.buf);
+        rule.key[1] = load_le64((const unsigned char *)key.buf + 8);
+    } else if (strcmp(action, "truncate") == 0) {
+        rule.action = REDACT_TRUNCATE;
+        if (rule.v4_prefix < 0 || rule.v4_prefix > 32 ||
+            rule.v6_prefix < 0 || rule.v6_prefix > 128) {
+            PyErr_SetString(PyExc_ValueError, "v4_prefix must be 0-32 and v6_prefix 0-128");
+            goto error;
+        }
+    } else if (strcmp(action, "mask") == 0) {
+        rule.action = REDACT_MASK;
+        if (rule.keep_start < 0 || rule.keep_end < 0) {
+            PyErr_SetString(PyExc_ValueError, "keep_start and keep_end must not be negative");
+            goto error;
+        }
+        if (strlen(mask) != 1 || (mask[0] & 0x80) != 0) {
+            PyErr_SetString(PyExc_ValueError, "mask must be a single ASCII character");
+            goto error;
+        }
+        rule.mask = mask[0];
+    } else {
+        PyErr_Format(PyExc_ValueError, "action must be 'hash', 'truncate' or 'mask', not '%s'",
+                     action);
+        goto error;
+    }
+    if (key.buf != NULL)
+        PyBuffer_Release(&key);
+
+    PyObject *names = PyUnicode_Check(fields) ? PyTuple_Pack(1, fields) : PySequence_Tuple(fields);
+    if (names == NULL)
+        return NULL;
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(names); i++) {
+        PyObject *field = PyTuple_GET_ITEM(names, i);
+        Py_ssize_t len;
+        const char *name = PyUnicode_Check(field) ? PyUnicode_AsUTF8AndSize(field, &len) : NULL;
+        if (name == NULL) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_TypeError, "redact fields must be str");
+            Py_DECREF(names);
+            return NULL;
+        }
+
+        redact_rule *rules = PyMem_Realloc(self->redactions,
+                                           (self->nredactions + 1) * sizeof(redact_rule));
+        if (rules == NULL) {
+            Py_DECREF(names);
+            return PyErr_NoMemory();
+        }
+        self->redactions = rules;
+        redact_rule *r = &rules[self->nredactions];
+        *r = rule;
+        r->path = len > 0 ? path_compile(name, (size_t)len, &r->depth) : NULL;
+        r->keep_after = keep_after != NULL && *keep_after != '\0' ? strdup(keep_after) : NULL;
+        if (r->path == NULL || (keep_after != NULL && *keep_after != '\0' && r->keep_after == NULL)) {
+            free(r->path);
+            free(r->keep_after);
+            Py_DECREF(names);
+            if (len == 0) {
+                PyErr_SetString(PyExc_ValueError, "field names must not be empty");
+                return NULL;
+            }
+            return PyErr_NoMemory();
+        }
+        self->nredactions++;
+    }
+    Py_DECREF(names);
+    Py_RETURN_NONE;
+
+error:
+    if (key.buf != NULL)
+        PyBuffer_Release(&key);
+    return NULL;
+}
+
+//----------------------------------------------------------------------------
+// field mapping (rename / drop / nest / constants) applied during conversion
+//----------------------------------------------------------------------------
+
+static void
+mapping_free_value(void *value)
+{
+    Py_DECREF((PyObject *)value);
+}
+
+// Split a dotted target name into a tuple of interned keys.
+static PyObject*
+mapping_path(PyObject *name)
+{
+    if (!PyUnicode_Check(name)) {
+        PyErr_SetString(PyExc_TypeError, "mapping targets must be str or None");
+        return NULL;
+    }
+    PyObject *dot = PyUnicode_FromString(".");
+    PyObject *parts = dot ? PyUnicode_Split(name, dot, -1) : NULL;
+    Py_XDECREF(dot);
+    if (parts == NULL)
+        return NULL;
+
+    Py_ssize_t n = PyList_GET_SIZE(parts);
+    PyObject *path = PyTuple_New(n);
+    if (path == NULL) {
+        Py_DECREF(parts);
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *key = PyList_GET_ITEM(parts, i);
+        if (PyUnicode_GET_LENGTH(key) == 0) {
+            PyErr_Format(PyExc_ValueError, "invalid mapping target: %R", name);
+            Py_DECREF(parts);
+            Py_DECREF(path);
+            return NULL;
+        }
+        Py_INCREF(key);
+        PyUnicode_InternInPlace(&key);
+        PyTuple_SET_ITEM(path, i, key);
+    }
+    Py_DECREF(parts);
+    return path;
+}
+
+// Compile the `mapping` ({source: target or None}) and `constants`
+// ({target: value}) constructor arguments into the context.
+static int
+mapping_init(ObjectInstance *self, PyObject *mapping, PyObject *constants)
+{
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+
+    if (mapping != NULL && mapping != Py_None) {
+        if (!PyDict_Check(mapping)) {
+            PyErr_SetString(PyExc_TypeError, "mapping must be a dict");
+            return -1;
+        }
+        while (PyDict_Next(mapping, &pos, &key, &value)) {
+            Py_ssize_t len;
+            const char *name = PyUnicode_Check(key) ? PyUnicode_AsUTF8AndSize(key, &len) : NULL;
+            if (name == NULL) {
+                if (!PyErr_Occurred())
+                    PyErr_SetString(PyExc_TypeError, "mapping sources must be str");
+                return -1;
+            }
+            PyObject *path = value == Py_None ? Py_None : mapping_path(value);
+            if (path == NULL)
+                return -1;
+            if (path == Py_None)
+                Py_INCREF(path);
+
+            strmap_entry *e = strmap_insert(&self->field_map, name, (size_t)len,
+                                            hash_bytes(name, (size_t)len));
+            if (e == NULL) {
+                Py_DECREF(path);
+                PyErr_NoMemory();
+                return -1;
+            }
+            if (e->value != NULL)
+                Py_DECREF((PyObject *)e->value);
+            e->value = path;
+        }
+    }
+
+    if (constants != NULL && constants != Py_None) {
+        if (!PyDict_Check(constants)) {
+            PyErr_SetString(PyExc_TypeError, "constants must be a dict");
+            return -1;
+        }
+        self->constants = PyList_New(0);
+        if (self->constants == NULL)
+            return -1;
+        pos = 0;
+        while (PyDict_Next(constants, &pos, &key, &value)) {
+            PyObject *path = mapping_path(key);
+            PyObject *entry = path ? PyTuple_Pack(2, path, value) : NULL;
+            Py_XDECREF(path);
+            if (entry == NULL || PyList_Append(self->constants, entry) != 0) {
+                Py_XDECREF(entry);
+                return -1;
+            }
+            Py_DECREF(entry);
+        }
+    }
+    return 0;
+}
+
+// Store `value` (stolen) under `path` in `target`, creating intermediate
+// dicts; a non-dict already sitting on the path is replaced.
+static int
+mapping_store(PyObject *target, PyObject *path, PyObject *value)
+{
+    Py_ssize_t last = PyTuple_GET_SIZE(path) - 1;
+
+    for (Py_ssize_t i = 0; i < last; i++) {
+        PyObject *key = PyTuple_GET_ITEM(path, i);
+        PyObject *sub = PyDict_GetItemWithError(target, key);
+        if (sub == NULL && PyErr_Occurred())
+            goto fail;
+        if (sub == NULL || !PyDict_Check(sub)) {
+            sub = PyDict_New();
+            if (sub == NULL || PyDict_SetItem(target, key, sub) != 0) {
+                Py_XDECREF(sub);
+                goto fail;
+            }
+            Py_DECREF(sub);
+        }
+        target = sub;
+    }
+    int rc = PyDict_SetItem(target, PyTuple_GET_ITEM(path, last), value);
+    Py_DECREF(value);
+    return rc;
+
+fail:
+    Py_DECREF(value);
+    return -1;
+}
+
+// Top-level conversion of an event into `target`.  Without a mapping this
+// is fill_hash(); with one, mapped members go straight to their target
+// keys and constants are added last, so no intermediate dict is built.
+static int
+fill_event(json_object *obj, PyObject *target, const conv_state *cv, int reuse)
+{
+    ObjectInstance *self = cv->ctx;
+
+    if (self->field_map.count == 0 && self->constants == NULL) {
+        if (fill_hash(obj, target, cv, reuse) != 0)
+            return -1;
+        return self->enrichments ? enrich_event(obj, target, cv) : 0;
+    }
+
+    // mapped targets may be nested anywhere, so in-place refilling of
+    // nested dicts is not attempted
+    if (reuse)
+        PyDict_Clear(target);
+
+    struct json_object_iterator it = json_object_iter_begin(obj);
+    struct json_object_iterator itEnd = json_object_iter_end(obj);
+    for (; !json_object_iter_equal(&it, &itEnd); json_object_iter_next(&it)) {
+        const char *key = json_object_iter_peek_name(&it);
+        size_t len = strlen(key);
+        strmap_entry *e = strmap_find(&self->field_map, key, len, hash_bytes(key, len));
+        if (e != NULL && e->value == Py_None)
+            continue;
+
+        PyObject *value = convert_member(key, json_object_iter_peek_value(&it), cv);
+        if (value == NULL)
+            return -1;
+        if (e != NULL) {
+            if (mapping_store(target, (PyObject *)e->value, value) != 0)
+                return -1;
+        } else {
+            int rc = PyDict_SetItemString(target, key, value);
+            Py_DECREF(value);
+            if (rc != 0)
+                return -1;
+        }
+    }
+
+    for (Py_ssize_t i = 0; self->constants && i < PyList_GET_SIZE(self->constants); i++) {
+        PyObject *entry = PyList_GET_ITEM(self->constants, i);
+        PyObject *value = PyTuple_GET_ITEM(entry, 1);
+        Py_INCREF(value);
+        if (mapping_store(target, PyTuple_GET_ITEM(entry, 0), value) != 0)
+            return -1;
+    }
+    return self->enrichments ? enrich_event(obj, target, cv) : 0;
+}
+
+// Python dict for a whole event, going through the context's mapping.
+static PyObject*
+convert_event(json_object *obj, const conv_state *cv)
+{
+    if (json_object_get_type(obj) != json_type_object)
+        return convert_object(obj, cv);
+
+    PyObject *result = PyDict_New();
+    if (result == NULL)
+        return NULL;
+    if (fill_event(obj, result, cv, 0) != 0) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    return result;
+}
+
+//----------------------------------------------------------------------------
+// rulebase schema (field names taken from the retained rule sources)
+//----------------------------------------------------------------------------
+
+// Append (name, type) for one field of a rule sample.  "-" discards the
+// value and "." merges it into the event root, so neither names a field.
+static int
+rule_field_add(PyObject *fields, const char *name, size_t name_len,
+               const char *type, size_t type_len)
+{
+    if (name_len == 0 || (name_len == 1 && (*name == '-' || *name == '.')))
+        return 0;
+
+    PyObject *n = PyUnicode_DecodeUTF8(name, (Py_ssize_t)name_len, "replace");
+    PyObject *t = PyUnicode_DecodeUTF8(type, (Py_ssize_t)type_len, "replace");
+    PyObject *entry = (n && t) ? PyTuple_Pack(2, n, t) : NULL;
+    Py_XDECREF(n);
+    Py_XDECREF(t);
+    if (entry == NULL)
+        return -1;
+    int rc = PyList_Append(fields, entry);
+    Py_DECREF(entry);
+    return rc;
+}
+
+// Fields of a JSON field description.  Named parsers produce one field
+// (whatever they nest below it); unnamed ones such as "alternative" put
+// the fields of their sub-parsers at the level they appear on.
+static int
+rule_json_fields(json_object *desc, PyObject *fields)
+{
+    json_object *name, *type, *parser;
+
+    if (json_object_get_type(desc) == json_type_array) {
+        int n = json_object_array_length(desc);
+        for (int i = 0; i < n; i++) {
+            if (rule_json_fields(json_object_array_get_idx(desc, i), fields) != 0)
+                return -1;
+        }
+        return 0;
+    }
+    if (json_object_get_type(desc) != json_type_object)
+        return 0;
+
+    if (json_object_object_get_ex(desc, "name", &name) &&
+        json_object_get_type(name) == json_type_string) {
+        const char *tname = "";
+        size_t tlen = 0;
+        if (json_object_object_get_ex(desc, "type", &type) &&
+            json_object_get_type(type) == json_type_string) {
+            tname = json_object_get_string(type);
+            tlen = (size_t)json_object_get_string_len(type);
+        }
+        return rule_field_add(fields, json_object_get_string(name),
+                              (size_t)json_object_get_string_len(name), tname, tlen);
+    }
+    if (json_object_object_get_ex(desc, "parser", &parser))
+        return rule_json_fields(parser, fields);
+    return 0;
+}
+
+// End of the JSON text starting at `p` (one past its closing bracket),
+// NULL if it is not terminated before `end`.
+static const char*
+json_text_end(const char *p, const char *end)
+{
+    int depth = 0, quoted = 0;
+    for (; p < end; p++) {
+        if (quoted) {
+            if (*p == '\\')
+                p++;
+            else if (*p == '"')
+                quoted = 0;
+        } else if (*p == '"') {
+            quoted = 1;
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+        } else if ((*p == '}' || *p == ']') && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// Append the fields of one rule sample ("%name:type%", "%name:type:args%",
+// "%name:type{...}%" or "%{...}%" descriptions) to `fields`.
+static int
+rule_sample_fields(const char *p, const char *end, PyObject *fields)
+{
+    while (p < end && (p = memchr(p, '%', (size_t)(end - p))) != NULL) {
+        p++;
+        if (p < end && *p == '%') {         // "%%" is a literal percent sign
+            p++;
+            continue;
+        }
+
+        if (p < end && (*p == '{' || *p == '[')) {
+            const char *close = json_text_end(p, end);
+            if (close == NULL || close >= end || *close != '%')
+                return 0;                   // malformed, liblognorm rejected it anyway
+            char *text = PyMem_Malloc((size_t)(close - p) + 1);
+            if (text == NULL) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            memcpy(text, p, (size_t)(close - p));
+            text[close - p] = '\0';
+            json_object *desc = json_tokener_parse(text);
+            PyMem_Free(text);
+            if (desc != NULL) {
+                int rc = rule_json_fields(desc, fields);
+                json_object_put(desc);
+                if (rc != 0)
+                    return -1;
+            }
+            p = close + 1;
+            continue;
+        }
+
+        const char *name = p;
+        while (p < end && *p != ':' && *p != '%')
+            p++;
+        const char *name_end = p;
+        const char *type = p < end && *p == ':' ? ++p : p;
+        while (p < end && *p != ':' && *p != '{' && *p != '%')
+            p++;
+        const char *type_end = p;
+
+        if (p < end && *p == '{') {
+            p = json_text_end(p, end);
+            if (p == NULL)
+                return 0;
+        }
+        p = memchr(p, '%', (size_t)(end - p));
+        if (p == NULL)
+            return 0;
+        p++;
+
+        if (rule_field_add(fields, name, (size_t)(name_end - name),
+                           type, (size_t)(type_end - type)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// Called for every rule of the retained sources with the text of the
+// prefix= line in effect (empty if none), the tag list and the sample.
+typedef int (*rule_visit_fn)(void *arg, PyObject *origin, long lineno,
+                             span prefix, span tags, span sample);
+
+static int
+rulebase_walk(ObjectInstance *self, rule_visit_fn visit, void *arg)
+{
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(self->rule_sources); i++) {
+        PyObject *entry = PyList_GET_ITEM(self->rule_sources, i);
+        const char *p = PyBytes_AS_STRING(PyTuple_GET_ITEM(entry, 1));
+        const char *end = p + PyBytes_GET_SIZE(PyTuple_GET_ITEM(entry, 1));
+        span prefix = { "", 0 };
+
+        for (long lineno = 1; p < end; lineno++) {
+            const char *eol = memchr(p, '\n', (size_t)(end - p));
+            const char *line = p;
+            const char *line_end = eol ? eol : end;
+            p = eol ? eol + 1 : end;
+            if (line_end > line && line_end[-1] == '\r')
+                line_end--;
+
+            if (line_end - line >= 7 && memcmp(line, "prefix=", 7) == 0) {
+                prefix.ptr = line + 7;
+                prefix.len = (size_t)(line_end - prefix.ptr);
+                continue;
+            }
+            if (line_end - line < 5 || memcmp(line, "rule=", 5) != 0)
+                continue;
+            const char *colon = memchr(line + 5, ':', (size_t)(line_end - line - 5));
+            if (colon == NULL)
+                continue;
+            span tags = { line + 5, (size_t)(colon - line - 5) };
+            span sample = { colon + 1, (size_t)(line_end - colon - 1) };
+            if (visit(arg, PyTuple_GET_ITEM(entry, 0), lineno, prefix, tags, sample) != 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+all_fields_visit(void *arg, PyObject *origin, long lineno, span prefix, span tags, span sample)
+{
+    if (rule_sample_fields(prefix.ptr, prefix.ptr + prefix.len, (PyObject *)arg) != 0 ||
+        rule_sample_fields(sample.ptr, sample.ptr + sample.len, (PyObject *)arg) != 0)
+        return -1;
+    return 0;
+}
+
+// (name, type) of every top-level field of every rule (prefix included), in
+// rulebase order and with duplicates.
+static PyObject*
+rulebase_all_fields(ObjectInstance *self)
+{
+    PyObject *all = PyList_New(0);
+    if (all != NULL && rulebase_walk(self, all_fields_visit, all) != 0)
+        Py_CLEAR(all);
+    return all;
+}
+
+// (name, type) of every top-level field the loaded rules can produce, in
+// order of first appearance and without duplicates.
+static PyObject*
+rulebase_fields(ObjectInstance *self)
+{
+    PyObject *all = rulebase_all_fields(self);
+    if (all == NULL)
+        return NULL;
+
+    PyObject *seen = PySet_New(NULL);
+    PyObject *result = PyList_New(0);
+    if (seen == NULL || result == NULL)
+        goto fail;
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(all); i++) {
+        PyObject *entry = PyList_GET_ITEM(all, i);
+        int known = PySet_Contains(seen, PyTuple_GET_ITEM(entry, 0));
+        if (known < 0)
+            goto fail;
+        if (known)
+            continue;
+        if (PySet_Add(seen, PyTuple_GET_ITEM(entry, 0)) != 0 ||
+            PyList_Append(result, entry) != 0)
+            goto fail;
+    }
+    Py_DECREF(seen);
+    Py_DECREF(all);
+    return result;
+
+fail:
+    Py_XDECREF(seen);
+    Py_XDECREF(result);
+    Py_DECREF(all);
+    return NULL;
+}
+
+static PyObject*
+span_str(span s)
+{
+    return PyUnicode_DecodeUTF8(s.ptr, (Py_ssize_t)s.len, "replace");
+}
+
+// Comma-separated rule tags as a tuple of str.
+static PyObject*
+rule_tags(span tags)
+{
+    PyObject *list = PyList_New(0);
+    const char *p = tags.ptr, *end = tags.ptr + tags.len;
+    while (list != NULL && p < end) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *tag_end = comma ? comma : end;
+        span tag = { p, (size_t)(tag_end - p) };
+        while (tag.len > 0 && (*tag.ptr == ' ' || *tag.ptr == '\t')) {
+            tag.ptr++;
+            tag.len--;
+        }
+        while (tag.len > 0 && (tag.ptr[tag.len - 1] == ' ' || tag.ptr[tag.len - 1] == '\t'))
+            tag.len--;
+        if (tag.len > 0) {
+            PyObject *text = span_str(tag);
+            if (text == NULL || PyList_Append(list, text) != 0)
+                Py_CLEAR(list);
+            Py_XDECREF(text);
+        }
+        p = comma ? comma + 1 : end;
+    }
+    if (list == NULL)
+        return NULL;
+    PyObject *tuple = PyList_AsTuple(list);
+    Py_DECREF(list);
+    return tuple;
+}
+
+static int
+rules_visit(void *arg, PyObject *origin, long lineno, span prefix, span tags, span sample)
+{
+    PyObject *fields = PyList_New(0);
+    if (fields == NULL)
+        return -1;
+    if (rule_sample_fields(prefix.ptr, prefix.ptr + prefix.len, fields) != 0 ||
+        rule_sample_fields(sample.ptr, sample.ptr + sample.len, fields) != 0) {
+        Py_DECREF(fields);
+        return -1;
+    }
+    PyObject *rule = Py_BuildValue("{s:O,s:l,s:N,s:N,s:N,s:N}",
+                                   "origin", origin, "line", lineno,
+                                   "tags", rule_tags(tags),
+                                   "prefix", span_str(prefix),
+                                   "sample", span_str(sample),
+                                   "fields", PyList_AsTuple(fields));
+    Py_DECREF(fields);
+    if (rule == NULL)
+        return -1;
+    int rc = PyList_Append((PyObject *)arg, rule);
+    Py_DECREF(rule);
+    return rc;
+}
+
+// [{"origin", "line", "tags", "prefix", "sample", "fields"}, ...] = lognorm.rules()
+static PyObject*
+liblognorm_rules(ObjectInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    PyObject *rules = PyList_New(0);
+    if (rules != NULL && rulebase_walk(self, rules_visit, rules) != 0)
+        Py_CLEAR(rules);
+    return rules;
+}
+
+// {name: (type, ...)} = lognorm.fields()
+static PyObject*
+liblognorm_fields(ObjectInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    PyObject *all = rulebase_all_fields(self);
+    PyObject *types = all ? PyDict_New() : NULL;
+    if (types == NULL)
+        goto error;
+
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(all); i++) {
+        PyObject *name = PyTuple_GET_ITEM(PyList_GET_ITEM(all, i), 0);
+        PyObject *type = PyTuple_GET_ITEM(PyList_GET_ITEM(all, i), 1);
+        PyObject *list = PyDict_GetItem(types, name);
+        if (list == NULL) {
+            list = PyList_New(0);
+            if (list == NULL || PyDict_SetItem(types, name, list) != 0) {
+                Py_XDECREF(list);
+                goto error;
+            }
+            Py_DECREF(list);
+        }
+        int known = PySequence_Contains(list, type);
+        if (known < 0 || (known == 0 && PyList_Append(list, type) != 0))
+            goto error;
+    }
+
+    PyObject *name, *list;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(types, &pos, &name, &list)) {
+        PyObject *tuple = PyList_AsTuple(list);
+        if (tuple == NULL || PyDict_SetItem(types, name, tuple) != 0) {
+            Py_XDECREF(tuple);
+            goto error;
+        }
+        Py_DECREF(tuple);
+    }
+    Py_DECREF(all);
+    return types;
+
+error:
+    Py_XDECREF(types);
+    Py_XDECREF(all);
+    return NULL;
+}
+
+// Rough memory per parse-DAG node: the node, its parser entry and edge.
+#define DAG_NODE_ESTIMATE 96
+
+typedef struct {
+    strmap nodes;            // (parent node, component) -> node number
+    size_t rules;
+    size_t text_bytes;       // field names and literal text
+} dag_counter;
+
+// Add the components of a sample (literal bytes one by one, field
+// descriptions whole) as a path below `*node`, sharing common prefixes
+// the way liblognorm merges rules into one DAG.
+static int
+dag_add_sample(dag_counter *dc, span text, size_t *node)
+{
+    const char *p = text.ptr, *end = text.ptr + text.len;
+    char key[sizeof(size_t) + 256];
+    while (p < end) {
+        const char *start = p;
+        if (*p == '%' && p + 1 < end && p[1] != '%') {
+            p++;
+            while (p < end && *p != '%') {
+                const char *close = (*p == '{' || *p == '[') ? json_text_end(p, end) : NULL;
+                p = close != NULL ? close : p + 1;
+            }
+            p = p < end ? p + 1 : end;
+        } else {
+            p += *p == '%' && p + 1 < end ? 2 : 1;
+        }
+
+        size_t len = (size_t)(p - start);
+        if (len > 256)
+            len = 256;
+        memcpy(key, node, sizeof(size_t));
+        memcpy(key + sizeof(size_t), start, len);
+        strmap_entry *e = strmap_insert(&dc->nodes, key, sizeof(size_t) + len,
+                                        hash_bytes(key, sizeof(size_t) + len));
+        if (e == NULL)
+            return -1;
+        if (e->value == NULL) {
+            e->value = (void *)(uintptr_t)dc->nodes.count;
+            dc->text_bytes += (size_t)(p - start);
+        }
+        *node = (size_t)(uintptr_t)e->value;
+    }
+    return 0;
+}
+
+static int
+dag_visit(void *arg, PyObject *origin, long lineno, span prefix, span tags, span sample)
+{
+    dag_counter *dc = arg;
+    size_t node = 0;
+    dc->rules++;
+    return dag_add_sample(dc, prefix, &node) != 0 || dag_add_sample(dc, sample, &node) != 0
+        ? -1 : 0;
+}
+
+// {"rules", "nodes", "bytes"} = lognorm.dag_estimate()
+static PyObject*
+liblognorm_dag_estimate(ObjectInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    dag_counter dc;
+    memset(&dc, 0, sizeof(dc));
+    if (rulebase_walk(self, dag_visit, &dc) != 0) {
+        strmap_clear(&dc.nodes, NULL);
+        return PyErr_Occurred() ? NULL : PyErr_NoMemory();
+    }
+    size_t nodes = dc.nodes.count + 1;
+    strmap_clear(&dc.nodes, NULL);
+    return Py_BuildValue("{s:n,s:n,s:n}", "rules", (Py_ssize_t)dc.rules,
+                         "nodes", (Py_ssize_t)nodes,
+                         "bytes", (Py_ssize_t)(nodes * DAG_NODE_ESTIMATE + dc.text_bytes));
+}
+
+//----------------------------------------------------------------------------
+// keyword prefilter: Aho-Corasick over literals that every rule requires
+//----------------------------------------------------------------------------
+
+// Dense automaton over byte classes: bytes that occur in no literal share
+// class 0, which always leads back to the root.
+typedef struct prefilter_dfa {
+    uint8_t cls[256];
+    uint32_t nclasses;
+    uint32_t nstates;
+    uint32_t *delta;         // nstates * nclasses transitions
+    uint8_t *accept;         // some literal ends in the state
+} prefilter_dfa;
+
+static void
+prefilter_free(prefilter_dfa *dfa)
+{
+    if (dfa == NULL)
+        return;
+    free(dfa->delta);
+    free(dfa->accept);
+    free(dfa);
+}
+
+// Compile a tuple of non-empty bytes literals; NULL when out of memory.
+static prefilter_dfa*
+prefilter_build(PyObject *literals)
+{
+    Py_ssize_t n = PyTuple_GET_SIZE(literals);
+    prefilter_dfa *dfa = calloc(1, sizeof(prefilter_dfa));
+    if (dfa == NULL)
+        return NULL;
+
+    size_t total = 1;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *lit = PyTuple_GET_ITEM(literals, i);
+        const unsigned char *p = (const unsigned char *)PyBytes_AS_STRING(lit);
+        for (Py_ssize_t j = 0; j < PyBytes_GET_SIZE(lit); j++)
+            dfa->cls[p[j]] = 1;
+        total += (size_t)PyBytes_GET_SIZE(lit);
+    }
+    dfa->nclasses = 1;
+    for (int b = 0; b < 256; b++) {
+        if (dfa->cls[b])
+            dfa->cls[b] = (uint8_t)dfa->nclasses++;
+    }
+    size_t nc = dfa->nclasses;
+
+    uint32_t *fail = calloc(total, sizeof(uint32_t));
+    uint32_t *queue = calloc(total, sizeof(uint32_t));
+    dfa->delta = calloc(total * nc, sizeof(uint32_t));
+    dfa->accept = calloc(total, 1);
+    if (fail == NULL || queue == NULL || dfa->delta == NULL || dfa->accept == NULL)
+        goto error;
+
+    // trie; 0 doubles as "no edge" since nothing leads back to the root yet
+    dfa->nstates = 1;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *lit = PyTuple_GET_ITEM(literals, i);
+        const unsigned char *p = (const unsigned char *)PyBytes_AS_STRING(lit);
+        uint32_t s = 0;
+        for (Py_ssize_t j = 0; j < PyBytes_GET_SIZE(lit); j++) {
+            uint32_t *t = &dfa->delta[s * nc + dfa->cls[p[j]]];
+            if (*t == 0)
+                *t = dfa->nstates++;
+            s = *t;
+        }
+        dfa->accept[s] = 1;
+    }
+
+    // breadth-first failure links, folded into the transition table
+    size_t head = 0, tail = 0;
+    for (size_t c = 1; c < nc; c++) {
+        if (dfa->delta[c] != 0)
+            queue[tail++] = dfa->delta[c];
+    }
+    while (head < tail) {
+        uint32_t s = queue[head++];
+        for (size_t c = 1; c < nc; c++) {
+            uint32_t *t = &dfa->delta[s * nc + c];
+            uint32_t via_fail = dfa->delta[fail[s] * nc + c];
+            if (*t == 0) {
+                *t = via_fail;
+            } else {
+                fail[*t] = via_fail;
+                dfa->accept[*t] |= dfa->accept[via_fail];
+                queue[tail++] = *t;
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+    return dfa;
+
+error:
+    free(fail);
+    free(queue);
+    prefilter_free(dfa);
+    return NULL;
+}
+
+// Whether `msg` contains one of the literals.
+static int
+prefilter_match(const prefilter_dfa *dfa, const char *msg, size_t len)
+{
+    uint32_t s = 0;
+    for (size_t i = 0; i < len; i++) {
+        s = dfa->delta[s * dfa->nclasses + dfa->cls[(unsigned char)msg[i]]];
+        if (dfa->accept[s])
+            return 1;
+    }
+    return 0;
+}
+
+// Longest literal text of a rule sample (outside its field descriptions),
+// without surrounding whitespace; `*len` is 0 when there is none.
+static const char*
+rule_longest_literal(const char *p, const char *end, size_t *len)
+{
+    const char *best = NULL;
+    *len = 0;
+    while (p < end) {
+        const char *start = p;
+        while (p < end && !(*p == '%' && (p + 1 >= end || p[1] != '%')))
+            p += *p == '%' ? 2 : 1;     // "%%" is a literal percent sign
+
+        // a "%%" inside a literal stays doubled here, which only shortens it
+        const char *s = start, *e = p;
+        while (s < e && (*s == ' ' || *s == '\t'))
+            s++;
+        while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'))
+            e--;
+        const char *pct = memchr(s, '%', (size_t)(e - s));
+        if (pct != NULL)
+            e = pct;
+        if ((size_t)(e - s) > *len) {
+            best = s;
+            *len = (size_t)(e - s);
+        }
+
+        if (p >= end)
+            break;
+        p++;                            // field description
+        while (p < end && *p != '%') {
+            if (*p == '{' || *p == '[') {
+                p = json_text_end(p, end);
+                if (p == NULL)
+                    return best;
+            } else {
+                p++;
+            }
+        }
+        p++;
+    }
+    return best;
+}
+
+typedef struct {
+    Py_ssize_t min_length;
+    PyObject *literals;      // list of bytes
+    PyObject *seen;          // set of the same
+} literal_collector;
+
+static int
+literals_visit(void *arg, PyObject *origin, long lineno, span prefix, span tags, span sample)
+{
+    literal_collector *lc = arg;
+    size_t len, prefix_len;
+    const char *lit = rule_longest_literal(sample.ptr, sample.ptr + sample.len, &len);
+    const char *prefix_lit = rule_longest_literal(prefix.ptr, prefix.ptr + prefix.len,
+                                                  &prefix_len);
+    if (prefix_len > len) {
+        lit = prefix_lit;
+        len = prefix_len;
+    }
+    if (len < (size_t)lc->min_length) {
+        PyErr_Format(PyExc_ValueError, "%U:%ld: rule has no literal of at least %zd bytes",
+                     origin, lineno, lc->min_length);
+        return -1;
+    }
+    PyObject *bytes = PyBytes_FromStringAndSize(lit, (Py_ssize_t)len);
+    int known = bytes ? PySet_Contains(lc->seen, bytes) : -1;
+    if (known == 0 && (PySet_Add(lc->seen, bytes) != 0 || PyList_Append(lc->literals, bytes) != 0))
+        known = -1;
+    Py_XDECREF(bytes);
+    return known < 0 ? -1 : 0;
+}
+
+// One literal per rule of the loaded rulebases: the longest of the rule
+// and its prefix.  Raises ValueError for a rule without a literal of at
+// least `min_length` bytes.
+static PyObject*
+rulebase_literals(ObjectInstance *self, Py_ssize_t min_length)
+{
+    literal_collector lc = { min_length, PyList_New(0), PySet_New(NULL) };
+    PyObject *result = NULL;
+    if (lc.literals != NULL && lc.seen != NULL &&
+        rulebase_walk(self, literals_visit, &lc) == 0)
+        result = PyList_AsTuple(lc.literals);
+    Py_XDECREF(lc.literals);
+    Py_XDECREF(lc.seen);
+    return result;
+}
+
+static void
+prefilter_clear(ObjectInstance *self)
+{
+    prefilter_free(self->prefilter);
+    self->prefilter = NULL;
+    Py_CLEAR(self->prefilter_literals);
+    self->prefilter_derived = 0;
+}
+
+// Install the automaton for `literals` (a tuple of bytes).
+static int
+prefilter_install(ObjectInstance *self, PyObject *literals, int derived)
+{
+    prefilter_dfa *dfa = prefilter_build(literals);
+    if (dfa == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    prefilter_clear(self);
+    self->prefilter = dfa;
+    Py_INCREF(literals);
+    self->prefilter_literals = literals;
+    self->prefilter_derived = derived;
+    return 0;
+}
+
+// New rules were loaded: rebuild a prefilter derived from the rules.  If
+// that is impossible, a stale prefilter would reject valid lines, so it is
+// turned off instead.
+static void
+prefilter_rules_changed(ObjectInstance *self)
+{
+    if (!self->prefilter_derived)
+        return;
+    PyObject *literals = rulebase_literals(self, self->prefilter_min_length);
+    if (literals == NULL || prefilter_install(self, literals, 1) != 0) {
+        PyErr_Clear();
+        prefilter_clear(self);
+    }
+    Py_XDECREF(literals);
+}
+
+// literals = lognorm.prefilter(literals = None, min_length = 3)
+static PyObject*
+liblognorm_prefilter(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"literals", "min_length", NULL};
+    PyObject *arg = Py_None;
+    Py_ssize_t min_length = 3;
+    PyObject *literals;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O$n", kwlist, &arg, &min_length))
+        return NULL;
+    if (min_length < 1) {
+        PyErr_SetString(PyExc_ValueError, "min_length must be positive");
+        return NULL;
+    }
+
+    if (arg == Py_None) {
+        literals = rulebase_literals(self, min_length);
+    } else if (PyUnicode_Check(arg) || PyBytes_Check(arg)) {
+        PyErr_SetString(PyExc_TypeError, "literals must be an iterable of str");
+        return NULL;
+    } else {
+        PyObject *items = PySequence_Tuple(arg);
+        if (items == NULL)
+            return NULL;
+        literals = PyTuple_New(PyTuple_GET_SIZE(items));
+        for (Py_ssize_t i = 0; literals != NULL && i < PyTuple_GET_SIZE(items); i++) {
+            PyObject *item = PyTuple_GET_ITEM(items, i);
+            PyObject *bytes = PyUnicode_Check(item) ? PyUnicode_AsUTF8String(item) : NULL;
+            if (bytes == NULL || PyBytes_GET_SIZE(bytes) == 0) {
+                if (bytes != NULL)
+                    PyErr_SetString(PyExc_ValueError, "literals must not be empty");
+                else if (!PyErr_Occurred())
+                    PyErr_SetString(PyExc_TypeError, "literals must be str");
+                Py_XDECREF(bytes);
+                Py_CLEAR(literals);
+                break;
+            }
+            PyTuple_SET_ITEM(literals, i, bytes);
+        }
+        Py_DECREF(items);
+    }
+    if (literals == NULL)
+        return NULL;
+    if (PyTuple_GET_SIZE(literals) == 0) {
+        PyErr_SetString(PyExc_ValueError, "no literals to match; load rules first");
+        Py_DECREF(literals);
+        return NULL;
+    }
+
+    if (prefilter_install(self, literals, arg == Py_None) != 0) {
+        Py_DECREF(literals);
+        return NULL;
+    }
+    self->prefilter_min_length = min_length;
+
+    PyObject *result = PyTuple_New(PyTuple_GET_SIZE(literals));
+    for (Py_ssize_t i = 0; result != NULL && i < PyTuple_GET_SIZE(literals); i++) {
+        PyObject *lit = PyTuple_GET_ITEM(literals, i);
+        PyObject *text = PyUnicode_DecodeUTF8(PyBytes_AS_STRING(lit), PyBytes_GET_SIZE(lit),
+                                              "surrogateescape");
+        if (text == NULL)
+            Py_CLEAR(result);
+        else
+            PyTuple_SET_ITEM(result, i, text);
+    }
+    Py_DECREF(literals);
+    return result;
+}
+
+static PyObject*
+liblognorm_clear_prefilter(ObjectInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    prefilter_clear(self);
+    Py_RETURN_NONE;
+}
+
+//----------------------------------------------------------------------------
+// per-rule profiling
+//----------------------------------------------------------------------------
+
+static void
+profile_clear(ObjectInstance *self)
+{
+    strmap_clear(&self->profile, free);
+    memset(&self->unattributed, 0, sizeof(self->unattributed));
+}
+
+// File and line of the rule that produced `event`, from the metadata
+// liblognorm adds with add_rule_location.
+static int
+event_rule_location(json_object *event, const char **origin, long *lineno)
+{
+    json_object *meta, *rule, *location, *file, *line;
+    if (event == NULL ||
+        !json_object_object_get_ex(event, "metadata", &meta) ||
+        !json_object_object_get_ex(meta, "rule", &rule) ||
+        !json_object_object_get_ex(rule, "location", &location) ||
+        !json_object_object_get_ex(location, "file", &file) ||
+        !json_object_object_get_ex(location, "line", &line) ||
+        json_object_get_type(file) != json_type_string)
+        return 0;
+    *origin = json_object_get_string(file);
+    *lineno = (long)json_object_get_int64(line);
+    return 1;
+}
+
+// Charge `seconds` of ln_normalize() to the rule that produced `event`
+// (from the add_rule_location metadata), or to the unattributed lines.
+static void
+profile_record(ObjectInstance *self, json_object *event, double seconds)
+{
+    rule_cost *cost = &self->unattributed;
+    const char *origin;
+    long lineno;
+    if (event_rule_location(event, &origin, &lineno)) {
+        char key[PATH_MAX + 32];
+        int n = snprintf(key, sizeof(key), "%s%c%ld", origin, '\0', lineno);
+        if (n > 0 && (size_t)n < sizeof(key)) {
+            strmap_entry *e = strmap_insert(&self->profile, key, (size_t)n,
+                                            hash_bytes(key, (size_t)n));
+            if (e != NULL && e->value == NULL) {
+                e->value = calloc(1, sizeof(rule_cost));
+                if (e->value == NULL)
+                    strmap_remove(&self->profile, e);
+                else
+                    *(rule_cost *)e->value = (rule_cost){ e->key, lineno, 0, 0, 0 };
+            }
+            if (e != NULL && e->value != NULL)
+                cost = e->value;
+        }
+    }
+    cost->count++;
+    cost->seconds += seconds;
+    if (seconds > cost->max)
+        cost->max = seconds;
+}
+
+static int
+profile_entry_cmp(const void *a, const void *b)
+{
+    double x = (*(rule_cost *const *)a)->seconds, y = (*(rule_cost *const *)b)->seconds;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+// Costs ranked by total time, at most `n` of them (-1 for all).
+static PyObject*
+profile_report(ObjectInstance *self, Py_ssize_t n)
+{
+    size_t count = 0;
+    rule_cost **costs = malloc((self->profile.count + 1) * sizeof(rule_cost *));
+    if (costs == NULL)
+        return PyErr_NoMemory();
+    for (size_t i = 0; i < self->profile.cap; i++) {
+        if (self->profile.slots[i].key != NULL)
+            costs[count++] = self->profile.slots[i].value;
+    }
+    if (self->unattributed.count > 0)
+        costs[count++] = &self->unattributed;
+    qsort(costs, count, sizeof(rule_cost *), profile_entry_cmp);
+
+    if (n < 0 || (size_t)n > count)
+        n = (Py_ssize_t)count;
+    PyObject *report = PyList_New(n);
+    for (Py_ssize_t i = 0; report != NULL && i < n; i++) {
+        rule_cost *c = costs[i];
+        PyObject *entry;
+        if (c->origin == NULL)
+            entry = Py_BuildValue("{s:O,s:O,s:n,s:d,s:d,s:d}", "origin", Py_None,
+                                  "line", Py_None, "count", c->count, "seconds", c->seconds,
+                                  "mean", c->seconds / (double)c->count, "max", c->max);
+        else
+            entry = Py_BuildValue("{s:s,s:l,s:n,s:d,s:d,s:d}", "origin", c->origin,
+                                  "line", c->line, "count", c->count, "seconds", c->seconds,
+                                  "mean", c->seconds / (double)c->count, "max", c->max);
+        if (entry == NULL)
+            Py_CLEAR(report);
+        else
+            PyList_SET_ITEM(report, i, entry);
+    }
+    free(costs);
+    return report;
+}
+
+static int
+profile_check(ObjectInstance *self)
+{
+    if (!self->rule_location) {
+        PyErr_SetString(PyExc_ValueError,
+                        "profiling needs a Lognorm created with add_rule_location=True");
+        return -1;
+    }
+    return 0;
+}
+
+// lognorm.profile(enabled = True)
+static PyObject*
+liblognorm_profile(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"enabled", NULL};
+    int enabled = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p", kwlist, &enabled))
+        return NULL;
+    if (enabled && profile_check(self) != 0)
+        return NULL;
+    self->profiling = enabled;
+    Py_RETURN_NONE;
+}
+
+// [{"origin", "line", "count", "seconds", "mean", "max"}, ...] =
+//     lognorm.profile_report(n = None, reset = False)
+static PyObject*
+liblognorm_profile_report(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"n", "reset", NULL};
+    PyObject *n_arg = Py_None;
+    int reset = 0;
+    Py_ssize_t n = -1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O$p", kwlist, &n_arg, &reset))
+        return NULL;
+    if (n_arg != Py_None) {
+        n = PyNumber_AsSsize_t(n_arg, PyExc_OverflowError);
+        if (n == -1 && PyErr_Occurred())
+            return NULL;
+        if (n < 0) {
+            PyErr_SetString(PyExc_ValueError, "n must not be negative");
+            return NULL;
+        }
+    }
+
+    PyObject *report = profile_report(self, n);
+    if (report != NULL && reset)
+        profile_clear(self);
+    return report;
+}
+
+// report = lognorm.profile_rulebase(corpus, repeat = 1)
+static PyObject*
+liblognorm_profile_rulebase(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"corpus", "repeat", NULL};
+    PyObject *corpus;
+    Py_ssize_t repeat = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$n", kwlist, &corpus, &repeat))
+        return NULL;
+    if (repeat < 1) {
+        PyErr_SetString(PyExc_ValueError, "repeat must be positive");
+        return NULL;
+    }
+    if (profile_check(self) != 0)
+        return NULL;
+    PyObject *lines = PySequence_Fast(corpus, "corpus must be an iterable of lines");
+    if (lines == NULL)
+        return NULL;
+
+    int was_profiling = self->profiling;
+    profile_clear(self);
+    self->profiling = 1;
+
+    int failed = 0;
+    for (Py_ssize_t r = 0; !failed && r < repeat; r++) {
+        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(lines); i++) {
+            const char *msg;
+            Py_ssize_t len;
+            int raw;
+            Py_buffer view;
+            if (get_message(PySequence_Fast_GET_ITEM(lines, i), &view, &msg, &len, &raw) != 0) {
+                failed = 1;
+                break;
+            }
+            struct json_object *log = NULL;
+            int norm_result = ctx_normalize(self, msg, rstrip_len(msg, (size_t)len), raw, &log);
+            slowlog_check(self, log);
+            json_object_put(log);
+            release_message(&view);
+            if (norm_result == NORMALIZE_PYERR) {
+                if (!PyErr_ExceptionMatches(PyExc_UnicodeDecodeError)) {
+                    failed = 1;
+                    break;
+                }
+                PyErr_Clear();
+            }
+        }
+    }
+    self->profiling = was_profiling;
+    Py_DECREF(lines);
+    return failed ? NULL : profile_report(self, -1);
+}
+
+//----------------------------------------------------------------------------
+// slow-line log
+//----------------------------------------------------------------------------
+
+typedef struct {
+    char *line;              // the first max_bytes bytes of the input line
+    size_t length;           // full length of the line
+    char *rule;              // "file:line" or mockup of the matched rule, or NULL
+    double time;             // wall clock time of the call
+    double parse;            // seconds until ln_normalize() returned
+    double convert;          // ... and in the conversion after it
+} slow_entry;
+
+typedef struct slowlog {
+    double threshold;        // seconds of parse plus conversion
+    size_t max_bytes;
+    size_t cap;
+    size_t head;             // oldest entry
+    size_t count;
+    Py_ssize_t dropped;      // entries overwritten since the last drain
+    slow_entry entries[];
+} slowlog;
+
+static void
+slow_entry_free(slow_entry *e)
+{
+    free(e->line);
+    free(e->rule);
+}
+
+static void
+slowlog_free(slowlog *log)
+{
+    if (log == NULL)
+        return;
+    for (size_t i = 0; i < log->count; i++)
+        slow_entry_free(&log->entries[(log->head + i) % log->cap]);
+    free(log);
+}
+
+// Text identifying the rule that produced `event`, or NULL.
+static char*
+slow_rule_text(json_object *event)
+{
+    const char *origin;
+    long lineno;
+    if (event_rule_location(event, &origin, &lineno)) {
+        size_t size = strlen(origin) + 24;
+        char *text = malloc(size);
+        if (text != NULL)
+            snprintf(text, size, "%s:%ld", origin, lineno);
+        return text;
+    }
+    json_object *meta, *rule, *mockup;
+    if (event != NULL &&
+        json_object_object_get_ex(event, "metadata", &meta) &&
+        json_object_object_get_ex(meta, "rule", &rule) &&
+        json_object_object_get_ex(rule, "mockup", &mockup) &&
+        json_object_get_type(mockup) == json_type_string)
+        return strdup(json_object_get_string(mockup));
+    return NULL;
+}
+
+// Finish the call ctx_normalize() started: copy its line into the ring
+// when parse plus conversion took longer than the threshold.
+static void
+slowlog_check(ObjectInstance *self, json_object *event)
+{
+    if (self->pending.msg == NULL)
+        return;
+    slow_call call = self->pending;
+    self->pending.msg = NULL;
+
+    slowlog *log = self->slowlog;
+    double now = monotonic_now();
+    if (log == NULL || now - call.started < log->threshold)
+        return;
+
+    slow_entry e;
+    size_t copied = call.len < log->max_bytes ? call.len : log->max_bytes;
+    e.line = malloc(copied + 1);
+    if (e.line == NULL)
+        return;
+    memcpy(e.line, call.msg, copied);
+    e.line[copied] = '\0';
+    e.length = call.len;
+    e.rule = slow_rule_text(event);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    e.time = (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+    e.parse = call.parsed - call.started;
+    e.convert = now - call.parsed;
+
+    if (log->count == log->cap) {
+        slow_entry_free(&log->entries[log->head]);
+        log->entries[log->head] = e;
+        log->head = (log->head + 1) % log->cap;
+        log->dropped++;
+    } else {
+        log->entries[(log->head + log->count) % log->cap] = e;
+        log->count++;
+    }
+}
+
+// lognorm.slowlog(threshold, capacity = 128, max_bytes = 4096)
+static PyObject*
+liblognorm_slowlog(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"threshold", "capacity", "max_bytes", NULL};
+    PyObject *threshold_arg;
+    Py_ssize_t capacity = 128;
+    Py_ssize_t max_bytes = 4096;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$nn", kwlist, &threshold_arg,
+                                     &capacity, &max_bytes))
+        return NULL;
+
+    slowlog *log = NULL;
+    if (threshold_arg != Py_None) {
+        double threshold = PyFloat_AsDouble(threshold_arg);
+        if (threshold == -1.0 && PyErr_Occurred())
+            return NULL;
+        if (!(threshold >= 0)) {
+            PyErr_SetString(PyExc_ValueError, "threshold must not be negative");
+            return NULL;
+        }
+        if (capacity < 1 || max_bytes < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                            "capacity must be positive and max_bytes not negative");
+            return NULL;
+        }
+        log = calloc(1, sizeof(slowlog) + (size_t)capacity * sizeof(slow_entry));
+        if (log == NULL)
+            return PyErr_NoMemory();
+        log->threshold = threshold;
+        log->max_bytes = (size_t)max_bytes;
+        log->cap = (size_t)capacity;
+    }
+    slowlog_free(self->slowlog);
+    self->slowlog = log;
+    self->pending.msg = NULL;
+    Py_RETURN_NONE;
+}
+
+// ([{"line", "length", "rule", "time", "parse", "convert", "total"}, ...], dropped) =
+//     lognorm.drain_slowlog()
+static PyObject*
+liblognorm_drain_slowlog(ObjectInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    slowlog *log = self->slowlog;
+    size_t count = log != NULL ? log->count : 0;
+    PyObject *entries = PyList_New((Py_ssize_t)count);
+    for (size_t i = 0; entries != NULL && i < count; i++) {
+        slow_entry *e = &log->entries[(log->head + i) % log->cap];
+        PyObject *line = PyUnicode_DecodeUTF8(e->line, (Py_ssize_t)strlen(e->line),
+                                              "surrogateescape");
+        PyObject *rule = e->rule != NULL ? PyUnicode_DecodeUTF8(e->rule, (Py_ssize_t)strlen(e->rule),
+                                                                "replace") : Py_None;
+        if (rule == Py_None)
+            Py_INCREF(rule);
+        PyObject *entry = line && rule ?
+            Py_BuildValue("{s:O,s:n,s:O,s:d,s:d,s:d,s:d}", "line", line,
+                          "length", (Py_ssize_t)e->length, "rule", rule, "time", e->time,
+                          "parse", e->parse, "convert", e->convert,
+                          "total", e->parse + e->convert) : NULL;
+        Py_XDECREF(line);
+        Py_XDECREF(rule);
+        if (entry == NULL)
+            Py_CLEAR(entries);
+        else
+            PyList_SET_ITEM(entries, (Py_ssize_t)i, entry);
+    }
+    if (entries == NULL)
+        return NULL;
+
+    Py_ssize_t dropped = 0;
+    if (log != NULL) {
+        for (size_t i = 0; i < count; i++)
+            slow_entry_free(&log->entries[(log->head + i) % log->cap]);
+        dropped = log->dropped;
+        log->head = log->count = 0;
+        log->dropped = 0;
+    }
+    return Py_BuildValue("(Nn)", entries, dropped);
+}
+
+//----------------------------------------------------------------------------
+// parse traces from liblognorm's debug callback
+//----------------------------------------------------------------------------
+
+typedef struct tracer {
+    Py_ssize_t every;        // trace one line in `every`, 0 = none
+    Py_ssize_t countdown;    // lines until the next sampled one
+    double slow;             // re-run lines slower than this traced, 0 = never
+    Py_ssize_t capacity;     // traces kept, the oldest are dropped
+    size_t max_bytes;        // debug output kept per trace
+    char *text;              // debug output of the traced call
+    size_t len;
+    int truncated;
+    PyObject *traces;        // list of trace dicts
+} tracer;
+
+static void
+tracer_free(tracer *t)
+{
+    if (t == NULL)
+        return;
+    free(t->text);
+    Py_XDECREF(t->traces);
+    free(t);
+}
+
+// ln_setDebugCB() callback: append one debug message to the current trace.
+static void
+trace_callback(void *cookie, const char *msg, size_t len)
+{
+    tracer *t = ((ObjectInstance *)cookie)->tracer;
+    if (t == NULL || t->text == NULL || msg == NULL)
+        return;
+    if (t->len + len + 1 > t->max_bytes) {
+        t->truncated = 1;
+        return;
+    }
+    memcpy(t->text + t->len, msg, len);
+    t->len += len;
+    t->text[t->len++] = '\n';
+}
+
+// Run ln_normalize() with debug output on and keep its trace.  `seconds`
+// is the untraced parse time that triggered the trace, or < 0 to report
+// the traced run's own time.
+static int
+trace_run(ObjectInstance *self, const char *reason, double seconds, const char *msg,
+          size_t len, struct json_object **json, int *norm_result)
+{
+    tracer *t = self->tracer;
+    t->len = 0;
+    t->truncated = 0;
+
+    ln_enableDebug(self->lognorm_context, 1);
+    double started = monotonic_now();
+    *norm_result = ln_normalize(self->lognorm_context, msg, len, json);
+    if (seconds < 0)
+        seconds = monotonic_now() - started;
+    ln_enableDebug(self->lognorm_context, 0);
+
+    // drop the trailing newline, then split into one str per message
+    PyObject *text = PyUnicode_DecodeUTF8(t->text, t->len > 0 ? (Py_ssize_t)t->len - 1 : 0,
+                                          "replace");
+    PyObject *lines = text != NULL && t->len > 0 ? PyUnicode_Splitlines(text, 0) : PyList_New(0);
+    PyObject *steps = lines != NULL ? PyList_AsTuple(lines) : NULL;
+    Py_XDECREF(text);
+    Py_XDECREF(lines);
+    if (steps == NULL)
+        return -1;
+
+    PyObject *trace = Py_BuildValue("{s:N,s:s,s:i,s:d,s:N,s:O}",
+                                    "line", PyUnicode_DecodeUTF8(msg, (Py_ssize_t)len,
+                                                                 "surrogateescape"),
+                                    "reason", reason, "result", *norm_result,
+                                    "seconds", seconds, "trace", steps,
+                                    "truncated", t->truncated ? Py_True : Py_False);
+    if (trace == NULL || PyList_Append(t->traces, trace) != 0) {
+        Py_XDECREF(trace);
+        return -1;
+    }
+    Py_DECREF(trace);
+    if (PyList_GET_SIZE(t->traces) > t->capacity &&
+        PySequence_DelItem(t->traces, 0) != 0)
+        return -1;
+    return 0;
+}
+
+// ln_normalize() for a context with a tracer: sampled lines run with
+// debug output on; lines slower than the budget are run again to trace
+// them, which takes `*traced` seconds.
+static int
+traced_normalize(ObjectInstance *self, const char *msg, size_t len,
+                 struct json_object **json, double *traced)
+{
+    tracer *t = self->tracer;
+    int norm_result;
+    *traced = 0;
+
+    if (t->every > 0 && --t->countdown <= 0) {
+        t->countdown = t->every;
+        if (trace_run(self, "sampled", -1, msg, len, json, &norm_result) != 0) {
+            json_object_put(*json);
+            *json = NULL;
+            return NORMALIZE_PYERR;
+        }
+        return norm_result;
+    }
+    if (t->slow <= 0)
+        return ln_normalize(self->lognorm_context, msg, len, json);
+
+    double started = monotonic_now();
+    norm_result = ln_normalize(self->lognorm_context, msg, len, json);
+    double rerun = monotonic_now();
+    if (rerun - started < t->slow)
+        return norm_result;
+
+    // the re-run's event never leaves this function, so it is ours to free
+    struct json_object *again = NULL;
+    int again_result;
+    int rc = trace_run(self, "slow", rerun - started, msg, len, &again, &again_result);
+    json_object_put(again);
+    if (rc != 0) {
+        json_object_put(*json);
+        *json = NULL;
+        return NORMALIZE_PYERR;
+    }
+    *traced = monotonic_now() - rerun;
+    return norm_result;
+}
+
+// lognorm.trace(every = 0, slow = None, capacity = 16, max_bytes = 65536)
+static PyObject*
+liblognorm_trace(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"every", "slow", "capacity", "max_bytes", NULL};
+    Py_ssize_t every = 0;
+    PyObject *slow_arg = Py_None;
+    Py_ssize_t capacity = 16;
+    Py_ssize_t max_bytes = 65536;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n$Onn", kwlist, &every, &slow_arg,
+                                     &capacity, &max_bytes))
+        return NULL;
+
+    double slow = 0;
+    if (slow_arg != Py_None) {
+        slow = PyFloat_AsDouble(slow_arg);
+        if (slow == -1.0 && PyErr_Occurred())
+            return NULL;
+        if (!(slow > 0)) {
+            PyErr_SetString(PyExc_ValueError, "slow must be positive");
+            return NULL;
+        }
+    }
+    if (every < 0 || capacity < 1 || max_bytes < 1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "every must not be negative, capacity and max_bytes must be positive");
+        return NULL;
+    }
+
+    tracer *t = NULL;
+    if (every > 0 || slow > 0) {
+        t = calloc(1, sizeof(tracer));
+        if (t == NULL || (t->text = malloc((size_t)max_bytes)) == NULL ||
+            (t->traces = PyList_New(0)) == NULL) {
+            tracer_free(t);
+            return PyErr_Occurred() ? NULL : PyErr_NoMemory();
+        }
+        t->every = every;
+        t->countdown = every;
+        t->slow = slow;
+        t->capacity = capacity;
+        t->max_bytes = (size_t)max_bytes;
+    }
+
+    ln_enableDebug(self->lognorm_context, 0);
+    if (t != NULL)
+        ln_setDebugCB(self->lognorm_context, trace_callback, self);
+    else
+        ln_setDebugCB(self->lognorm_context, NULL, NULL);
+    tracer_free(self->tracer);
+    self->tracer = t;
+    Py_RETURN_NONE;
+}
+
+// [{"line", "reason", "result", "seconds", "trace", "truncated"}, ...] =
+//     lognorm.drain_traces()
+static PyObject*
+liblognorm_drain_traces(ObjectInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    if (self->tracer == NULL)
+        return PyList_New(0);
+    PyObject *traces = self->tracer->traces;
+    PyObject *empty = PyList_New(0);
+    if (empty == NULL)
+        return NULL;
+    self->tracer->traces = empty;
+    return traces;
+}
+
+//----------------------------------------------------------------------------
+// input guard counters
+//----------------------------------------------------------------------------
+
+// {"truncated", "rejected", "prefiltered", "over_budget"} =
+//     lognorm.counters(reset = False)
+static PyObject*
+liblognorm_counters(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"reset", NULL};
+    int reset = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|$p", kwlist, &reset))
+        return NULL;
+    PyObject *counters = Py_BuildValue("{s:n,s:n,s:n,s:n}", "truncated", self->truncated,
+                                       "rejected", self->oversized,
+                                       "prefiltered", self->prefiltered,
+                                       "over_budget", self->over_budget);
+    if (counters != NULL && reset)
+        self->truncated = self->oversized = self->prefiltered = self->over_budget = 0;
+    return counters;
+}
+
+//----------------------------------------------------------------------------
+// compact Event records
+//----------------------------------------------------------------------------
+
+#define RECORD_DOCSTRING "normalized event with one slot per rulebase field"
+
+// Build the structseq type for `names` (a tuple of str) and make it the
+// context's record type.  The slot names point into `names`, which is kept
+// alive as the type's `_fields` attribute.
+static PyObject*
+install_record_type(ObjectInstance *self, PyObject *names, int derived)
+{
+    Py_ssize_t n = PyTuple_GET_SIZE(names);
+    strmap slots = {0};
+
+    PyStructSequence_Field *members = PyMem_Calloc((size_t)n + 1, sizeof(PyStructSequence_Field));
+    if (members == NULL)
+        return PyErr_NoMemory();
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *item = PyTuple_GET_ITEM(names, i);
+        Py_ssize_t len;
+        const char *name = PyUnicode_Check(item) ? PyUnicode_AsUTF8AndSize(item, &len) : NULL;
+        if (name == NULL) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_TypeError, "record field names must be str");
+            goto fail;
+        }
+        strmap_entry *e = strmap_insert(&slots, name, (size_t)len, hash_bytes(name, (size_t)len));
+        if (e == NULL) {
+            PyErr_NoMemory();
+            goto fail;
+        }
+        if (e->value != NULL) {
+            PyErr_Format(PyExc_ValueError, "duplicate record field: %s", name);
+            goto fail;
+        }
+        e->value = (void *)(intptr_t)(i + 1);
+        members[i].name = name;
+        members[i].doc = NULL;
+    }
+
+    PyStructSequence_Desc desc = {
+        MODULE_NAME ".Event", RECORD_DOCSTRING, members, (int)n
+    };
+    PyObject *type = (PyObject *)PyStructSequence_NewType(&desc);
+    PyMem_Free(members);
+    members = NULL;
+    if (type == NULL || PyObject_SetAttrString(type, "_fields", names) != 0) {
+        Py_XDECREF(type);
+        goto fail;
+    }
+
+    strmap_clear(&self->record_slots, NULL);
+    self->record_slots = slots;
+    Py_XDECREF(self->record_type);
+    self->record_type = type;
+    self->record_derived = derived;
+    Py_INCREF(type);
+    return type;
+
+fail:
+    PyMem_Free(members);
+    strmap_clear(&slots, NULL);
+    return NULL;
+}
+
+// Record type whose slots are the fields of the loaded rules.
+static PyObject*
+derive_record_type(ObjectInstance *self)
+{
+    PyObject *fields = rulebase_fields(self);
+    if (fields == NULL)
+        return NULL;
+
+    Py_ssize_t n = PyList_GET_SIZE(fields);
+    if (n == 0) {
+        Py_DECREF(fields);
+        PyErr_SetString(PyExc_ValueError, "the loaded rules define no fields");
+        return NULL;
+    }
+    PyObject *names = PyTuple_New(n);
+    if (names == NULL) {
+        Py_DECREF(fields);
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *name = PyTuple_GET_ITEM(PyList_GET_ITEM(fields, i), 0);
+        Py_INCREF(name);
+        PyTuple_SET_ITEM(names, i, name);
+    }
+    Py_DECREF(fields);
+
+    PyObject *type = install_record_type(self, names, 1);
+    Py_DECREF(names);
+    return type;
+}
+
+// Event = lognorm.record_type(fields = None)
+static PyObject*
+liblognorm_record_type(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *fields = Py_None;
+    static char *kwlist[] = {"fields", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &fields))
+        return NULL;
+
+    if (fields == Py_None)
+        return derive_record_type(self);
+
+    if (PyUnicode_Check(fields)) {
+        PyErr_SetString(PyExc_TypeError, "fields must be a sequence of str, not str");
+        return NULL;
+    }
+    PyObject *names = PySequence_Tuple(fields);
+    if (names == NULL)
+        return NULL;
+    if (PyTuple_GET_SIZE(names) == 0) {
+        Py_DECREF(names);
+        PyErr_SetString(PyExc_ValueError, "fields must not be empty");
+        return NULL;
+    }
+    PyObject *type = install_record_type(self, names, 0);
+    Py_DECREF(names);
+    return type;
+}
+
+// Fill a fresh record from the top level of `obj`; members without a slot
+// are dropped.
+static PyObject*
+convert_record(json_object *obj, const conv_state *cv)
+{
+    ObjectInstance *self = cv->ctx;
+    PyObject *record = PyStructSequence_New((PyTypeObject *)self->record_type);
+    if (record == NULL)
+        return NULL;
+
+    Py_ssize_t n = (Py_ssize_t)self->record_slots.count;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        Py_INCREF(Py_None);
+        PyStructSequence_SET_ITEM(record, i, Py_None);
+    }
+
+    struct json_object_iterator it = json_object_iter_begin(obj);
+    struct json_object_iterator itEnd = json_object_iter_end(obj);
+    for (; !json_object_iter_equal(&it, &itEnd); json_object_iter_next(&it)) {
+        const char *key = json_object_iter_peek_name(&it);
+        size_t len = strlen(key);
+        strmap_entry *e = strmap_find(&self->record_slots, key, len, hash_bytes(key, len));
+        if (e == NULL)
+            continue;
+
+        PyObject *value = convert_member(key, json_object_iter_peek_value(&it), cv);
+        if (value == NULL) {
+            Py_DECREF(record);
+            return NULL;
+        }
+        Py_ssize_t slot = (Py_ssize_t)(intptr_t)e->value - 1;
+        Py_DECREF(PyStructSequence_GET_ITEM(record, slot));
+        PyStructSequence_SET_ITEM(record, slot, value);
+    }
+    return record;
+}
+
+// record = lognorm.normalize_record(log = "...", strip = True, values = "str",
+//                                   filter = None)
+static PyObject*
+normalize_record(ObjectInstance *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *log_obj;
+    PyObject *strip = NULL;
+    const char *values = NULL;
+    PyObject *filter = NULL;
+    int values_mode;
+
+    static char *kwlist[] = {"log", "strip", "values", "filter", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OzO", kwlist, &log_obj, &strip, &values,
+                                     &filter))
+        return NULL;
+
+    if (parse_values_mode(values, &values_mode) != 0)
+        return NULL;
+
+    if (self->record_type == NULL) {
+        PyObject *type = derive_record_type(self);
+        if (type == NULL)
+            return NULL;
+        Py_DECREF(type);
+    }
+
+    struct json_object *log = NULL;
+    Py_buffer view;
+    int status = normalize_message(self, log_obj, strip, filter, &log, &view);
+    if (status < 0) {
+        release_message(&view);
+        return NULL;
+    }
+    if (status == 0 || json_object_get_type(log) != json_type_object) {
+        slowlog_check(self, log);
+        json_object_put(log);
+        release_message(&view);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    conv_state cv;
+    conv_init(&cv, self, values_mode);
+    PyObject *record = convert_record(log, &cv);
+    slowlog_check(self, log);
+    json_object_put(log);
+    release_message(&view);
+    return record;
+}
+
+//----------------------------------------------------------------------------
+// Multi-line record joining (stack traces and other continuation lines)
+//----------------------------------------------------------------------------
+
+typedef struct {
+    char *start;             // literal prefix that opens a record, or NULL
+    size_t start_len;
+    int timestamp;           // a leading timestamp opens a record
+    Py_ssize_t max_lines;
+    size_t max_bytes;
+    double timeout;          // seconds a pending record waits for more lines
+} mljoin_config;
+
+typedef struct {
+    const mljoin_config *cfg;
+    char *buf;
+    size_t len;
+    size_t cap;
+    Py_ssize_t lines;        // 0 when no record is pending
+    size_t input_bytes;      // raw input consumed by the pending record
+    double since;            // when the pending record was started
+} mljoin;
+
+static double
+monotonic_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// A record opens with a timestamp, optionally inside '['.
+static int
+starts_with_timestamp(const char *line, size_t len)
+{
+    if (len > 0 && line[0] == '[') {
+        line++;
+        len--;
+    }
+    return timestamp_len(line, len) > 0;
+}
+
+static int
+mljoin_is_start(const mljoin_config *cfg, const char *line, size_t len)
+{
+    if (cfg->start != NULL && len >= cfg->start_len &&
+        memcmp(line, cfg->start, cfg->start_len) == 0)
+        return 1;
+    return cfg->timestamp && starts_with_timestamp(line, len);
+}
+
+// Must the pending record be emitted before `line` can be pushed?
+static int
+mljoin_boundary(const mljoin *ml, const char *line, size_t len)
+{
+    return ml->lines > 0 &&
+        (mljoin_is_start(ml->cfg, line, len) || ml->len + 1 + len > ml->cfg->max_bytes);
+}
+
+// Has the pending record reached one of its caps?
+static int
+mljoin_full(const mljoin *ml)
+{
+    return ml->lines >= ml->cfg->max_lines || ml->len >= ml->cfg->max_bytes;
+}
+
+static int
+mljoin_expired(const mljoin *ml, double now)
+{
+    return ml->lines > 0 && now - ml->since >= ml->cfg->timeout;
+}
+
+static void
+mljoin_reset(mljoin *ml)
+{
+    ml->len = 0;
+    ml->lines = 0;
+    ml->input_bytes = 0;
+}
+
+// Append one physical line (consuming `used` bytes of input) to the record.
+static int
+mljoin_push(mljoin *ml, const char *line, size_t len, size_t used)
+{
+    size_t need = ml->len + len + 1;
+    if (need > ml->cap) {
+        size_t cap = ml->cap ? ml->cap : 256;
+        while (cap < need)
+            cap *= 2;
+        char *buf = realloc(ml->buf, cap);
+        if (buf == NULL)
+            return -1;
+        ml->buf = buf;
+        ml->cap = cap;
+    }
+    if (ml->lines == 0)
+        ml->since = monotonic_now();
+    else
+        ml->buf[ml->len++] = '\n';
+    memcpy(ml->buf + ml->len, line, len);
+    ml->len += len;
+    ml->lines++;
+    ml->input_bytes += used;
+    return 0;
+}
+
+// Normalize the pending record straight from the join buffer.
+static PyObject*
+mljoin_take(mljoin *ml, ObjectInstance *ctx, int values)
+{
+    PyObject *event = normalize_batch_line(ctx, ml->buf, ml->len, values);
+    mljoin_reset(ml);
+    return event;
+}
+
+typedef struct {
+    PyObject_HEAD
+    ObjectInstance *ctx;
+    mljoin_config cfg;
+    mljoin ml;
+    int strip;
+    int values;              // VALUES_* mode of the returned events
+} MultilineInstance;
+
+static PyTypeObject MultilineType;
+
+static int
+multiline_append(PyObject *list, PyObject *event)
+{
+    if (event == NULL)
+        return -1;
+    int rc = PyList_Append(list, event);
+    Py_DECREF(event);
+    return rc;
+}
+
+static void
+multiline_clear(MultilineInstance *self)
+{
+    free(self->ml.buf);
+    memset(&self->ml, 0, sizeof(self->ml));
+    PyMem_Free(self->cfg.start);
+    self->cfg.start = NULL;
+    Py_CLEAR(self->ctx);
+}
+
+static int
+multiline_init(MultilineInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {
+        "ctx", "start", "timestamp", "max_lines", "max_bytes", "timeout", "strip",
+        "values", NULL
+    };
+    PyObject *ctx;
+    const char *start = NULL;
+    Py_ssize_t start_len = 0;
+    int timestamp = 0;
+    Py_ssize_t max_lines = 500;
+    Py_ssize_t max_bytes = 65536;
+    double timeout = 1.0;
+    int strip = 1;
+    const char *values = NULL;
+    int values_mode;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|$z#pnndpz", kwlist,
+                                     &TypeObject, &ctx, &start, &start_len, &timestamp,
+                                     &max_lines, &max_bytes, &timeout, &strip, &values))
+        return -1;
+
+    if (parse_values_mode(values, &values_mode) != 0)
+        return -1;
+    if ((start == NULL || start_len == 0) && !timestamp) {
+        PyErr_SetString(PyExc_ValueError, "either start or timestamp must be given");
+        return -1;
+    }
+    if (max_lines < 1 || max_bytes < 1 || timeout < 0) {
+        PyErr_SetString(PyExc_ValueError, "max_lines, max_bytes and timeout must be positive");
+        return -1;
+    }
+
+    multiline_clear(self);
+    if (start != NULL && start_len > 0) {
+        self->cfg.start = PyMem_Malloc((size_t)start_len);
+        if (self->cfg.start == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        memcpy(self->cfg.start, start, (size_t)start_len);
+        self->cfg.start_len = (size_t)start_len;
+    }
+    self->cfg.timestamp = timestamp;
+    self->cfg.max_lines = max_lines;
+    self->cfg.max_bytes = (size_t)max_bytes;
+    self->cfg.timeout = timeout;
+    self->ml.cfg = &self->cfg;
+    self->strip = strip;
+    self->values = values_mode;
+    Py_INCREF(ctx);
+    self->ctx = (ObjectInstance *)ctx;
+    return 0;
+}
+
+static void
+multiline_dealloc(MultilineInstance *self)
+{
+    multiline_clear(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// events = multiline.feed(data)
+static PyObject*
+multiline_feed(MultilineInstance *self, PyObject *args)
+{
+    const char *data;
+    Py_ssize_t data_len;
+
+    if (!PyArg_ParseTuple(args, "s#", &data, &data_len))
+        return NULL;
+
+    if (self->ctx == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Multiline is not initialized");
+        return NULL;
+    }
+
+    PyObject *result = PyList_New(0);
+    if (result == NULL)
+        return NULL;
+
+    const char *end = data + data_len;
+    while (data < end) {
+        const char *nl = memchr(data, '\n', (size_t)(end - data));
+        size_t len = nl ? (size_t)(nl - data) : (size_t)(end - data);
+        size_t used = nl ? len + 1 : len;
+        const char *line = data;
+
+        data += used;
+        if (self->strip)
+            len = rstrip_len(line, len);
+        if (len == 0 && self->ml.lines == 0)
+            continue;
+
+        if (mljoin_boundary(&self->ml, line, len) &&
+            multiline_append(result, mljoin_take(&self->ml, self->ctx, self->values)) != 0)
+            goto error;
+        if (mljoin_push(&self->ml, line, len, used) != 0) {
+            PyErr_NoMemory();
+            goto error;
+        }
+        if (mljoin_full(&self->ml) &&
+            multiline_append(result, mljoin_take(&self->ml, self->ctx, self->values)) != 0)
+            goto error;
+    }
+    return result;
+
+error:
+    Py_DECREF(result);
+    return NULL;
+}
+
+static PyObject*
+multiline_flush_pending(MultilineInstance *self, int only_expired)
+{
+    PyObject *result = PyList_New(0);
+    if (result == NULL)
+        return NULL;
+    if (self->ctx == NULL || self->ml.lines == 0)
+        return result;
+    if (only_expired && !mljoin_expired(&self->ml, monotonic_now()))
+        return result;
+    if (multiline_append(result, mljoin_take(&self->ml, self->ctx, self->values)) != 0) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    return result;
+}
+
+static PyObject*
+multiline_flush(MultilineInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    return multiline_flush_pending(self, 0);
+}
+
+static PyObject*
+multiline_expire(MultilineInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    return multiline_flush_pending(self, 1);
+}
+
+static PyMethodDef multiline_methods[] = {
+  {"feed", (PyCFunction)multiline_feed, METH_VARARGS,
+    "Feed one or more lines; return the events of all completed records."},
+  {"flush", (PyCFunction)multiline_flush, METH_NOARGS,
+    "Emit the pending record, if any."},
+  {"expire", (PyCFunction)multiline_expire, METH_NOARGS,
+    "Emit the pending record if it has waited longer than the timeout."},
+  {NULL}
+};
+
+static PyTypeObject MultilineType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." MULTILINE_TYPE_NAME, /* tp_name */
+    sizeof(MultilineInstance),           /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)multiline_dealloc,       /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    0,                                   /* tp_repr */
+    0,                                   /* tp_as_number */
+    0,                                   /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    MULTILINE_DOCSTRING,                 /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    multiline_methods,                   /* tp_methods */
+    0,                                   /* tp_members */
+    0,                                   /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)multiline_init,            /* tp_init */
+    0,                                   /* tp_alloc */
+    PyType_GenericNew,                   /* tp_new */
+};
+
+//----------------------------------------------------------------------------
+// Aggregation: group-by counters updated without per-event Python objects
+//----------------------------------------------------------------------------
+
+// Statistic kept for a numeric field
+enum {
+    AGG_SUM = 0,
+    AGG_MIN,
+    AGG_MAX,
+};
+
+typedef struct {
+    char *path;              // compiled field name, see path_compile()
+    size_t depth;
+    int stat;                // AGG_* for value fields
+} agg_field;
+
+typedef struct {
+    double num;
+    int seen;                // a numeric value has been folded in
+    int integral;            // every value so far was an integer
+} agg_value;
+
+typedef struct {
+    int64_t bucket;          // window index, 0 without windows
+    uint64_t count;
+    agg_value values[];      // one per value field
+} agg_group;
+
+// Group table shared by the aggregating types.  Group keys are encoded as
+// the bucket followed by (present, length, text) for every `by` field.
+typedef struct {
+    agg_field *by;
+    size_t nby;
+    agg_field *values;
+    size_t nvalues;
+    PyObject *names;         // tuple: by names, "count", value columns
+    strmap groups;           // encoded key -> agg_group
+    scratch_buf key;
+} agg_table;
+
+static void
+agg_table_free(agg_table *t)
+{
+    for (size_t i = 0; i < t->nby; i++)
+        free(t->by[i].path);
+    for (size_t i = 0; i < t->nvalues; i++)
+        free(t->values[i].path);
+    PyMem_Free(t->by);
+    PyMem_Free(t->values);
+    Py_CLEAR(t->names);
+    strmap_clear(&t->groups, free);
+    free(t->key.ptr);
+    memset(t, 0, sizeof(*t));
+}
+
+// Compile the field names of `seq` into `fields[*n...]`, appending their
+// output column names ("bytes_sum", or the name itself for `suffix` NULL).
+static int
+agg_add_fields(PyObject *seq, int stat, const char *suffix, agg_field *fields,
+               size_t *n, PyObject *names)
+{
+    PyObject *fast = PySequence_Fast(seq, "fields must be a sequence of str");
+    if (fast == NULL)
+        return -1;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(fast); i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(fast, i);
+        Py_ssize_t len;
+        const char *name = PyUnicode_Check(item) ? PyUnicode_AsUTF8AndSize(item, &len) : NULL;
+        if (name == NULL) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_TypeError, "fields must be a sequence of str");
+            goto error;
+        }
+        if (len == 0) {
+            PyErr_SetString(PyExc_ValueError, "field names must not be empty");
+            goto error;
+        }
+        agg_field *f = &fields[*n];
+        f->path = path_compile(name, (size_t)len, &f->depth);
+        if (f->path == NULL) {
+            PyErr_NoMemory();
+            goto error;
+        }
+        f->stat = stat;
+        (*n)++;
+
+        PyObject *column = suffix == NULL ? (Py_INCREF(item), item)
+                                          : PyUnicode_FromFormat("%U_%s", item, suffix);
+        if (column == NULL)
+            goto error;
+        PyUnicode_InternInPlace(&column);
+        int rc = PyList_Append(names, column);
+        Py_DECREF(column);
+        if (rc != 0)
+            goto error;
+    }
+    Py_DECREF(fast);
+    return 0;
+
+error:
+    Py_DECREF(fast);
+    return -1;
+}
+
+static Py_ssize_t
+agg_count_fields(PyObject *seq)
+{
+    if (seq == NULL)
+        return 0;
+    if (PyUnicode_Check(seq)) {
+        PyErr_SetString(PyExc_TypeError, "fields must be a sequence of str, not str");
+        return -1;
+    }
+    return PySequence_Size(seq);
+}
+
+// Set up `t` for the given group-by and statistic field sequences (any
+// of which may be NULL).
+static int
+agg_table_init(agg_table *t, PyObject *by, PyObject *sum, PyObject *min, PyObject *max)
+{
+    Py_ssize_t nby = agg_count_fields(by);
+    Py_ssize_t nsum = agg_count_fields(sum);
+    Py_ssize_t nmin = agg_count_fields(min);
+    Py_ssize_t nmax = agg_count_fields(max);
+    if (nby < 0 || nsum < 0 || nmin < 0 || nmax < 0)
+        return -1;
+
+    PyObject *names = PyList_New(0);
+    if (names == NULL)
+        return -1;
+    t->by = PyMem_Calloc((size_t)nby + 1, sizeof(agg_field));
+    t->values = PyMem_Calloc((size_t)(nsum + nmin + nmax) + 1, sizeof(agg_field));
+    if (t->by == NULL || t->values == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    if (by != NULL && agg_add_fields(by, AGG_SUM, NULL, t->by, &t->nby, names) != 0)
+        goto error;
+
+    PyObject *count = PyUnicode_InternFromString("count");
+    if (count == NULL)
+        goto error;
+    int rc = PyList_Append(names, count);
+    Py_DECREF(count);
+    if (rc != 0)
+        goto error;
+
+    if ((sum != NULL && agg_add_fields(sum, AGG_SUM, "sum", t->values, &t->nvalues, names) != 0) ||
+        (min != NULL && agg_add_fields(min, AGG_MIN, "min", t->values, &t->nvalues, names) != 0) ||
+        (max != NULL && agg_add_fields(max, AGG_MAX, "max", t->values, &t->nvalues, names) != 0))
+        goto error;
+
+    t->names = PyList_AsTuple(names);
+    Py_DECREF(names);
+    return t->names != NULL ? 0 : -1;
+
+error:
+    Py_DECREF(names);
+    return -1;
+}
+
+// Numeric value of a field, telling whether it is an integer.
+static int
+agg_number(json_object *obj, double *out, int *integral)
+{
+    if (!flt_number(obj, out))
+        return 0;
+    switch (json_object_get_type(obj)) {
+        case json_type_double:
+            *integral = 0;
+            break;
+        case json_type_string: {
+            char *end;
+            errno = 0;
+            (void)strtoll(json_object_get_string(obj), &end, 10);
+            *integral = *end == '\0' && errno == 0;
+            break;
+        }
+        default:
+            *integral = 1;
+    }
+    return 1;
+}
+
+// Find or create the group of `event` in window `bucket`; NULL when out
+// of memory.
+static agg_group*
+agg_group_for(agg_table *t, json_object *event, int64_t bucket)
+{
+    size_t len = sizeof(bucket);
+    for (size_t i = 0; i < t->nby; i++) {
+        size_t n = 0;
+        json_object *obj = path_lookup(event, t->by[i].path, t->by[i].depth);
+        if (obj != NULL)
+            (void)flt_text(obj, &n);
+        len += 1 + sizeof(uint32_t) + n;
+    }
+    char *key = scratch_reserve(&t->key, len);
+    if (key == NULL)
+        return NULL;
+
+    char *p = key;
+    memcpy(p, &bucket, sizeof(bucket));
+    p += sizeof(bucket);
+    for (size_t i = 0; i < t->nby; i++) {
+        size_t n = 0;
+        const char *text = NULL;
+        json_object *obj = path_lookup(event, t->by[i].path, t->by[i].depth);
+        if (obj != NULL)
+            text = flt_text(obj, &n);
+        uint32_t n32 = (uint32_t)n;
+        *p++ = text != NULL;
+        memcpy(p, &n32, sizeof(n32));
+        p += sizeof(n32);
+        if (n > 0)
+            memcpy(p, text, n);
+        p += n;
+    }
+
+    strmap_entry *e = strmap_insert(&t->groups, key, len, hash_bytes(key, len));
+    if (e == NULL)
+        return NULL;
+    if (e->value == NULL) {
+        agg_group *g = calloc(1, sizeof(agg_group) + t->nvalues * sizeof(agg_value));
+        if (g == NULL)
+            return NULL;
+        g->bucket = bucket;
+        for (size_t i = 0; i < t->nvalues; i++)
+            g->values[i].integral = 1;
+        e->value = g;
+    }
+    return e->value;
+}
+
+// Fold one normalized event into its group.
+static int
+agg_update(agg_table *t, json_object *event, int64_t bucket)
+{
+    agg_group *g = agg_group_for(t, event, bucket);
+    if (g == NULL)
+        return -1;
+    g->count++;
+    for (size_t i = 0; i < t->nvalues; i++) {
+        const agg_field *f = &t->values[i];
+        agg_value *v = &g->values[i];
+        double num;
+        int integral;
+        json_object *obj = path_lookup(event, f->path, f->depth);
+        if (obj == NULL || !agg_number(obj, &num, &integral))
+            continue;
+        if (f->stat == AGG_SUM)
+            v->num += num;
+        else if (!v->seen || (f->stat == AGG_MIN ? num < v->num : num > v->num))
+            v->num = num;
+        v->seen = 1;
+        v->integral = v->integral && integral;
+    }
+    return 0;
+}
+
+static PyObject*
+agg_value_object(const agg_field *f, const agg_value *v)
+{
+    if (!v->seen && f->stat != AGG_SUM) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    return v->integral ? PyLong_FromDouble(v->num) : PyFloat_FromDouble(v->num);
+}
+
+// Store `value` (a new reference, NULL on error) under `key` in `row`.
+static int
+agg_set(PyObject *row, PyObject *key, PyObject *value)
+{
+    if (value == NULL)
+        return -1;
+    int rc = PyDict_SetItem(row, key, value);
+    Py_DECREF(value);
+    return rc;
+}
+
+// Row dict for one group; `window` > 0 adds the window start time.
+static PyObject*
+agg_row(const agg_table *t, const strmap_entry *e, double window, const char *errors)
+{
+    const agg_group *g = e->value;
+    PyObject *row = PyDict_New();
+    if (row == NULL)
+        return NULL;
+
+    const char *p = e->key + sizeof(int64_t);
+    Py_ssize_t col = 0;
+    for (size_t i = 0; i < t->nby; i++) {
+        int present = *p++;
+        uint32_t n;
+        memcpy(&n, p, sizeof(n));
+        p += sizeof(n);
+        PyObject *value = Py_None;
+        if (present)
+            value = PyUnicode_DecodeUTF8(p, (Py_ssize_t)n, errors);
+        else
+            Py_INCREF(value);
+        p += n;
+        if (agg_set(row, PyTuple_GET_ITEM(t->names, col++), value) != 0)
+            goto error;
+    }
+    if (agg_set(row, PyTuple_GET_ITEM(t->names, col++),
+                PyLong_FromUnsignedLongLong(g->count)) != 0)
+        goto error;
+    for (size_t i = 0; i < t->nvalues; i++) {
+        if (agg_set(row, PyTuple_GET_ITEM(t->names, col++),
+                    agg_value_object(&t->values[i], &g->values[i])) != 0)
+            goto error;
+    }
+    if (window > 0) {
+        PyObject *key = PyUnicode_InternFromString("window");
+        int rc = key == NULL ? -1 : agg_set(row, key, PyFloat_FromDouble((double)g->bucket * window));
+        Py_XDECREF(key);
+        if (rc != 0)
+            goto error;
+    }
+    return row;
+
+error:
+    Py_DECREF(row);
+    return NULL;
+}
+
+// Move the groups of windows before `before` (all groups when `all`) into
+// `rows` as dicts; the remaining groups stay in the table.
+static int
+agg_take(agg_table *t, int all, int64_t before, double window, const char *errors,
+         PyObject *rows)
+{
+    strmap kept = {NULL, 0, 0};
+    int rc = 0;
+
+    for (size_t i = 0; i < t->groups.cap; i++) {
+        strmap_entry *e = &t->groups.slots[i];
+        if (e->key == NULL)
+            continue;
+        agg_group *g = e->value;
+        if (rc == 0 && (all || g->bucket < before)) {
+            PyObject *row = agg_row(t, e, window, errors);
+            if (row != NULL && PyList_Append(rows, row) == 0) {
+                Py_DECREF(row);
+                free(g);
+                e->value = NULL;
+                continue;
+            }
+            Py_XDECREF(row);
+            rc = -1;
+        }
+        // Rows that could not be emitted stay in the table.
+        strmap_entry *k = strmap_insert(&kept, e->key, e->len, e->hash);
+        if (k == NULL) {
+            if (rc == 0)
+                PyErr_NoMemory();
+            rc = -1;
+            free(g);
+        } else {
+            k->value = g;
+        }
+        e->value = NULL;
+    }
+    strmap_clear(&t->groups, NULL);
+    t->groups = kept;
+    return rc;
+}
+
+typedef struct {
+    PyObject_HEAD
+    ObjectInstance *ctx;
+    PyObject *filter;        // Filter overriding the context's, or NULL
+    agg_table table;
+    double window;           // seconds per window, 0 for a single window
+    int strip;
+    unsigned long long lines;
+    unsigned long long unmatched;
+    char *time_path;         // Rollup: compiled timestamp field, else NULL
+    size_t time_depth;
+    double lateness;         // Rollup: seconds the watermark trails the newest event
+    double watermark;        // Rollup: NAN until the first timed event
+    unsigned long long late;
+    unsigned long long untimed;
+    PyObject *backlog;       // inputs feed_many() has not finished within
+                             // batch_budget: str/bytes buffers and iterators
+    Py_ssize_t backlog_offset; // bytes of the first buffer already consumed
+} AggregatorInstance;
+
+static void
+aggregator_clear(AggregatorInstance *self)
+{
+    agg_table_free(&self->table);
+    Py_CLEAR(self->filter);
+    Py_CLEAR(self->ctx);
+    free(self->time_path);
+    self->time_path = NULL;
+    Py_CLEAR(self->backlog);
+    self->backlog_offset = 0;
+}
+
+// Settings shared by Aggregator and Rollup.
+static int
+aggregator_setup(AggregatorInstance *self, PyObject *ctx, PyObject *by, PyObject *sum,
+                 PyObject *min, PyObject *max, double window, PyObject *filter_arg, int strip)
+{
+    aggregator_clear(self);
+    if (agg_table_init(&self->table, by, sum, min, max) != 0)
+        return -1;
+    self->filter = filter_from_arg(filter_arg);
+    if (self->filter == NULL && PyErr_Occurred())
+        return -1;
+    self->window = window;
+    self->strip = strip;
+    self->lines = 0;
+    self->unmatched = 0;
+    self->lateness = 0;
+    self->watermark = NAN;
+    self->late = 0;
+    self->untimed = 0;
+    Py_INCREF(ctx);
+    self->ctx = (ObjectInstance *)ctx;
+    return 0;
+}
+
+static int
+aggregator_init(AggregatorInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {
+        "ctx", "by", "sum", "min", "max", "window", "filter", "strip", NULL
+    };
+    PyObject *ctx;
+    PyObject *by = NULL;
+    PyObject *sum = NULL;
+    PyObject *min = NULL;
+    PyObject *max = NULL;
+    PyObject *window_obj = Py_None;
+    PyObject *filter_arg = Py_None;
+    int strip = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|O$OOOOOp", kwlist,
+                                     &TypeObject, &ctx, &by, &sum, &min, &max,
+                                     &window_obj, &filter_arg, &strip))
+        return -1;
+
+    double window = 0;
+    if (window_obj != Py_None) {
+        window = PyFloat_AsDouble(window_obj);
+        if (window == -1 && PyErr_Occurred())
+            return -1;
+        if (!(window > 0)) {
+            PyErr_SetString(PyExc_ValueError, "window must be positive");
+            return -1;
+        }
+    }
+
+    return aggregator_setup(self, ctx, by, sum, min, max, window, filter_arg, strip);
+}
+
+static void
+aggregator_dealloc(AggregatorInstance *self)
+{
+    aggregator_clear(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int
+aggregator_check(AggregatorInstance *self)
+{
+    if (self->ctx != NULL)
+        return 0;
+    PyErr_Format(PyExc_ValueError, "%s is not initialized", Py_TYPE(self)->tp_name);
+    return -1;
+}
+
+// Window index of the current wall-clock time.
+static int64_t
+aggregator_bucket(const AggregatorInstance *self)
+{
+    if (self->window <= 0)
+        return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)(((double)ts.tv_sec + (double)ts.tv_nsec / 1e9) / self->window);
+}
+
+// Seconds since the epoch of a timestamp field: a number, or a string
+// holding a number or an ISO 8601 / RFC 3164 timestamp.
+static int
+event_time(json_object *obj, double *out)
+{
+    size_t len;
+    const char *text;
+
+    switch (json_object_get_type(obj)) {
+        case json_type_int:
+        case json_type_double:
+            *out = json_object_get_double(obj);
+            return 1;
+        case json_type_string:
+            text = flt_text(obj, &len);
+            if (text != NULL && timestamp_value(text, len, (double)time(NULL), out))
+                return 1;
+            return flt_number(obj, out);
+        default:
+            return 0;
+    }
+}
+
+// Rollup: window index of an event from its timestamp field, advancing
+// the watermark.  Returns 0 for events without a usable timestamp and
+// for events older than the windows the watermark has closed.
+static int
+rollup_bucket(AggregatorInstance *self, json_object *event, int64_t *bucket)
+{
+    json_object *obj = path_lookup(event, self->time_path, self->time_depth);
+    double t;
+    if (obj == NULL || !event_time(obj, &t) || !isfinite(t)) {
+        self->untimed++;
+        return 0;
+    }
+    double b = floor(t / self->window);
+    if (!isnan(self->watermark) && b < floor(self->watermark / self->window)) {
+        self->late++;
+        return 0;
+    }
+    if (isnan(self->watermark) || t - self->lateness > self->watermark)
+        self->watermark = t - self->lateness;
+    *bucket = (int64_t)b;
+    return 1;
+}
+
+// Normalize and count one line; returns 1 if it was counted, 0 if it was
+// skipped (empty, unmatched, filtered out, untimed or late), -1 with an
+// exception set.
+static int
+aggregator_add(AggregatorInstance *self, const char *line, size_t len, int raw, int64_t bucket)
+{
+    if (self->strip)
+        len = rstrip_len(line, len);
+    if (len == 0)
+        return 0;
+    self->lines++;
+
+    ObjectInstance *ctx = self->ctx;
+    struct json_object *log = NULL;
+    int norm_result = ctx_normalize(ctx, line, len, raw, &log);
+
+    if (norm_result == NORMALIZE_PYERR && PyErr_ExceptionMatches(PyExc_UnicodeDecodeError)) {
+        PyErr_Clear();
+        norm_result = LN_WRONGPARSER;
+    }
+    if (norm_result == LN_WRONGPARSER || norm_result == NORMALIZE_OVERSIZE ||
+        norm_result == NORMALIZE_PREFILTERED) {
+        json_object_put(log);
+        self->unmatched++;
+        return 0;
+    }
+    if (norm_result != 0 || log == NULL) {
+        json_object_put(log);
+        raise_normalize_error(ctx, norm_result);
+        return -1;
+    }
+    int counted = ctx_accepts(ctx, self->filter != NULL ? self->filter : ctx->filter, log) &&
+        (self->time_path == NULL || rollup_bucket(self, log, &bucket));
+    if (counted && agg_update(&self->table, log, bucket) != 0) {
+        json_object_put(log);
+        PyErr_NoMemory();
+        return -1;
+    }
+    slowlog_check(ctx, log);
+    json_object_put(log);
+    return counted;
+}
+
+// Count the lines of a str or bytes-like `data` split on newlines, from
+// `*offset` on.  Stops early, with `*offset` at the next line, once a call
+// started at `started` has used up the batch budget (never when `started`
+// is negative); `*done` tells whether the end was reached.
+static Py_ssize_t
+aggregator_add_text(AggregatorInstance *self, PyObject *data, int64_t bucket,
+                    Py_ssize_t *offset, double started, int *done)
+{
+    const char *text;
+    Py_ssize_t text_len;
+    int raw;
+    Py_buffer view;
+    Py_ssize_t counted = 0;
+
+    if (get_message(data, &view, &text, &text_len, &raw) != 0)
+        return -1;
+    const char *end = text + text_len;
+    const char *p = text + (*offset < text_len ? *offset : text_len);
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t len = nl ? (size_t)(nl - p) : (size_t)(end - p);
+        int rc = aggregator_add(self, p, len, raw, bucket);
+        if (rc < 0) {
+            counted = -1;
+            break;
+        }
+        counted += rc;
+        p += nl ? len + 1 : len;
+        if (p < end && started >= 0 && batch_budget_spent(self->ctx, started))
+            break;
+    }
+    *offset = (Py_ssize_t)(p - text);
+    *done = p >= end;
+    release_message(&view);
+    return counted;
+}
+
+// Count the remaining lines of an iterator; like aggregator_add_text().
+static Py_ssize_t
+aggregator_add_iter(AggregatorInstance *self, PyObject *iter, int64_t bucket,
+                    double started, int *done)
+{
+    Py_ssize_t counted = 0;
+    PyObject *item;
+    *done = 0;
+    for (;;) {
+        item = PyIter_Next(iter);
+        if (item == NULL) {
+            *done = 1;
+            break;
+        }
+        const char *msg;
+        Py_ssize_t len;
+        int raw;
+        Py_buffer view;
+        int rc = get_message(item, &view, &msg, &len, &raw);
+        if (rc == 0) {
+            rc = aggregator_add(self, msg, (size_t)len, raw, bucket);
+            release_message(&view);
+        }
+        Py_DECREF(item);
+        if (rc < 0)
+            return -1;
+        counted += rc;
+        if (started >= 0 && batch_budget_spent(self->ctx, started))
+            break;
+    }
+    return PyErr_Occurred() ? -1 : counted;
+}
+
+// Work through the backlog in order, within the batch budget unless
+// `started` is negative.  An error drops the whole backlog.
+static Py_ssize_t
+aggregator_drain(AggregatorInstance *self, double started)
+{
+    Py_ssize_t counted = 0;
+    int64_t bucket = aggregator_bucket(self);
+    while (self->backlog != NULL && PyList_GET_SIZE(self->backlog) > 0) {
+        PyObject *input = PyList_GET_ITEM(self->backlog, 0);
+        int done;
+        Py_INCREF(input);       // an iterator may run arbitrary code
+        Py_ssize_t rc = PyIter_Check(input)
+            ? aggregator_add_iter(self, input, bucket, started, &done)
+            : aggregator_add_text(self, input, bucket, &self->backlog_offset, started, &done);
+        Py_DECREF(input);
+        if (rc < 0) {
+            Py_CLEAR(self->backlog);
+            self->backlog_offset = 0;
+            return -1;
+        }
+        counted += rc;
+        if (!done)
+            break;
+        if (PySequence_DelItem(self->backlog, 0) != 0)
+            return -1;
+        self->backlog_offset = 0;
+    }
+    return counted;
+}
+
+// counted = aggregator.feed(line)
+static PyObject*
+aggregator_feed(AggregatorInstance *self, PyObject *args)
+{
+    PyObject *line;
+    const char *msg;
+    Py_ssize_t len;
+    int raw;
+    Py_buffer view;
+
+    if (!PyArg_ParseTuple(args, "O", &line) || aggregator_check(self) != 0)
+        return NULL;
+    if (get_message(line, &view, &msg, &len, &raw) != 0)
+        return NULL;
+    int rc = aggregator_add(self, msg, (size_t)len, raw, aggregator_bucket(self));
+    release_message(&view);
+    if (rc < 0)
+        return NULL;
+    return PyBool_FromLong(rc);
+}
+
+// counted = aggregator.feed_many(lines)
+static PyObject*
+aggregator_feed_many(AggregatorInstance *self, PyObject *args)
+{
+    PyObject *lines;
+
+    if (!PyArg_ParseTuple(args, "O", &lines) || aggregator_check(self) != 0)
+        return NULL;
+
+    PyObject *input;
+    if (PyUnicode_Check(lines) || PyObject_CheckBuffer(lines)) {
+        input = lines;
+        Py_INCREF(input);
+    } else {
+        input = PyObject_GetIter(lines);
+        if (input == NULL)
+            return NULL;
+    }
+    if (self->backlog == NULL && (self->backlog = PyList_New(0)) == NULL) {
+        Py_DECREF(input);
+        return NULL;
+    }
+    int rc = PyList_Append(self->backlog, input);
+    Py_DECREF(input);
+    if (rc != 0)
+        return NULL;
+
+    Py_ssize_t counted = aggregator_drain(self, monotonic_now());
+    return counted < 0 ? NULL : PyLong_FromSsize_t(counted);
+}
+
+static PyObject*
+aggregator_take(AggregatorInstance *self, int all)
+{
+    if (aggregator_check(self) != 0)
+        return NULL;
+    PyObject *rows = PyList_New(0);
+    if (rows == NULL)
+        return NULL;
+    if (!all && (self->window <= 0 || (self->time_path != NULL && isnan(self->watermark))))
+        return rows;
+
+    // Rollup windows close when the watermark passes their end.
+    int64_t before = self->time_path != NULL
+        ? (int64_t)floor(self->watermark / self->window)
+        : aggregator_bucket(self);
+    conv_state cv;
+    conv_init(&cv, self->ctx, VALUES_STR);
+    if (agg_take(&self->table, all, before, self->window, cv.errors, rows) != 0) {
+        Py_DECREF(rows);
+        return NULL;
+    }
+    return rows;
+}
+
+static PyObject*
+aggregator_flush(AggregatorInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    // the final rows include what feed_many() left over, budget or not
+    if (aggregator_check(self) != 0 || aggregator_drain(self, -1) < 0)
+        return NULL;
+    return aggregator_take(self, 1);
+}
+
+static PyObject*
+aggregator_expire(AggregatorInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    return aggregator_take(self, 0);
+}
+
+static PyObject*
+aggregator_get_lines(AggregatorInstance *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->lines);
+}
+
+static PyObject*
+aggregator_get_unmatched(AggregatorInstance *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->unmatched);
+}
+
+static PyObject*
+aggregator_get_backlog(AggregatorInstance *self, void *closure)
+{
+    return PyBool_FromLong(self->backlog != NULL && PyList_GET_SIZE(self->backlog) > 0);
+}
+
+static Py_ssize_t
+aggregator_length(AggregatorInstance *self)
+{
+    return (Py_ssize_t)self->table.groups.count;
+}
+
+static PyMethodDef aggregator_methods[] = {
+    {"feed", (PyCFunction)aggregator_feed, METH_VARARGS,
+        "Normalize one line and count it; return whether it was counted."},
+    {"feed_many", (PyCFunction)aggregator_feed_many, METH_VARARGS,
+        "Count an iterable of lines or a newline-separated buffer."},
+    {"flush", (PyCFunction)aggregator_flush, METH_NOARGS,
+        "Return the rows of all groups and reset them."},
+    {"expire", (PyCFunction)aggregator_expire, METH_NOARGS,
+        "Return and reset the rows of the windows that have closed."},
+    {NULL}
+};
+
+static PyGetSetDef aggregator_getset[] = {
+    {"lines", (getter)aggregator_get_lines, NULL, "non-empty lines fed so far", NULL},
+    {"unmatched", (getter)aggregator_get_unmatched, NULL, "lines that matched no rule", NULL},
+    {"backlog", (getter)aggregator_get_backlog, NULL,
+        "whether feed_many() input is left over from batch_budget", NULL},
+    {NULL}
+};
+
+static PySequenceMethods aggregator_as_sequence = {
+    (lenfunc)aggregator_length,          /* sq_length */
+};
+
+static PyTypeObject AggregatorType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." AGGREGATOR_TYPE_NAME, /* tp_name */
+    sizeof(AggregatorInstance),          /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)aggregator_dealloc,      /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    0,                                   /* tp_repr */
+    0,                                   /* tp_as_number */
+    &aggregator_as_sequence,             /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    AGGREGATOR_DOCSTRING,                /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    aggregator_methods,                  /* tp_methods */
+    0,                                   /* tp_members */
+    aggregator_getset,                   /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)aggregator_init,           /* tp_init */
+    0,                                   /* tp_alloc */
+    PyType_GenericNew,                   /* tp_new */
+};
+
+static int
+rollup_init(AggregatorInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {
+        "ctx", "time_field", "window", "by", "sum", "min", "max", "lateness", "filter",
+        "strip", NULL
+    };
+    PyObject *ctx;
+    const char *time_field;
+    Py_ssize_t time_field_len;
+    double window;
+    PyObject *by = NULL;
+    PyObject *sum = NULL;
+    PyObject *min = NULL;
+    PyObject *max = NULL;
+    double lateness = 0;
+    PyObject *filter_arg = Py_None;
+    int strip = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!s#d|O$OOOdOp", kwlist,
+                                     &TypeObject, &ctx, &time_field, &time_field_len,
+                                     &window, &by, &sum, &min, &max, &lateness,
+                                     &filter_arg, &strip))
+        return -1;
+
+    if (time_field_len == 0) {
+        PyErr_SetString(PyExc_ValueError, "time_field must not be empty");
+        return -1;
+    }
+    if (!(window > 0) || !isfinite(window)) {
+        PyErr_SetString(PyExc_ValueError, "window must be positive");
+        return -1;
+    }
+    if (!(lateness >= 0) || !isfinite(lateness)) {
+        PyErr_SetString(PyExc_ValueError, "lateness must not be negative");
+        return -1;
+    }
+
+    if (aggregator_setup(self, ctx, by, sum, min, max, window, filter_arg, strip) != 0)
+        return -1;
+    self->time_path = path_compile(time_field, (size_t)time_field_len, &self->time_depth);
+    if (self->time_path == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->lateness = lateness;
+    return 0;
+}
+
+static PyObject*
+rollup_get_watermark(AggregatorInstance *self, void *closure)
+{
+    if (isnan(self->watermark))
+        Py_RETURN_NONE;
+    return PyFloat_FromDouble(self->watermark);
+}
+
+static PyObject*
+rollup_get_late(AggregatorInstance *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->late);
+}
+
+static PyObject*
+rollup_get_untimed(AggregatorInstance *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->untimed);
+}
+
+static PyGetSetDef rollup_getset[] = {
+    {"lines", (getter)aggregator_get_lines, NULL, "non-empty lines fed so far", NULL},
+    {"unmatched", (getter)aggregator_get_unmatched, NULL, "lines that matched no rule", NULL},
+    {"watermark", (getter)rollup_get_watermark, NULL,
+        "event time up to which windows are complete, or None", NULL},
+    {"late", (getter)rollup_get_late, NULL, "events dropped for windows already closed", NULL},
+    {"untimed", (getter)rollup_get_untimed, NULL, "events without a usable timestamp", NULL},
+    {"backlog", (getter)aggregator_get_backlog, NULL,
+        "whether feed_many() input is left over from batch_budget", NULL},
+    {NULL}
+};
+
+static PyTypeObject RollupType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." ROLLUP_TYPE_NAME,    /* tp_name */
+    sizeof(AggregatorInstance),          /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)aggregator_dealloc,      /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    0,                                   /* tp_repr */
+    0,                                   /* tp_as_number */
+    &aggregator_as_sequence,             /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    ROLLUP_DOCSTRING,                    /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    aggregator_methods,                  /* tp_methods */
+    0,                                   /* tp_members */
+    rollup_getset,                       /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)rollup_init,               /* tp_init */
+    0,                                   /* tp_alloc */
+    PyType_GenericNew,                   /* tp_new */
+};
+
+//----------------------------------------------------------------------------
+// Sketches: bounded-memory summaries fed by one field of accepted events
+//----------------------------------------------------------------------------
+
+// Common head of the types accepted by Lognorm.attach()
+typedef struct {
+    PyObject_HEAD
+    void (*observe)(PyObject *sketch, const char *text, size_t len);
+} SketchInstance;
+
+static PyTypeObject TopKType;
+static PyTypeObject HyperLogLogType;
+
+static int
+is_sketch(PyObject *obj)
+{
+    return PyObject_TypeCheck(obj, &TopKType) || PyObject_TypeCheck(obj, &HyperLogLogType);
+}
+
+static void
+sketches_observe(ObjectInstance *self, json_object *event)
+{
+    for (size_t i = 0; i < self->nsketches; i++) {
+        const sketch_attachment *a = &self->sketches[i];
+        json_object *obj = path_lookup(event, a->path, a->depth);
+        size_t len;
+        const char *text = obj != NULL ? flt_text(obj, &len) : NULL;
+        if (text != NULL)
+            ((SketchInstance *)a->sketch)->observe(a->sketch, text, len);
+    }
+}
+
+static void
+sketches_clear(ObjectInstance *self)
+{
+    for (size_t i = 0; i < self->nsketches; i++) {
+        Py_DECREF(self->sketches[i].sketch);
+        free(self->sketches[i].path);
+    }
+    PyMem_Free(self->sketches);
+    self->sketches = NULL;
+    self->nsketches = 0;
+}
+
+// lognorm.attach(sketch, field)
+static PyObject*
+liblognorm_attach(ObjectInstance *self, PyObject *args)
+{
+    PyObject *sketch;
+    const char *field;
+    Py_ssize_t field_len;
+
+    if (!PyArg_ParseTuple(args, "Os#", &sketch, &field, &field_len))
+        return NULL;
+    if (!is_sketch(sketch)) {
+        PyErr_Format(PyExc_TypeError, "expected a TopK or HyperLogLog, not %.200s", Py_TYPE(sketch)->tp_name);
+        return NULL;
+    }
+    // set by a successful __init__, which also allocates the sketch
+    if (((SketchInstance *)sketch)->observe == NULL) {
+        PyErr_Format(PyExc_ValueError, "%s is not initialized",
+                     PyObject_TypeCheck(sketch, &TopKType) ? TOPK_TYPE_NAME : HLL_TYPE_NAME);
+        return NULL;
+    }
+    if (field_len == 0) {
+        PyErr_SetString(PyExc_ValueError, "field name must not be empty");
+        return NULL;
+    }
+
+    sketch_attachment *sketches = PyMem_Realloc(self->sketches,
+                                                (self->nsketches + 1) * sizeof(sketch_attachment));
+    if (sketches == NULL)
+        return PyErr_NoMemory();
+    self->sketches = sketches;
+
+    sketch_attachment *a = &sketches[self->nsketches];
+    a->path = path_compile(field, (size_t)field_len, &a->depth);
+    if (a->path == NULL)
+        return PyErr_NoMemory();
+    Py_INCREF(sketch);
+    a->sketch = sketch;
+    self->nsketches++;
+    Py_RETURN_NONE;
+}
+
+// detached = lognorm.detach(sketch)
+static PyObject*
+liblognorm_detach(ObjectInstance *self, PyObject *args)
+{
+    PyObject *sketch;
+    size_t kept = 0;
+
+    if (!PyArg_ParseTuple(args, "O", &sketch))
+        return NULL;
+    for (size_t i = 0; i < self->nsketches; i++) {
+        sketch_attachment *a = &self->sketches[i];
+        if (a->sketch == sketch) {
+            Py_DECREF(a->sketch);
+            free(a->path);
+        } else {
+            self->sketches[kept++] = *a;
+        }
+    }
+    int found = kept < self->nsketches;
+    self->nsketches = kept;
+    return PyBool_FromLong(found);
+}
+
+//----------------------------------------------------------------------------
+// TopK: heavy hitters with the Space-Saving algorithm
+//----------------------------------------------------------------------------
+
+typedef struct {
+    const char *key;         // owned by the index entry
+    size_t len;
+    uint64_t hash;
+    unsigned long long count;
+    unsigned long long error; // upper bound of the overestimation of count
+    size_t pos;              // position in the heap
+} topk_counter;
+
+typedef struct {
+    SketchInstance base;
+    Py_ssize_t k;
+    size_t capacity;         // number of counters
+    topk_counter *counters;
+    topk_counter **heap;     // min-heap on count
+    size_t size;             // counters in use
+    strmap index;            // value -> topk_counter
+    unsigned long long total;
+    unsigned long long dropped; // values attach() could not count, out of memory
+} TopKInstance;
+
+static void
+topk_swap(topk_counter **heap, size_t a, size_t b)
+{
+    topk_counter *c = heap[a];
+    heap[a] = heap[b];
+    heap[b] = c;
+    heap[a]->pos = a;
+    heap[b]->pos = b;
+}
+
+static void
+topk_sift_up(TopKInstance *self, size_t pos)
+{
+    topk_counter **heap = self->heap;
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (heap[parent]->count <= heap[pos]->count)
+            break;
+        topk_swap(heap, pos, parent);
+        pos = parent;
+    }
+}
+
+static void
+topk_sift_down(TopKInstance *self, size_t pos)
+{
+    topk_counter **heap = self->heap;
+    for (;;) {
+        size_t least = pos;
+        size_t left = 2 * pos + 1;
+        size_t right = left + 1;
+        if (left < self->size && heap[left]->count < heap[least]->count)
+            least = left;
+        if (right < self->size && heap[right]->count < heap[least]->count)
+            least = right;
+        if (least == pos)
+            break;
+        topk_swap(heap, pos, least);
+        pos = least;
+    }
+}
+
+// Count `n` occurrences of a value.  When all counters are taken the one
+// with the lowest count is reassigned, inheriting its count as the error.
+// Returns -1 when out of memory, leaving the sketch unchanged.
+static int
+topk_add(TopKInstance *self, const char *text, size_t len, unsigned long long n)
+{
+    uint64_t hash = hash_bytes(text, len);
+    strmap_entry *e = strmap_find(&self->index, text, len, hash);
+
+    if (e != NULL) {
+        topk_counter *c = e->value;
+        c->count += n;
+        topk_sift_down(self, c->pos);
+        self->total += n;
+        return 0;
+    }
+
+    e = strmap_insert(&self->index, text, len, hash);
+    if (e == NULL)
+        return -1;
+    topk_counter *c;
+    if (self->size < self->capacity) {
+        c = &self->counters[self->size];
+        c->count = n;
+        c->error = 0;
+        c->pos = self->size;
+        self->heap[self->size++] = c;
+    } else {
+        c = self->heap[0];
+        strmap_remove(&self->index, strmap_find(&self->index, c->key, c->len, c->hash));
+        // The removal may have moved the new entry.
+        e = strmap_find(&self->index, text, len, hash);
+        c->error = c->count;
+        c->count += n;
+    }
+    e->value = c;
+    c->key = e->key;
+    c->len = len;
+    c->hash = hash;
+    if (c->error == 0)
+        topk_sift_up(self, c->pos);
+    else
+        topk_sift_down(self, c->pos);
+    self->total += n;
+    return 0;
+}
+
+static void
+topk_observe(PyObject *sketch, const char *text, size_t len)
+{
+    TopKInstance *self = (TopKInstance *)sketch;
+    // a failed re-__init__ leaves an attached sketch without counters
+    if (self->counters == NULL || topk_add(self, text, len, 1) != 0)
+        self->dropped++;
+}
+
+static void
+topk_release(TopKInstance *self)
+{
+    strmap_clear(&self->index, NULL);
+    PyMem_Free(self->counters);
+    PyMem_Free(self->heap);
+    self->counters = NULL;
+    self->heap = NULL;
+    self->size = 0;
+    self->total = 0;
+}
+
+static int
+topk_init(TopKInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"k", "capacity", NULL};
+    Py_ssize_t k;
+    Py_ssize_t capacity = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n|$n", kwlist, &k, &capacity))
+        return -1;
+    if (k < 1) {
+        PyErr_SetString(PyExc_ValueError, "k must be positive");
+        return -1;
+    }
+    if (capacity == 0)
+        capacity = k > PY_SSIZE_T_MAX / 10 ? k : k * 10;
+    if (capacity < k) {
+        PyErr_SetString(PyExc_ValueError, "capacity must not be smaller than k");
+        return -1;
+    }
+
+    topk_release(self);
+    self->counters = PyMem_Calloc((size_t)capacity, sizeof(topk_counter));
+    self->heap = PyMem_Calloc((size_t)capacity, sizeof(topk_counter *));
+    if (self->counters == NULL || self->heap == NULL) {
+        topk_release(self);
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->base.observe = topk_observe;
+    self->k = k;
+    self->capacity = (size_t)capacity;
+    return 0;
+}
+
+static void
+topk_dealloc(TopKInstance *self)
+{
+    topk_release(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int
+topk_check(TopKInstance *self)
+{
+    if (self->counters != NULL)
+        return 0;
+    PyErr_SetString(PyExc_ValueError, "TopK is not initialized");
+    return -1;
+}
+
+// topk.add(value, count = 1)
+static PyObject*
+topk_add_method(TopKInstance *self, PyObject *args)
+{
+    PyObject *value;
+    Py_ssize_t count = 1;
+    const char *text;
+    Py_ssize_t len;
+    int raw;
+    Py_buffer view;
+
+    if (!PyArg_ParseTuple(args, "O|n", &value, &count) || topk_check(self) != 0)
+        return NULL;
+    if (count < 1) {
+        PyErr_SetString(PyExc_ValueError, "count must be positive");
+        return NULL;
+    }
+    if (get_message(value, &view, &text, &len, &raw) != 0)
+        return NULL;
+    int rc = topk_add(self, text, (size_t)len, (unsigned long long)count);
+    release_message(&view);
+    if (rc != 0)
+        return PyErr_NoMemory();
+    Py_RETURN_NONE;
+}
+
+static int
+topk_order(const void *a, const void *b)
+{
+    const topk_counter *x = *(topk_counter *const *)a;
+    const topk_counter *y = *(topk_counter *const *)b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    if (x->error != y->error)
+        return x->error < y->error ? -1 : 1;
+    return 0;
+}
+
+// [(value, count, error), ...] = topk.top(n = None)
+static PyObject*
+topk_top(TopKInstance *self, PyObject *args)
+{
+    PyObject *n_obj = Py_None;
+
+    if (!PyArg_ParseTuple(args, "|O", &n_obj) || topk_check(self) != 0)
+        return NULL;
+    Py_ssize_t n = self->k;
+    if (n_obj != Py_None) {
+        n = PyNumber_AsSsize_t(n_obj, PyExc_OverflowError);
+        if (n == -1 && PyErr_Occurred())
+            return NULL;
+        if (n < 0) {
+            PyErr_SetString(PyExc_ValueError, "n must not be negative");
+            return NULL;
+        }
+    }
+    if ((size_t)n > self->size)
+        n = (Py_ssize_t)self->size;
+
+    topk_counter **order = PyMem_Malloc((self->size + 1) * sizeof(topk_counter *));
+    if (order == NULL)
+        return PyErr_NoMemory();
+    memcpy(order, self->heap, self->size * sizeof(topk_counter *));
+    qsort(order, self->size, sizeof(topk_counter *), topk_order);
+
+    PyObject *result = PyList_New(n);
+    for (Py_ssize_t i = 0; result != NULL && i < n; i++) {
+        const topk_counter *c = order[i];
+        PyObject *item = Py_BuildValue("(NKK)",
+                                       PyUnicode_DecodeUTF8(c->key, (Py_ssize_t)c->len,
+                                                            "surrogateescape"),
+                                       c->count, c->error);
+        if (item == NULL)
+            Py_CLEAR(result);
+        else
+            PyList_SET_ITEM(result, i, item);
+    }
+    PyMem_Free(order);
+    return result;
+}
+
+static PyObject*
+topk_clear(TopKInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    if (topk_check(self) != 0)
+        return NULL;
+    strmap_clear(&self->index, NULL);
+    self->size = 0;
+    self->total = 0;
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+topk_get_k(TopKInstance *self, void *closure)
+{
+    return PyLong_FromSsize_t(self->k);
+}
+
+static PyObject*
+topk_get_total(TopKInstance *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->total);
+}
+
+static PyObject*
+topk_get_dropped(TopKInstance *self, void *closure)
+{
+    return PyLong_FromUnsignedLongLong(self->dropped);
+}
+
+static Py_ssize_t
+topk_length(TopKInstance *self)
+{
+    return (Py_ssize_t)self->size;
+}
+
+static PyMethodDef topk_methods[] = {
+    {"add", (PyCFunction)topk_add_method, METH_VARARGS,
+        "Count occurrences of a value."},
+    {"top", (PyCFunction)topk_top, METH_VARARGS,
+        "The most frequent values as (value, count, error) tuples."},
+    {"clear", (PyCFunction)topk_clear, METH_NOARGS,
+        "Forget all counts."},
+    {NULL}
+};
+
+static PyGetSetDef topk_getset[] = {
+    {"k", (getter)topk_get_k, NULL, "number of values reported by top()", NULL},
+    {"total", (getter)topk_get_total, NULL, "sum of all counts added", NULL},
+    {"dropped", (getter)topk_get_dropped, NULL,
+     "values from attached contexts lost to out-of-memory", NULL},
+    {NULL}
+};
+
+static PySequenceMethods topk_as_sequence = {
+    (lenfunc)topk_length,                /* sq_length */
+};
+
+static PyTypeObject TopKType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." TOPK_TYPE_NAME,      /* tp_name */
+    sizeof(TopKInstance),                /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)topk_dealloc,            /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    0,                                   /* tp_repr */
+    0,                                   /* tp_as_number */
+    &topk_as_sequence,                   /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    TOPK_DOCSTRING,                      /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    topk_methods,                        /* tp_methods */
+    0,                                   /* tp_members */
+    topk_getset,                         /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)topk_init,                 /* tp_init */
+    0,                                   /* tp_alloc */
+    PyType_GenericNew,                   /* tp_new */
+};
+
+//----------------------------------------------------------------------------
+// HyperLogLog: mergeable distinct-count sketches
+//----------------------------------------------------------------------------
+
+#define HLL_MAGIC     "LNHLL1"
+#define HLL_MAGIC_LEN 6
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 18
+
+typedef struct {
+    SketchInstance base;
+    int precision;           // log2 of the number of registers
+    uint8_t *registers;
+} HyperLogLogInstance;
+
+// hash_bytes() is stable across processes, which serialized sketches
+// rely on; the extra finalizer spreads it over all 64 bits.
+static uint64_t
+hll_hash(const char *text, size_t len)
+{
+    uint64_t h = hash_bytes(text, len);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static void
+hll_add(HyperLogLogInstance *self, const char *text, size_t len)
+{
+    int p = self->precision;
+    uint64_t h = hll_hash(text, len);
+    uint64_t w = h << p;
+    uint8_t rank = 1;
+    while (rank <= 64 - p && (w & (1ULL << 63)) == 0) {
+        rank++;
+        w <<= 1;
+    }
+    uint8_t *reg = &self->registers[h >> (64 - p)];
+    if (rank > *reg)
+        *reg = rank;
+}
+
+static void
+hll_observe(PyObject *sketch, const char *text, size_t len)
+{
+    hll_add((HyperLogLogInstance *)sketch, text, len);
+}
+
+// Cardinality estimate from the register histogram, using the improved
+// estimator of O. Ertl, "New cardinality estimation algorithms for
+// HyperLogLog sketches" (2017), which needs no empirical bias tables.
+static double
+hll_sigma(double x)
+{
+    if (x == 1)
+        return INFINITY;
+    double y = 1;
+    double z = x;
+    double prev;
+    do {
+        x *= x;
+        prev = z;
+        z += x * y;
+        y += y;
+    } while (z != prev);
+    return z;
+}
+
+static double
+hll_tau(double x)
+{
+    if (x == 0 || x == 1)
+        return 0;
+    double y = 1;
+    double z = 1 - x;
+    double prev;
+    do {
+        x = sqrt(x);
+        prev = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z != prev);
+    return z / 3;
+}
+
+static double
+hll_estimate(const HyperLogLogInstance *self)
+{
+    int q = 64 - self->precision;
+    size_t m = (size_t)1 << self->precision;
+    size_t hist[66] = {0};
+    for (size_t i = 0; i < m; i++)
+        hist[self->registers[i]]++;
+
+    double z = (double)m * hll_tau(1 - (double)hist[q + 1] / (double)m);
+    for (int k = q; k >= 1; k--)
+        z = 0.5 * (z + (double)hist[k]);
+    z += (double)m * hll_sigma((double)hist[0] / (double)m);
+    return (double)m * (double)m / (2 * log(2) * z);
+}
+
+static int
+hll_init(HyperLogLogInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"precision", NULL};
+    int precision = 14;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &precision))
+        return -1;
+    if (precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION) {
+        PyErr_Format(PyExc_ValueError, "precision must be between %d and %d",
+                     HLL_MIN_PRECISION, HLL_MAX_PRECISION);
+        return -1;
+    }
+
+    uint8_t *registers = PyMem_Calloc((size_t)1 << precision, 1);
+    if (registers == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    PyMem_Free(self->registers);
+    self->registers = registers;
+    self->precision = precision;
+    self->base.observe = hll_observe;
+    return 0;
+}
+
+static void
+hll_dealloc(HyperLogLogInstance *self)
+{
+    PyMem_Free(self->registers);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int
+hll_check(HyperLogLogInstance *self)
+{
+    if (self->registers != NULL)
+        return 0;
+    PyErr_SetString(PyExc_ValueError, "HyperLogLog is not initialized");
+    return -1;
+}
+
+// hll.add(value)
+static PyObject*
+hll_add_method(HyperLogLogInstance *self, PyObject *args)
+{
+    PyObject *value;
+    const char *text;
+    Py_ssize_t len;
+    int raw;
+    Py_buffer view;
+
+    if (!PyArg_ParseTuple(args, "O", &value) || hll_check(self) != 0)
+        return NULL;
+    if (get_message(value, &view, &text, &len, &raw) != 0)
+        return NULL;
+    hll_add(self, text, (size_t)len);
+    release_message(&view);
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+hll_count(HyperLogLogInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    if (hll_check(self) != 0)
+        return NULL;
+    return PyLong_FromDouble(floor(hll_estimate(self) + 0.5));
+}
+
+// hll.merge(other)
+static PyObject*
+hll_merge(HyperLogLogInstance *self, PyObject *args)
+{
+    HyperLogLogInstance *other;
+
+    if (!PyArg_ParseTuple(args, "O!", &HyperLogLogType, &other) ||
+        hll_check(self) != 0 || hll_check(other) != 0)
+        return NULL;
+    if (other->precision != self->precision) {
+        PyErr_Format(PyExc_ValueError, "cannot merge precision %d into precision %d",
+                     other->precision, self->precision);
+        return NULL;
+    }
+    size_t m = (size_t)1 << self->precision;
+    for (size_t i = 0; i < m; i++) {
+        if (other->registers[i] > self->registers[i])
+            self->registers[i] = other->registers[i];
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+hll_clear(HyperLogLogInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    if (hll_check(self) != 0)
+        return NULL;
+    memset(self->registers, 0, (size_t)1 << self->precision);
+    Py_RETURN_NONE;
+}
+
+// Serialized form: magic, precision byte, one byte per register.
+static PyObject*
+hll_to_bytes(HyperLogLogInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    if (hll_check(self) != 0)
+        return NULL;
+    size_t m = (size_t)1 << self->precision;
+    PyObject *data = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)(HLL_MAGIC_LEN + 1 + m));
+    if (data == NULL)
+        return NULL;
+    char *p = PyBytes_AS_STRING(data);
+    memcpy(p, HLL_MAGIC, HLL_MAGIC_LEN);
+    p[HLL_MAGIC_LEN] = (char)self->precision;
+    memcpy(p + HLL_MAGIC_LEN + 1, self->registers, m);
+    return data;
+}
+
+// hll = HyperLogLog.from_bytes(data)
+static PyObject*
+hll_from_bytes(PyObject *cls, PyObject *args)
+{
+    Py_buffer view;
+
+    if (!PyArg_ParseTuple(args, "y*", &view))
+        return NULL;
+    const unsigned char *p = view.buf;
+    int precision = view.len > HLL_MAGIC_LEN ? p[HLL_MAGIC_LEN] : 0;
+    if (view.len <= HLL_MAGIC_LEN || memcmp(p, HLL_MAGIC, HLL_MAGIC_LEN) != 0 ||
+        precision < HLL_MIN_PRECISION || precision > HLL_MAX_PRECISION ||
+        (size_t)view.len != HLL_MAGIC_LEN + 1 + ((size_t)1 << precision)) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_ValueError, "not a serialized HyperLogLog");
+        return NULL;
+    }
+
+    HyperLogLogInstance *self =
+        (HyperLogLogInstance *)PyObject_CallFunction(cls, "i", precision);
+    if (self != NULL) {
+        size_t m = (size_t)1 << precision;
+        for (size_t i = 0; i < m; i++) {
+            uint8_t rank = p[HLL_MAGIC_LEN + 1 + i];
+            self->registers[i] = rank <= 65 - precision ? rank : (uint8_t)(65 - precision);
+        }
+    }
+    PyBuffer_Release(&view);
+    return (PyObject *)self;
+}
+
+static PyObject*
+hll_get_precision(HyperLogLogInstance *self, void *closure)
+{
+    return PyLong_FromLong(self->precision);
+}
+
+static PyMethodDef hll_methods[] = {
+    {"add", (PyCFunction)hll_add_method, METH_VARARGS,
+        "Add a value to the set."},
+    {"count", (PyCFunction)hll_count, METH_NOARGS,
+        "Estimated number of distinct values added."},
+    {"merge", (PyCFunction)hll_merge, METH_VARARGS,
+        "Add all values of another sketch of the same precision."},
+    {"clear", (PyCFunction)hll_clear, METH_NOARGS,
+        "Forget all values."},
+    {"to_bytes", (PyCFunction)hll_to_bytes, METH_NOARGS,
+        "Serialize the sketch."},
+    {"from_bytes", (PyCFunction)hll_from_bytes, METH_VARARGS | METH_CLASS,
+        "Restore a sketch serialized by to_bytes()."},
+    {NULL}
+};
+
+static PyGetSetDef hll_getset[] = {
+    {"precision", (getter)hll_get_precision, NULL, "log2 of the number of registers", NULL},
+    {NULL}
+};
+
+static PyTypeObject HyperLogLogType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." HLL_TYPE_NAME,       /* tp_name */
+    sizeof(HyperLogLogInstance),         /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)hll_dealloc,             /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    0,                                   /* tp_repr */
+    0,                                   /* tp_as_number */
+    0,                                   /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    HLL_DOCSTRING,                       /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    hll_methods,                         /* tp_methods */
+    0,                                   /* tp_members */
+    hll_getset,                          /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)hll_init,                  /* tp_init */
+    0,                                   /* tp_alloc */
+    PyType_GenericNew,                   /* tp_new */
+};
+
+//----------------------------------------------------------------------------
+// Follower: inotify-driven tail with rotation handling and checkpoints
+//----------------------------------------------------------------------------
+
+#define FOLLOW_READ_CHUNK  65536
+#define FOLLOW_MAX_BUFFER  (4 * 1024 * 1024)   // stop reading ahead past this
+#define FOLLOW_WATCH_MASK  (IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | \
+                            IN_DELETE | IN_CLOSE_WRITE | IN_ATTRIB)
+
+typedef struct {
+    char *path;
+    PyObject *path_obj;      // shared by every tuple returned for this file
+    int fd;                  // -1 while the file does not exist
+    dev_t dev;
+    ino_t ino;
+    off_t offset;            // bytes handed out to the caller (checkpointed)
+    char *buf;               // buf[start..buf_len) is data read past `offset`
+    size_t buf_len;
+    size_t buf_cap;
+    size_t start;            // bytes of `buf` already handed out, compacted lazily
+    size_t consumed;         // end of the lines taken by the current batch (>= start)
+    int rotated;             // path now names another file; drain the old one first
+    mljoin ml;               // pending multi-line record (when joining is enabled)
+    size_t ml_carried;       // input bytes the pending record had before this batch
+} follow_file;
+
+typedef struct {
+    PyObject_HEAD
+    ObjectInstance *ctx;
+    follow_file *files;
+    Py_ssize_t nfiles;
+    int inotify_fd;
+    char *checkpoint;
+    Py_ssize_t batch_size;
+    int strip;
+    int values;                     // VALUES_* mode of the returned events
+    int multiline;                  // join continuation lines using `ml_cfg`
+    mljoin_config ml_cfg;           // copy of the Multiline settings, shared by all files
+} FollowerInstance;
+
+static PyTypeObject FollowerType;
+
+static void
+follow_close_file(follow_file *f)
+{
+    if (f->fd >= 0)
+        close(f->fd);
+    f->fd = -1;
+    f->buf_len = 0;
+    f->start = 0;
+    f->consumed = 0;
+    f->rotated = 0;
+    mljoin_reset(&f->ml);
+    f->ml_carried = 0;
+}
+
+// Offset a restart has to resume from: the start of a pending multi-line
+// record, which has been read but not handed out yet.
+static off_t
+follow_stable_offset(const follow_file *f)
+{
+    return f->offset - (off_t)f->ml.input_bytes;
+}
+
+// (Re)open the file at `offset`; a missing file is not an error, it is
+// picked up once it gets created.
+static int
+follow_open_file(follow_file *f, off_t offset)
+{
+    struct stat st;
+
+    follow_close_file(f);
+    f->offset = 0;
+    f->fd = open(f->path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (f->fd < 0)
+        return errno == ENOENT ? 0 : -1;
+
+    if (fstat(f->fd, &st) != 0) {
+        follow_close_file(f);
+        return -1;
+    }
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+
+    if (offset < 0 || offset > st.st_size)
+        offset = offset < 0 ? st.st_size : 0;   // end of file, or truncated meanwhile
+    if (lseek(f->fd, offset, SEEK_SET) < 0) {
+        follow_close_file(f);
+        return -1;
+    }
+    f->offset = offset;
+    return 0;
+}
+
+// Notice truncation (copytruncate) and rotation (rename + create) of the
+// followed path.
+static int
+follow_refresh_file(follow_file *f)
+{
+    struct stat st;
+
+    if (f->rotated)
+        return 0;   // still draining the old file
+
+    if (f->fd < 0)
+        return follow_open_file(f, 0);
+
+    if (fstat(f->fd, &st) == 0 && st.st_size < f->offset + (off_t)(f->buf_len - f->start)) {
+        if (lseek(f->fd, 0, SEEK_SET) < 0)
+            return -1;
+        f->offset = 0;
+        f->buf_len = 0;
+        f->start = 0;
+        f->consumed = 0;
+        mljoin_reset(&f->ml);
+    }
+
+    if (stat(f->path, &st) != 0 || st.st_dev != f->dev || st.st_ino != f->ino)
+        f->rotated = 1;
+    return 0;
+}
+
+// Drop the bytes already handed out from the front of the buffer.
+static void
+follow_compact_file(follow_file *f)
+{
+    memmove(f->buf, f->buf + f->start, f->buf_len - f->start);
+    f->buf_len -= f->start;
+    f->consumed -= f->start;
+    f->start = 0;
+}
+
+// Append whatever the file has beyond the read position to the buffer.
+static int
+follow_fill_file(follow_file *f)
+{
+    while (f->fd >= 0 && f->buf_len - f->start < FOLLOW_MAX_BUFFER) {
+        if (f->buf_cap - f->buf_len < FOLLOW_READ_CHUNK && f->start > 0)
+            follow_compact_file(f);
+        if (f->buf_cap - f->buf_len < FOLLOW_READ_CHUNK) {
+            size_t cap = f->buf_cap ? f->buf_cap * 2 : FOLLOW_READ_CHUNK * 2;
+            char *buf = realloc(f->buf, cap);
+            if (buf == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+            f->buf = buf;
+            f->buf_cap = cap;
+        }
+        ssize_t n = read(f->fd, f->buf + f->buf_len, f->buf_cap - f->buf_len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        if (n == 0)
+            break;
+        f->buf_len += (size_t)n;
+    }
+    return 0;
+}
+
+// Advance past the lines consumed by a successfully returned batch, and
+// switch over to the new file once a rotated one is fully drained.  The
+// buffer is only compacted once the handed-out part passes half of it, so
+// a small batch does not move the whole read-ahead.
+static int
+follow_commit_file(follow_file *f)
+{
+    f->offset += (off_t)(f->consumed - f->start);
+    f->start = f->consumed;
+    if (f->start == f->buf_len)
+        f->buf_len = f->start = f->consumed = 0;
+    else if (f->start > f->buf_cap / 2)
+        follow_compact_file(f);
+    f->ml_carried = f->ml.input_bytes;
+    if (f->rotated && f->buf_len == 0 && f->ml.lines == 0)
+        return follow_open_file(f, 0);
+    return 0;
+}
+
+// Forget everything read since the last returned batch (including lines
+// that were joined into a pending record) and read it again next time.
+static void
+follow_rewind_file(follow_file *f)
+{
+    if (f->fd >= 0) {
+        off_t offset = f->offset - (off_t)f->ml_carried;
+        if (lseek(f->fd, offset, SEEK_SET) >= 0)
+            f->offset = offset;
+    }
+    f->buf_len = 0;
+    f->start = 0;
+    f->consumed = 0;
+    mljoin_reset(&f->ml);
+    f->ml_carried = 0;
+}
+
+static int
+follow_emit(FollowerInstance *self, follow_file *f, PyObject *batch, PyObject *event)
+{
+    if (event == NULL)
+        return -1;
+    PyObject *item = PyTuple_Pack(2, f->path_obj, event);
+    Py_DECREF(event);
+    if (item == NULL || PyList_Append(batch, item) != 0) {
+        Py_XDECREF(item);
+        return -1;
+    }
+    Py_DECREF(item);
+    return 0;
+}
+
+// Normalize up to batch_size complete lines into `batch`.  Buffers are only
+// advanced by the caller once the whole batch has been built.
+static int
+follow_collect(FollowerInstance *self, PyObject *batch)
+{
+    double now = monotonic_now();
+
+    for (Py_ssize_t i = 0; i < self->nfiles; i++) {
+        follow_file *f = &self->files[i];
+
+        if (follow_refresh_file(f) != 0 || follow_fill_file(f) != 0) {
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, f->path);
+            return -1;
+        }
+
+        while (PyList_GET_SIZE(batch) < self->batch_size && f->consumed < f->buf_len) {
+            // the rest of the buffer is returned by the next read()
+            if (PyList_GET_SIZE(batch) > 0 && batch_budget_spent(self->ctx, now))
+                return 0;
+            char *line = f->buf + f->consumed;
+            size_t avail = f->buf_len - f->consumed;
+            char *nl = memchr(line, '\n', avail);
+            size_t len, used;
+
+            if (nl != NULL) {
+                len = (size_t)(nl - line);
+                used = len + 1;
+            } else if (f->rotated || f->buf_len - f->start >= FOLLOW_MAX_BUFFER) {
+                // last line of a rotated file, or a line too long to buffer
+                len = used = avail;
+            } else {
+                break;
+            }
+            f->consumed += used;
+
+            if (self->strip)
+                len = rstrip_len(line, len);
+
+            if (!self->multiline) {
+                if (len > 0 &&
+                    follow_emit(self, f, batch,
+                                normalize_batch_line(self->ctx, line, len, self->values)) != 0)
+                    return -1;
+                continue;
+            }
+
+            if (len == 0 && f->ml.lines == 0)
+                continue;   // blank line outside a record: nothing to join it to
+            if (mljoin_boundary(&f->ml, line, len) &&
+                follow_emit(self, f, batch, mljoin_take(&f->ml, self->ctx, self->values)) != 0)
+                return -1;
+            if (mljoin_push(&f->ml, line, len, used) != 0) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            if (mljoin_full(&f->ml) &&
+                follow_emit(self, f, batch, mljoin_take(&f->ml, self->ctx, self->values)) != 0)
+                return -1;
+        }
+
+        // A record is complete when its file was rotated away or when no
+        // continuation line arrived within the timeout.
+        if (f->ml.lines > 0 && f->consumed == f->buf_len &&
+            (f->rotated || mljoin_expired(&f->ml, now)) &&
+            follow_emit(self, f, batch, mljoin_take(&f->ml, self->ctx, self->values)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void
+follow_drain_events(int inotify_fd)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (read(inotify_fd, events, sizeof(events)) > 0)
+        ;
+}
+
+// Checkpoint file: one "<dev> <ino> <offset> <path>" line per followed file.
+static int
+follow_load_checkpoint(FollowerInstance *self, off_t *offsets)
+{
+    FILE *fp = fopen(self->checkpoint, "r");
+    if (fp == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    char line[PATH_MAX + 96];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long long dev, ino;
+        long long offset;
+        int pos = 0;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%llu %llu %lld %n", &dev, &ino, &offset, &pos) != 3 || pos == 0)
+            continue;
+
+        for (Py_ssize_t i = 0; i < self->nfiles; i++) {
+            struct stat st;
+            if (strcmp(self->files[i].path, line + pos) != 0)
+                continue;
+            // rotated while we were down: the new file is read from its start
+            if (stat(self->files[i].path, &st) == 0 &&
+                (unsigned long long)st.st_dev == dev && (unsigned long long)st.st_ino == ino)
+                offsets[i] = (off_t)offset;
+            else
+                offsets[i] = 0;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+// Write the checkpoint to a temporary file and rename() it into place, so a
+// crash leaves either the old or the new checkpoint, never a torn one.
+static int
+follow_save_checkpoint(FollowerInstance *self)
+{
+    size_t tmp_len = strlen(self->checkpoint) + 5;
+    char *tmp = malloc(tmp_len);
+    if (tmp == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", self->checkpoint);
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        free(tmp);
+        return -1;
+    }
+    for (Py_ssize_t i = 0; i < self->nfiles; i++) {
+        follow_file *f = &self->files[i];
+        if (f->fd < 0)
+            continue;
+        fprintf(fp, "%llu %llu %lld %s\n", (unsigned long long)f->dev,
+                (unsigned long long)f->ino, (long long)follow_stable_offset(f), f->path);
+    }
+    int failed = fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+    failed = (fclose(fp) != 0) || failed;
+    if (failed || rename(tmp, self->checkpoint) != 0) {
+        int saved = errno;
+        unlink(tmp);
+        free(tmp);
+        errno = saved;
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+static void
+follower_clear(FollowerInstance *self)
+{
+    for (Py_ssize_t i = 0; i < self->nfiles; i++) {
+        follow_close_file(&self->files[i]);
+        free(self->files[i].buf);
+        free(self->files[i].ml.buf);
+        free(self->files[i].path);
+        Py_XDECREF(self->files[i].path_obj);
+    }
+    PyMem_Free(self->files);
+    self->files = NULL;
+    self->nfiles = 0;
+    if (self->inotify_fd >= 0)
+        close(self->inotify_fd);
+    self->inotify_fd = -1;
+    PyMem_Free(self->checkpoint);
+    self->checkpoint = NULL;
+    PyMem_Free(self->ml_cfg.start);
+    memset(&self->ml_cfg, 0, sizeof(self->ml_cfg));
+    self->multiline = 0;
+    Py_CLEAR(self->ctx);
+}
+
+static int
+follower_init(FollowerInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {
+        "ctx", "paths", "checkpoint", "batch_size", "strip", "from_beginning",
+        "multiline", "values", NULL
+    };
+    PyObject *ctx;
+    PyObject *paths;
+    const char *checkpoint = NULL;
+    Py_ssize_t batch_size = 1024;
+    int strip = 1;
+    int from_beginning = 0;
+    PyObject *multiline = Py_None;
+    const char *values = NULL;
+    int values_mode;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O|$znppOz", kwlist,
+                                     &TypeObject, &ctx, &paths, &checkpoint,
+                                     &batch_size, &strip, &from_beginning,
+                                     &multiline, &values))
+        return -1;
+
+    if (parse_values_mode(values, &values_mode) != 0)
+        return -1;
+    if (batch_size < 1) {
+        PyErr_SetString(PyExc_ValueError, "batch_size must be positive");
+        return -1;
+    }
+    if (multiline != Py_None &&
+        (!PyObject_TypeCheck(multiline, &MultilineType) ||
+         ((MultilineInstance *)multiline)->ctx == NULL)) {
+        PyErr_SetString(PyExc_TypeError, "multiline must be an initialized Multiline or None");
+        return -1;
+    }
+    if (multiline != Py_None && (PyObject *)((MultilineInstance *)multiline)->ctx != ctx) {
+        PyErr_SetString(PyExc_ValueError, "multiline must use the same Lognorm as the Follower");
+        return -1;
+    }
+
+    follower_clear(self);
+    Py_INCREF(ctx);
+    self->ctx = (ObjectInstance *)ctx;
+    if (multiline != Py_None) {
+        // Copy the settings: re-initializing the Multiline frees its own.
+        const mljoin_config *cfg = &((MultilineInstance *)multiline)->cfg;
+        self->ml_cfg = *cfg;
+        self->ml_cfg.start = NULL;
+        if (cfg->start != NULL) {
+            self->ml_cfg.start = PyMem_Malloc(cfg->start_len);
+            if (self->ml_cfg.start == NULL) {
+                self->ml_cfg.start_len = 0;
+                PyErr_NoMemory();
+                return -1;
+            }
+            memcpy(self->ml_cfg.start, cfg->start, cfg->start_len);
+        }
+        self->multiline = 1;
+    }
+    self->batch_size = batch_size;
+    self->strip = strip;
+    self->values = values_mode;
+
+    PyObject *seq = PyUnicode_Check(paths)
+        ? PyTuple_Pack(1, paths)
+        : PySequence_Tuple(paths);
+    if (seq == NULL)
+        return -1;
+    Py_ssize_t nfiles = PyTuple_GET_SIZE(seq);
+    if (nfiles == 0) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "at least one path is required");
+        return -1;
+    }
+
+    self->files = PyMem_Calloc((size_t)nfiles, sizeof(follow_file));
+    if (self->files == NULL) {
+        Py_DECREF(seq);
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (Py_ssize_t i = 0; i < nfiles; i++) {
+        PyObject *item = PyTuple_GET_ITEM(seq, i);
+        const char *path = PyUnicode_Check(item) ? PyUnicode_AsUTF8(item) : NULL;
+        if (path == NULL) {
+            Py_DECREF(seq);
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_TypeError, "paths must be str");
+            return -1;
+        }
+        follow_file *f = &self->files[self->nfiles++];
+        f->fd = -1;
+        if (self->multiline)
+            f->ml.cfg = &self->ml_cfg;
+        f->path = strdup(path);
+        if (f->path == NULL) {
+            Py_DECREF(seq);
+            PyErr_NoMemory();
+            return -1;
+        }
+        Py_INCREF(item);
+        f->path_obj = item;
+    }
+    Py_DECREF(seq);
+
+    if (checkpoint != NULL) {
+        self->checkpoint = PyMem_Malloc(strlen(checkpoint) + 1);
+        if (self->checkpoint == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        strcpy(self->checkpoint, checkpoint);
+    }
+
+    self->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (self->inotify_fd < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+
+    off_t *offsets = PyMem_Malloc((size_t)self->nfiles * sizeof(off_t));
+    if (offsets == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (Py_ssize_t i = 0; i < self->nfiles; i++)
+        offsets[i] = from_beginning ? 0 : -1;
+    if (self->checkpoint != NULL && follow_load_checkpoint(self, offsets) != 0) {
+        PyMem_Free(offsets);
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, self->checkpoint);
+        return -1;
+    }
+
+    for (Py_ssize_t i = 0; i < self->nfiles; i++) {
+        follow_file *f = &self->files[i];
+        // Watch the parent directory: it reports writes to the file as well
+        // as the create/rename that replaces it on rotation.
+        char dir[PATH_MAX];
+        const char *slash = strrchr(f->path, '/');
+        if (slash == NULL)
+            strcpy(dir, ".");
+        else
+            snprintf(dir, sizeof(dir), "%.*s", slash == f->path ? 1 : (int)(slash - f->path), f->path);
+
+        if (inotify_add_watch(self->inotify_fd, dir, FOLLOW_WATCH_MASK) < 0 ||
+            follow_open_file(f, offsets[i]) != 0) {
+            PyMem_Free(offsets);
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, f->path);
+            return -1;
+        }
+    }
+    PyMem_Free(offsets);
+    return 0;
+}
+
+static PyObject*
+follower_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    FollowerInstance *self = (FollowerInstance *)type->tp_alloc(type, 0);
+    if (self != NULL)
+        self->inotify_fd = -1;
+    return (PyObject *)self;
+}
+
+static void
+follower_dealloc(FollowerInstance *self)
+{
+    follower_clear(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// batch = follower.read(timeout = None)
+static PyObject*
+follower_read(FollowerInstance *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"timeout", NULL};
+    PyObject *timeout_obj = Py_None;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &timeout_obj))
+        return NULL;
+
+    if (self->ctx == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Follower is closed");
+        return NULL;
+    }
+
+    double timeout = -1.0;
+    if (timeout_obj != Py_None) {
+        timeout = PyFloat_AsDouble(timeout_obj);
+        if (timeout == -1.0 && PyErr_Occurred())
+            return NULL;
+        if (timeout < 0)
+            timeout = 0;
+    }
+
+    double start = monotonic_now();
+
+    PyObject *batch = PyList_New(0);
+    if (batch == NULL)
+        return NULL;
+
+    for (;;) {
+        if (follow_collect(self, batch) != 0) {
+            // nothing is consumed: the same lines come back on the next read()
+            for (Py_ssize_t i = 0; i < self->nfiles; i++)
+                follow_rewind_file(&self->files[i]);
+            Py_DECREF(batch);
+            return NULL;
+        }
+        for (Py_ssize_t i = 0; i < self->nfiles; i++) {
+            if (follow_commit_file(&self->files[i]) != 0) {
+                Py_DECREF(batch);
+                PyErr_SetFromErrnoWithFilename(PyExc_OSError, self->files[i].path);
+                return NULL;
+            }
+        }
+        if (PyList_GET_SIZE(batch) > 0)
+            return batch;
+
+        double now = monotonic_now();
+        double left = -1.0;
+        if (timeout >= 0) {
+            left = timeout - (now - start);
+            if (left <= 0)
+                return batch;
+        }
+        // wake up in time to emit multi-line records whose timeout runs out
+        for (Py_ssize_t i = 0; i < self->nfiles; i++) {
+            const mljoin *ml = &self->files[i].ml;
+            if (ml->lines > 0) {
+                double due = ml->since + ml->cfg->timeout - now;
+                if (left < 0 || due < left)
+                    left = due > 0 ? due : 0;
+            }
+        }
+        int wait_ms = left < 0 ? -1 : (int)(left * 1000.0) + 1;
+
+        // Idle files cost nothing: we sleep in poll() until inotify reports
+        // activity in one of the watched directories.
+        struct pollfd pfd = { self->inotify_fd, POLLIN, 0 };
+        int ready;
+        Py_BEGIN_ALLOW_THREADS
+        ready = poll(&pfd, 1, wait_ms);
+        Py_END_ALLOW_THREADS
+        if (ready < 0 && errno != EINTR) {
+            Py_DECREF(batch);
+            return PyErr_SetFromErrno(PyExc_OSError);
+        }
+        if (ready < 0 && PyErr_CheckSignals() != 0) {
+            Py_DECREF(batch);
+            return NULL;
+        }
+        if (ready > 0)
+            follow_drain_events(self->inotify_fd);
+    }
+}
+
+static PyObject*
+follower_commit(FollowerInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    if (self->checkpoint == NULL) {
+        PyErr_SetString(PyExc_ValueError, "Follower has no checkpoint file");
+        return NULL;
+    }
+    if (follow_save_checkpoint(self) != 0)
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError, self->checkpoint);
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+follower_offsets(FollowerInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    PyObject *result = PyDict_New();
+    if (result == NULL)
+        return NULL;
+    for (Py_ssize_t i = 0; i < self->nfiles; i++) {
+        PyObject *offset = PyLong_FromLongLong((long long)follow_stable_offset(&self->files[i]));
+        if (offset == NULL || PyDict_SetItem(result, self->files[i].path_obj, offset) != 0) {
+            Py_XDECREF(offset);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(offset);
+    }
+    return result;
+}
+
+static PyObject*
+follower_fileno(FollowerInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    if (self->inotify_fd < 0) {
+        PyErr_SetString(PyExc_ValueError, "Follower is closed");
+        return NULL;
+    }
+    return PyLong_FromLong(self->inotify_fd);
+}
+
+static PyObject*
+follower_close(FollowerInstance *self, PyObject *Py_UNUSED(ignored))
+{
+    follower_clear(self);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef follower_methods[] = {
+  {"read", (PyCFunction)follower_read, METH_VARARGS | METH_KEYWORDS,
+    "Wait for new lines and return a batch of (path, event) tuples."},
+  {"commit", (PyCFunction)follower_commit, METH_NOARGS,
+    "Atomically persist the offsets of all lines returned so far."},
+  {"offsets", (PyCFunction)follower_offsets, METH_NOARGS,
+    "Return the current byte offset of each followed file."},
+  {"fileno", (PyCFunction)follower_fileno, METH_NOARGS,
+    "Return the inotify descriptor, for use with select()/poll()."},
+  {"close", (PyCFunction)follower_close, METH_NOARGS,
+    "Stop following and release all descriptors."},
+  {NULL}
+};
+
+static PyTypeObject FollowerType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    MODULE_NAME "." FOLLOWER_TYPE_NAME,  /* tp_name */
+    sizeof(FollowerInstance),            /* tp_basicsize */
+    0,                                   /* tp_itemsize */
+    (destructor)follower_dealloc,        /* tp_dealloc */
+    0,                                   /* tp_vectorcall_offset */
+    0,                                   /* tp_getattr */
+    0,                                   /* tp_setattr */
+    0,                                   /* tp_as_async */
+    0,                                   /* tp_repr */
+    0,                                   /* tp_as_number */
+    0,                                   /* tp_as_sequence */
+    0,                                   /* tp_as_mapping */
+    0,                                   /* tp_hash  */
+    0,                                   /* tp_call */
+    0,                                   /* tp_str */
+    0,                                   /* tp_getattro */
+    0,                                   /* tp_setattro */
+    0,                                   /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                  /* tp_flags */
+    FOLLOWER_DOCSTRING,                  /* tp_doc */
+    0,                                   /* tp_traverse */
+    0,                                   /* tp_clear */
+    0,                                   /* tp_richcompare */
+    0,                                   /* tp_weaklistoffset */
+    0,                                   /* tp_iter */
+    0,                                   /* tp_iternext */
+    follower_methods,                    /* tp_methods */
+    0,                                   /* tp_members */
+    0,                                   /* tp_getset */
+    0,                                   /* tp_base */
+    0,                                   /* tp_dict */
+    0,                                   /* tp_descr_get */
+    0,                                   /* tp_descr_set */
+    0,                                   /* tp_dictoffset */
+    (initproc)follower_init,             /* tp_init */
+    0,                                   /* tp_alloc */
+    follower_new,                        /* tp_new */
+};
+
+//----------------------------------------------------------------------------
+// Python module administrative stuff
+//----------------------------------------------------------------------------
+
+static PyMethodDef object_methods[] = {
+  {"normalize", (PyCFunction)normalize, METH_VARARGS | METH_KEYWORDS,
+    "parse log line to dict object"},
+  {"normalize_into", (PyCFunction)normalize_into, METH_VARARGS | METH_KEYWORDS,
+    "parse log line into an existing dict object"},
+  {"normalize_record", (PyCFunction)normalize_record, METH_VARARGS | METH_KEYWORDS,
+    "parse log line to an Event record"},
+  {"rules", (PyCFunction)liblognorm_rules, METH_NOARGS,
+    "Describe every loaded rule: origin, line, tags, sample and fields."},
+  {"fields", (PyCFunction)liblognorm_fields, METH_NOARGS,
+    "Map every field the rules can produce to its parser types."},
+  {"dag_estimate", (PyCFunction)liblognorm_dag_estimate, METH_NOARGS,
+    "Rough size of the parse DAG built from the loaded rules."},
+  {"profile", (PyCFunction)liblognorm_profile, METH_VARARGS | METH_KEYWORDS,
+    "Turn per-rule timing of ln_normalize() on or off."},
+  {"profile_report", (PyCFunction)liblognorm_profile_report, METH_VARARGS | METH_KEYWORDS,
+    "Rules ranked by the time spent parsing their lines."},
+  {"profile_rulebase", (PyCFunction)liblognorm_profile_rulebase, METH_VARARGS | METH_KEYWORDS,
+    "Normalize a corpus and return the ranked per-rule profile."},
+  {"slowlog", (PyCFunction)liblognorm_slowlog, METH_VARARGS | METH_KEYWORDS,
+    "Keep lines that take longer than a threshold to normalize."},
+  {"drain_slowlog", (PyCFunction)liblognorm_drain_slowlog, METH_NOARGS,
+    "Remove and return the lines kept by the slow-line log."},
+  {"trace", (PyCFunction)liblognorm_trace, METH_VARARGS | METH_KEYWORDS,
+    "Capture liblognorm debug traces for sampled or slow lines."},
+  {"drain_traces", (PyCFunction)liblognorm_drain_traces, METH_NOARGS,
+    "Remove and return the captured parse traces."},
+  {"counters", (PyCFunction)liblognorm_counters, METH_VARARGS | METH_KEYWORDS,
+    "Lines truncated or rejected by the input guards."},
+  {"record_type", (PyCFunction)liblognorm_record_type, METH_VARARGS | METH_KEYWORDS,
+    "Build the Event record type from the rulebase or a list of field names."},
+  {"enrich", (PyCFunction)liblognorm_enrich, METH_VARARGS | METH_KEYWORDS,
+    "Annotate fields with the attributes of a CidrTable or KVTable."},
+  {"prefilter", (PyCFunction)liblognorm_prefilter, METH_VARARGS | METH_KEYWORDS,
+    "Skip lines that contain none of the rules' literals before parsing."},
+  {"clear_prefilter", (PyCFunction)liblognorm_clear_prefilter, METH_NOARGS,
+    "Remove the prefilter."},
+  {"redact", (PyCFunction)liblognorm_redact, METH_VARARGS | METH_KEYWORDS,
+    "Hash, truncate or mask fields right after parsing."},
+  {"attach", (PyCFunction)liblognorm_attach, METH_VARARGS,
+    "Feed a field of every accepted event to a TopK or HyperLogLog."},
+  {"detach", (PyCFunction)liblognorm_detach, METH_VARARGS,
+    "Stop feeding a sketch."},
+  {"load", (PyCFunction)liblognorm_load, METH_VARARGS,
+    "Load a rulebase file or all rulebase files in a directory."},
+  {"load_from_string", (PyCFunction)liblognorm_load_from_string, METH_VARARGS,
     "Load a rulebase from a string."},
   {NULL}
 };
@@ -462,6 +9643,24 @@ PyMODINIT_FUNC PyInit__liblognorm(void)
   TypeObject.tp_new = PyType_GenericNew;
   if (PyType_Ready(&TypeObject) < 0)
     return NULL;
+  if (PyType_Ready(&FollowerType) < 0)
+    return NULL;
+  if (PyType_Ready(&MultilineType) < 0)
+    return NULL;
+  if (PyType_Ready(&FilterType) < 0)
+    return NULL;
+  if (PyType_Ready(&CidrTableType) < 0)
+    return NULL;
+  if (PyType_Ready(&KVTableType) < 0)
+    return NULL;
+  if (PyType_Ready(&AggregatorType) < 0)
+    return NULL;
+  if (PyType_Ready(&RollupType) < 0)
+    return NULL;
+  if (PyType_Ready(&TopKType) < 0)
+    return NULL;
+  if (PyType_Ready(&HyperLogLogType) < 0)
+    return NULL;
 
 
   module = PyModule_Create(&moduledef);
@@ -487,7 +9686,38 @@ PyMODINIT_FUNC PyInit__liblognorm(void)
   Py_INCREF(LognormRuleError);
   PyModule_AddObject(module, "RuleError", LognormRuleError);
 
+  LognormPrefilterError = PyErr_NewException("liblognorm.PrefilterError", LognormParserError, NULL);
+  Py_INCREF(LognormPrefilterError);
+  PyModule_AddObject(module, "PrefilterError", LognormPrefilterError);
+
   Py_INCREF(&TypeObject);
   PyModule_AddObject(module, TYPE_NAME, (PyObject *)&TypeObject);
+
+  Py_INCREF(&FollowerType);
+  PyModule_AddObject(module, FOLLOWER_TYPE_NAME, (PyObject *)&FollowerType);
+
+  Py_INCREF(&MultilineType);
+  PyModule_AddObject(module, MULTILINE_TYPE_NAME, (PyObject *)&MultilineType);
+
+  Py_INCREF(&FilterType);
+  PyModule_AddObject(module, FILTER_TYPE_NAME, (PyObject *)&FilterType);
+
+  Py_INCREF(&CidrTableType);
+  PyModule_AddObject(module, CIDR_TYPE_NAME, (PyObject *)&CidrTableType);
+
+  Py_INCREF(&KVTableType);
+  PyModule_AddObject(module, KV_TYPE_NAME, (PyObject *)&KVTableType);
+
+  Py_INCREF(&AggregatorType);
+  PyModule_AddObject(module, AGGREGATOR_TYPE_NAME, (PyObject *)&AggregatorType);
+
+  Py_INCREF(&RollupType);
+  PyModule_AddObject(module, ROLLUP_TYPE_NAME, (PyObject *)&RollupType);
+
+  Py_INCREF(&TopKType);
+  PyModule_AddObject(module, TOPK_TYPE_NAME, (PyObject *)&TopKType);
+
+  Py_INCREF(&HyperLogLogType);
+  PyModule_AddObject(module, HLL_TYPE_NAME, (PyObject *)&HyperLogLogType);
   return module;
 }
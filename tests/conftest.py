@@ -0,0 +1,31 @@
+import pytest
+
+try:
+    from liblognorm import _liblognorm as liblognorm
+except ImportError:  # built in place as a top-level module
+    import liblognorm
+
+
+RULES = """version=2
+rule=:user=%user:word% port=%port:number% src=%src:word%
+rule=:user=%user:word% port=%port:number%
+rule=:user=%user:word%
+rule=:msg=%msg:rest%
+"""
+
+
+@pytest.fixture
+def ln():
+    return liblognorm
+
+
+@pytest.fixture
+def rules():
+    return RULES
+
+
+@pytest.fixture
+def ctx():
+    ctx = liblognorm.Lognorm()
+    ctx.load_from_string(RULES)
+    return ctx
@@ -0,0 +1,79 @@
+import time
+
+import pytest
+
+
+def rows_by(rows, key):
+    return {row[key]: row for row in rows}
+
+
+def test_group_counts_and_stats(ctx, ln):
+    agg = ln.Aggregator(ctx, by=["user"], sum=["port"], min=["port"], max=["port"])
+    for line in ("user=bob port=22", "user=bob port=80", "user=eve port=443",
+                 "user=bob"):
+        assert agg.feed(line) is True
+    assert len(agg) == 2
+    rows = rows_by(agg.flush(), "user")
+    assert rows["bob"]["count"] == 3
+    assert rows["bob"]["port_sum"] == 102
+    assert rows["bob"]["port_min"] == 22
+    assert rows["bob"]["port_max"] == 80
+    assert isinstance(rows["bob"]["port_sum"], int)
+    assert rows["eve"] == {"user": "eve", "count": 1, "port_sum": 443,
+                           "port_min": 443, "port_max": 443}
+    assert len(agg) == 0
+    assert agg.flush() == []
+
+
+def test_missing_group_field_and_no_numbers(ctx, ln):
+    agg = ln.Aggregator(ctx, by=["src"], sum=["port"], min=["port"])
+    agg.feed("msg=hello")
+    assert agg.flush() == [{"src": None, "count": 1, "port_sum": 0, "port_min": None}]
+
+
+def test_single_group(ctx, ln):
+    agg = ln.Aggregator(ctx)
+    assert agg.feed_many(["user=a", "user=b", "msg=c"]) == 3
+    assert agg.flush() == [{"count": 3}]
+
+
+def test_unmatched_empty_and_filtered(ctx, ln):
+    agg = ln.Aggregator(ctx, by=["user"], filter='user != "eve"')
+    assert agg.feed("?? no rule") is False
+    assert agg.feed("") is False
+    assert agg.feed("user=eve") is False
+    assert agg.feed("user=bob") is True
+    assert agg.lines == 3
+    assert agg.unmatched == 1
+    assert [row["user"] for row in agg.flush()] == ["bob"]
+
+
+def test_feed_many_text(ctx, ln):
+    agg = ln.Aggregator(ctx, by=["user"])
+    assert agg.feed_many("user=a\nuser=b\n\nuser=a\n?? x\n") == 3
+    assert agg.feed_many(b"user=b\n") == 1
+    rows = rows_by(agg.flush(), "user")
+    assert rows["a"]["count"] == 2
+    assert rows["b"]["count"] == 2
+
+
+def test_window_expire(ctx, ln):
+    agg = ln.Aggregator(ctx, by=["user"], window=0.2)
+    agg.feed("user=bob")
+    assert agg.expire() == []
+    time.sleep(0.45)
+    rows = agg.expire()
+    assert [row["user"] for row in rows] == ["bob"]
+    assert isinstance(rows[0]["window"], float)
+    assert agg.expire() == []
+
+
+def test_invalid(ctx, ln):
+    with pytest.raises(ValueError):
+        ln.Aggregator(ctx, by=[""])
+    with pytest.raises(ValueError):
+        ln.Aggregator(ctx, window=0)
+    with pytest.raises(TypeError):
+        ln.Aggregator(ctx, by=[1])
+    with pytest.raises(ValueError):
+        ln.Aggregator(ctx, filter="user ==")
@@ -0,0 +1,35 @@
+import pytest
+
+
+def test_normalize_bytes_values(ctx):
+    event = ctx.normalize("user=bob port=22", values="bytes")
+    assert event["user"] == b"bob"
+    assert all(isinstance(key, str) for key in event)
+    assert ctx.normalize("msg=é", values="bytes")["msg"] == "é".encode("utf-8")
+
+
+def test_default_is_str(ctx):
+    assert ctx.normalize("user=bob", values="str")["user"] == "bob"
+    assert ctx.normalize("user=bob")["user"] == "bob"
+
+
+def test_multiline_bytes_values(ctx, ln):
+    joiner = ln.Multiline(ctx, start="msg=", values="bytes")
+    joiner.feed("msg=a\nb\n")
+    assert joiner.flush()[0]["msg"] == b"a\nb"
+
+
+def test_follower_bytes_values(ctx, ln, tmp_path):
+    path = str(tmp_path / "app.log")
+    with open(path, "w") as f:
+        f.write("user=bob\n")
+    follower = ln.Follower(ctx, path, from_beginning=True, values="bytes")
+    assert follower.read(timeout=0.2)[0][1]["user"] == b"bob"
+    follower.close()
+
+
+def test_invalid_mode(ctx, ln):
+    with pytest.raises(ValueError):
+        ctx.normalize("user=bob", values="raw")
+    with pytest.raises(ValueError):
+        ln.Multiline(ctx, start="msg=", values="raw")
@@ -0,0 +1,83 @@
+import pytest
+
+
+def write(path, text):
+    with open(str(path), "w") as f:
+        f.write(text)
+    return str(path)
+
+
+@pytest.fixture
+def cidr_csv(tmp_path):
+    return write(tmp_path / "nets.csv", """cidr,zone,owner
+# comment lines and blank lines are skipped
+
+10.0.0.0/8,internal,it
+10.1.0.0/16,lab,
+10.1.2.0/24,lab-core,"ops, team"
+10.1.2.3,printer,facilities
+192.168.0.0/16,home,
+2001:db8::/32,v6,net
+2001:db8:1::/48,v6-lab,
+""")
+
+
+def test_cidr_longest_prefix(ln, cidr_csv):
+    table = ln.CidrTable(cidr_csv)
+    assert table.columns == ("zone", "owner")
+    assert table.lookup("10.200.0.1") == {"zone": "internal", "owner": "it"}
+    # empty attributes are left out
+    assert table.lookup("10.1.200.1") == {"zone": "lab"}
+    assert table.lookup("10.1.2.200") == {"zone": "lab-core", "owner": "ops, team"}
+    assert table.lookup("10.1.2.3") == {"zone": "printer", "owner": "facilities"}
+    assert table.lookup("10.1.2.4") == {"zone": "lab-core", "owner": "ops, team"}
+    assert table.lookup("11.0.0.1") is None
+    assert table.lookup("2001:db8:1::5") == {"zone": "v6-lab"}
+    assert table.lookup("2001:db8:2::5") == {"zone": "v6", "owner": "net"}
+    assert table.lookup("::ffff:10.1.2.3") == {"zone": "printer", "owner": "facilities"}
+    assert table.lookup("not an address") is None
+
+
+def test_cidr_save_roundtrip(ln, cidr_csv, tmp_path):
+    table = ln.CidrTable(cidr_csv)
+    saved = str(tmp_path / "nets.bin")
+    table.save(saved)
+    loaded = ln.CidrTable(saved)
+    assert loaded.columns == table.columns
+    assert len(loaded) == len(table)
+    for ip in ("10.1.2.3", "10.1.2.4", "10.9.9.9", "2001:db8:1::1", "8.8.8.8"):
+        assert loaded.lookup(ip) == table.lookup(ip)
+
+
+def test_cidr_malformed(ln, tmp_path):
+    with pytest.raises(ValueError):
+        ln.CidrTable(write(tmp_path / "bad.csv", "cidr,zone\n10.0.0.0/33,x\n"))
+    with pytest.raises(OSError):
+        ln.CidrTable(str(tmp_path / "missing.csv"))
+
+
+def test_cidr_enrich(ln, rules, cidr_csv):
+    ctx = ln.Lognorm()
+    ctx.load_from_string(rules)
+    ctx.enrich(ln.CidrTable(cidr_csv), "src", prefix="net_")
+    event = ctx.normalize("user=bob port=22 src=10.1.2.9")
+    assert event["net_zone"] == "lab-core"
+    assert event["net_owner"] == "ops, team"
+    assert "net_zone" not in ctx.normalize("user=bob port=22 src=8.8.8.8")
+
+
+def test_cidr_reinit_while_enriching(ln, rules, cidr_csv, tmp_path):
+    ctx = ln.Lognorm()
+    ctx.load_from_string(rules)
+    table = ln.CidrTable(cidr_csv)
+    ctx.enrich(table, "src")
+    # other columns than the ones enrich() saw: the table is skipped
+    table.__init__(write(tmp_path / "one.csv", "cidr,zone\n10.0.0.0/8,x\n"))
+    assert "src_zone" not in ctx.normalize("user=bob port=22 src=10.1.2.3")
+    # a failed load leaves the table unloaded: skipped as well
+    with pytest.raises(OSError):
+        table.__init__(str(tmp_path / "missing.csv"))
+    assert ctx.normalize("user=bob port=22 src=10.1.2.3")["user"] == "bob"
+    # same columns again: used again
+    table.__init__(cidr_csv)
+    assert ctx.normalize("user=bob port=22 src=10.1.2.3")["src_zone"] == "printer"
@@ -0,0 +1,65 @@
+import json
+
+import pytest
+
+
+def container_ctx(ln, rules, **kwargs):
+    ctx = ln.Lognorm(**kwargs)
+    ctx.load_from_string(rules)
+    return ctx
+
+
+def test_docker(ln, rules):
+    ctx = container_ctx(ln, rules, input_format="docker")
+    record = json.dumps({"log": "user=bob\n", "stream": "stdout",
+                         "time": "2024-05-01T10:00:00.1Z"})
+    event = ctx.normalize(record)
+    assert event["user"] == "bob"
+    assert event["stream"] == "stdout"
+    assert event["time"] == "2024-05-01T10:00:00.1Z"
+    assert "partial" not in event
+
+
+def test_docker_escaped_payload(ln, rules):
+    ctx = container_ctx(ln, rules, input_format="docker")
+    record = json.dumps({"log": "msg=\"quoted\"é\n", "stream": "stderr"})
+    event = ctx.normalize(record)
+    assert event["msg"] == "\"quoted\"é"
+    assert event["stream"] == "stderr"
+
+
+def test_docker_partial(ln, rules):
+    ctx = container_ctx(ln, rules, input_format="docker")
+    event = ctx.normalize(json.dumps({"log": "user=bob", "stream": "stdout"}))
+    assert event["partial"] is True
+
+
+def test_cri(ln, rules):
+    ctx = container_ctx(ln, rules, input_format="cri")
+    event = ctx.normalize("2024-05-01T10:00:00.123456789Z stdout F user=bob")
+    assert event["user"] == "bob"
+    assert event["stream"] == "stdout"
+    assert event["time"] == "2024-05-01T10:00:00.123456789Z"
+    assert "partial" not in event
+    assert ctx.normalize("2024-05-01T10:00:00Z stderr P user=eve")["partial"] is True
+
+
+def test_other_lines_unchanged(ln, rules):
+    for fmt in ("docker", "cri"):
+        ctx = container_ctx(ln, rules, input_format=fmt)
+        event = ctx.normalize("user=bob")
+        assert event["user"] == "bob"
+        assert "stream" not in event
+
+
+def test_with_syslog_header(ln, rules):
+    ctx = container_ctx(ln, rules, input_format="cri", syslog_header=True)
+    event = ctx.normalize("2024-05-01T10:00:00Z stdout F <38>Oct 11 22:14:15 gw sshd: user=bob")
+    assert event["user"] == "bob"
+    assert event["hostname"] == "gw"
+    assert event["stream"] == "stdout"
+
+
+def test_invalid_format(ln):
+    with pytest.raises(ValueError):
+        ln.Lognorm(input_format="journald")
@@ -0,0 +1,60 @@
+import pytest
+
+
+def enc_ctx(ln, rules, errors):
+    ctx = ln.Lognorm(errors=errors)
+    ctx.load_from_string(rules)
+    return ctx
+
+
+def test_strict(ln, rules):
+    ctx = enc_ctx(ln, rules, "strict")
+    assert ctx.normalize("msg=é".encode("utf-8"))["msg"] == "é"
+    with pytest.raises(UnicodeDecodeError):
+        ctx.normalize(b"msg=a\xffb")
+
+
+@pytest.mark.parametrize("errors, expected", [
+    ("replace", "a�b�"),
+    ("surrogateescape", "a\udcffb\udcc3"),
+    ("latin1", "a\xffb\xc3"),
+])
+def test_policies(ln, rules, errors, expected):
+    ctx = enc_ctx(ln, rules, errors)
+    assert ctx.normalize(b"msg=a\xffb\xc3")["msg"] == expected
+
+
+def test_surrogateescape_round_trip(ln, rules):
+    ctx = enc_ctx(ln, rules, "surrogateescape")
+    raw = b"msg=\xe9t\xe9"
+    value = ctx.normalize(raw)["msg"]
+    assert value.encode("utf-8", "surrogateescape") == raw[4:]
+
+
+def test_valid_input_unchanged(ln, rules):
+    for errors in ("replace", "surrogateescape"):
+        ctx = enc_ctx(ln, rules, errors)
+        assert ctx.normalize("msg=€".encode("utf-8"))["msg"] == "€"
+    # str input never goes through the policy
+    assert enc_ctx(ln, rules, "latin1").normalize("msg=€")["msg"] == "€"
+
+
+def test_memoryview_input(ln, rules):
+    ctx = enc_ctx(ln, rules, "replace")
+    assert ctx.normalize(memoryview(b"msg=\xff"))["msg"] == "�"
+
+
+def test_follower_strict_line_is_none(ln, rules, tmp_path):
+    path = str(tmp_path / "app.log")
+    with open(path, "wb") as f:
+        f.write(b"msg=\xff\nuser=bob\n")
+    follower = ln.Follower(enc_ctx(ln, rules, "strict"), path, from_beginning=True)
+    events = [event for _, event in follower.read(timeout=0.2)]
+    assert events[0] is None
+    assert events[1]["user"] == "bob"
+    follower.close()
+
+
+def test_invalid_policy(ln):
+    with pytest.raises(ValueError):
+        ln.Lognorm(errors="ignore")
@@ -0,0 +1,53 @@
+import pytest
+
+
+def test_parse_errors(ln):
+    for expr in ("", "user ==", "user == \"x", "(user", "user in (\"a\"",
+                 "user ~ \"a\"", "and", "user == \"a\" or"):
+        with pytest.raises(ValueError):
+            ln.Filter(expr)
+
+
+def test_bad_filter_on_context(ln):
+    with pytest.raises(ValueError):
+        ln.Lognorm(filter="user ==")
+
+
+@pytest.mark.parametrize("expr, accepted", [
+    ('user == "bob"', True),
+    ('user == "alice"', False),
+    ('user != "alice"', True),
+    ('port == 22', True),
+    ('port < 100', True),
+    ('port <= 22', True),
+    ('port > 22', False),
+    ('port >= 23', False),
+    ('port > 3', True),             # numeric, not byte-wise: "22" > "3"
+    ('port < "3"', True),           # string literal compares byte-wise
+    ('user ^= "bo"', True),
+    ('user ^= "ob"', False),
+    ('user in ("alice", "bob")', True),
+    ('user not in ("alice", "bob")', False),
+    ('user', True),
+    ('missing', False),
+    ('not missing', True),
+    ('missing == "x"', False),
+    ('missing != "x"', True),
+    ('missing < 1', False),
+    ('user == "bob" and port == 22', True),
+    ('user == "bob" and port == 23', False),
+    ('user == "x" or port == 22', True),
+    ('not (user == "x" or port == 23)', True),
+])
+def test_operators(ctx, ln, expr, accepted):
+    event = ctx.normalize("user=bob port=22", filter=ln.Filter(expr))
+    assert (event is not None) == accepted
+
+
+def test_context_filter(ln, rules):
+    ctx = ln.Lognorm(filter='port >= 1024')
+    ctx.load_from_string(rules)
+    assert ctx.normalize("user=bob port=22") is None
+    assert ctx.normalize("user=bob port=8080")["user"] == "bob"
+    # a per-call filter replaces the context's one
+    assert ctx.normalize("user=bob port=22", filter='user == "bob"') is not None
@@ -0,0 +1,96 @@
+import os
+
+
+def append(path, text):
+    with open(path, "a") as f:
+        f.write(text)
+
+
+def users(batch):
+    return [event["user"] for _, event in batch]
+
+
+def read_all(follower):
+    events = []
+    while True:
+        batch = follower.read(timeout=0.2)
+        if not batch:
+            return events
+        events += users(batch)
+
+
+def test_rotation(ctx, ln, tmp_path):
+    path = str(tmp_path / "app.log")
+    append(path, "user=a\nuser=b\n")
+    follower = ln.Follower(ctx, path, from_beginning=True)
+    assert read_all(follower) == ["a", "b"]
+
+    # lines written to the old file after the rename are drained first
+    os.rename(path, path + ".1")
+    append(path + ".1", "user=c\n")
+    append(path, "user=d\n")
+    assert read_all(follower) == ["c", "d"]
+    assert follower.offsets() == {path: len("user=d\n")}
+    follower.close()
+
+
+def test_truncation(ctx, ln, tmp_path):
+    path = str(tmp_path / "app.log")
+    append(path, "user=a\nuser=b\n")
+    follower = ln.Follower(ctx, path, from_beginning=True)
+    assert read_all(follower) == ["a", "b"]
+    with open(path, "w") as f:
+        f.write("user=c\n")
+    assert read_all(follower) == ["c"]
+    follower.close()
+
+
+def test_checkpoint_resume(ctx, ln, tmp_path):
+    path = str(tmp_path / "app.log")
+    checkpoint = str(tmp_path / "offsets")
+    append(path, "".join("user=u%d\n" % i for i in range(10)))
+
+    follower = ln.Follower(ctx, path, checkpoint=checkpoint, batch_size=4,
+                           from_beginning=True)
+    assert users(follower.read(timeout=0.2)) == ["u0", "u1", "u2", "u3"]
+    follower.commit()
+    # returned but not committed: read again after a restart
+    assert users(follower.read(timeout=0.2)) == ["u4", "u5", "u6", "u7"]
+    follower.close()
+
+    append(path, "user=u10\n")
+    follower = ln.Follower(ctx, path, checkpoint=checkpoint)
+    assert read_all(follower) == ["u%d" % i for i in range(4, 11)]
+    follower.commit()
+    follower.close()
+
+    follower = ln.Follower(ctx, path, checkpoint=checkpoint)
+    assert follower.read(timeout=0.1) == []
+    follower.close()
+
+
+def test_checkpoint_after_rotation(ctx, ln, tmp_path):
+    path = str(tmp_path / "app.log")
+    checkpoint = str(tmp_path / "offsets")
+    append(path, "user=a\n")
+    follower = ln.Follower(ctx, path, checkpoint=checkpoint, from_beginning=True)
+    assert read_all(follower) == ["a"]
+    follower.commit()
+    follower.close()
+
+    # the checkpointed file was rotated away while nothing was following it
+    os.rename(path, path + ".1")
+    append(path, "user=bbbbbb\n")
+    follower = ln.Follower(ctx, path, checkpoint=checkpoint)
+    assert read_all(follower) == ["bbbbbb"]
+    follower.close()
+
+
+def test_partial_line_waits(ctx, ln, tmp_path):
+    path = str(tmp_path / "app.log")
+    append(path, "user=a\nuser=b")
+    follower = ln.Follower(ctx, path, from_beginning=True)
+    assert read_all(follower) == ["a"]
+    append(path, "c\n")
+    assert read_all(follower) == ["bc"]
+    follower.close()
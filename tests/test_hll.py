@@ -0,0 +1,60 @@
+import pytest
+
+
+def test_hll_roundtrip(ln):
+    hll = ln.HyperLogLog(12)
+    for i in range(5000):
+        hll.add("10.0.%d.%d" % (i // 256, i % 256))
+    data = hll.to_bytes()
+    copy = ln.HyperLogLog.from_bytes(data)
+    assert copy.precision == 12
+    assert copy.count() == hll.count()
+    assert copy.to_bytes() == data
+    assert abs(hll.count() - 5000) < 5000 * 0.05
+
+
+def test_hll_roundtrip_merge(ln):
+    a, b = ln.HyperLogLog(), ln.HyperLogLog()
+    for i in range(3000):
+        a.add("a%d" % i)
+        b.add("b%d" % i)
+    merged = ln.HyperLogLog.from_bytes(a.to_bytes())
+    merged.merge(ln.HyperLogLog.from_bytes(b.to_bytes()))
+    assert abs(merged.count() - 6000) < 6000 * 0.05
+
+
+def test_hll_from_bytes_invalid(ln):
+    data = ln.HyperLogLog(10).to_bytes()
+    for bad in (b"", data[:-1], data + b"\0", b"\xff" * len(data)):
+        with pytest.raises(ValueError):
+            ln.HyperLogLog.from_bytes(bad)
+
+
+def test_hll_attach(ln, ctx):
+    hll = ln.HyperLogLog()
+    ctx.attach(hll, "user")
+    for i in range(200):
+        ctx.normalize("user=u%d" % (i % 50))
+    assert 48 <= hll.count() <= 52
+
+
+def test_hll_attach_uninitialized(ln, ctx):
+    with pytest.raises(ValueError):
+        ctx.attach(ln.HyperLogLog.__new__(ln.HyperLogLog), "user")
+
+
+def test_hll_merge_precision_mismatch(ln):
+    with pytest.raises(ValueError):
+        ln.HyperLogLog(10).merge(ln.HyperLogLog(12))
+
+
+def test_hll_precision_bounds(ln):
+    for precision in (3, 19):
+        with pytest.raises(ValueError):
+            ln.HyperLogLog(precision)
+    hll = ln.HyperLogLog(4)
+    hll.add("x")
+    hll.add(b"x")
+    assert hll.count() == 1
+    hll.clear()
+    assert hll.count() == 0
@@ -0,0 +1,52 @@
+import pytest
+
+
+def intern_ctx(ln, rules, **kwargs):
+    ctx = ln.Lognorm(**kwargs)
+    ctx.load_from_string(rules)
+    return ctx
+
+
+def test_named_fields(ln, rules):
+    ctx = intern_ctx(ln, rules, intern=["user"])
+    first = ctx.normalize("user=" + "bob")
+    second = ctx.normalize("user=" + "bob")
+    assert first["user"] == "bob"
+    assert first["user"] is second["user"]
+    # other fields are not interned
+    a = ctx.normalize("msg=" + "x" * 10)["msg"]
+    b = ctx.normalize("msg=" + "x" * 10)["msg"]
+    assert a == b and a is not b
+
+
+def test_limit(ln, rules):
+    ctx = intern_ctx(ln, rules, intern=["user"], intern_limit=2)
+    for user in ("u1", "u2"):
+        ctx.normalize("user=" + user)
+    # the cache is full: new values are no longer shared
+    assert ctx.normalize("user=u3")["user"] is not ctx.normalize("user=u3")["user"]
+    assert ctx.normalize("user=u1")["user"] is ctx.normalize("user=u1")["user"]
+
+
+def test_auto(ln, rules):
+    ctx = intern_ctx(ln, rules, intern="auto", intern_limit=3)
+    assert ctx.normalize("user=bob")["user"] is ctx.normalize("user=bob")["user"]
+    for i in range(5):
+        ctx.normalize("user=u%d" % i)
+    # the field exceeded the limit and is no longer interned
+    assert ctx.normalize("user=bob")["user"] is not ctx.normalize("user=bob")["user"]
+
+
+def test_auto_skips_long_values(ln, rules):
+    ctx = intern_ctx(ln, rules, intern="auto")
+    long_value = "msg=" + "y" * 100
+    assert ctx.normalize(long_value)["msg"] is not ctx.normalize(long_value)["msg"]
+
+
+def test_invalid(ln):
+    with pytest.raises(ValueError):
+        ln.Lognorm(intern=["user"], intern_limit=0)
+    with pytest.raises(ValueError):
+        ln.Lognorm(intern="user")
+    with pytest.raises(TypeError):
+        ln.Lognorm(intern=["user", 1])
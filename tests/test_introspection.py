@@ -0,0 +1,52 @@
+RULEBASE = (
+    "version=2\n"
+    "prefix=%host:word% app: \r\n"
+    "rule=auth, ssh:login %user:word% from %ip:ipv4%\r\n"
+    "rule=fw:drop %ip:word% %{\"name\":\"port\",\"type\":\"number\"}% 100%%\r\n"
+    "prefix=\r\n"
+    "rule=:plain %msg:rest%\r\n"
+)
+
+
+def test_rules(ln):
+    ctx = ln.Lognorm()
+    ctx.load_from_string(RULEBASE)
+    rules = ctx.rules()
+    assert [rule["line"] for rule in rules] == [3, 4, 6]
+    assert rules[0]["origin"] == "<string>"
+    assert rules[0]["tags"] == ("auth", "ssh")
+    assert rules[0]["prefix"] == "%host:word% app: "
+    assert rules[0]["sample"] == "login %user:word% from %ip:ipv4%"
+    assert rules[0]["fields"] == (("host", "word"), ("user", "word"), ("ip", "ipv4"))
+    assert rules[1]["fields"] == (("host", "word"), ("ip", "word"), ("port", "number"))
+    assert rules[2]["tags"] == ()
+    assert rules[2]["prefix"] == ""
+    assert rules[2]["fields"] == (("msg", "rest"),)
+
+
+def test_fields_agree_with_rules_on_crlf(ln):
+    ctx = ln.Lognorm()
+    ctx.load_from_string(RULEBASE)
+    assert ctx.fields() == {"host": ("word",), "user": ("word",), "ip": ("ipv4", "word"),
+                            "port": ("number",), "msg": ("rest",)}
+    assert ctx.record_type()._fields == ("host", "user", "ip", "port", "msg")
+
+
+def test_rules_from_file(ln, tmp_path):
+    path = tmp_path / "rules.rb"
+    path.write_text("version=2\nrule=:user=%user:word%\n")
+    ctx = ln.Lognorm()
+    ctx.load(str(path))
+    assert [(rule["origin"], rule["line"]) for rule in ctx.rules()] == [(str(path), 2)]
+
+
+def test_dag_estimate(ln, ctx):
+    assert ln.Lognorm().dag_estimate()["rules"] == 0
+    estimate = ctx.dag_estimate()
+    assert estimate["rules"] == 4
+    # the three "user=" rules share their common start
+    assert 0 < estimate["nodes"]
+    assert estimate["bytes"] > 0
+    single = ln.Lognorm()
+    single.load_from_string("version=2\nrule=:user=%user:word% port=%port:number% src=%src:word%\n")
+    assert estimate["nodes"] < 4 * single.dag_estimate()["nodes"]
@@ -0,0 +1,81 @@
+import struct
+
+import pytest
+
+
+def write(path, text):
+    with open(str(path), "w") as f:
+        f.write(text)
+    return str(path)
+
+
+def test_kvtable_reload(ln, tmp_path):
+    path = str(tmp_path / "users.kv")
+    ln.KVTable.build(write(tmp_path / "v1.csv", "key,name\nbob,Bob\neve,Eve\n"), path)
+    table = ln.KVTable(path, check_interval=0)
+    assert table.columns == ("name",)
+    assert len(table) == 2
+    assert table.lookup("bob") == {"name": "Bob"}
+    assert table.reload() is False
+
+    ln.KVTable.build(write(tmp_path / "v2.csv", "key,name\nbob,Robert\nann,Ann\n"), path)
+    # lookups do not check for a replaced file with check_interval=0
+    assert table.lookup("bob") == {"name": "Bob"}
+    assert table.reload() is True
+    assert table.lookup("bob") == {"name": "Robert"}
+    assert table.lookup("ann") == {"name": "Ann"}
+    assert table.lookup("eve") is None
+    assert len(table) == 2
+    assert table.reload() is False
+
+
+def test_kvtable_reload_rejects_other_columns(ln, tmp_path):
+    path = str(tmp_path / "users.kv")
+    ln.KVTable.build(write(tmp_path / "v1.csv", "key,name\nbob,Bob\n"), path)
+    table = ln.KVTable(path, check_interval=0)
+    ln.KVTable.build(write(tmp_path / "v2.csv", "key,name,dept\nbob,Bob,IT\n"), path)
+    with pytest.raises(ValueError):
+        table.reload()
+    assert table.lookup("bob") == {"name": "Bob"}
+
+
+def test_kvtable_enrich(ln, rules, tmp_path):
+    path = str(tmp_path / "users.kv")
+    ln.KVTable.build(write(tmp_path / "users.csv", "key,name\nbob,Bob\n"), path)
+    ctx = ln.Lognorm()
+    ctx.load_from_string(rules)
+    ctx.enrich(ln.KVTable(path), "user")
+    assert ctx.normalize("user=bob")["user_name"] == "Bob"
+    assert "user_name" not in ctx.normalize("user=eve")
+
+
+def test_kvtable_reinit_while_enriching(ln, rules, tmp_path):
+    path = str(tmp_path / "users.kv")
+    other = str(tmp_path / "depts.kv")
+    ln.KVTable.build(write(tmp_path / "users.csv", "key,name\nbob,Bob\n"), path)
+    ln.KVTable.build(write(tmp_path / "depts.csv", "key,name,dept\nbob,Bob,IT\n"), other)
+    ctx = ln.Lognorm()
+    ctx.load_from_string(rules)
+    table = ln.KVTable(path)
+    ctx.enrich(table, "user")
+    # other columns than the ones enrich() saw: the table is skipped
+    table.__init__(other)
+    assert "user_name" not in ctx.normalize("user=bob")
+    table.__init__(path)
+    assert ctx.normalize("user=bob")["user_name"] == "Bob"
+
+
+def test_kvtable_rejects_full_slot_array(ln, tmp_path):
+    path = str(tmp_path / "users.kv")
+    ln.KVTable.build(write(tmp_path / "users.csv", "key,name\nbob,Bob\n"), path)
+    with open(path, "rb") as f:
+        data = bytearray(f.read())
+    # header: magic[8], ncols, nrows (u32), nkeys, nslots, blob_size (u64)
+    nslots = struct.unpack_from("=Q", data, 24)[0]
+    for i in range(nslots):
+        struct.pack_into("=I", data, 40 + 4 * i, 1)
+    with open(path, "wb") as f:
+        f.write(data)
+    # a miss would probe forever without an empty slot
+    with pytest.raises(ValueError):
+        ln.KVTable(path)
@@ -0,0 +1,58 @@
+import pytest
+
+
+def map_ctx(ln, rules, **kwargs):
+    ctx = ln.Lognorm(**kwargs)
+    ctx.load_from_string(rules)
+    return ctx
+
+
+def test_rename_nest_and_drop(ln, rules):
+    ctx = map_ctx(ln, rules, mapping={"user": "user.name", "port": "source.port",
+                                      "src": None})
+    event = ctx.normalize("user=bob port=22 src=x")
+    assert event["user"] == {"name": "bob"}
+    assert str(event["source"]["port"]) == "22"
+    assert "src" not in event
+    assert "port" not in event
+
+
+def test_unmapped_fields_kept(ln, rules):
+    ctx = map_ctx(ln, rules, mapping={"user": "account"})
+    event = ctx.normalize("user=bob port=22")
+    assert event["account"] == "bob"
+    assert str(event["port"]) == "22"
+
+
+def test_constants(ln, rules):
+    ctx = map_ctx(ln, rules, mapping={"port": "source.port"},
+                  constants={"event.dataset": "fw", "source.zone": "dmz", "n": 1})
+    first = ctx.normalize("user=bob port=22")
+    assert first["event"] == {"dataset": "fw"}
+    assert first["source"]["zone"] == "dmz"
+    assert str(first["source"]["port"]) == "22"
+    assert first["n"] == 1
+    second = ctx.normalize("user=eve")
+    assert second["source"] == {"zone": "dmz"}
+    assert second["event"] is not first["event"]
+
+
+def test_normalize_into_uses_mapping(ln, rules):
+    ctx = map_ctx(ln, rules, mapping={"user": "account"})
+    target = {}
+    ctx.normalize_into("user=bob", target)
+    assert target == {"account": "bob"}
+
+
+def test_normalize_record_ignores_mapping(ln, rules):
+    ctx = map_ctx(ln, rules, mapping={"user": "account"})
+    assert ctx.normalize_record("user=bob").user == "bob"
+
+
+def test_invalid(ln):
+    with pytest.raises(ValueError):
+        ln.Lognorm(mapping={"user": ""})
+    with pytest.raises(TypeError):
+        ln.Lognorm(mapping={"user": 1})
+    with pytest.raises(TypeError):
+        ln.Lognorm(constants=["x"])
@@ -0,0 +1,86 @@
+import json
+
+import pytest
+
+
+def msg_ctx(ln, rules, **kwargs):
+    ctx = ln.Lognorm(**kwargs)
+    ctx.load_from_string(rules)
+    return ctx
+
+
+@pytest.mark.parametrize("max_length", range(5, 25))
+def test_truncate_at_character_boundary(ln, rules, max_length):
+    # "msg=" followed by 1-, 2-, 3- and 4-byte characters
+    text = "msg=aé€\U0001f600bé€\U0001f600"
+    ctx = msg_ctx(ln, rules, max_length=max_length)
+    event = ctx.normalize(text)
+    kept = text.encode("utf-8")[:max_length].decode("utf-8", "ignore")
+    assert "msg=" + event["msg"] == kept
+    assert len(kept.encode("utf-8")) <= max_length
+    counters = ctx.counters()
+    assert counters["truncated"] == (max_length < len(text.encode("utf-8")))
+
+
+def test_truncate_bytes_input(ln, rules):
+    ctx = msg_ctx(ln, rules, max_length=6)
+    assert ctx.normalize("msg=éé".encode("utf-8"))["msg"] == "é"
+    assert ctx.normalize("msg=éé".encode("utf-8"), values="bytes")["msg"] == b"\xc3\xa9"
+
+
+def test_short_message_untouched(ln, rules):
+    ctx = msg_ctx(ln, rules, max_length=64)
+    assert ctx.normalize("msg=€€")["msg"] == "€€"
+
+
+def test_reject(ln, rules):
+    ctx = msg_ctx(ln, rules, max_length=8, oversize="reject")
+    assert ctx.normalize("msg=abcd")["msg"] == "abcd"
+    with pytest.raises(ln.ParserError):
+        ctx.normalize("msg=abcde")
+    assert ctx.counters()["rejected"] == 1
+
+
+def test_invalid_options(ln):
+    with pytest.raises(ValueError):
+        ln.Lognorm(max_length=-1)
+    with pytest.raises(ValueError):
+        ln.Lognorm(oversize="drop")
+
+
+def test_container_payload_limit(ln, rules):
+    # the limit applies to the payload, not to the framing around it
+    record = json.dumps({"log": "user=bob\n", "stream": "stdout",
+                         "time": "2024-05-01T10:00:00.1Z"})
+    ctx = msg_ctx(ln, rules, input_format="docker", max_length=16, oversize="reject")
+    assert len(record) > 16
+    event = ctx.normalize(record)
+    assert event["user"] == "bob"
+    assert event["stream"] == "stdout"
+    ctx = msg_ctx(ln, rules, input_format="cri", max_length=8)
+    event = ctx.normalize("2024-05-01T10:00:00Z stdout F msg=abcdefgh")
+    assert event["msg"] == "abcd"
+    assert event["stream"] == "stdout"
+    assert ctx.counters()["truncated"] == 1
+
+
+def test_counters_reset(ln, rules):
+    ctx = msg_ctx(ln, rules, max_length=4, oversize="reject")
+    with pytest.raises(ln.ParserError):
+        ctx.normalize("msg=abcde")
+    assert ctx.counters(reset=True) == {"truncated": 0, "rejected": 1,
+                                        "prefiltered": 0, "over_budget": 0}
+    assert ctx.counters()["rejected"] == 0
+
+
+def test_batch_budget_backlog(ln, rules):
+    ctx = msg_ctx(ln, rules, batch_budget=1e-9)
+    agg = ln.Aggregator(ctx, by=["user"])
+    lines = ["user=u%d" % (i % 3) for i in range(300)]
+    fed = agg.feed_many(lines)
+    assert fed < len(lines)
+    assert agg.backlog is True
+    assert ctx.counters()["over_budget"] >= 1
+    rows = agg.flush()
+    assert agg.backlog is False
+    assert sum(row["count"] for row in rows) == len(lines)
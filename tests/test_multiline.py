@@ -0,0 +1,87 @@
+import pytest
+
+
+TRACE = "msg=boom\nat.a()\nat.b()\nmsg=next\n"
+
+
+def test_joins_continuation_lines(ctx, ln):
+    joiner = ln.Multiline(ctx, start="msg=")
+    events = joiner.feed(TRACE)
+    assert [e["msg"] for e in events] == ["boom\nat.a()\nat.b()"]
+    # the last record stays pending until flush()
+    assert [e["msg"] for e in joiner.flush()] == ["next"]
+    assert joiner.flush() == []
+
+
+def test_records_span_feeds(ctx, ln):
+    joiner = ln.Multiline(ctx, start="msg=")
+    assert joiner.feed("msg=one\nat.a()\n") == []
+    assert joiner.feed("at.b()\n") == []
+    assert [e["msg"] for e in joiner.feed("msg=two\n")] == ["one\nat.a()\nat.b()"]
+
+
+def test_strip(ctx, ln):
+    joiner = ln.Multiline(ctx, start="msg=")
+    joiner.feed("msg=one  \r\nat.a()\t\n")
+    assert [e["msg"] for e in joiner.flush()] == ["one\nat.a()"]
+
+
+def test_max_lines(ctx, ln):
+    joiner = ln.Multiline(ctx, start="msg=", max_lines=2)
+    events = joiner.feed("msg=one\nat.a()\nat.b()\n")
+    assert [e["msg"] for e in events] == ["one\nat.a()"]
+    # the rest becomes a record of its own, which no rule matches
+    assert joiner.flush() == [None]
+
+
+def test_max_bytes(ctx, ln):
+    joiner = ln.Multiline(ctx, start="msg=", max_bytes=12)
+    events = joiner.feed("msg=one\nat.a()\n")
+    assert [e["msg"] for e in events] == ["one"]
+
+
+def test_timestamp_start(ctx, ln):
+    joiner = ln.Multiline(ctx, timestamp=True)
+    events = joiner.feed("2024-05-01T12:00:00Z a\nb\n[May  1 12:00:01] c\nd\n")
+    assert len(events) == 1
+    assert len(joiner.flush()) == 1
+
+
+def test_expire(ctx, ln):
+    joiner = ln.Multiline(ctx, start="msg=", timeout=0)
+    joiner.feed("msg=one\n")
+    assert [e["msg"] for e in joiner.expire()] == ["one"]
+    assert joiner.expire() == []
+
+
+def test_unmatched_record_is_none(ctx, ln):
+    joiner = ln.Multiline(ctx, start="??")
+    joiner.feed("?? no rule\n")
+    assert joiner.flush() == [None]
+
+
+def test_invalid_arguments(ctx, ln):
+    with pytest.raises(ValueError):
+        ln.Multiline(ctx)
+    with pytest.raises(ValueError):
+        ln.Multiline(ctx, start="msg=", max_lines=0)
+
+
+def test_follower_joins(ctx, ln, tmp_path):
+    path = str(tmp_path / "app.log")
+    with open(path, "w") as f:
+        f.write(TRACE)
+    joiner = ln.Multiline(ctx, start="msg=", timeout=0)
+    follower = ln.Follower(ctx, path, multiline=joiner, from_beginning=True)
+    # the Follower keeps its own copy of the settings
+    joiner.__init__(ctx, start="other")
+    events = [e["msg"] for _, e in follower.read(timeout=0.2)]
+    events += [e["msg"] for _, e in follower.read(timeout=0.2)]
+    assert events == ["boom\nat.a()\nat.b()", "next"]
+    follower.close()
+
+
+def test_follower_rejects_other_context(ctx, ln, tmp_path):
+    joiner = ln.Multiline(ln.Lognorm(), start="msg=")
+    with pytest.raises(ValueError):
+        ln.Follower(ctx, str(tmp_path / "app.log"), multiline=joiner)
@@ -0,0 +1,49 @@
+import pytest
+
+
+def test_refills_target(ctx):
+    target = {"stale": 1}
+    assert ctx.normalize_into("user=bob port=22", target) is True
+    assert target["user"] == "bob"
+    assert "stale" not in target
+    assert ctx.normalize_into("user=eve", target) is True
+    assert target == ctx.normalize("user=eve")
+
+
+def test_same_result_as_normalize(ctx):
+    for line in ("user=bob port=22 src=x", "msg=hello", "user=a"):
+        target = {}
+        ctx.normalize_into(line, target, values="bytes")
+        assert target == ctx.normalize(line, values="bytes")
+
+
+def test_filter_rejection_empties_target(ctx):
+    target = {"stale": 1}
+    assert ctx.normalize_into("user=bob", target, filter='user == "eve"') is False
+    assert target == {}
+
+
+def test_empty_message(ctx):
+    target = {"stale": 1}
+    assert ctx.normalize_into("", target) is False
+    assert target == {}
+
+
+def test_reuse_nested(ln):
+    ctx = ln.Lognorm()
+    ctx.load_from_string("version=2\nrule=:data=%data:json%\n")
+    target = {}
+    ctx.normalize_into('data={"a":"1","b":{"c":"2"}}', target, reuse=True)
+    nested = target["data"]
+    ctx.normalize_into('data={"a":"3"}', target, reuse=True)
+    assert target["data"] is nested
+    assert nested == {"a": "3"}
+    # without reuse, a new nested dict is built
+    ctx.normalize_into('data={"a":"4"}', target)
+    assert target["data"] is not nested
+    assert target["data"] == {"a": "4"}
+
+
+def test_target_must_be_dict(ctx):
+    with pytest.raises(TypeError):
+        ctx.normalize_into("user=bob", [])
@@ -0,0 +1,59 @@
+import pytest
+
+
+def test_derived_literals(ctx):
+    assert set(ctx.prefilter()) == {"user=", "msg="}
+
+
+def test_rejects_lines_without_literal(ctx, ln):
+    ctx.prefilter()
+    assert ctx.normalize("user=bob")["user"] == "bob"
+    with pytest.raises(ln.PrefilterError) as info:
+        ctx.normalize("nothing to see")
+    assert isinstance(info.value, ln.ParserError)
+    assert ctx.counters()["prefiltered"] == 1
+
+
+def test_rule_miss_is_not_prefilter_error(ctx, ln):
+    ctx.prefilter(["no"])
+    try:
+        ctx.normalize("no rule matches this")
+    except ln.PrefilterError:
+        pytest.fail("a line with a literal reached the rulebase")
+    except ln.ParserError:
+        pass
+
+
+def test_explicit_literals_and_clear(ctx, ln):
+    assert ctx.prefilter(["msg="]) == ("msg=",)
+    with pytest.raises(ln.PrefilterError):
+        ctx.normalize("user=bob")
+    ctx.clear_prefilter()
+    assert ctx.normalize("user=bob")["user"] == "bob"
+
+
+def test_batch_apis_count_as_unmatched(ctx, ln, tmp_path):
+    ctx.prefilter(["user="])
+    agg = ln.Aggregator(ctx)
+    assert agg.feed_many("user=a\nmsg=b\n") == 1
+    assert agg.unmatched == 1
+    path = str(tmp_path / "app.log")
+    with open(path, "w") as f:
+        f.write("msg=b\nuser=a\n")
+    follower = ln.Follower(ctx, path, from_beginning=True)
+    events = [event for _, event in follower.read(timeout=0.2)]
+    assert events[0] is None and events[1]["user"] == "a"
+    follower.close()
+
+
+def test_rebuilt_when_rules_are_loaded(ctx):
+    ctx.prefilter()
+    ctx.load_from_string("version=2\nrule=:host=%host:word%\n")
+    assert ctx.normalize("host=gw")["host"] == "gw"
+
+
+def test_rule_without_literal(ctx, ln):
+    with pytest.raises(ValueError):
+        ctx.prefilter(min_length=10)
+    with pytest.raises(ValueError):
+        ctx.prefilter([])
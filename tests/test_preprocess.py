@@ -0,0 +1,39 @@
+def pre_ctx(ln, rules, **kwargs):
+    ctx = ln.Lognorm(**kwargs)
+    ctx.load_from_string(rules)
+    return ctx
+
+
+def test_unescape_control(ln, rules):
+    ctx = pre_ctx(ln, rules, unescape_control=True)
+    assert ctx.normalize("msg=a#011b#177c")["msg"] == "a\tb\x7fc"
+    # only control codes are decoded
+    assert ctx.normalize("msg=#065#999")["msg"] == "#065#999"
+
+
+def test_strip_ansi(ln, rules):
+    ctx = pre_ctx(ln, rules, strip_ansi=True)
+    assert ctx.normalize("msg=\x1b[1;31mred\x1b[0m\x1b[2K")["msg"] == "red"
+    # escaped sequences need unescape_control as well
+    assert ctx.normalize("msg=#033[32mgreen")["msg"] == "#033[32mgreen"
+
+
+def test_unescape_then_strip_ansi(ln, rules):
+    ctx = pre_ctx(ln, rules, unescape_control=True, strip_ansi=True)
+    assert ctx.normalize("msg=#033[31mred#033[0m#011x")["msg"] == "red\tx"
+
+
+def test_strip_pri(ln, rules):
+    ctx = pre_ctx(ln, rules, strip_pri=True)
+    assert ctx.normalize("<13>user=bob")["user"] == "bob"
+    assert ctx.normalize("msg=<13>")["msg"] == "<13>"
+
+
+def test_lstrip(ln, rules):
+    ctx = pre_ctx(ln, rules, lstrip=True, strip_pri=True)
+    assert ctx.normalize(" \t<13>user=bob")["user"] == "bob"
+
+
+def test_untouched_without_options(ln, rules):
+    ctx = pre_ctx(ln, rules)
+    assert ctx.normalize("msg=a#011b\x1b[0m")["msg"] == "a#011b\x1b[0m"
@@ -0,0 +1,58 @@
+import pytest
+
+
+@pytest.fixture
+def prof_ctx(ln, rules, tmp_path):
+    path = tmp_path / "rules.rb"
+    path.write_text(rules)
+    ctx = ln.Lognorm(add_rule_location=True)
+    ctx.load(str(path))
+    return ctx
+
+
+def test_requires_rule_location(ctx):
+    with pytest.raises(ValueError):
+        ctx.profile()
+    with pytest.raises(ValueError):
+        ctx.profile_rulebase(["user=bob"])
+
+
+def test_profile_rulebase(prof_ctx):
+    report = prof_ctx.profile_rulebase(["user=bob", "msg=hi", "?? none"], repeat=3)
+    assert sum(entry["count"] for entry in report) == 9
+    unattributed = [entry for entry in report if entry["origin"] is None]
+    assert len(unattributed) == 1
+    assert unattributed[0]["line"] is None
+    assert unattributed[0]["count"] == 3
+    for entry in report:
+        assert entry["max"] <= entry["seconds"]
+        assert entry["mean"] == pytest.approx(entry["seconds"] / entry["count"])
+        if entry["origin"] is not None:
+            assert isinstance(entry["line"], int)
+    seconds = [entry["seconds"] for entry in report]
+    assert seconds == sorted(seconds, reverse=True)
+
+
+def test_profile_rulebase_skips_undecodable_lines(prof_ctx):
+    report = prof_ctx.profile_rulebase([b"msg=\xff", b"user=bob"])
+    assert sum(entry["count"] for entry in report) == 1
+
+
+def test_profile_live_traffic(prof_ctx, ln):
+    prof_ctx.profile()
+    prof_ctx.normalize("user=bob")
+    ln.Aggregator(prof_ctx).feed_many("user=a\nmsg=b\n")
+    prof_ctx.profile(False)
+    prof_ctx.normalize("user=eve")
+    report = prof_ctx.profile_report()
+    assert sum(entry["count"] for entry in report) == 3
+    assert len(prof_ctx.profile_report(1)) == 1
+    prof_ctx.profile_report(reset=True)
+    assert prof_ctx.profile_report() == []
+
+
+def test_invalid(prof_ctx):
+    with pytest.raises(ValueError):
+        prof_ctx.profile_rulebase(["user=bob"], repeat=0)
+    with pytest.raises(ValueError):
+        prof_ctx.profile_report(-1)
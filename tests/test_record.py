@@ -0,0 +1,49 @@
+import pytest
+
+
+def test_derived_type(ctx):
+    Event = ctx.record_type()
+    assert Event._fields == ("user", "port", "src", "msg")
+    rec = ctx.normalize_record("user=bob port=22")
+    assert isinstance(rec, Event)
+    assert rec.user == "bob"
+    assert str(rec.port) == "22"
+    assert rec.src is None
+    assert rec[0] == "bob"
+    assert len(rec) == 4
+
+
+def test_derived_on_first_use(ctx):
+    rec = ctx.normalize_record("msg=hi")
+    assert rec.msg == "hi"
+    assert rec.user is None
+
+
+def test_explicit_fields(ctx):
+    Event = ctx.record_type(["msg", "user"])
+    assert Event._fields == ("msg", "user")
+    rec = ctx.normalize_record("user=bob port=22")
+    # fields without a slot are dropped
+    assert tuple(rec) == (None, "bob")
+
+
+def test_values_and_filter(ctx):
+    ctx.record_type(["user"])
+    assert ctx.normalize_record("user=bob", values="bytes").user == b"bob"
+    assert ctx.normalize_record("user=bob", filter='user == "eve"') is None
+    assert ctx.normalize_record("") is None
+
+
+def test_rederived_after_loading(ctx):
+    ctx.normalize_record("user=bob")
+    ctx.load_from_string("version=2\nrule=:host=%host:word%\n")
+    assert ctx.normalize_record("host=gw").host == "gw"
+
+
+def test_invalid_fields(ctx, ln):
+    with pytest.raises(ValueError):
+        ctx.record_type([])
+    with pytest.raises(ValueError):
+        ctx.record_type(["user", "user"])
+    with pytest.raises(ValueError):
+        ln.Lognorm().normalize_record("user=bob")
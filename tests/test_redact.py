@@ -0,0 +1,100 @@
+import struct
+
+import pytest
+
+
+KEY = bytes(range(16))
+
+
+def siphash24(key, data):
+    mask = 0xffffffffffffffff
+
+    def rotl(x, b):
+        return ((x << b) | (x >> (64 - b))) & mask
+
+    def sipround(v0, v1, v2, v3):
+        v0 = (v0 + v1) & mask; v1 = rotl(v1, 13) ^ v0; v0 = rotl(v0, 32)
+        v2 = (v2 + v3) & mask; v3 = rotl(v3, 16) ^ v2
+        v0 = (v0 + v3) & mask; v3 = rotl(v3, 21) ^ v0
+        v2 = (v2 + v1) & mask; v1 = rotl(v1, 17) ^ v2; v2 = rotl(v2, 32)
+        return v0, v1, v2, v3
+
+    k0, k1 = struct.unpack("<QQ", key)
+    v = [0x736f6d6570736575 ^ k0, 0x646f72616e646f6d ^ k1,
+         0x6c7967656e657261 ^ k0, 0x7465646279746573 ^ k1]
+    tail = len(data) % 8
+    blocks = [struct.unpack_from("<Q", data, i)[0] for i in range(0, len(data) - tail, 8)]
+    blocks.append((len(data) & 0xff) << 56 | int.from_bytes(data[len(data) - tail:], "little"))
+    for m in blocks:
+        v[3] ^= m
+        v = list(sipround(*sipround(*v)))
+        v[0] ^= m
+    v[2] ^= 0xff
+    for _ in range(4):
+        v = list(sipround(*v))
+    return v[0] ^ v[1] ^ v[2] ^ v[3]
+
+
+def test_reference_vector():
+    assert siphash24(KEY, b"") == 0x726fdb47dd0e0e31
+    assert siphash24(KEY, bytes(range(15))) == 0xa129ca6149be45e5
+
+
+def test_hash(ctx):
+    ctx.redact("user", "hash", key=KEY)
+    event = ctx.normalize("user=bob port=22")
+    assert event["user"] == "%016x" % siphash24(KEY, b"bob")
+    assert ctx.normalize("user=bob")["user"] == event["user"]
+    assert str(event["port"]) == "22"
+
+
+def test_hash_numbers_from_decimal_text(ctx):
+    ctx.redact("port", "hash", key=KEY)
+    assert ctx.normalize("user=bob port=22")["port"] == "%016x" % siphash24(KEY, b"22")
+
+
+def test_truncate(ln, rules):
+    ctx = ln.Lognorm()
+    ctx.load_from_string(rules)
+    ctx.redact("src", "truncate", v4_prefix=16, v6_prefix=32)
+    assert ctx.normalize("user=a port=1 src=10.1.2.3")["src"] == "10.1.0.0"
+    assert ctx.normalize("user=a port=1 src=2001:db8:1:2::5")["src"] == "2001:db8::"
+    assert ctx.normalize("user=a port=1 src=::ffff:10.1.2.3")["src"] == "::ffff:10.1.0.0"
+    assert ctx.normalize("user=a port=1 src=host")["src"] is None
+
+
+@pytest.mark.parametrize("options, value, expected", [
+    ({}, "secret", "******"),
+    ({"keep_end": 4}, "4111111111111111", "************1111"),
+    ({"keep_start": 1, "keep_after": "@"}, "alice@example.com", "a****@example.com"),
+    ({"keep_start": 2, "keep_end": 2}, "abc", "***"),
+    ({"keep_start": 1, "mask": "#"}, "émile", "é####"),
+])
+def test_mask(ctx, options, value, expected):
+    ctx.redact("msg", "mask", **options)
+    assert ctx.normalize("msg=" + value)["msg"] == expected
+
+
+def test_redaction_runs_before_filters(ctx):
+    ctx.redact("user", "mask")
+    assert ctx.normalize("user=bob", filter='user == "bob"') is None
+    assert ctx.normalize("user=bob", filter='user == "***"') is not None
+
+
+def test_rules_apply_in_order(ctx):
+    ctx.redact("user", "mask", keep_start=1)
+    ctx.redact("user", "hash", key=KEY)
+    assert ctx.normalize("user=bob")["user"] == "%016x" % siphash24(KEY, b"b**")
+
+
+def test_invalid(ctx):
+    with pytest.raises(ValueError):
+        ctx.redact("user", "hash")
+    with pytest.raises(ValueError):
+        ctx.redact("user", "hash", key=b"short")
+    with pytest.raises(ValueError):
+        ctx.redact("src", "truncate", v4_prefix=33)
+    with pytest.raises(ValueError):
+        ctx.redact("user", "mask", keep_start=-1)
+    with pytest.raises(ValueError):
+        ctx.redact("user", "shred")
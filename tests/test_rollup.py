@@ -0,0 +1,68 @@
+import pytest
+
+
+@pytest.fixture
+def timed_ctx(ln):
+    ctx = ln.Lognorm()
+    ctx.load_from_string("version=2\n"
+                         "rule=:ts=%ts:word% user=%user:word% bytes=%bytes:number%\n"
+                         "rule=:ts=%ts:word% user=%user:word%\n"
+                         "rule=:user=%user:word%\n")
+    return ctx
+
+
+def test_windows_and_watermark(timed_ctx, ln):
+    rollup = ln.Rollup(timed_ctx, "ts", 60, ["user"], sum=["bytes"])
+    assert rollup.watermark is None
+    assert rollup.feed("ts=1714564800 user=bob bytes=10") is True
+    assert rollup.feed("ts=1714564830 user=bob bytes=5") is True
+    assert rollup.feed("ts=1714564845 user=eve") is True
+    assert rollup.watermark == 1714564845
+    assert rollup.expire() == []
+    # the next window's first event closes the previous window
+    rollup.feed("ts=1714564870 user=bob")
+    rows = sorted(rollup.expire(), key=lambda row: row["user"])
+    assert rows == [
+        {"user": "bob", "count": 2, "bytes_sum": 15, "window": 1714564800.0},
+        {"user": "eve", "count": 1, "bytes_sum": 0, "window": 1714564800.0},
+    ]
+    assert len(rollup) == 1
+    assert [row["window"] for row in rollup.flush()] == [1714564860.0]
+
+
+def test_timestamp_formats(timed_ctx, ln):
+    rollup = ln.Rollup(timed_ctx, "ts", 3600)
+    assert rollup.feed("ts=2024-05-01T12:00:00Z user=a") is True
+    assert rollup.feed("ts=2024-05-01T14:59:59+02:00 user=b") is True
+    assert rollup.feed("ts=2024-05-01T12:30:00.5 user=c") is True
+    assert rollup.flush() == [{"count": 3, "window": 1714564800.0}]
+
+
+def test_lateness_and_late_events(timed_ctx, ln):
+    rollup = ln.Rollup(timed_ctx, "ts", 60, lateness=30)
+    rollup.feed("ts=1714564850 user=a")
+    rollup.feed("ts=1714564885 user=a")
+    # the watermark (1714564855) has not passed the first window yet
+    assert rollup.expire() == []
+    assert rollup.feed("ts=1714564810 user=a") is True
+    rollup.feed("ts=1714564895 user=a")
+    assert rollup.expire() == [{"count": 2, "window": 1714564800.0}]
+    assert rollup.feed("ts=1714564820 user=a") is False
+    assert rollup.late == 1
+
+
+def test_untimed(timed_ctx, ln):
+    rollup = ln.Rollup(timed_ctx, "ts", 60)
+    assert rollup.feed("user=bob") is False
+    assert rollup.feed("ts=never user=bob") is False
+    assert rollup.untimed == 2
+    assert rollup.flush() == []
+
+
+def test_invalid(timed_ctx, ln):
+    with pytest.raises(ValueError):
+        ln.Rollup(timed_ctx, "ts", 0)
+    with pytest.raises(ValueError):
+        ln.Rollup(timed_ctx, "ts", 60, lateness=-1)
+    with pytest.raises(ValueError):
+        ln.Rollup(timed_ctx, "", 60)
@@ -0,0 +1,74 @@
+import time
+
+import pytest
+
+
+def test_captures_every_line_over_threshold(ctx, ln):
+    ctx.slowlog(0.0)
+    before = time.time()
+    ctx.normalize("user=bob")
+    ctx.normalize_into("msg=hi", {})
+    with pytest.raises(ln.ParserError):
+        ctx.normalize("?? none")
+    entries, overwritten = ctx.drain_slowlog()
+    assert overwritten == 0
+    assert [entry["line"] for entry in entries] == ["user=bob", "msg=hi", "?? none"]
+    for entry in entries:
+        assert entry["length"] == len(entry["line"])
+        assert entry["time"] >= before - 1
+        assert entry["total"] >= entry["parse"] >= 0
+        assert entry["convert"] >= 0
+        assert entry["rule"] is None
+    assert ctx.drain_slowlog() == ([], 0)
+
+
+def test_threshold(ctx):
+    ctx.slowlog(60.0)
+    ctx.normalize("user=bob")
+    assert ctx.drain_slowlog() == ([], 0)
+
+
+def test_capacity_and_max_bytes(ctx):
+    ctx.slowlog(0.0, capacity=2, max_bytes=6)
+    for user in ("a", "b", "c"):
+        ctx.normalize("user=" + user)
+    entries, overwritten = ctx.drain_slowlog()
+    assert overwritten == 1
+    assert [entry["line"] for entry in entries] == ["user=b", "user=c"]
+    ctx.normalize("msg=" + "x" * 20)
+    entry = ctx.drain_slowlog()[0][0]
+    assert entry["line"] == "msg=xx"
+    assert entry["length"] == 24
+
+
+def test_batch_apis(ctx, ln):
+    ctx.slowlog(0.0)
+    ln.Aggregator(ctx).feed_many("user=a\nuser=b\n")
+    joiner = ln.Multiline(ctx, start="msg=")
+    joiner.feed("msg=x\ny\n")
+    joiner.flush()
+    lines = [entry["line"] for entry in ctx.drain_slowlog()[0]]
+    assert lines == ["user=a", "user=b", "msg=x\ny"]
+
+
+def test_rule_location(ln, rules, tmp_path):
+    path = tmp_path / "rules.rb"
+    path.write_text(rules)
+    ctx = ln.Lognorm(add_rule_location=True)
+    ctx.load(str(path))
+    ctx.slowlog(0.0)
+    ctx.normalize("user=bob")
+    rule = ctx.drain_slowlog()[0][0]["rule"]
+    assert rule.rsplit(":", 1)[1].isdigit()
+
+
+def test_off_and_invalid(ctx):
+    ctx.slowlog(0.0)
+    ctx.normalize("user=bob")
+    ctx.slowlog(None)
+    ctx.normalize("user=bob")
+    assert ctx.drain_slowlog() == ([], 0)
+    with pytest.raises(ValueError):
+        ctx.slowlog(-1.0)
+    with pytest.raises(ValueError):
+        ctx.slowlog(0.0, capacity=0)
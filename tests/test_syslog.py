@@ -0,0 +1,60 @@
+import pytest
+
+
+@pytest.fixture
+def syslog_ctx(ln, rules):
+    ctx = ln.Lognorm(syslog_header=True)
+    ctx.load_from_string(rules)
+    return ctx
+
+
+def test_rfc3164(syslog_ctx):
+    event = syslog_ctx.normalize("<38>Oct 11 22:14:15 gw sshd[812]: user=bob")
+    assert event["user"] == "bob"
+    assert event["pri"] == 38
+    assert event["facility"] == 4
+    assert event["severity"] == 6
+    assert event["timestamp"] == "Oct 11 22:14:15"
+    assert event["hostname"] == "gw"
+    assert event["app_name"] == "sshd"
+    assert event["procid"] == "812"
+
+
+def test_rfc5424(syslog_ctx):
+    event = syslog_ctx.normalize(
+        '<165>1 2024-05-01T12:00:00.5Z web01 nginx 99 ID47 '
+        '[origin ip="10.0.0.1"] user=eve')
+    assert event["user"] == "eve"
+    assert event["version"] == 1
+    assert event["timestamp"] == "2024-05-01T12:00:00.5Z"
+    assert event["hostname"] == "web01"
+    assert event["app_name"] == "nginx"
+    assert event["procid"] == "99"
+    assert event["msgid"] == "ID47"
+    assert "origin" in str(event["structured_data"])
+
+
+def test_rfc5424_nil_values(syslog_ctx):
+    event = syslog_ctx.normalize("<14>1 - - - - - - user=ann")
+    assert event["user"] == "ann"
+    for field in ("hostname", "app_name", "procid", "msgid", "structured_data"):
+        assert field not in event
+
+
+def test_octet_counted_framing(syslog_ctx):
+    message = "<38>Oct 11 22:14:15 gw sshd: user=bob"
+    event = syslog_ctx.normalize("%d %s" % (len(message), message))
+    assert event["user"] == "bob"
+    assert event["hostname"] == "gw"
+
+
+def test_rulebase_fields_win(ln):
+    ctx = ln.Lognorm(syslog_header=True)
+    ctx.load_from_string("version=2\nrule=:hostname=%hostname:word%\n")
+    assert ctx.normalize("<38>Oct 11 22:14:15 gw app: hostname=real")["hostname"] == "real"
+
+
+def test_plain_message_unchanged(syslog_ctx):
+    event = syslog_ctx.normalize("user=bob")
+    assert event["user"] == "bob"
+    assert "pri" not in event
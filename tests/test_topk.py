@@ -0,0 +1,84 @@
+import random
+
+import pytest
+
+
+def test_topk_exact_below_capacity(ln):
+    topk = ln.TopK(3, capacity=10)
+    for value, count in (("a", 5), ("b", 3), ("c", 8), ("d", 1)):
+        topk.add(value, count)
+    assert topk.top() == [("c", 8, 0), ("a", 5, 0), ("b", 3, 0)]
+    assert topk.total == 17
+    assert len(topk) == 4
+
+
+def test_topk_error_bounds(ln):
+    rng = random.Random(1)
+    capacity = 20
+    topk = ln.TopK(5, capacity=capacity)
+    truth = {}
+    # a few heavy hitters in a long tail of rare values
+    stream = ["heavy%d" % (i % 4) for i in range(4000)]
+    stream += ["rare%d" % rng.randrange(2000) for _ in range(6000)]
+    rng.shuffle(stream)
+    for value in stream:
+        topk.add(value)
+        truth[value] = truth.get(value, 0) + 1
+
+    total = len(stream)
+    assert topk.total == total
+    assert len(topk) == capacity
+    reported = topk.top(capacity)
+    for value, count, error in reported:
+        assert count - error <= truth[value] <= count
+        assert error <= total // capacity
+    # every value above total / capacity is tracked
+    tracked = {value for value, _, _ in reported}
+    for value, n in truth.items():
+        if n > total / capacity:
+            assert value in tracked
+    assert sorted(v for v, _, _ in topk.top(4)) == ["heavy0", "heavy1", "heavy2", "heavy3"]
+
+
+def test_topk_attach(ln, ctx):
+    topk = ln.TopK(2)
+    ctx.attach(topk, "user")
+    for user in ("bob", "bob", "eve", "bob", "ann", "eve"):
+        ctx.normalize("user=" + user)
+    assert [value for value, _, _ in topk.top()] == ["bob", "eve"]
+    assert topk.dropped == 0
+
+
+def test_attach_uninitialized(ln, ctx):
+    with pytest.raises(ValueError):
+        ctx.attach(ln.TopK.__new__(ln.TopK), "user")
+
+
+def test_topk_detach_and_clear(ln, ctx):
+    topk = ln.TopK(2)
+    ctx.attach(topk, "user")
+    ctx.normalize("user=bob")
+    assert ctx.detach(topk) is True
+    assert ctx.detach(topk) is False
+    ctx.normalize("user=bob")
+    assert topk.top() == [("bob", 1, 0)]
+    topk.clear()
+    assert topk.top() == []
+    assert topk.total == 0
+
+
+def test_topk_filtered_events_not_counted(ln, rules):
+    ctx = ln.Lognorm(filter='user != "eve"')
+    ctx.load_from_string(rules)
+    topk = ln.TopK(2)
+    ctx.attach(topk, "user")
+    ctx.normalize("user=eve")
+    ctx.normalize("user=bob")
+    assert [value for value, _, _ in topk.top()] == ["bob"]
+
+
+def test_topk_invalid(ln):
+    with pytest.raises(ValueError):
+        ln.TopK(0)
+    with pytest.raises(ValueError):
+        ln.TopK(5, capacity=4)
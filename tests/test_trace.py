@@ -0,0 +1,55 @@
+import pytest
+
+
+def test_sampling(ctx):
+    ctx.trace(2)
+    for user in ("a", "b", "c", "d"):
+        assert ctx.normalize("user=" + user)["user"] == user
+    traces = ctx.drain_traces()
+    assert [trace["line"] for trace in traces] == ["user=b", "user=d"]
+    for trace in traces:
+        assert trace["reason"] == "sampled"
+        assert trace["result"] == 0
+        assert trace["seconds"] >= 0
+        assert isinstance(trace["trace"], tuple) and trace["trace"]
+        assert all(isinstance(step, str) for step in trace["trace"])
+        assert trace["truncated"] is False
+    assert ctx.drain_traces() == []
+
+
+def test_unmatched_line(ctx, ln):
+    ctx.trace(1)
+    with pytest.raises(ln.ParserError):
+        ctx.normalize("?? none")
+    trace = ctx.drain_traces()[0]
+    assert trace["line"] == "?? none"
+    assert trace["result"] != 0
+
+
+def test_slow(ctx):
+    ctx.trace(slow=1e-9)
+    assert ctx.normalize("user=bob")["user"] == "bob"
+    trace = ctx.drain_traces()[0]
+    assert trace["reason"] == "slow"
+    assert trace["line"] == "user=bob"
+    assert trace["seconds"] > 0
+
+
+def test_capacity_and_max_bytes(ctx):
+    ctx.trace(1, capacity=2, max_bytes=1)
+    for user in ("a", "b", "c"):
+        ctx.normalize("user=" + user)
+    traces = ctx.drain_traces()
+    assert [trace["line"] for trace in traces] == ["user=b", "user=c"]
+    assert all(trace["truncated"] and trace["trace"] == () for trace in traces)
+
+
+def test_off_and_invalid(ctx):
+    ctx.trace(1)
+    ctx.trace()
+    ctx.normalize("user=bob")
+    assert ctx.drain_traces() == []
+    for kwargs in ({"every": -1}, {"slow": 0}, {"every": 1, "capacity": 0},
+                   {"every": 1, "max_bytes": 0}):
+        with pytest.raises(ValueError):
+            ctx.trace(**kwargs)